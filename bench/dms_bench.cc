@@ -0,0 +1,1340 @@
+// dms-bench: benchmark suite for the hot paths of the client.
+//
+// Measures:
+//   - single-large-file copy throughput per I/O backend, and the cost of
+//     the chunk journal;
+//   - the many-small-files copy rate with and without packing, and the
+//     directory walker's scan rate;
+//   - checksum kernel speed;
+//   - an incremental sync against a full copy;
+//   - job submission to a mock DMS server, pipelined against one blocking
+//     request at a time;
+//   - the CPU cost per GiB of each way of pushing file data to a loopback
+//     data mover, and how far an adaptive striped push gets over a path
+//     that caps every stream;
+//   - the cost of a rate-limiter check for an unthrottled and a throttled
+//     job, and how closely a throttled copy holds its tenant's limit;
+//   - where the adaptive concurrency controller settles on a simulated
+//     file system with a known knee, and how far it backs off when that
+//     file system loses capacity;
+//   - a half-compressible push over a capped stream, uncompressed and per
+//     codec;
+//   - the content-defined chunker's scan rate and chunk fingerprinting,
+//     and a deduplicating push of a file the mover already holds, as is
+//     and after a few small edits, against the first push of it;
+//   - chunk descriptors handed between many producer and consumer threads
+//     through the mutex-and-condition-variable queue and the lock-free
+//     one, item by item and in batches;
+//   - memcpy into buffers on the local and on a remote NUMA node, and the
+//     large file copied under each NUMA policy;
+//   - taking and filling a chunk buffer from the transfer-buffer arena
+//     against allocating, filling and freeing one per chunk;
+//   - setting mode and mtime on the small-file tree one path at a time
+//     against the batched metadata pool;
+//   - copying a mostly empty sparse image with holes kept and inflated;
+//   - the large file copied through the workers' buffers, by
+//     copy_file_range() and by reflink, where the file system allows;
+//   - the memory per suspended coroutine and the rate at which the reactor
+//     spawns and finishes a million of them, and the small-file tree
+//     copied in packs against one coroutine per file;
+//   - the cost of a scheduler grant with 10 and with 10,000 jobs waiting,
+//     and how long an urgent copy takes beside a bulk one, unscheduled
+//     and scheduled, against running alone.
+// Results are printed as they come and written to bench_output.txt as
+// tab-separated "name value unit" lines, so runs can be diffed to catch
+// regressions.
+//
+// With --check, exits non-zero when the journal measurably costs more
+// than --max-journal-overhead; timings on a shared machine are too noisy
+// for that to be the default.
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <deque>
+#include <filesystem>
+#include <functional>
+#include <future>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "dms/arena.h"
+#include "dms/blocking_queue.h"
+#include "dms/checksum.h"
+#include "dms/compress.h"
+#include "dms/concurrency.h"
+#include "dms/copy_engine.h"
+#include "dms/data_stream.h"
+#include "dms/dedup.h"
+#include "dms/error.h"
+#include "dms/file.h"
+#include "dms/io_backend.h"
+#include "dms/job_client.h"
+#include "dms/journal.h"
+#include "dms/metadata.h"
+#include "dms/mock_server.h"
+#include "dms/mover.h"
+#include "dms/mpmc_queue.h"
+#include "dms/numa.h"
+#include "dms/rate_limit.h"
+#include "dms/reactor.h"
+#include "dms/scanner.h"
+#include "dms/scheduler.h"
+#include "dms/units.h"
+
+namespace fs = std::filesystem;
+
+namespace {
+
+struct Config {
+  std::string dir;
+  std::string output = "bench_output.txt";
+  std::uint64_t large_size = 1 * dms::GiB;
+  std::size_t chunk_size = 1 * dms::MiB;
+  unsigned small_files = 20000;
+  std::uint64_t small_size = 4 * dms::KiB;
+  int runs = 3;
+  unsigned jobs = 100000;
+  std::chrono::microseconds rpc_latency{200};
+  std::uint64_t stream_rate = 100 * dms::MiB;
+  std::uint64_t throttle_rate = 200 * dms::MiB;
+  unsigned queue_threads = 64;
+  std::size_t tasks = 1000000;
+  std::size_t scheduled_jobs = 10000;
+  double max_journal_overhead = 2.0;
+  bool check = false;
+  std::vector<std::string> only;
+};
+
+class Report {
+ public:
+  void add(const std::string& name, double value, const char* unit) {
+    char buf[64];
+    std::snprintf(buf, sizeof(buf), "%.3f", value);
+    lines_.push_back(name + "\t" + buf + "\t" + unit);
+    std::printf("  %-36s %14s %s\n", name.c_str(), buf, unit);
+    std::fflush(stdout);
+  }
+
+  void add(const std::string& name, const std::string& value) {
+    lines_.push_back(name + "\t" + value + "\t-");
+    std::printf("  %-36s %14s\n", name.c_str(), value.c_str());
+  }
+
+  bool write(const std::string& path, const std::string& header) const {
+    std::FILE* f = std::fopen(path.c_str(), "w");
+    if (!f) return false;
+    std::fprintf(f, "# %s\n", header.c_str());
+    for (const auto& line : lines_) std::fprintf(f, "%s\n", line.c_str());
+    return std::fclose(f) == 0;
+  }
+
+ private:
+  std::vector<std::string> lines_;
+};
+
+double now() {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+// Fills `buf` from a fixed LCG so data is incompressible and reproducible.
+void fill(char* buf, std::size_t n, std::uint64_t& state) {
+  for (std::size_t i = 0; i + 8 <= n; i += 8) {
+    state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+    std::memcpy(buf + i, &state, 8);
+  }
+}
+
+void write_file(const std::string& path, std::uint64_t size, std::uint64_t seed) {
+  dms::UniqueFd fd = dms::open_or_throw(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  std::vector<char> block(dms::MiB);
+  for (std::uint64_t off = 0; off < size; off += block.size()) {
+    fill(block.data(), block.size(), seed);
+    const auto n = static_cast<std::size_t>(std::min<std::uint64_t>(block.size(), size - off));
+    dms::pwrite_full(fd.get(), block.data(), n, static_cast<off_t>(off));
+  }
+}
+
+// Appends `size` bytes of log-like text (numbered lines of LCG values),
+// which compresses about 3x.
+void append_text(const std::string& path, std::uint64_t size, std::uint64_t seed) {
+  std::FILE* f = std::fopen(path.c_str(), "a");
+  if (!f) dms::throw_errno("fopen " + path);
+  std::uint64_t written = 0;
+  for (std::uint64_t line = 0; written < size; ++line) {
+    seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+    written += static_cast<std::uint64_t>(std::fprintf(
+        f, "%012llu level=%u value=%llu\n", static_cast<unsigned long long>(line),
+        static_cast<unsigned>(seed >> 62), static_cast<unsigned long long>(seed >> 44)));
+  }
+  std::fclose(f);
+}
+
+// Spreads `files` files of `size` bytes over 100 directories.
+void make_small_tree(const std::string& root, unsigned files, std::uint64_t size) {
+  std::vector<char> data(size);
+  std::uint64_t seed = 1;
+  for (unsigned i = 0; i < files; ++i) {
+    const std::string dir = root + "/d" + std::to_string(i % 100);
+    if (i < 100) fs::create_directories(dir);
+    fill(data.data(), data.size(), seed);
+    dms::UniqueFd fd =
+        dms::open_or_throw(dir + "/f" + std::to_string(i), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    dms::pwrite_full(fd.get(), data.data(), data.size(), 0);
+  }
+}
+
+// Runs `job` after flushing earlier writeback, returning wall seconds.
+double timed(const std::function<dms::JobStats()>& job) {
+  ::sync();
+  const double start = now();
+  dms::JobStats stats = job();
+  const double seconds = now() - start;
+  if (stats.failed_files != 0) {
+    std::fprintf(stderr, "benchmark job failed: %s\n",
+                 stats.errors.empty() ? "?" : stats.errors.front().c_str());
+    std::exit(1);
+  }
+  return seconds;
+}
+
+bool selected(const Config& config, const char* name) {
+  return config.only.empty() ||
+         std::find(config.only.begin(), config.only.end(), name) != config.only.end();
+}
+
+void bench_large(const Config& config, Report& report) {
+  const std::string src = config.dir + "/large.src";
+  const std::string dst = config.dir + "/large.dst";
+  write_file(src, config.large_size, 42);
+  std::vector<dms::IoBackendKind> backends = {dms::IoBackendKind::kPsync};
+  if (dms::uring_available()) backends.insert(backends.begin(), dms::IoBackendKind::kUring);
+  for (dms::IoBackendKind kind : backends) {
+    dms::CopyOptions options;
+    options.chunk_size = config.chunk_size;
+    options.io_backend = kind;
+    double best = 1e30;
+    for (int r = 0; r < config.runs; ++r) {
+      fs::remove(dst);
+      best = std::min(best, timed([&] {
+        return dms::CopyEngine(options).copy_files({{src, dst}});
+      }));
+    }
+    report.add(std::string("large_file.") + dms::to_string(kind) + ".throughput",
+               static_cast<double>(config.large_size) / best / dms::MiB, "MiB/s");
+  }
+  fs::remove(src);
+  fs::remove(dst);
+}
+
+// Returns false if the journal measurably costs more than the limit.
+bool bench_journal(const Config& config, Report& report) {
+  const std::string src = config.dir + "/journal.src";
+  const std::string dst = config.dir + "/journal.dst";
+  const std::string journal = config.dir + "/journal.log";
+  write_file(src, config.large_size, 43);
+  dms::CopyOptions plain;
+  plain.chunk_size = config.chunk_size;
+  dms::CopyOptions journaled = plain;
+  journaled.journal = journal;
+  auto copy = [&](const dms::CopyOptions& options) {
+    fs::remove(dst);
+    fs::remove(journal);
+    return timed([&] { return dms::CopyEngine(options).copy_files({{src, dst}}); });
+  };
+  // Every round times a journaled copy and two plain ones, with the
+  // journaled one first, second and last in turn, so drift in the page
+  // cache or device hits both modes alike. Copies are timed around the
+  // whole job, so opening and syncing the journal count. Each of the three
+  // keeps its best time. The overhead is the journaled copy's against the
+  // mean of the plain ones; the noise, the difference between the two
+  // plain ones, is how small an overhead the run can tell apart at all.
+  const int rounds = std::max(config.runs, 9);
+  double best_journal = 1e30, best_first = 1e30, best_second = 1e30;
+  for (int r = 0; r < rounds; ++r) {
+    double times[3];
+    for (int i = 0; i < 3; ++i) times[i] = copy(i == r % 3 ? journaled : plain);
+    best_journal = std::min(best_journal, times[r % 3]);
+    best_first = std::min(best_first, times[r % 3 == 0 ? 1 : 0]);
+    best_second = std::min(best_second, times[r % 3 == 2 ? 1 : 2]);
+  }
+  const double best_plain = (best_first + best_second) / 2;
+  // The journal's share of the workers' time, measured without the copy's
+  // noise: opening it, one record per chunk and the final sync, as the
+  // journaled copy does them.
+  const std::uint64_t chunks = (config.large_size + config.chunk_size - 1) / config.chunk_size;
+  double alone = 1e30;
+  for (int r = 0; r < rounds; ++r) {
+    fs::remove(journal);
+    ::sync();
+    const double start = now();
+    {
+      dms::Journal::Options options;
+      options.durable = journaled.journal_sync_data;
+      dms::Journal j(journal, options);
+      for (std::uint64_t i = 0; i < chunks; ++i) {
+        j.record(1, i * config.chunk_size, static_cast<std::uint32_t>(config.chunk_size));
+      }
+      j.sync();
+    }
+    alone = std::min(alone, now() - start);
+  }
+  const double overhead = (best_journal / best_plain - 1.0) * 100.0;
+  const double noise = std::abs(best_second - best_first) / best_plain * 100.0;
+  const double critical_path = alone / best_plain * 100.0;
+  report.add("journal.overhead", overhead, "%");
+  report.add("journal.noise", noise, "%");
+  report.add("journal.critical_path", critical_path, "%");
+  report.add("journal.overhead_limit", config.max_journal_overhead, "%");
+  fs::remove(src);
+  fs::remove(dst);
+  fs::remove(journal);
+  // An end-to-end overhead within the noise says nothing either way.
+  return critical_path <= config.max_journal_overhead &&
+         (overhead <= config.max_journal_overhead || overhead <= noise);
+}
+
+void bench_small(const Config& config, Report& report) {
+  const std::string src = config.dir + "/small.src";
+  const std::string dst = config.dir + "/small.dst";
+  make_small_tree(src, config.small_files, config.small_size);
+  for (bool packed : {true, false}) {
+    dms::CopyOptions options;
+    if (!packed) options.small_file_max = 0;
+    double best = 1e30;
+    for (int r = 0; r < config.runs; ++r) {
+      fs::remove_all(dst);
+      best = std::min(best, timed([&] { return dms::CopyEngine(options).copy_tree(src, dst); }));
+    }
+    report.add(std::string("small_files.") + (packed ? "packed" : "unpacked") + ".rate",
+               config.small_files / best, "files/s");
+  }
+
+  double best = 1e30;
+  std::uint64_t entries = 0;
+  for (int r = 0; r < config.runs; ++r) {
+    dms::Scanner scanner;
+    dms::ScanStats stats = scanner.scan(src, [](std::vector<dms::ScanEntry>&&) {});
+    best = std::min(best, stats.seconds);
+    entries = stats.dirs + stats.files + stats.others;
+  }
+  report.add("scan.rate", static_cast<double>(entries) / best, "entries/s");
+  fs::remove_all(src);
+  fs::remove_all(dst);
+}
+
+void bench_checksum(const Config& config, Report& report) {
+  // A chunk-sized buffer that stays in cache, hashed repeatedly: this
+  // measures the kernels, not the memory system.
+  std::vector<char> buf(config.chunk_size);
+  std::uint64_t seed = 7;
+  fill(buf.data(), buf.size(), seed);
+  const std::uint64_t total = 2 * dms::GiB;
+  for (dms::ChecksumKind kind : {dms::ChecksumKind::kCrc32c, dms::ChecksumKind::kXxh3}) {
+    double best = 1e30;
+    std::uint64_t sink = 0;
+    for (int r = 0; r < config.runs; ++r) {
+      const double start = now();
+      for (std::uint64_t done = 0; done < total; done += buf.size()) {
+        sink ^= dms::chunk_digest(kind, buf.data(), buf.size());
+      }
+      best = std::min(best, now() - start);
+    }
+    if (sink == 1) std::printf(" ");  // keeps the loop from being elided
+    report.add(std::string("checksum.") + dms::to_string(kind), total / best / 1e9, "GB/s");
+  }
+  report.add("checksum.crc32c.kernel", dms::crc32c_implementation());
+  report.add("checksum.xxh3.kernel", dms::xxh3_implementation());
+}
+
+// A full copy of a mixed tree against a sync after about 1% of it changed.
+void bench_sync(const Config& config, Report& report) {
+  const std::string src = config.dir + "/sync.src";
+  const std::string dst = config.dir + "/sync.dst";
+  make_small_tree(src, config.small_files, config.small_size);
+  write_file(src + "/large", config.large_size / 4, 44);
+  dms::CopyOptions options;
+  options.chunk_size = config.chunk_size;
+  double full = 1e30;
+  for (int r = 0; r < config.runs; ++r) {
+    fs::remove_all(dst);
+    full = std::min(full, timed([&] { return dms::CopyEngine(options).copy_tree(src, dst); }));
+  }
+
+  // Rewrite 1% of the small files and one chunk of the large file.
+  std::vector<char> patch(config.small_size, 'x');
+  for (unsigned i = 0; i < config.small_files; i += 100) {
+    const std::string path = src + "/d" + std::to_string(i % 100) + "/f" + std::to_string(i);
+    dms::UniqueFd fd = dms::open_or_throw(path, O_WRONLY | O_TRUNC);
+    dms::pwrite_full(fd.get(), patch.data(), patch.size(), 0);
+  }
+  {
+    dms::UniqueFd fd = dms::open_or_throw(src + "/large", O_WRONLY);
+    dms::pwrite_full(fd.get(), patch.data(), patch.size(), config.large_size / 8);
+  }
+  options.sync = true;
+  const double incremental =
+      timed([&] { return dms::CopyEngine(options).copy_tree(src, dst); });
+  report.add("sync.full_copy", full, "s");
+  report.add("sync.incremental", incremental, "s");
+  report.add("sync.speedup", full / incremental, "x");
+  fs::remove_all(src);
+  fs::remove_all(dst);
+}
+
+// Jobs/s submitted to an in-process mock server whose replies take
+// --rpc-latency-us: all at once through the pipelined client, and one
+// blocking request at a time (on fewer jobs; it is that slow).
+void bench_submit(const Config& config, Report& report) {
+  dms::MockDmsServer::Options server_options;
+  server_options.latency = config.rpc_latency;
+  dms::MockDmsServer server(server_options);
+  auto job = [](unsigned i) {
+    return dms::JobSpec{"/src/f" + std::to_string(i), "/dst/f" + std::to_string(i), 0};
+  };
+
+  double best = 1e30;
+  for (int r = 0; r < config.runs; ++r) {
+    const double start = now();
+    dms::JobClient client(server.address());
+    std::vector<std::future<dms::JobReceipt>> receipts;
+    receipts.reserve(config.jobs);
+    for (unsigned i = 0; i < config.jobs; ++i) receipts.push_back(client.submit(job(i)));
+    for (auto& receipt : receipts) receipt.get();
+    best = std::min(best, now() - start);
+  }
+  const double batched = config.jobs / best;
+
+  const unsigned blocking_jobs = std::min(config.jobs, 1000u);
+  dms::JobClient::Options one_at_a_time;
+  one_at_a_time.max_batch_jobs = 1;
+  one_at_a_time.max_inflight_frames = 1;
+  const double start = now();
+  dms::JobClient client(server.address(), one_at_a_time);
+  for (unsigned i = 0; i < blocking_jobs; ++i) client.submit(job(i)).get();
+  const double blocking = blocking_jobs / (now() - start);
+
+  report.add("submit.pipelined.rate", batched, "jobs/s");
+  report.add("submit.blocking.rate", blocking, "jobs/s");
+  report.add("submit.speedup", batched / blocking, "x");
+}
+
+// Pushes the large file to an in-process mover that discards it, once per
+// send method. The file is read once first so every method sends from the
+// page cache; CPU time is the pushing thread's, kernel time included.
+void bench_net(const Config& config, Report& report) {
+  const std::string src = config.dir + "/net.src";
+  write_file(src, config.large_size, 45);
+  dms::checksum_file(src, dms::ChecksumKind::kCrc32c, config.chunk_size);
+  dms::MoverServer mover;
+  for (dms::SendMethod method : {dms::SendMethod::kCopy, dms::SendMethod::kSplice,
+                                 dms::SendMethod::kSendfile, dms::SendMethod::kZerocopy}) {
+    dms::PushOptions options;
+    options.send_method = method;
+    options.chunk_size = config.chunk_size;
+    options.adaptive = false;
+    double cpu = 1e30, seconds = 1e30;
+    dms::PushStats stats;
+    for (int r = 0; r < config.runs; ++r) {
+      stats = dms::push_files(mover.address(), {{src, "net.dst"}}, options);
+      cpu = std::min(cpu, stats.cpu_seconds_per_gib());
+      seconds = std::min(seconds, stats.seconds);
+    }
+    const std::string name = std::string("net.") + dms::to_string(method);
+    if (stats.send_method != dms::to_string(method)) {
+      report.add(name + ".fallback", stats.send_method);
+      continue;
+    }
+    report.add(name + ".cpu", cpu, "s/GiB");
+    report.add(name + ".throughput", static_cast<double>(config.large_size) / seconds / dms::MiB,
+               "MiB/s");
+    if (method == dms::SendMethod::kZerocopy && stats.zerocopy_sends > 0) {
+      report.add(name + ".copied", 100.0 * stats.zerocopy_copied / stats.zerocopy_sends, "%");
+    }
+  }
+  fs::remove(src);
+}
+
+// Pushes the large file with adaptive striping to a mover that caps each
+// connection at --stream-rate, as a window-limited long-haul path would.
+void bench_stripe(const Config& config, Report& report) {
+  const std::string src = config.dir + "/stripe.src";
+  write_file(src, config.large_size, 46);
+  dms::MoverServer::Options mover_options;
+  mover_options.stream_rate = config.stream_rate;
+  dms::MoverServer mover(mover_options);
+  dms::PushOptions options;
+  options.chunk_size = config.chunk_size;
+  const dms::PushStats stats = dms::push_files(mover.address(), {{src, "stripe.dst"}}, options);
+  const double rate = static_cast<double>(stats.bytes) / stats.seconds;
+  report.add("stripe.stream_cap", static_cast<double>(config.stream_rate) / dms::MiB, "MiB/s");
+  report.add("stripe.adaptive.throughput", rate / dms::MiB, "MiB/s");
+  report.add("stripe.adaptive.peak_streams", stats.peak_streams, "streams");
+  report.add("stripe.speedup", rate / static_cast<double>(config.stream_rate), "x");
+  fs::remove(src);
+}
+
+// Nanoseconds per acquire_bytes() call with `threads` threads calling at
+// once on one throttle.
+double acquire_ns(dms::Throttle& throttle, unsigned threads) {
+  constexpr int kCalls = 2000000;
+  const double start = now();
+  std::vector<std::thread> pool;
+  for (unsigned t = 0; t < threads; ++t) {
+    pool.emplace_back([&] {
+      for (int i = 0; i < kCalls; ++i) throttle.acquire_bytes(1);
+    });
+  }
+  for (auto& t : pool) t.join();
+  return (now() - start) * 1e9 / (static_cast<double>(kCalls) * threads);
+}
+
+// The per-call cost of the throttle for a job under no limit (the
+// lock-free fast path) and under one too high to ever wait, from 4
+// threads; then the large file copied under a tenant limit of
+// --throttle-rate. The burst is capped at 1% of the copy's expected time,
+// so that it cannot move the measured rate by more than that.
+void bench_throttle(const Config& config, Report& report) {
+  const auto expected = std::chrono::duration<double>(static_cast<double>(config.large_size) /
+                                                      static_cast<double>(config.throttle_rate));
+  const auto burst =
+      std::min<std::chrono::nanoseconds>(dms::TokenBucket::kDefaultBurst,
+                                         std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                             expected / 100));
+  dms::RateLimiter limiter(burst);
+  auto unlimited = limiter.make_throttle("bench");
+  report.add("throttle.unlimited.acquire", acquire_ns(*unlimited, 4), "ns");
+  auto limited = limiter.make_throttle("bench", {1ull << 50, 0});
+  report.add("throttle.limited.acquire", acquire_ns(*limited, 4), "ns");
+
+  const std::string src = config.dir + "/throttle.src";
+  const std::string dst = config.dir + "/throttle.dst";
+  write_file(src, config.large_size, 47);
+  limiter.set_tenant_limits("bench", {config.throttle_rate, 0});
+  dms::CopyOptions options;
+  options.chunk_size = config.chunk_size;
+  options.throttle = limiter.make_throttle("bench");
+  const double seconds = timed([&] { return dms::CopyEngine(options).copy_files({{src, dst}}); });
+  const double rate = static_cast<double>(config.large_size) / seconds;
+  report.add("throttle.limit", static_cast<double>(config.throttle_rate) / dms::MiB, "MiB/s");
+  report.add("throttle.burst", std::chrono::duration<double, std::milli>(burst).count(), "ms");
+  report.add("throttle.throughput", rate / dms::MiB, "MiB/s");
+  report.add("throttle.accuracy", 100 * rate / static_cast<double>(config.throttle_rate), "%");
+  fs::remove(src);
+  fs::remove(dst);
+}
+
+// 64 threads gated by an AdaptiveLimit issue operations to a simulated
+// file system that serves `knee` of them at once in 1 ms each and queues
+// the rest, so throughput stops growing at `knee` in flight while latency
+// keeps rising. After 3 s the file system drops to a quarter of its
+// capacity (others are using it) for another 3 s.
+void bench_adaptive(Report& report) {
+  constexpr unsigned kThreads = 64;
+  constexpr double kBaseLatency = 1e-3;
+  std::atomic<unsigned> knee{16};
+  std::atomic<unsigned> in_flight{0};
+  std::atomic<std::uint64_t> ops{0};
+  std::atomic<bool> stop{false};
+  dms::AdaptiveLimit::Options options;
+  options.max_limit = kThreads;
+  options.initial_limit = 1;
+  dms::AdaptiveLimit limit(options);
+  std::vector<std::thread> pool;
+  for (unsigned slot = 0; slot < kThreads; ++slot) {
+    pool.emplace_back([&, slot] {
+      while (!stop.load()) {
+        limit.admit(slot);
+        const unsigned n = in_flight.fetch_add(1) + 1;
+        const double latency = kBaseLatency * std::max(1.0, static_cast<double>(n) / knee.load());
+        std::this_thread::sleep_for(std::chrono::duration<double>(latency));
+        in_flight.fetch_sub(1);
+        ops.fetch_add(1);
+        limit.record(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                         std::chrono::duration<double>(latency)),
+                     1, 1);
+      }
+    });
+  }
+  auto phase = [&](const std::string& name) {
+    std::this_thread::sleep_for(std::chrono::seconds(2));
+    const std::uint64_t before = ops.load();
+    std::this_thread::sleep_for(std::chrono::seconds(1));
+    const double rate = static_cast<double>(ops.load() - before);
+    report.add("adaptive." + name + ".knee", knee.load(), "ops in flight");
+    report.add("adaptive." + name + ".limit", limit.limit(), "threads");
+    report.add("adaptive." + name + ".efficiency", 100 * rate * kBaseLatency / knee.load(), "%");
+  };
+  phase("full");
+  knee.store(knee.load() / 4);
+  phase("degraded");
+  stop.store(true);
+  limit.close();
+  for (auto& t : pool) t.join();
+  report.add("adaptive.changes", limit.changes(), "changes");
+}
+
+// Pushes a file that is half text and half random data over one stream
+// capped at --stream-rate, uncompressed and with each codec. The random
+// half should go out raw, so compression only pays where it helps.
+void bench_compress(const Config& config, Report& report) {
+  const std::string src = config.dir + "/compress.src";
+  const std::uint64_t half = config.large_size / 8;
+  write_file(src, half, 48);
+  append_text(src, half, 49);
+  dms::MoverServer::Options mover_options;
+  mover_options.stream_rate = config.stream_rate;
+  dms::MoverServer mover(mover_options);
+  double uncompressed = 0;
+  for (dms::Codec codec :
+       {dms::Codec::kNone, dms::Codec::kLz4, dms::Codec::kZstd, dms::Codec::kAuto}) {
+    if (!dms::codec_available(codec)) continue;
+    dms::PushOptions options;
+    options.chunk_size = config.chunk_size;
+    options.adaptive = false;
+    options.compression = codec;
+    const dms::PushStats stats = dms::push_files(mover.address(), {{src, "compress.dst"}}, options);
+    const double rate = static_cast<double>(stats.bytes) / stats.seconds;
+    const std::string name = std::string("compress.") + dms::to_string(codec);
+    report.add(name + ".throughput", rate / dms::MiB, "MiB/s");
+    if (codec == dms::Codec::kNone) {
+      uncompressed = rate;
+      continue;
+    }
+    report.add(name + ".wire", 100 * stats.compression_ratio(), "%");
+    report.add(name + ".raw_chunks",
+               100.0 * stats.raw_chunks / (stats.raw_chunks + stats.compressed_chunks), "%");
+    report.add(name + ".cpu", stats.cpu_seconds_per_gib(), "s/GiB");
+    report.add(name + ".speedup", rate / uncompressed, "x");
+  }
+  fs::remove(src);
+}
+
+// Times the chunker and the fingerprint hash on a buffer that stays in
+// cache, then pushes a file over one stream capped at --stream-rate three
+// times with one chunk index: first to an empty index, then the same file
+// to another path, then a copy with three 100-byte insertions, which only
+// disturbs the chunks around them.
+void bench_dedup(const Config& config, Report& report) {
+  std::vector<char> buf(config.chunk_size);
+  std::uint64_t seed = 51;
+  fill(buf.data(), buf.size(), seed);
+  const dms::Chunker chunker;
+  const std::uint64_t total = dms::GiB;
+  double scan = 1e30;
+  double hash = 1e30;
+  std::vector<std::size_t> ends;
+  std::uint64_t sink = 0;
+  for (int r = 0; r < config.runs; ++r) {
+    double start = now();
+    for (std::uint64_t done = 0; done < total; done += buf.size()) {
+      ends.clear();
+      chunker.split(buf.data(), buf.size(), true, ends);
+    }
+    scan = std::min(scan, now() - start);
+    start = now();
+    for (std::uint64_t done = 0; done < total; done += buf.size()) {
+      std::size_t from = 0;
+      for (const std::size_t end : ends) {
+        sink ^= dms::xxh3_128(buf.data() + from, end - from).low;
+        from = end;
+      }
+    }
+    hash = std::min(hash, now() - start);
+  }
+  if (sink == 1) std::printf(" ");
+  report.add("dedup.scan", total / scan / 1e9, "GB/s");
+  report.add("dedup.scan.kernel", dms::cdc_implementation());
+  report.add("dedup.fingerprint", total / hash / 1e9, "GB/s");
+
+  const std::string root = config.dir + "/dedup.root";
+  const std::string src = config.dir + "/dedup.src";
+  const std::string edited = config.dir + "/dedup.edited";
+  fs::create_directories(root);
+  std::vector<char> data(config.large_size / 8);
+  seed = 52;
+  fill(data.data(), data.size(), seed);
+  {
+    dms::UniqueFd fd = dms::open_or_throw(src, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    dms::pwrite_full(fd.get(), data.data(), data.size(), 0);
+    const std::string insert(100, 'x');
+    for (int i = 3; i >= 1; --i) {
+      data.insert(data.begin() + static_cast<std::ptrdiff_t>(data.size() / 4 * i), insert.begin(),
+                  insert.end());
+    }
+    fd = dms::open_or_throw(edited, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    dms::pwrite_full(fd.get(), data.data(), data.size(), 0);
+  }
+  dms::MoverServer::Options mover_options;
+  mover_options.root = root;
+  mover_options.stream_rate = config.stream_rate;
+  dms::MoverServer mover(mover_options);
+  dms::PushOptions options;
+  options.adaptive = false;
+  options.dedup_index = std::make_shared<dms::ChunkIndex>();
+  double first = 0;
+  const std::pair<const char*, const std::string*> pushes[] = {
+      {"first", &src}, {"repeat", &src}, {"edited", &edited}};
+  for (const auto& [name, path] : pushes) {
+    const dms::PushStats stats =
+        dms::push_files(mover.address(), {{*path, std::string("dedup.") + name}}, options);
+    const double rate = static_cast<double>(stats.bytes) / stats.seconds;
+    const std::string key = std::string("dedup.") + name;
+    report.add(key + ".throughput", rate / dms::MiB, "MiB/s");
+    if (first == 0) {
+      first = rate;
+      continue;
+    }
+    report.add(key + ".wire", 100 * stats.compression_ratio(), "%");
+    report.add(key + ".speedup", rate / first, "x");
+  }
+  fs::remove_all(root);
+  fs::remove(src);
+  fs::remove(edited);
+}
+
+// A chunk descriptor, the kind of item pipeline stages hand each other.
+struct QueueItem {
+  std::uint64_t offset = 0;
+  std::uint64_t length = 0;
+};
+
+// Moves `items` descriptors from threads / 2 producers to as many
+// consumers through `q` and returns the items per second. `batch` > 1 uses
+// the batch calls, which only MpmcQueue has.
+template <typename Queue>
+double queue_rate(Queue& q, unsigned threads, std::uint64_t items, std::size_t batch) {
+  const unsigned producers = std::max(1u, threads / 2);
+  const unsigned consumers = std::max(1u, threads - producers);
+  const std::uint64_t each = items / producers;
+  std::atomic<std::uint64_t> sum{0};
+  std::vector<std::thread> pool;
+  const double start = now();
+  for (unsigned c = 0; c < consumers; ++c) {
+    pool.emplace_back([&] {
+      std::uint64_t local = 0;
+      if constexpr (std::is_same_v<Queue, dms::MpmcQueue<QueueItem>>) {
+        std::vector<QueueItem> out(batch);
+        while (const std::size_t n = q.pop_batch(out.data(), batch)) {
+          for (std::size_t i = 0; i < n; ++i) local += out[i].length;
+        }
+      } else {
+        while (auto item = q.pop()) local += item->length;
+      }
+      sum.fetch_add(local);
+    });
+  }
+  std::vector<std::thread> senders;
+  for (unsigned p = 0; p < producers; ++p) {
+    senders.emplace_back([&] {
+      if constexpr (std::is_same_v<Queue, dms::MpmcQueue<QueueItem>>) {
+        std::vector<QueueItem> in(batch);
+        for (std::uint64_t i = 0; i < each; i += batch) {
+          const std::size_t n = static_cast<std::size_t>(std::min<std::uint64_t>(batch, each - i));
+          for (std::size_t k = 0; k < n; ++k) in[k] = {i + k, 1};
+          q.push_batch(in.data(), n);
+        }
+      } else {
+        for (std::uint64_t i = 0; i < each; ++i) q.push({i, 1});
+      }
+    });
+  }
+  for (auto& t : senders) t.join();
+  q.close();
+  for (auto& t : pool) t.join();
+  const double seconds = now() - start;
+  if (sum.load() != each * producers) throw std::runtime_error("queue benchmark lost items");
+  return static_cast<double>(each * producers) / seconds;
+}
+
+// --queue-threads threads, half producing and half consuming, move chunk
+// descriptors through a 1024-slot BlockingQueue (one mutex, two condition
+// variables) and through an MpmcQueue, item by item and in batches of 32.
+void bench_queue(const Config& config, Report& report) {
+  constexpr std::size_t kCapacity = 1024;
+  constexpr std::size_t kBatch = 32;
+  const std::uint64_t items = 2000000;
+  double mutex = 0;
+  double lockfree = 0;
+  double batched = 0;
+  for (int r = 0; r < config.runs; ++r) {
+    dms::BlockingQueue<QueueItem> a(kCapacity);
+    mutex = std::max(mutex, queue_rate(a, config.queue_threads, items, 1));
+    dms::MpmcQueue<QueueItem> b(kCapacity);
+    lockfree = std::max(lockfree, queue_rate(b, config.queue_threads, items, 1));
+    dms::MpmcQueue<QueueItem> c(kCapacity);
+    batched = std::max(batched, queue_rate(c, config.queue_threads, items, kBatch));
+  }
+  report.add("queue.threads", config.queue_threads, "threads");
+  report.add("queue.mutex", mutex / 1e6, "M items/s");
+  report.add("queue.lockfree", lockfree / 1e6, "M items/s");
+  report.add("queue.lockfree.batch32", batched / 1e6, "M items/s");
+  report.add("queue.lockfree.speedup", lockfree / mutex, "x");
+  report.add("queue.lockfree.batch32.speedup", batched / mutex, "x");
+}
+
+// GB/s of memcpy between two 64 MiB buffers placed on `memory_node`, by a
+// thread pinned to `cpu_node`; the buffers are far larger than the caches,
+// so the copy runs at the speed of that node's memory as seen from there.
+double numa_memcpy_rate(int cpu_node, int memory_node, int runs) {
+  constexpr std::size_t kBuffer = 64 * dms::MiB;
+  constexpr std::uint64_t kTotal = 4 * dms::GiB;
+  double best = 1e30;
+  std::thread([&] {
+    dms::pin_thread_to_node(cpu_node);
+    dms::BufferArena::Options options;
+    options.buffer_size = kBuffer;
+    options.count = 2;
+    options.node = memory_node;
+    dms::BufferArena arena(options);
+    char* const buffers[2] = {arena.acquire(), arena.acquire()};
+    for (int r = 0; r < runs; ++r) {
+      const double start = now();
+      for (std::uint64_t done = 0; done < kTotal; done += kBuffer) {
+        std::memcpy(buffers[done / kBuffer % 2], buffers[1 - done / kBuffer % 2], kBuffer);
+      }
+      best = std::min(best, now() - start);
+    }
+    for (char* buffer : buffers) arena.release(buffer);
+  }).join();
+  return static_cast<double>(kTotal) / best / 1e9;
+}
+
+// memcpy from the first node into buffers on it and on the last node, and
+// the large file copied under each NUMA policy. On a one-node host the
+// remote case is skipped and the policies should tie.
+void bench_numa(const Config& config, Report& report) {
+  const std::vector<int>& nodes = dms::numa_nodes();
+  report.add("numa.nodes", static_cast<double>(nodes.size()), "nodes");
+  const double local = numa_memcpy_rate(nodes.front(), nodes.front(), config.runs);
+  report.add("numa.local.memcpy", local, "GB/s");
+  if (nodes.size() > 1) {
+    const double remote = numa_memcpy_rate(nodes.front(), nodes.back(), config.runs);
+    report.add("numa.remote.memcpy", remote, "GB/s");
+    report.add("numa.remote.penalty", 100 * (1 - remote / local), "%");
+  }
+
+  const std::string src = config.dir + "/numa.src";
+  const std::string dst = config.dir + "/numa.dst";
+  write_file(src, config.large_size, 53);
+  for (const dms::NumaPolicy policy :
+       {dms::NumaPolicy::kNone, dms::NumaPolicy::kLocal, dms::NumaPolicy::kInterleave}) {
+    dms::CopyOptions options;
+    options.chunk_size = config.chunk_size;
+    options.numa = policy;
+    double best = 1e30;
+    for (int r = 0; r < config.runs; ++r) {
+      fs::remove(dst);
+      best = std::min(best, timed([&] {
+        return dms::CopyEngine(options).copy_files({{src, dst}});
+      }));
+    }
+    report.add(std::string("numa.") + dms::to_string(policy) + ".throughput",
+               static_cast<double>(config.large_size) / best / dms::MiB, "MiB/s");
+  }
+  fs::remove(src);
+  fs::remove(dst);
+}
+
+// Microseconds per chunk to get a --chunk-size buffer, write every byte
+// of it as a read would and give it back: from the arena, and from a
+// mapping of its own, which is what malloc does for buffers this large
+// until its heuristics start keeping them, and costs a page fault per
+// page. Also the bare acquire/release cost.
+void bench_arena(const Config& config, Report& report) {
+  constexpr int kChunks = 512;
+  constexpr int kCycles = 1000000;
+  for (const bool huge : {true, false}) {
+    dms::BufferArena::Options options;
+    options.buffer_size = config.chunk_size;
+    options.count = 4;
+    options.huge_pages = huge;
+    dms::BufferArena arena(options);
+    const std::string name = std::string("arena.") + (huge ? "huge" : "normal");
+    report.add(name + ".pages", arena.page_kind());
+    double best = 1e30;
+    for (int r = 0; r < config.runs; ++r) {
+      const double start = now();
+      for (int i = 0; i < kChunks; ++i) {
+        char* buffer = arena.acquire();
+        std::memset(buffer, i, config.chunk_size);
+        arena.release(buffer);
+      }
+      best = std::min(best, now() - start);
+    }
+    report.add(name + ".fill", best / kChunks * 1e6, "us/chunk");
+  }
+
+  double best = 1e30;
+  for (int r = 0; r < config.runs; ++r) {
+    const double start = now();
+    for (int i = 0; i < kChunks; ++i) {
+      void* buffer = ::mmap(nullptr, config.chunk_size, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (buffer == MAP_FAILED) dms::throw_errno("mmap");
+      std::memset(buffer, i, config.chunk_size);
+      ::munmap(buffer, config.chunk_size);
+    }
+    best = std::min(best, now() - start);
+  }
+  report.add("arena.mmap.fill", best / kChunks * 1e6, "us/chunk");
+
+  dms::BufferArena::Options options;
+  options.buffer_size = config.chunk_size;
+  dms::BufferArena arena(options);
+  const double start = now();
+  for (int i = 0; i < kCycles; ++i) arena.release(arena.acquire());
+  report.add("arena.acquire_release", (now() - start) / kCycles * 1e9, "ns");
+}
+
+// Entries/s when giving every file and directory of the small-file tree a
+// mode and an mtime: one path-based chmod and utimensat per entry on one
+// thread, as a copy would after each file, and through MetadataBatcher.
+void bench_metadata(const Config& config, Report& report) {
+  const std::string root = config.dir + "/metadata";
+  make_small_tree(root, config.small_files, config.small_size);
+  std::vector<dms::MetadataFixup> fixups;
+  for (const auto& entry : fs::recursive_directory_iterator(root)) {
+    const std::string path = entry.path().string();
+    fixups.push_back({path, path, entry.is_directory() ? S_IFDIR | 0755u : S_IFREG | 0644u});
+  }
+  // Directories last, as a copy would have to.
+  std::stable_partition(fixups.begin(), fixups.end(),
+                        [](const dms::MetadataFixup& f) { return !S_ISDIR(f.mode); });
+
+  double serial = 1e30;
+  double batched = 1e30;
+  for (int r = 0; r < config.runs; ++r) {
+    // A new mtime every run, so no run finds the work already done.
+    const std::int64_t mtime = (1000000000LL + 2 * r) * 1000000000LL;
+    double start = now();
+    for (const dms::MetadataFixup& f : fixups) {
+      struct timespec times[2] = {{0, UTIME_OMIT}, {mtime / 1000000000, 0}};
+      if (::chmod(f.dst.c_str(), f.mode & 07777) != 0 ||
+          ::utimensat(AT_FDCWD, f.dst.c_str(), times, 0) != 0) {
+        dms::throw_errno(f.dst);
+      }
+    }
+    serial = std::min(serial, now() - start);
+
+    start = now();
+    dms::MetadataBatcher batcher;
+    for (dms::MetadataFixup f : fixups) {
+      f.mtime_ns = mtime + 1000000000LL;
+      batcher.add(std::move(f));
+    }
+    const dms::MetadataStats stats = batcher.finish();
+    batched = std::min(batched, now() - start);
+    if (stats.error_count != 0) {
+      std::fprintf(stderr, "metadata benchmark failed: %s\n", stats.errors.front().c_str());
+      std::exit(1);
+    }
+  }
+  const auto entries = static_cast<double>(fixups.size());
+  report.add("metadata.entries", entries, "entries");
+  report.add("metadata.serial.rate", entries / serial, "entries/s");
+  report.add("metadata.batched.rate", entries / batched, "entries/s");
+  report.add("metadata.speedup", serial / batched, "x");
+  fs::remove_all(root);
+}
+
+// A --large-size image that is one tenth data, in 1 MiB extents spread
+// over it as a VM image's are, copied keeping its holes and inflating
+// them. Reports the time and the space the copy takes at the destination.
+void bench_sparse(const Config& config, Report& report) {
+  const std::string src = config.dir + "/sparse.src";
+  const std::string dst = config.dir + "/sparse.dst";
+  {
+    dms::UniqueFd fd = dms::open_or_throw(src, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (::ftruncate(fd.get(), static_cast<off_t>(config.large_size)) != 0) {
+      dms::throw_errno("ftruncate " + src);
+    }
+    std::vector<char> block(dms::MiB);
+    std::uint64_t seed = 71;
+    fill(block.data(), block.size(), seed);
+    for (std::uint64_t off = 0; off + block.size() <= config.large_size; off += 10 * dms::MiB) {
+      dms::pwrite_full(fd.get(), block.data(), block.size(), static_cast<off_t>(off));
+    }
+  }
+  for (const bool sparse : {true, false}) {
+    dms::CopyOptions options;
+    options.chunk_size = config.chunk_size;
+    options.sparse = sparse;
+    double best = 1e30;
+    for (int r = 0; r < config.runs; ++r) {
+      fs::remove(dst);
+      best = std::min(best, timed([&] {
+        return dms::CopyEngine(options).copy_files({{src, dst}});
+      }));
+    }
+    struct stat st;
+    if (::stat(dst.c_str(), &st) != 0) dms::throw_errno("stat " + dst);
+    const std::string name = std::string("sparse.") + (sparse ? "kept" : "inflated");
+    report.add(name + ".throughput", static_cast<double>(config.large_size) / best / dms::MiB,
+               "MiB/s");
+    report.add(name + ".allocated", static_cast<double>(st.st_blocks) * 512 / dms::MiB, "MiB");
+  }
+  fs::remove(src);
+  fs::remove(dst);
+}
+
+// The large file copied within --dir with each offload mode, reporting
+// how the copy was made: modes the file system refuses fall back to
+// reads and writes.
+void bench_offload(const Config& config, Report& report) {
+  const std::string src = config.dir + "/offload.src";
+  const std::string dst = config.dir + "/offload.dst";
+  write_file(src, config.large_size, 73);
+  for (const dms::OffloadMode mode :
+       {dms::OffloadMode::kNone, dms::OffloadMode::kCopyRange, dms::OffloadMode::kReflink}) {
+    dms::CopyOptions options;
+    options.chunk_size = config.chunk_size;
+    options.offload = mode;
+    dms::CopyPath path = dms::CopyPath::kReadWrite;
+    options.path_sink = [&](const dms::FileTask&, dms::CopyPath p) { path = p; };
+    double best = 1e30;
+    for (int r = 0; r < config.runs; ++r) {
+      fs::remove(dst);
+      best = std::min(best, timed([&] {
+        return dms::CopyEngine(options).copy_files({{src, dst}});
+      }));
+    }
+    const std::string name = std::string("offload.") + dms::to_string(mode);
+    report.add(name + ".throughput", static_cast<double>(config.large_size) / best / dms::MiB,
+               "MiB/s");
+    report.add(name + ".path", dms::to_string(path));
+  }
+  fs::remove(src);
+  fs::remove(dst);
+}
+
+// Resident memory of the process.
+std::size_t resident_bytes() {
+  std::FILE* f = std::fopen("/proc/self/statm", "r");
+  if (!f) return 0;
+  unsigned long size = 0;
+  unsigned long resident = 0;
+  const int n = std::fscanf(f, "%lu %lu", &size, &resident);
+  std::fclose(f);
+  return n == 2 ? resident * static_cast<std::size_t>(::sysconf(_SC_PAGESIZE)) : 0;
+}
+
+// Parks on its reactor thread's gate, then takes one trip through the ring.
+dms::Task<void> gated_task(std::vector<std::unique_ptr<dms::AsyncSemaphore>>& gates,
+                           std::atomic<std::size_t>& parked) {
+  parked.fetch_add(1, std::memory_order_relaxed);
+  co_await gates[dms::reactor_thread_index()]->acquire();
+  co_await dms::async_yield();
+}
+
+dms::Task<void> open_gate(std::vector<std::unique_ptr<dms::AsyncSemaphore>>& gates,
+                          std::size_t count) {
+  dms::AsyncSemaphore& gate = *gates[dms::reactor_thread_index()];
+  for (std::size_t i = 0; i < count; ++i) gate.release();
+  co_return;
+}
+
+// --tasks coroutines are spawned onto a two-thread reactor and held at a
+// gate until all are suspended, which gives the memory each costs, then
+// let go. Spawns are round robin, so one more task per thread lands behind
+// that thread's share and opens its gate. Then the small-file tree is
+// copied in packs and with a coroutine per file.
+void bench_reactor(const Config& config, Report& report) {
+  {
+    dms::Reactor::Options options;
+    options.threads = 2;
+    dms::Reactor reactor(options);
+    std::vector<std::unique_ptr<dms::AsyncSemaphore>> gates;
+    for (unsigned i = 0; i < reactor.threads(); ++i) {
+      gates.push_back(std::make_unique<dms::AsyncSemaphore>(0));
+    }
+    std::atomic<std::size_t> parked{0};
+    const std::size_t tasks = config.tasks - config.tasks % reactor.threads();
+    const std::size_t before = resident_bytes();
+    const double start = now();
+    for (std::size_t i = 0; i < tasks; ++i) reactor.spawn(gated_task(gates, parked));
+    while (parked.load() < tasks) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    const std::size_t held = resident_bytes();
+    for (unsigned i = 0; i < reactor.threads(); ++i) {
+      reactor.spawn(open_gate(gates, tasks / reactor.threads()));
+    }
+    reactor.wait();
+    const double seconds = now() - start;
+    report.add("reactor.backend", reactor.backend_name());
+    report.add("reactor.peak_in_flight", static_cast<double>(reactor.peak_in_flight()), "tasks");
+    report.add("reactor.bytes_per_task", static_cast<double>(held - before) / tasks, "bytes");
+    report.add("reactor.rate", tasks / seconds, "tasks/s");
+  }
+
+  const std::string src = config.dir + "/reactor.src";
+  const std::string dst = config.dir + "/reactor.dst";
+  make_small_tree(src, config.small_files, config.small_size);
+  for (const bool coroutines : {false, true}) {
+    dms::CopyOptions options;
+    options.coroutines = coroutines;
+    double best = 1e30;
+    for (int r = 0; r < config.runs; ++r) {
+      fs::remove_all(dst);
+      best = std::min(best, timed([&] { return dms::CopyEngine(options).copy_tree(src, dst); }));
+    }
+    report.add(std::string("reactor.small_files.") + (coroutines ? "coroutines" : "packed"),
+               config.small_files / best, "files/s");
+  }
+  fs::remove_all(src);
+  fs::remove_all(dst);
+}
+
+// Nanoseconds per slot handed from one job to the next with `jobs` jobs of
+// one class, weighted 1 to 4, always waiting. One thread plays them all:
+// it gives back the oldest granted slot, which the scheduler grants to the
+// job with the lowest virtual time, and queues the giver again.
+double grant_ns(std::size_t jobs) {
+  constexpr std::uint64_t kGrants = 1000000;
+  constexpr std::uint64_t kBytes = 4 * dms::MiB;
+  dms::Scheduler::Options options;
+  options.slots = 8;
+  dms::Scheduler scheduler(options);
+  std::vector<std::unique_ptr<dms::SchedulerJob>> handles;
+  std::vector<std::unique_ptr<dms::SchedulerJob::Request>> requests;
+  std::deque<std::size_t> granted;
+  for (std::size_t i = 0; i < jobs; ++i) {
+    handles.push_back(scheduler.add_job(dms::Priority::kNormal, 1 + i % 4));
+    requests.push_back(
+        std::make_unique<dms::SchedulerJob::Request>([&granted, i] { granted.push_back(i); }));
+  }
+  for (std::size_t i = 0; i < jobs; ++i) handles[i]->request(*requests[i], kBytes);
+  const double start = now();
+  for (std::uint64_t n = 0; n < kGrants; ++n) {
+    const std::size_t i = granted.front();
+    granted.pop_front();
+    handles[i]->release();
+    handles[i]->request(*requests[i], kBytes);
+  }
+  const double seconds = now() - start;
+  while (!granted.empty()) {
+    handles[granted.front()]->release();
+    granted.pop_front();
+  }
+  return seconds * 1e9 / kGrants;
+}
+
+// The urgent file (an eighth of the large one) copied alone, then while
+// the large file is copied as a bulk job, with no scheduler and with both
+// jobs on one of two slots.
+void bench_scheduler(const Config& config, Report& report) {
+  report.add("scheduler.jobs_10.grant", grant_ns(10), "ns");
+  report.add("scheduler.jobs_" + std::to_string(config.scheduled_jobs) + ".grant",
+             grant_ns(config.scheduled_jobs), "ns");
+
+  const std::string bulk = config.dir + "/scheduler.bulk";
+  const std::string urgent = config.dir + "/scheduler.urgent";
+  write_file(bulk, config.large_size, 79);
+  write_file(urgent, config.large_size / 8, 83);
+  dms::CopyOptions options;
+  options.chunk_size = config.chunk_size;
+  options.threads = 4;
+  const double alone = timed([&] {
+    return dms::CopyEngine(options).copy_files({{urgent, urgent + ".dst"}});
+  });
+  report.add("scheduler.urgent.alone", alone, "s");
+  for (const bool scheduled : {false, true}) {
+    dms::CopyOptions bulk_options = options;
+    dms::CopyOptions urgent_options = options;
+    if (scheduled) {
+      dms::Scheduler::Options scheduling;
+      scheduling.slots = 2;
+      auto scheduler = std::make_shared<dms::Scheduler>(scheduling);
+      bulk_options.scheduler = scheduler;
+      bulk_options.priority = dms::Priority::kBulk;
+      urgent_options.scheduler = scheduler;
+      urgent_options.priority = dms::Priority::kUrgent;
+    }
+    ::sync();
+    auto bulk_job = std::async(std::launch::async, [&] {
+      return dms::CopyEngine(bulk_options).copy_files({{bulk, bulk + ".dst"}});
+    });
+    // Let the bulk job fill the slots first.
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    const dms::JobStats stats =
+        dms::CopyEngine(urgent_options).copy_files({{urgent, urgent + ".dst"}});
+    const dms::JobStats bulk_stats = bulk_job.get();
+    const std::string name = scheduled ? "scheduler.urgent.scheduled" : "scheduler.urgent.fifo";
+    report.add(name, stats.seconds, "s");
+    report.add(name + ".bulk", bulk_stats.seconds, "s");
+  }
+  for (const auto& path : {bulk, urgent}) {
+    fs::remove(path);
+    fs::remove(path + ".dst");
+  }
+}
+
+void usage(const char* argv0) {
+  std::fprintf(stderr,
+               "usage: %s [options] [BENCHMARK...]\n"
+               "\n"
+               "benchmarks: large journal small checksum sync submit net stripe throttle\n"
+               "            adaptive compress dedup queue numa arena metadata sparse\n"
+               "            offload reactor scheduler\n"
+               "            (default: all)\n"
+               "\n"
+               "  --dir DIR            scratch directory (default: a new one in /tmp)\n"
+               "  --output FILE        results file (default bench_output.txt)\n"
+               "  --large-size SIZE    large file size (default 1G)\n"
+               "  --chunk-size SIZE    copy chunk size (default 1M)\n"
+               "  --small-files N      files in the small-file tree (default 20000)\n"
+               "  --small-size SIZE    size of each small file (default 4K)\n"
+               "  --jobs N             jobs submitted to the mock server (default 100000)\n"
+               "  --rpc-latency-us N   mock server reply latency (default 200)\n"
+               "  --stream-rate SIZE   per-stream cap of the stripe, compress and dedup\n"
+               "                       benchmarks (default 100M)\n"
+               "  --throttle-rate SIZE limit of the throttle benchmark (default 200M)\n"
+               "  --queue-threads N    producer plus consumer threads of the queue benchmark\n"
+               "                       (default 64)\n"
+               "  --tasks N            coroutines of the reactor benchmark (default 1000000)\n"
+               "  --scheduled-jobs N   waiting jobs of the scheduler benchmark (default 10000)\n"
+               "  --runs N             runs per measurement, best kept (default 3)\n"
+               "  --max-journal-overhead PERCENT\n"
+               "                       journal overhead limit (default 2)\n"
+               "  --check              exit non-zero if a limit is exceeded\n",
+               argv0);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  Config config;
+  for (int i = 1; i < argc; ++i) {
+    auto value = [&] {
+      if (i + 1 >= argc) {
+        std::fprintf(stderr, "missing value for %s\n", argv[i]);
+        std::exit(2);
+      }
+      return argv[++i];
+    };
+    const std::string arg = argv[i];
+    if (arg == "--dir") {
+      config.dir = value();
+    } else if (arg == "--output") {
+      config.output = value();
+    } else if (arg == "--large-size") {
+      config.large_size = dms::parse_size(value());
+    } else if (arg == "--chunk-size") {
+      config.chunk_size = dms::parse_size(value());
+    } else if (arg == "--small-files") {
+      config.small_files = static_cast<unsigned>(std::stoul(value()));
+    } else if (arg == "--small-size") {
+      config.small_size = dms::parse_size(value());
+    } else if (arg == "--jobs") {
+      config.jobs = static_cast<unsigned>(std::stoul(value()));
+    } else if (arg == "--rpc-latency-us") {
+      config.rpc_latency = std::chrono::microseconds(std::stoll(value()));
+    } else if (arg == "--stream-rate") {
+      config.stream_rate = dms::parse_size(value());
+    } else if (arg == "--throttle-rate") {
+      config.throttle_rate = dms::parse_size(value());
+    } else if (arg == "--queue-threads") {
+      config.queue_threads = std::max(2u, static_cast<unsigned>(std::stoul(value())));
+    } else if (arg == "--tasks") {
+      config.tasks = std::max<std::size_t>(2, std::stoul(value()));
+    } else if (arg == "--scheduled-jobs") {
+      config.scheduled_jobs = std::max<std::size_t>(1, std::stoul(value()));
+    } else if (arg == "--runs") {
+      config.runs = std::max(1, std::atoi(value()));
+    } else if (arg == "--max-journal-overhead") {
+      config.max_journal_overhead = std::atof(value());
+    } else if (arg == "--check") {
+      config.check = true;
+    } else if (arg.rfind("--", 0) == 0) {
+      usage(argv[0]);
+      return 2;
+    } else {
+      config.only.push_back(arg);
+    }
+  }
+
+  bool own_dir = false;
+  if (config.dir.empty()) {
+    char tmpl[] = "/tmp/dms-bench-XXXXXX";
+    if (!::mkdtemp(tmpl)) {
+      std::perror("mkdtemp");
+      return 1;
+    }
+    config.dir = tmpl;
+    own_dir = true;
+  }
+  fs::create_directories(config.dir);
+
+  const std::time_t t = std::time(nullptr);
+  char date[32];
+  std::strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", std::localtime(&t));
+  const std::string header = std::string("dms-bench ") + date + " large_size=" +
+                             std::to_string(config.large_size) +
+                             " chunk_size=" + std::to_string(config.chunk_size) +
+                             " small_files=" + std::to_string(config.small_files) +
+                             " small_size=" + std::to_string(config.small_size) +
+                             " jobs=" + std::to_string(config.jobs) +
+                             " rpc_latency_us=" + std::to_string(config.rpc_latency.count()) +
+                             " stream_rate=" + std::to_string(config.stream_rate) +
+                             " throttle_rate=" + std::to_string(config.throttle_rate) +
+                             " queue_threads=" + std::to_string(config.queue_threads) +
+                             " tasks=" + std::to_string(config.tasks) +
+                             " scheduled_jobs=" + std::to_string(config.scheduled_jobs) +
+                             " runs=" + std::to_string(config.runs);
+  std::printf("%s\n", header.c_str());
+
+  Report report;
+  bool ok = true;
+  bool within_limits = true;
+  try {
+    if (selected(config, "large")) bench_large(config, report);
+    if (selected(config, "journal")) within_limits = bench_journal(config, report);
+    if (selected(config, "small")) bench_small(config, report);
+    if (selected(config, "checksum")) bench_checksum(config, report);
+    if (selected(config, "sync")) bench_sync(config, report);
+    if (selected(config, "submit")) bench_submit(config, report);
+    if (selected(config, "net")) bench_net(config, report);
+    if (selected(config, "stripe")) bench_stripe(config, report);
+    if (selected(config, "throttle")) bench_throttle(config, report);
+    if (selected(config, "adaptive")) bench_adaptive(report);
+    if (selected(config, "compress")) bench_compress(config, report);
+    if (selected(config, "dedup")) bench_dedup(config, report);
+    if (selected(config, "queue")) bench_queue(config, report);
+    if (selected(config, "numa")) bench_numa(config, report);
+    if (selected(config, "arena")) bench_arena(config, report);
+    if (selected(config, "metadata")) bench_metadata(config, report);
+    if (selected(config, "sparse")) bench_sparse(config, report);
+    if (selected(config, "offload")) bench_offload(config, report);
+    if (selected(config, "reactor")) bench_reactor(config, report);
+    if (selected(config, "scheduler")) bench_scheduler(config, report);
+  } catch (const std::exception& e) {
+    std::fprintf(stderr, "dms-bench: %s\n", e.what());
+    ok = false;
+  }
+  if (own_dir) fs::remove_all(config.dir);
+
+  if (!report.write(config.output, header)) {
+    std::perror(config.output.c_str());
+    return 1;
+  }
+  std::printf("results written to %s\n", config.output.c_str());
+  if (!within_limits) {
+    std::fprintf(stderr, "dms-bench: journal overhead exceeds %.2f%%\n",
+                 config.max_journal_overhead);
+    if (config.check) ok = false;
+  }
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "dms/numa.h"
+#include "dms/units.h"
+
+namespace dms {
+
+// A fixed set of equally sized transfer buffers in one mapping that is
+// faulted in before use, so taking a buffer never costs a page fault or a
+// system call. The mapping uses 2 MiB pages when it can: reserved hugetlb
+// pages first, then transparent huge pages, then normal pages. An 8 MiB
+// chunk then spans 4 TLB entries instead of 2048.
+//
+// Buffers are recycled through per-thread free lists: a thread keeps the
+// last few buffers it released in a list of its own and takes from it
+// first. Its surplus, and buffers another thread is waiting for, go to a
+// shared list. Safe to use from many threads.
+class BufferArena {
+ public:
+  struct Options {
+    // Rounded up to a multiple of kDirectIoAlignment.
+    std::size_t buffer_size = 8 * MiB;
+    std::size_t count = 1;
+    bool huge_pages = true;
+    // NUMA placement (see numa.h).
+    int node = kAnyNode;
+    // Fault in the whole arena when it is built. Without it, callers
+    // prefault() each buffer before first using it, which lets many
+    // threads share the work.
+    bool prefault = true;
+  };
+
+  explicit BufferArena(Options options);
+  ~BufferArena();
+
+  BufferArena(const BufferArena&) = delete;
+  BufferArena& operator=(const BufferArena&) = delete;
+
+  std::size_t buffer_size() const { return buffer_size_; }
+  std::size_t count() const { return count_; }
+  int node() const { return node_; }
+  // What backs the arena: "hugetlb", "thp" or "4k".
+  const char* page_kind() const { return page_kind_; }
+
+  // A free buffer, or nullptr if every buffer is taken.
+  char* try_acquire();
+  // A free buffer, waiting for one to be released if necessary.
+  char* acquire();
+  // Hands back a buffer from this arena.
+  void release(char* buffer);
+  // Faults in the pages of a buffer; cheap once they are.
+  void prefault(char* buffer) const;
+
+ private:
+  struct alignas(64) Cache {
+    std::mutex mu;
+    std::vector<char*> buffers;
+  };
+
+  Cache& local_cache();
+  char* steal();
+
+  std::size_t buffer_size_;
+  std::size_t count_;
+  int node_;
+  const char* page_kind_ = "4k";
+  char* base_ = nullptr;
+  std::size_t mapped_ = 0;
+
+  std::unique_ptr<Cache[]> caches_;
+  std::mutex mu_;
+  std::condition_variable released_;
+  std::vector<char*> shared_;
+  std::atomic<unsigned> waiters_{0};
+};
+
+// A buffer taken from an arena and handed back when the handle goes away.
+class ArenaBuffer {
+ public:
+  ArenaBuffer() = default;
+  ArenaBuffer(BufferArena* arena, char* data) : arena_(arena), data_(data) {}
+  ~ArenaBuffer() { reset(); }
+
+  ArenaBuffer(ArenaBuffer&& other) noexcept
+      : arena_(other.arena_), data_(std::exchange(other.data_, nullptr)) {}
+  ArenaBuffer& operator=(ArenaBuffer&& other) noexcept {
+    if (this != &other) {
+      reset();
+      arena_ = other.arena_;
+      data_ = std::exchange(other.data_, nullptr);
+    }
+    return *this;
+  }
+  ArenaBuffer(const ArenaBuffer&) = delete;
+  ArenaBuffer& operator=(const ArenaBuffer&) = delete;
+
+  char* data() const { return data_; }
+  explicit operator bool() const { return data_ != nullptr; }
+
+  void reset() {
+    if (data_) arena_->release(std::exchange(data_, nullptr));
+  }
+
+ private:
+  BufferArena* arena_ = nullptr;
+  char* data_ = nullptr;
+};
+
+}  // namespace dms
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <sys/uio.h>
+
+#include <cstddef>
+#include <vector>
+
+#include "dms/arena.h"
+
+namespace dms {
+
+// Alignment that satisfies O_DIRECT on every block device and parallel file
+// system we target (logical block sizes up to 4 KiB).
+constexpr std::size_t kDirectIoAlignment = 4096;
+
+// A worker's buffers, taken from an arena for as long as the pool lives,
+// so they can be registered with an I/O backend once and used for
+// O_DIRECT.
+class BufferPool {
+ public:
+  // Waits for `count` buffers if the arena is short of them, and faults
+  // them in on the calling thread.
+  BufferPool(BufferArena& arena, std::size_t count);
+  ~BufferPool();
+
+  BufferPool(const BufferPool&) = delete;
+  BufferPool& operator=(const BufferPool&) = delete;
+
+  std::size_t count() const { return buffers_.size(); }
+  std::size_t buffer_size() const { return arena_.buffer_size(); }
+
+  char* buffer(std::size_t index) const { return buffers_[index]; }
+
+  // One iovec per buffer, in index order, for IoBackend::register_buffers().
+  std::vector<iovec> iovecs() const;
+
+ private:
+  BufferArena& arena_;
+  std::vector<char*> buffers_;
+};
+
+// Rounds `n` up to a multiple of `alignment` (a power of two).
+constexpr std::size_t align_up(std::size_t n, std::size_t alignment) {
+  return (n + alignment - 1) & ~(alignment - 1);
+}
+
+}  // namespace dms
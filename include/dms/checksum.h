@@ -0,0 +1,80 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace dms {
+
+enum class ChecksumKind {
+  kNone,
+  kCrc32c,  // CRC-32C (Castagnoli), as used by iSCSI, ext4 and SCTP
+  kXxh3,    // 64-bit XXH3 with the default secret and seed 0
+};
+
+const char* to_string(ChecksumKind kind);
+
+// Parses "none", "crc32c" or "xxh3"; throws std::invalid_argument otherwise.
+ChecksumKind parse_checksum(const std::string& text);
+
+// Kernels are chosen once per process from the CPU's features. These name
+// the chosen implementation, e.g. "avx512", "sse4.2", "avx2" or "scalar".
+const char* crc32c_implementation();
+const char* xxh3_implementation();
+
+// CRC-32C of `data`, continuing from `crc` (the result of an earlier call,
+// or 0 to start).
+std::uint32_t crc32c(const void* data, std::size_t length, std::uint32_t crc = 0);
+
+// CRC-32C of A followed by B, given crc32c(A), crc32c(B) and B's length.
+std::uint32_t crc32c_combine(std::uint32_t crc_a, std::uint32_t crc_b, std::uint64_t length_b);
+
+std::uint64_t xxh3_64(const void* data, std::size_t length);
+
+// 128-bit XXH3 (XXH3_128bits, seed 0), for content fingerprints, where 64
+// bits leave too high a chance of two chunks colliding.
+struct Hash128 {
+  std::uint64_t low = 0;
+  std::uint64_t high = 0;
+
+  bool operator==(const Hash128& other) const {
+    return low == other.low && high == other.high;
+  }
+  bool operator!=(const Hash128& other) const { return !(*this == other); }
+};
+
+Hash128 xxh3_128(const void* data, std::size_t length);
+
+// Digest of one chunk; a CRC-32C is zero-extended.
+std::uint64_t chunk_digest(ChecksumKind kind, const void* data, std::size_t length);
+
+// Folds the digests of a file's chunks, in file order, into the file
+// digest. For CRC-32C the result is the CRC of the whole file, whatever the
+// chunk size. XXH3 digests cannot be combined that way, so the file digest
+// is the XXH3 of the chunk digests (as little-endian u64s) and depends on
+// the chunk size; a single-chunk file keeps the chunk digest.
+class FileDigest {
+ public:
+  explicit FileDigest(ChecksumKind kind) : kind_(kind) {}
+
+  void add(std::uint64_t chunk_digest, std::uint64_t chunk_length);
+  std::uint64_t value() const;
+
+ private:
+  ChecksumKind kind_;
+  std::uint64_t chunks_ = 0;
+  std::uint32_t crc_ = 0;
+  std::string digests_;
+};
+
+// Digest of the file at `path` as the copy engine computes it for the same
+// kind and chunk size, reading chunks on `threads` threads (0: one per
+// CPU). Used to verify a destination. Throws std::system_error on I/O
+// errors.
+std::uint64_t checksum_file(const std::string& path, ChecksumKind kind, std::size_t chunk_size,
+                            unsigned threads = 0);
+
+// Formats a digest as fixed-width lowercase hex (8 digits for CRC-32C).
+std::string format_digest(ChecksumKind kind, std::uint64_t digest);
+
+}  // namespace dms
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace dms {
+
+// Chunk compression for data streams. The codecs come from the system's
+// liblz4 and libzstd, loaded on first use, so the client neither needs
+// their headers to build nor the libraries to run: a codec whose library
+// is missing is simply unavailable.
+enum class Codec : std::uint16_t {
+  kNone = 0,
+  kLz4 = 1,
+  kZstd = 2,
+  // Per chunk: lz4 for mildly compressible data, zstd for data that
+  // compresses well. Never used on the wire.
+  kAuto = 255,
+};
+
+const char* to_string(Codec codec);
+// Parses "none", "lz4", "zstd" or "auto"; throws std::invalid_argument.
+Codec parse_codec(const std::string& text);
+
+// Whether the codec's library could be loaded. kNone always is; kAuto is
+// if either library is.
+bool codec_available(Codec codec);
+
+// Largest compressed size of `size` bytes.
+std::size_t compress_bound(Codec codec, std::size_t size);
+
+// Compresses `size` bytes into `out` (at least compress_bound() bytes) and
+// returns the compressed size. level 0 picks the codec's fast default.
+// Throws std::runtime_error if the codec is unavailable or fails.
+std::size_t compress(Codec codec, const char* data, std::size_t size, char* out,
+                     std::size_t capacity, int level = 0);
+
+// Decompresses into exactly `raw_size` bytes at `out`. Throws
+// std::runtime_error on corrupt input or a size mismatch.
+void decompress(Codec codec, const char* data, std::size_t size, char* out,
+                std::size_t raw_size);
+
+// Estimated compressed-to-raw size ratio of `data`, from compressing three
+// 4 KiB samples (head, middle, tail) with the fastest codec available; 1
+// when none is.
+double sample_ratio(const char* data, std::size_t size);
+
+// The codec to send a chunk with, given the requested one and the chunk's
+// sampled ratio: kNone for data that will not shrink by at least 10%
+// (already compressed or encrypted), so no CPU is spent on it.
+Codec choose_codec(Codec requested, double ratio);
+
+}  // namespace dms
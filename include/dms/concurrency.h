@@ -0,0 +1,95 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+
+namespace dms {
+
+// A concurrency limit that tunes itself from the latency and throughput
+// the gated threads report, and the gate that holds back the threads above
+// it. A pool starts all of its threads; thread `slot` works only while
+// slot < limit(), so lowering the limit parks the highest slots.
+//
+// Every `interval`, the controller compares the mean operation latency
+// with the lowest seen (the file system's unloaded latency) and the
+// throughput with that of the previous interval:
+//
+//   - latency above `tolerance` times the lowest: the storage is queueing,
+//     cut the limit to 70% (multiplicative decrease);
+//   - the last increase raised throughput by less than 5%: the knee has
+//     been found, undo it and hold for a few intervals;
+//   - otherwise add threads: double the limit until the first knee or
+//     backoff (slow start), then one at a time (additive increase).
+//
+// A latency rise that outlasts a backoff to min_limit is taken as the new
+// unloaded latency, so a file system that stays slow is not held at the
+// minimum forever.
+class AdaptiveLimit {
+ public:
+  struct Options {
+    unsigned min_limit = 1;
+    unsigned max_limit = 64;
+    unsigned initial_limit = 4;
+    std::chrono::milliseconds interval{100};
+    double tolerance = 2.0;
+    // Intervals spent at a found knee before probing upwards again.
+    unsigned hold_intervals = 10;
+  };
+
+  AdaptiveLimit();
+  explicit AdaptiveLimit(Options options);
+
+  AdaptiveLimit(const AdaptiveLimit&) = delete;
+  AdaptiveLimit& operator=(const AdaptiveLimit&) = delete;
+
+  unsigned limit() const { return limit_.load(std::memory_order_relaxed); }
+  unsigned peak() const { return peak_.load(std::memory_order_relaxed); }
+  // Times the limit went up or down.
+  unsigned changes() const { return changes_.load(std::memory_order_relaxed); }
+
+  // Blocks while slot >= limit(), unless the gate has been closed.
+  void admit(unsigned slot) {
+    if (slot >= limit_.load(std::memory_order_acquire)) wait_admitted(slot);
+  }
+
+  // Reports operations that took `latency` each on average and completed
+  // `work` units (bytes, entries). Runs the controller when an interval
+  // has passed.
+  void record(std::chrono::nanoseconds latency, std::uint64_t ops, std::uint64_t work);
+
+  // Releases every parked thread and stops gating, e.g. so that a pool can
+  // drain its queue and exit.
+  void close();
+
+ private:
+  void wait_admitted(unsigned slot);
+  void update(double seconds);
+  void set_limit(unsigned limit);
+
+  const Options options_;
+  std::atomic<unsigned> limit_;
+  std::atomic<unsigned> peak_;
+  std::atomic<unsigned> changes_{0};
+
+  std::atomic<std::int64_t> latency_ns_{0};
+  std::atomic<std::uint64_t> ops_{0};
+  std::atomic<std::uint64_t> work_{0};
+  std::atomic<std::int64_t> interval_start_;
+
+  // Controller state, guarded by update_mu_.
+  std::mutex update_mu_;
+  double base_latency_ = 0;
+  double last_throughput_ = 0;
+  unsigned last_step_ = 0;
+  unsigned hold_ = 0;
+  bool slow_start_ = true;
+
+  std::mutex gate_mu_;
+  std::condition_variable gate_cv_;
+  bool closed_ = false;
+};
+
+}  // namespace dms
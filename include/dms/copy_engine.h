@@ -0,0 +1,264 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "dms/arena.h"
+#include "dms/checksum.h"
+#include "dms/io_backend.h"
+#include "dms/numa.h"
+#include "dms/offload.h"
+#include "dms/rate_limit.h"
+#include "dms/scheduler.h"
+#include "dms/units.h"
+
+namespace dms {
+
+struct FileTask {
+  std::string src;
+  std::string dst;
+};
+
+// Receives the digest of every file copied without errors. Called from the
+// worker threads, so it must be thread-safe.
+using DigestSink = std::function<void(const FileTask& file, std::uint64_t digest)>;
+
+// Receives how each file copied without errors got its data (see
+// offload.h). Called from the planner and worker threads, so it must be
+// thread-safe.
+using CopyPathSink = std::function<void(const FileTask& file, CopyPath path)>;
+
+struct CopyOptions {
+  // Files are split into chunks of this size; each chunk is an independent
+  // unit of work, so one large file is moved by every worker at once.
+  std::size_t chunk_size = 8 * MiB;
+  // Number of I/O worker threads; 0 means std::thread::hardware_concurrency().
+  unsigned threads = 0;
+  // Let the number of busy workers, and of walker threads in copy_tree(),
+  // follow the measured I/O latency and throughput (see concurrency.h):
+  // grow until throughput stops improving, back off when latency climbs.
+  // `threads` and `scan_threads` are then upper bounds.
+  bool adaptive_concurrency = false;
+  // Chunks buffered between the planner and the workers; 0 means 4 * threads.
+  // Rounded up to a power of two.
+  std::size_t queue_depth = 0;
+  // I/O backend used by every worker; selectable per job for A/B runs.
+  IoBackendKind io_backend = IoBackendKind::kAuto;
+  // Placement of workers and their buffers on multi-socket hosts (numa.h).
+  NumaPolicy numa = NumaPolicy::kNone;
+  // Back the workers' chunk buffers with 2 MiB pages where the system
+  // allows (see arena.h).
+  bool huge_pages = true;
+  // Chunks each worker gathers into one batched read and write submission.
+  unsigned io_batch = 4;
+  // Bypass the page cache with O_DIRECT for files of at least
+  // direct_io_min_size bytes; smaller files stay on buffered I/O. Enabling
+  // this rounds chunk_size up to a multiple of kDirectIoAlignment.
+  bool direct_io = false;
+  std::uint64_t direct_io_min_size = 64 * MiB;
+  // Keep holes: files with fewer blocks than their size are mapped with
+  // SEEK_DATA/SEEK_HOLE (or FIEMAP) and only their data extents are read
+  // and written (see sparse.h), so the destination stays sparse. Holes
+  // are punched into a destination kept by sync or resume. Sparse files
+  // do not use O_DIRECT.
+  bool sparse = true;
+  // Copy offload (see offload.h). A chunked file is first reflinked to its
+  // destination, which finishes it without moving a byte; failing that,
+  // workers move its chunks with copy_file_range(), which the kernel or
+  // the file server carries out. Where the file systems refuse, the file
+  // falls back to the workers' reads and writes. Files are not offloaded
+  // when checksumming, which needs their bytes, and sync mode compares the
+  // chunks a destination already covers as usual. Under kAuto, files due
+  // for O_DIRECT (see direct_io) may still be reflinked but are not given
+  // to copy_file_range(), so they never fall back to buffered I/O;
+  // kCopyRange offloads them regardless.
+  OffloadMode offload = OffloadMode::kAuto;
+  CopyPathSink path_sink;
+  // Files of at most small_file_max bytes are not chunked; workers gather
+  // them into packed transfer units of about pack_size bytes (see pack.h)
+  // and unpack them at the destination. 0 disables packing.
+  std::uint64_t small_file_max = 64 * KiB;
+  std::size_t pack_size = 4 * MiB;
+  // Copy the files packing would take as one coroutine each instead (see
+  // reactor.h). reactor_threads event-loop threads open, stat, read, write
+  // and close them through their io_uring instances, with up to
+  // max_in_flight files started and unfinished and no thread blocked per
+  // file. Suits file systems where every open is a round trip to a
+  // server. Files are copied as they are planned; the metadata pool gives
+  // them their mode and mtime.
+  bool coroutines = false;
+  unsigned reactor_threads = 2;
+  std::size_t max_in_flight = 1 << 20;
+  // Directory-walker threads for copy_tree(); 0 means the same as threads.
+  unsigned scan_threads = 0;
+  // Copied entries get the source's mode and mtime, and with these its
+  // owner and extended attributes, from a pool of metadata_threads threads
+  // (0: the same as threads) in batches of up to metadata_batch entries of
+  // one directory (see metadata.h). Directories get theirs at the end of
+  // the job, deepest first. Packed files get mode and mtime as they are
+  // unpacked, and again from the pool after their owner or xattrs.
+  unsigned metadata_threads = 0;
+  std::size_t metadata_batch = 256;
+  bool preserve_owner = false;
+  bool preserve_xattrs = false;
+  // Path of a chunk journal (see journal.h). When set, completed chunks are
+  // logged there and chunks logged by an earlier run of the same job are
+  // skipped, so an interrupted job resumes instead of starting over.
+  std::string journal;
+  // fdatasync() each destination before journaling its chunks, and the
+  // journal itself (Journal::Options::durable). Without it a chunk can be
+  // journaled before its data is durable, which is safe against a killed
+  // client but not against a crash of the destination host.
+  bool journal_sync_data = false;
+  // Set by another thread (e.g. on SIGINT) to stop copy_manifest() from
+  // planning further entries: the entries planned so far are still copied
+  // and JobStats::manifest_offset tells where to resume.
+  const std::atomic<bool>* stop_planning = nullptr;
+  // Checksum computed by the workers over each chunk as it passes through
+  // their buffers, so verification costs no extra read of the source. Chunk
+  // digests are folded into a file digest (see checksum.h) and handed to
+  // digest_sink.
+  ChecksumKind checksum = ChecksumKind::kNone;
+  DigestSink digest_sink;
+  // Incremental sync. Files whose destination already has the source's size
+  // and mtime are skipped without being opened. Other existing destinations
+  // are not truncated: each chunk they already cover is read on both sides
+  // and compared by XXH3 digest, and only differing chunks are written.
+  // Copied files keep the source mtime, so the next sync skips them. Files
+  // skipped on metadata are not passed to digest_sink.
+  bool sync = false;
+  // Rate limits (see rate_limit.h). Workers acquire a batch's bytes before
+  // reading it; one metadata op is acquired per stat, open-and-create,
+  // directory or symlink creation or attribute fixup, by whichever thread
+  // issues it. Null
+  // means unthrottled; limits may be changed while the job runs.
+  std::shared_ptr<Throttle> throttle;
+  // Jobs run concurrently with the same scheduler (see scheduler.h) share
+  // its slots by priority class and, within a class, by weight. Workers
+  // take a slot for each batch of chunks or pack they move, so a job of a
+  // higher class takes slots over from running jobs at their next batch
+  // boundary. Null means the job's workers run unscheduled. Files copied
+  // by coroutines are not scheduled.
+  std::shared_ptr<Scheduler> scheduler;
+  Priority priority = Priority::kNormal;
+  unsigned weight = 1;
+};
+
+struct JobStats {
+  std::uint64_t files = 0;
+  std::uint64_t failed_files = 0;
+  // Files whose source or destination was accessed with O_DIRECT.
+  std::uint64_t direct_files = 0;
+  std::uint64_t bytes = 0;
+  std::uint64_t chunks = 0;
+  // Packed transfer units moved, and the files they carried.
+  std::uint64_t packs = 0;
+  std::uint64_t packed_files = 0;
+  // Chunks (and their bytes) skipped because the journal had them as done.
+  std::uint64_t skipped_chunks = 0;
+  std::uint64_t skipped_bytes = 0;
+  // Sync mode: files skipped on size and mtime, and chunks (and bytes)
+  // found identical at the destination and therefore not written.
+  std::uint64_t unchanged_files = 0;
+  std::uint64_t matched_chunks = 0;
+  std::uint64_t matched_bytes = 0;
+  // Files copied as sparse, and the hole bytes neither read nor written.
+  std::uint64_t sparse_files = 0;
+  std::uint64_t hole_bytes = 0;
+  // Files cloned by reflink, files whose chunks copy_file_range() moved
+  // throughout, and the bytes it moved. Offloaded chunks also count in
+  // `chunks` and `bytes`; reflinked files only in `files`.
+  std::uint64_t reflinked_files = 0;
+  std::uint64_t reflinked_bytes = 0;
+  std::uint64_t copy_range_files = 0;
+  std::uint64_t copy_range_bytes = 0;
+  // Entries whose attributes the metadata pool set, and the batches it
+  // applied them in. Entries it failed on count as failed files.
+  std::uint64_t metadata_files = 0;
+  std::uint64_t metadata_dirs = 0;
+  std::uint64_t metadata_batches = 0;
+  // Files copied by coroutines, and the most in flight at once.
+  std::uint64_t coroutine_files = 0;
+  std::uint64_t peak_in_flight = 0;
+  double seconds = 0;
+  // Workers allowed to run at the end of the job and at most; both equal
+  // the thread count unless adaptive_concurrency is set.
+  unsigned final_threads = 0;
+  unsigned peak_threads = 0;
+  // Time the job's threads spent blocked on the throttle, summed.
+  double throttled_seconds = 0;
+  // Time the scheduler held the job's workers back, waiting for slots or
+  // for its byte rate, summed.
+  double scheduled_seconds = 0;
+  // Name of the I/O backend the workers ran on ("uring" or "psync").
+  std::string io_backend;
+  // Checksum and kernel in use, e.g. "crc32c (avx512)", or "none".
+  std::string checksum;
+  // The workers' chunk buffers and the pages backing them, e.g. "32 x 8.00
+  // MiB (thp)".
+  std::string buffers;
+  // The reactor running the coroutines, e.g. "2 threads (uring)", or
+  // "none".
+  std::string reactor;
+  // NUMA policy and the nodes it spreads the workers over, e.g. "local (2
+  // nodes)", or "none".
+  std::string numa;
+  // copy_manifest(): the offset of the first manifest block not fully
+  // planned, i.e. the block planning stopped at, or the end of the
+  // manifest once it was read through. Passed back as start_offset (the
+  // CLI's --resume-offset), it restarts planning there.
+  std::uint64_t manifest_offset = 0;
+  // The first few per-file errors, formatted as "path: reason".
+  std::vector<std::string> errors;
+
+  double throughput() const { return seconds > 0 ? static_cast<double>(bytes) / seconds : 0; }
+};
+
+// Parallel chunked copy engine. A job is planned on the calling thread
+// (open, size, split into chunks) while a pool of workers moves chunks with
+// positional reads and writes, so chunks of the same file land concurrently.
+// Each worker owns an IoBackend and submits its reads and writes in batches.
+class CopyEngine {
+ public:
+  explicit CopyEngine(CopyOptions options = {});
+
+  const CopyOptions& options() const { return options_; }
+
+  // Copies each src to dst, creating or truncating dst.
+  JobStats copy_files(const std::vector<FileTask>& files);
+
+  // Recursively copies the tree at src_root into dst_root. The tree is
+  // walked by a parallel Scanner whose entries are planned as they stream
+  // in, so copying starts long before the walk ends. Directories and
+  // symlinks are recreated; other special files are skipped.
+  JobStats copy_tree(const std::string& src_root, const std::string& dst_root);
+
+  // Copies the entries listed in a manifest (see manifest.h), whose paths
+  // are relative to src_root, into dst_root. The manifest is read one block
+  // at a time, so planning memory does not grow with the job. A non-zero
+  // start_offset, taken from JobStats::manifest_offset of an earlier run or
+  // from ManifestReader::block_offset(), resumes planning at that block.
+  JobStats copy_manifest(const std::string& manifest, const std::string& src_root,
+                         const std::string& dst_root, std::uint64_t start_offset = 0);
+
+ private:
+  class Job;
+
+  // A finished job's arena for `node` with at least `count` buffers, or a
+  // new one. Keeping arenas between jobs spares later jobs faulting their
+  // buffers in again.
+  std::unique_ptr<BufferArena> take_arena(int node, std::size_t count);
+  void return_arena(std::unique_ptr<BufferArena> arena);
+
+  CopyOptions options_;
+  std::mutex arenas_mu_;
+  std::vector<std::unique_ptr<BufferArena>> arenas_;
+};
+
+}  // namespace dms
@@ -0,0 +1,197 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "dms/checksum.h"
+#include "dms/compress.h"
+#include "dms/copy_engine.h"
+#include "dms/dedup.h"
+#include "dms/file_sender.h"
+#include "dms/rate_limit.h"
+#include "dms/units.h"
+
+namespace dms {
+
+// Data streams from the client to a data mover.
+//
+// A stream is a sequence of 24-byte headers, some followed by payload:
+//
+//   header   "DMSD", u16 type, u16 reserved, u32 file id, u32 length,
+//            u64 offset
+//
+//   kHello   offset: session id. First on every connection; connections
+//            with the same session share their files.
+//   kOpen    file id, offset: file size, payload: `length` bytes of the
+//            destination path, relative to the mover's root.
+//   kData    file id, offset, payload: `length` bytes of file data.
+//   kEnd     no more frames on this connection; answered like kSync.
+//   kAck     mover to client, after kSync or kEnd: offset: data bytes
+//            received on the connection so far, file id: files completed
+//            by it.
+//   kZData   like kData, with the codec (see compress.h) in the reserved
+//            field; payload: u32 uncompressed length, then `length - 4`
+//            bytes of compressed data.
+//   kRef     file id, offset: where a chunk goes; payload: u32 chunk
+//            length, u64 source offset, u64 and u64 XXH3-128 of the chunk
+//            (low, high), then `length - 28` bytes of the source path,
+//            relative to the mover's root. The mover copies the chunk from
+//            the source if it still has that fingerprint.
+//   kMiss    mover to client, before a kAck: file id, offset, length: a
+//            kRef chunk the mover could not find. The client sends it.
+//   kSync    the mover answers with a kMiss for each kRef since the last
+//            kSync that it could not satisfy, then a kAck.
+//
+// Uncompressed file data goes into the socket straight from the page
+// cache (see FileSender), so a kData payload is never built in user space.
+enum class StreamFrame : std::uint16_t {
+  kHello = 1,
+  kOpen = 2,
+  kData = 3,
+  kEnd = 4,
+  kAck = 5,
+  kZData = 6,
+  kRef = 7,
+  kMiss = 8,
+  kSync = 9,
+};
+
+constexpr std::size_t kStreamHeaderSize = 24;
+// Largest chunk the mover holds in memory: the uncompressed length of a
+// kZData chunk, or the length of a kRef chunk.
+constexpr std::size_t kMaxBufferedChunk = 64 * MiB;
+
+struct StreamHeader {
+  StreamFrame type = StreamFrame::kHello;
+  std::uint32_t file_id = 0;
+  std::uint32_t length = 0;
+  std::uint64_t offset = 0;
+  // kZData only.
+  Codec codec = Codec::kNone;
+};
+
+void encode_stream_header(const StreamHeader& header, char* out);
+// Returns false on a bad magic or frame type.
+bool decode_stream_header(const char* in, StreamHeader& header);
+
+// kRef payload before the source path.
+constexpr std::size_t kRefHeaderSize = 28;
+
+struct RefHeader {
+  std::uint32_t length = 0;
+  std::uint64_t source_offset = 0;
+  Hash128 digest;
+};
+
+// The first kRefHeaderSize bytes of a kRef payload.
+void encode_ref_header(const RefHeader& ref, char* out);
+void decode_ref_header(const char* in, RefHeader& ref);
+
+struct PushOptions {
+  SendMethod send_method = SendMethod::kAuto;
+  // Largest kData frame; also the unit the streams take work in.
+  std::size_t chunk_size = 8 * MiB;
+  // Parallel connections at the start, and the most the push may grow to.
+  unsigned streams = 1;
+  unsigned max_streams = 16;
+  // Let the push add and retire streams as it measures throughput and
+  // round-trip time; without it, `streams` stays fixed.
+  bool adaptive = true;
+  std::chrono::milliseconds adapt_interval{200};
+  // Byte-rate limits (see rate_limit.h), acquired by each stream before it
+  // sends a chunk. Null means unthrottled.
+  std::shared_ptr<Throttle> throttle;
+  // Compress chunks on a pool of compress_threads threads (0: one per
+  // CPU) before the streams send them. Each chunk is sampled first and
+  // goes out raw if it will not shrink; with kAuto the sample also picks
+  // the codec. Compressed chunks are read into memory, so they do not
+  // take the zero-copy path. Chunks are capped at 64 MiB when compressing.
+  Codec compression = Codec::kNone;
+  int compression_level = 0;
+  unsigned compress_threads = 0;
+  // Deduplicate against `dedup_index`, the chunks this destination already
+  // holds (see dedup.h). The compress pool cuts each chunk into
+  // content-defined chunks and looks up their fingerprints; one found is
+  // sent as a kRef, which the mover fills from the copy it has. The mover
+  // checks the fingerprint first and reports the chunks it cannot find,
+  // which are then sent as data. Every chunk sent is added to the index,
+  // so repeats within the push are referenced too. Each chunk_size unit is
+  // cut on its own, so that the pool can cut a large file in parallel; an
+  // insertion also costs the partial chunks at the ends of the units
+  // after it, which is why units should stay well above avg_size. Like
+  // compression, this reads chunks into memory and caps them at 64 MiB.
+  std::shared_ptr<ChunkIndex> dedup_index;
+  Chunker::Options dedup_chunking;
+  // Back the buffers chunks are read into for compression or dedup with
+  // 2 MiB pages where the system allows (see arena.h).
+  bool huge_pages = true;
+};
+
+struct PushStats {
+  std::uint64_t files = 0;
+  std::uint64_t bytes = 0;
+  std::uint64_t failed_files = 0;
+  double seconds = 0;
+  // CPU time of the sending and compressing threads, including the
+  // kernel's share.
+  double cpu_seconds = 0;
+  // The method in use at the end, after any fallback.
+  std::string send_method;
+  std::uint64_t zerocopy_sends = 0;
+  std::uint64_t zerocopy_copied = 0;
+  // Most streams open at once, streams open at the end, and how often the
+  // count changed.
+  unsigned peak_streams = 0;
+  unsigned final_streams = 0;
+  unsigned stream_changes = 0;
+  // Codec requested, chunks sent compressed and raw, and the data and
+  // reference bytes that went on the wire (equal to `bytes` without
+  // compression or dedup).
+  std::string compression;
+  std::uint64_t compressed_chunks = 0;
+  std::uint64_t raw_chunks = 0;
+  std::uint64_t wire_bytes = 0;
+  // Content-defined chunks looked up, chunks sent as references and the
+  // bytes the mover copied for them, and references it could not satisfy
+  // (sent again as data).
+  std::uint64_t dedup_chunks = 0;
+  std::uint64_t dedup_hits = 0;
+  std::uint64_t dedup_bytes = 0;
+  std::uint64_t dedup_misses = 0;
+  // The first few errors, formatted as "path: reason".
+  std::vector<std::string> errors;
+
+  double compression_ratio() const {
+    return bytes > 0 ? static_cast<double>(wire_bytes) / static_cast<double>(bytes) : 1;
+  }
+
+  double cpu_seconds_per_gib() const {
+    return bytes > 0 ? cpu_seconds * static_cast<double>(GiB) / static_cast<double>(bytes) : 0;
+  }
+};
+
+// Sends the files to the mover at `address` ("host:port"); each task's dst
+// is a path below the mover's root.
+//
+// The files are cut into chunks that a set of streams (connections of one
+// session) take in order, so a single large file is striped across all of
+// them; the mover writes every chunk at its offset, wherever it arrived.
+// With `adaptive`, a controller samples throughput and smoothed RTT every
+// adapt_interval and hill-climbs the stream count: it probes with one more
+// stream, doubles the count while each step raises throughput by more than
+// 5%, undoes a step that does not and waits before probing again, and
+// retires a stream when the RTT climbs well above the lowest seen, a sign
+// that the extra streams only fill queues.
+//
+// Source files that cannot be opened are counted in failed_files. Throws
+// std::system_error if a connection fails or a source shrinks while being
+// sent, and std::runtime_error if the mover does not acknowledge every
+// byte or the requested codec is unavailable.
+PushStats push_files(const std::string& address, const std::vector<FileTask>& files,
+                     const PushOptions& options = {});
+
+}  // namespace dms
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "dms/checksum.h"
+#include "dms/units.h"
+
+namespace dms {
+
+// Content-defined chunking in the style of FastCDC: a gear hash rolls over
+// the data and a chunk ends where the hash has a run of zero bits, so an
+// insertion moves only the boundaries next to it and the chunks after it
+// are found again. Normalized chunking tests more bits before avg_size and
+// fewer after it, which keeps most chunks close to avg_size, and no chunk
+// is shorter than min_size or longer than max_size.
+//
+// The hash at a byte covers the 64 bytes ending at it (older bytes have
+// been shifted out of the 64-bit state), whatever the previous boundary
+// was. That makes every byte's hash independent of the others, so the
+// scan for candidate boundaries runs on eight stretches of the data at
+// once in AVX-512 lanes, and only the short pass that
+// applies the size rules to the candidates is sequential.
+class Chunker {
+ public:
+  struct Options {
+    // Clamped to at least 64 bytes; avg_size is rounded to a power of two.
+    std::size_t min_size = 16 * KiB;
+    std::size_t avg_size = 64 * KiB;
+    std::size_t max_size = 256 * KiB;
+  };
+
+  Chunker();
+  explicit Chunker(Options options);
+
+  const Options& options() const { return options_; }
+
+  // Appends to `ends` the end offsets of the chunks of `data`, which must
+  // start at a chunk boundary. Unless `last`, the chunk running into the
+  // end of `data` is left out, since more data could move its end. Returns
+  // the end of the last chunk appended, or 0.
+  std::size_t split(const char* data, std::size_t size, bool last,
+                    std::vector<std::size_t>& ends) const;
+
+ private:
+  Options options_;
+  std::uint64_t strict_mask_;  // before avg_size
+  std::uint64_t loose_mask_;   // from avg_size on; a subset of strict_mask_
+};
+
+// The candidate-scan kernel chosen for this CPU: "avx512" or "scalar".
+const char* cdc_implementation();
+
+// Where the chunks with a given fingerprint (XXH3-128 of their content)
+// are held at one destination, so that pushing the same data again can
+// reference them instead of sending it. Safe to use from many threads.
+//
+// Saved as "DMSCHIX1", u32 path count, u64 entry count, the paths (u32
+// length, bytes), the entries (u64 digest low, u64 digest high, u64
+// offset, u32 length, u32 path index) and an XXH3-64 of everything before
+// it, all little-endian. Entries are only hints: the mover checks the
+// fingerprint of the data it finds before using it.
+class ChunkIndex {
+ public:
+  struct Location {
+    std::string path;  // below the destination root
+    std::uint64_t offset = 0;
+    std::uint32_t length = 0;
+  };
+
+  ChunkIndex() = default;
+
+  ChunkIndex(const ChunkIndex&) = delete;
+  ChunkIndex& operator=(const ChunkIndex&) = delete;
+
+  // Adds the entries saved at `path`; a missing file adds nothing. Throws
+  // std::system_error on I/O errors and std::runtime_error if the file is
+  // not a valid index.
+  void load(const std::string& path);
+  // Writes the index to `path` through a temporary file and a rename, so a
+  // crash leaves the old index or the new one. Throws std::system_error.
+  void save(const std::string& path) const;
+
+  bool find(const Hash128& digest, Location& location) const;
+  // Records or replaces where the chunk with `digest` is held.
+  void insert(const Hash128& digest, const std::string& path, std::uint64_t offset,
+              std::uint32_t length);
+  std::size_t size() const;
+
+ private:
+  struct Entry {
+    std::uint64_t offset;
+    std::uint32_t length;
+    std::uint32_t path;
+  };
+
+  struct DigestHash {
+    std::size_t operator()(const Hash128& h) const { return static_cast<std::size_t>(h.low); }
+  };
+
+  // Called with mu_ held.
+  std::uint32_t path_id(const std::string& path);
+
+  mutable std::mutex mu_;
+  std::unordered_map<Hash128, Entry, DigestHash> entries_;
+  std::vector<std::string> paths_;
+  std::unordered_map<std::string, std::uint32_t> path_ids_;
+};
+
+}  // namespace dms
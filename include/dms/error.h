@@ -0,0 +1,14 @@
+#pragma once
+
+#include <string>
+
+namespace dms {
+
+// Throws std::system_error built from the current errno, prefixed with `what`.
+[[noreturn]] void throw_errno(const std::string& what);
+
+// Throws std::system_error for an explicit error code (e.g. a negative
+// return value from a syscall that does not set errno).
+[[noreturn]] void throw_errno(int err, const std::string& what);
+
+}  // namespace dms
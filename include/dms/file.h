@@ -0,0 +1,57 @@
+#pragma once
+
+#include <sys/types.h>
+#include <time.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+
+namespace dms {
+
+// Owning file descriptor; closes on destruction.
+class UniqueFd {
+ public:
+  UniqueFd() = default;
+  explicit UniqueFd(int fd) : fd_(fd) {}
+  ~UniqueFd() { reset(); }
+
+  UniqueFd(UniqueFd&& other) noexcept : fd_(other.release()) {}
+  UniqueFd& operator=(UniqueFd&& other) noexcept {
+    if (this != &other) reset(other.release());
+    return *this;
+  }
+  UniqueFd(const UniqueFd&) = delete;
+  UniqueFd& operator=(const UniqueFd&) = delete;
+
+  int get() const { return fd_; }
+  explicit operator bool() const { return fd_ >= 0; }
+
+  int release() { return std::exchange(fd_, -1); }
+  void reset(int fd = -1);
+
+  // Closes the descriptor and reports the close() result, which matters for
+  // write-back errors on network and parallel file systems.
+  int close();
+
+ private:
+  int fd_ = -1;
+};
+
+// Opens `path`, throwing std::system_error on failure.
+UniqueFd open_or_throw(const std::string& path, int flags, mode_t mode = 0);
+
+// Reads exactly `len` bytes at `offset` unless EOF is reached first; returns
+// the number of bytes read. Retries on EINTR and short reads.
+std::size_t pread_full(int fd, void* buf, std::size_t len, off_t offset);
+
+// Writes exactly `len` bytes at `offset`. Retries on EINTR and short writes.
+void pwrite_full(int fd, const void* buf, std::size_t len, off_t offset);
+
+// A time in nanoseconds since the epoch as a timespec. Rounds down, so
+// tv_nsec stays in [0, 1e9) for times before 1970 too, as utimensat()
+// requires.
+struct timespec to_timespec(std::int64_t ns);
+
+}  // namespace dms
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <string>
+
+#include "dms/file.h"
+
+namespace dms {
+
+enum class SendMethod {
+  kAuto,      // sendfile, falling back like kSendfile
+  kZerocopy,  // mmap the file and send() it with MSG_ZEROCOPY
+  kSendfile,  // sendfile(2) straight from the page cache
+  kSplice,    // splice(2) file -> pipe -> socket
+  kCopy,      // pread into a buffer, then send()
+};
+
+const char* to_string(SendMethod method);
+
+// Parses "auto", "zerocopy", "sendfile", "splice" or "copy"; throws
+// std::invalid_argument otherwise.
+SendMethod parse_send_method(const std::string& text);
+
+// Sends file data to a connected stream socket without passing it through
+// user space where the kernel allows it.
+//
+// A method the kernel or the file system refuses (e.g. SO_ZEROCOPY on an
+// old kernel, sendfile from a file system without splice support) is
+// dropped for the next one in the order zerocopy, sendfile, splice, copy,
+// for the rest of the sender's life; method() tells which one ended up in
+// use.
+//
+// MSG_ZEROCOPY only pays off for large sends, and the kernel still copies
+// on loopback; zerocopy_copied() counts the sends where it did. Mapped
+// file ranges stay mapped until the kernel reports it is done with them.
+// Not thread-safe; use one sender per socket.
+class FileSender {
+ public:
+  FileSender(int socket, SendMethod method);
+  // Calls finish(), ignoring errors.
+  ~FileSender();
+
+  FileSender(const FileSender&) = delete;
+  FileSender& operator=(const FileSender&) = delete;
+
+  // Sends a small buffer such as a frame header. With `more`, the kernel
+  // holds it back to go out with the data that follows.
+  void send_bytes(const void* data, std::size_t length, bool more = false);
+
+  // Sends `length` bytes of `fd` starting at `offset`. Throws
+  // std::system_error, with EIO if the file ends early.
+  void send_file(int fd, std::uint64_t offset, std::size_t length);
+
+  // Waits until no zerocopy send references a mapped file range any more.
+  void finish();
+
+  SendMethod method() const { return method_; }
+  std::uint64_t zerocopy_sends() const { return zc_next_; }
+  std::uint64_t zerocopy_copied() const { return zc_copied_; }
+
+ private:
+  struct Mapping {
+    void* addr;
+    std::size_t length;
+    std::uint32_t end_id;  // done once zc_done_ reaches this
+  };
+
+  // Each returns false, having sent nothing, if the method is unusable.
+  bool send_zerocopy(int fd, std::uint64_t& offset, std::size_t& length);
+  bool send_sendfile(int fd, std::uint64_t& offset, std::size_t& length);
+  bool send_splice(int fd, std::uint64_t& offset, std::size_t& length);
+  void send_copy(int fd, std::uint64_t offset, std::size_t length);
+
+  // Reads zerocopy completions, waiting for at least one if `wait`, and
+  // unmaps the ranges they release.
+  void reap(bool wait);
+
+  int socket_;
+  SendMethod method_;
+
+  std::deque<Mapping> mappings_;
+  std::uint32_t zc_next_ = 0;  // id of the next MSG_ZEROCOPY send
+  std::uint32_t zc_done_ = 0;  // every id below this has completed
+  std::uint64_t zc_copied_ = 0;
+
+  UniqueFd pipe_read_;
+  UniqueFd pipe_write_;
+  std::size_t pipe_size_ = 0;
+
+  std::unique_ptr<char[]> buffer_;
+};
+
+// CPU time consumed so far by the calling thread, in seconds.
+double thread_cpu_seconds();
+
+}  // namespace dms
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <sys/uio.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace dms {
+
+enum class IoBackendKind {
+  kAuto,   // io_uring when the kernel allows it, otherwise psync
+  kUring,  // io_uring with registered buffers, fixed files and batched submits
+  kPsync,  // blocking pread/pwrite on the calling worker thread
+};
+
+const char* to_string(IoBackendKind kind);
+
+// Parses "auto", "uring" or "psync"; throws std::invalid_argument otherwise.
+IoBackendKind parse_io_backend(const std::string& text);
+
+enum class IoOp : std::uint8_t { kRead, kWrite };
+
+struct IoRequest {
+  IoOp op = IoOp::kRead;
+  int fd = -1;
+  // Identifies the open file across requests so a backend can keep it in a
+  // fixed-file slot. Must never be reused for a different file; 0 disables.
+  std::uint64_t file_id = 0;
+  void* buf = nullptr;
+  std::size_t length = 0;
+  std::uint64_t offset = 0;
+  // Index into the buffers passed to register_buffers(), or -1.
+  int buf_index = -1;
+
+  // Filled in by submit(): bytes transferred, or -errno. Short transfers are
+  // retried by the backend, so a read returns less than `length` only at EOF.
+  std::int64_t result = 0;
+};
+
+// A per-thread I/O engine. Instances are not thread-safe; every copy worker
+// owns one, which makes the psync backend a pread/pwrite thread pool and
+// gives each worker its own io_uring instance.
+class IoBackend {
+ public:
+  virtual ~IoBackend() = default;
+
+  virtual const char* name() const = 0;
+
+  // Announces long-lived buffers so the backend can pin them once. Returns
+  // false if the backend could not register them; requests then run with
+  // buf_index ignored.
+  virtual bool register_buffers(const std::vector<iovec>& buffers) {
+    (void)buffers;
+    return false;
+  }
+
+  // Executes every request in the batch and waits for all of them.
+  virtual void submit(IoRequest* requests, std::size_t count) = 0;
+
+  // Drops any references the backend holds to files of earlier batches.
+  virtual void release_files() {}
+};
+
+// Returns true if io_uring can be set up in this process (kernel support and
+// not disabled by sysctl or seccomp). The probe runs once.
+bool uring_available();
+
+// Creates a backend able to keep `queue_depth` requests in flight. kAuto
+// falls back to psync when io_uring is unavailable; an explicit kUring
+// throws std::system_error instead.
+std::unique_ptr<IoBackend> make_io_backend(IoBackendKind kind, unsigned queue_depth);
+
+}  // namespace dms
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <future>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "dms/file.h"
+#include "dms/rpc.h"
+
+namespace dms {
+
+// Asynchronous job submission to a DMS server over one connection.
+//
+// submit() only queues the job and returns a future for its receipt. A
+// sender thread drains the queue into kSubmit frames of up to
+// max_batch_jobs jobs and writes them without waiting for replies, up to
+// max_inflight_frames unanswered frames; a receiver thread matches the
+// kReceipts frames to them and fulfils the futures. Batching needs no
+// timer: while one frame is on the wire, the next one fills up, so a lone
+// submission leaves at once and a burst leaves in full frames.
+//
+// If the connection fails, every unanswered future (and every later
+// submit()) carries the error as an exception.
+class JobClient {
+ public:
+  struct Options {
+    std::size_t max_batch_jobs = 4096;
+    std::size_t max_batch_bytes = 1 << 20;
+    std::size_t max_inflight_frames = 64;
+    // submit() blocks while this many jobs wait for the sender.
+    std::size_t max_queued_jobs = 1 << 18;
+  };
+
+  // Connects to `address` ("host:port"). Throws std::system_error.
+  explicit JobClient(const std::string& address);
+  JobClient(const std::string& address, Options options);
+  // Calls close().
+  ~JobClient();
+
+  JobClient(const JobClient&) = delete;
+  JobClient& operator=(const JobClient&) = delete;
+
+  std::future<JobReceipt> submit(JobSpec job);
+
+  // Blocks until every job submitted so far has its receipt or has failed.
+  void flush();
+
+  // Sends what is queued, waits for the receipts and closes the
+  // connection. Further submissions fail with std::logic_error.
+  void close();
+
+  std::uint64_t frames_sent() const { return frames_sent_.load(); }
+  std::uint64_t jobs_sent() const { return jobs_sent_.load(); }
+
+ private:
+  struct Queued {
+    JobSpec job;
+    std::promise<JobReceipt> promise;
+  };
+  struct InFlight {
+    std::uint64_t sequence;
+    std::vector<std::promise<JobReceipt>> promises;
+  };
+
+  void send_loop();
+  void receive_loop();
+  // Records the first error and fails every queued and unanswered job.
+  void fail(std::exception_ptr error);
+
+  Options options_;
+  UniqueFd fd_;
+
+  std::mutex mu_;
+  std::condition_variable work_cv_;  // sender: jobs queued or window opened
+  std::condition_variable done_cv_;  // submit() and flush(): room or receipts
+  std::deque<Queued> queued_;
+  std::deque<InFlight> inflight_;
+  std::uint64_t submitted_ = 0;
+  std::uint64_t completed_ = 0;
+  std::uint64_t next_sequence_ = 1;
+  bool closing_ = false;
+  std::exception_ptr error_;
+
+  std::atomic<std::uint64_t> frames_sent_{0};
+  std::atomic<std::uint64_t> jobs_sent_{0};
+
+  std::thread sender_;
+  std::thread receiver_;
+};
+
+}  // namespace dms
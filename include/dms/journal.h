@@ -0,0 +1,115 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "dms/file.h"
+
+namespace dms {
+
+// Append-only log of completed chunks, used to resume an interrupted job.
+//
+// Each record is 32 bytes: u64 file key, u64 chunk offset, u64 chunk
+// digest, u32 chunk length, u32 check (FNV-1a of the first 28 bytes), all
+// little-endian. The file key identifies a (destination, source size,
+// source mtime, chunk size, checksum kind) tuple, so a source that changed
+// between runs is copied again, and a resumed chunk's digest was computed
+// the way the current job computes it.
+// A torn or corrupt tail left by a crash is cut off when the journal is
+// reopened.
+//
+// Appends go to an in-memory buffer under a short lock. A background thread
+// writes the buffer once per sync_interval or whenever sync_records records
+// are pending, so workers never wait on the disk and many completions share
+// one write (group commit). A written record survives a killed client. A
+// durable journal also fdatasync()s every batch, to survive a crash of the
+// host; its file is zero-filled ahead of the records, so those syncs only
+// flush data.
+class Journal {
+ public:
+  struct Options {
+    std::chrono::milliseconds sync_interval{100};
+    std::size_t sync_records = 4096;
+    // fdatasync() each batch. Only worth it when the chunks themselves are
+    // durable before they are recorded: otherwise a synced record can
+    // outlive its chunk's data in a host crash.
+    bool durable = true;
+  };
+
+  // Opens or creates the journal at `path` and loads its completed chunks.
+  // Throws std::system_error on I/O errors.
+  explicit Journal(const std::string& path);
+  Journal(const std::string& path, Options options);
+  // Flushes and syncs everything recorded.
+  ~Journal();
+
+  Journal(const Journal&) = delete;
+  Journal& operator=(const Journal&) = delete;
+
+  static std::uint64_t file_key(const std::string& dst, std::uint64_t size,
+                                std::int64_t mtime_ns, std::uint64_t chunk_size,
+                                std::uint32_t checksum_kind);
+
+  // Queries against the state loaded at open; appends of this run are not
+  // visible here. Safe to call concurrently without locking.
+  bool has_file(std::uint64_t key) const { return files_.count(key) != 0; }
+  bool is_done(std::uint64_t key, std::uint64_t offset) const;
+  // Digest recorded with a done chunk; 0 if none was.
+  std::uint64_t digest(std::uint64_t key, std::uint64_t offset) const;
+  std::size_t loaded_records() const { return done_.size(); }
+
+  // Records a completed chunk. Thread-safe; does not block on I/O.
+  void record(std::uint64_t key, std::uint64_t offset, std::uint32_t length,
+              std::uint64_t digest = 0);
+
+  // Writes everything recorded so far, and syncs it if durable; throws on
+  // I/O errors.
+  void sync();
+
+  std::uint64_t records_written() const;
+  std::uint64_t syncs() const;
+
+ private:
+  struct PairHash {
+    std::size_t operator()(const std::pair<std::uint64_t, std::uint64_t>& p) const {
+      return static_cast<std::size_t>(p.first ^ (p.second * 0x9e3779b97f4a7c15ULL));
+    }
+  };
+
+  void load();
+  void flusher();
+  // Takes the pending batch, writes and syncs it. Requires io_mu_.
+  void flush_locked();
+  // Zero-fills the journal up to at least `size` bytes. Requires io_mu_.
+  void preallocate_locked(std::uint64_t size);
+  bool error_free() const;
+
+  Options options_;
+  UniqueFd fd_;
+  std::uint64_t end_ = 0;        // end of the valid records
+  std::uint64_t allocated_ = 0;  // end of the zero-filled region
+  std::unordered_set<std::uint64_t> files_;
+  std::unordered_map<std::pair<std::uint64_t, std::uint64_t>, std::uint64_t, PairHash> done_;
+
+  mutable std::mutex mu_;  // guards the fields below up to io_mu_
+  std::condition_variable wake_;
+  std::string pending_;
+  std::size_t pending_records_ = 0;
+  std::uint64_t appended_ = 0;
+  std::uint64_t syncs_ = 0;
+  int error_ = 0;
+  bool stop_ = false;
+  // Held across taking a batch and writing it, so batches land in order and
+  // sync() returns only after everything recorded before it is durable.
+  std::mutex io_mu_;
+  std::thread flusher_;
+};
+
+}  // namespace dms
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "dms/file.h"
+#include "dms/scanner.h"
+
+namespace dms {
+
+// On-disk file list of a job, written and read one block at a time so that
+// neither side ever holds more than a block of entries in memory.
+//
+//   header   "DMSMANI1", u32 version, u32 reserved
+//   block*   "MBLK", u32 entry count, u32 payload size, payload
+//   index    per block: u64 file offset, u64 first entry number, u32 count
+//   trailer  u64 index offset, u64 block count, u64 entry count, "DMSMEND1"
+//
+// A payload entry is: varint shared-prefix length (with the previous path
+// of the same block), varint suffix length, suffix bytes, varint mode,
+// varint size, zigzag-varint mtime delta (from the previous entry of the
+// block). Prefix and delta state resets at every block boundary, so any
+// block decodes on its own; that is what makes resuming at a block offset
+// possible. Integers without "varint" are little-endian fixed width.
+//
+// A manifest without a valid trailer (the writer died) is still readable
+// sequentially up to its last complete block.
+
+struct ManifestBlock {
+  std::uint64_t offset = 0;
+  std::uint64_t first_entry = 0;
+  std::uint32_t entries = 0;
+};
+
+class ManifestWriter {
+ public:
+  // Creates or truncates `path`. `block_entries` bounds both the entries per
+  // block and the writer's memory.
+  explicit ManifestWriter(const std::string& path, std::size_t block_entries = 4096);
+  ~ManifestWriter();
+
+  ManifestWriter(const ManifestWriter&) = delete;
+  ManifestWriter& operator=(const ManifestWriter&) = delete;
+
+  void add(const ScanEntry& entry);
+
+  // Flushes the last block and writes the index and trailer. Called by the
+  // destructor if needed, which swallows errors; call it explicitly to see
+  // them.
+  void close();
+
+  std::uint64_t entries() const { return entries_; }
+  std::size_t blocks() const { return index_.size(); }
+
+ private:
+  void flush_block();
+
+  UniqueFd fd_;
+  std::size_t block_entries_;
+  std::uint64_t offset_ = 0;
+  std::uint64_t entries_ = 0;
+  std::string block_;
+  std::uint32_t block_count_ = 0;
+  std::string prev_path_;
+  std::int64_t prev_mtime_ = 0;
+  std::vector<ManifestBlock> index_;
+  bool closed_ = false;
+};
+
+class ManifestReader {
+ public:
+  // Throws std::system_error if the file cannot be opened and
+  // std::runtime_error if it is not a manifest.
+  explicit ManifestReader(const std::string& path);
+
+  // True when the trailer and block index were found.
+  bool complete() const { return complete_; }
+  // Block index of a complete manifest; empty otherwise.
+  const std::vector<ManifestBlock>& blocks() const { return index_; }
+  std::uint64_t total_entries() const { return total_entries_; }
+
+  // Continues reading at the start of block `block` of the index.
+  void seek_block(std::size_t block);
+  // Continues reading at a block boundary recorded earlier from
+  // block_offset(); works for incomplete manifests too.
+  void seek_offset(std::uint64_t offset);
+
+  // File offset of the block the next entry comes from. Saving it lets a
+  // planner resume at that block later.
+  std::uint64_t block_offset() const { return left_ > 0 ? loaded_offset_ : next_offset_; }
+
+  // Reads the next entry; returns false at the end of the manifest. Throws
+  // std::runtime_error on a corrupt block.
+  bool next(ScanEntry& entry);
+
+ private:
+  bool load_block();
+
+  UniqueFd fd_;
+  std::uint64_t file_size_ = 0;
+  std::uint64_t data_end_ = 0;
+  bool complete_ = false;
+  std::uint64_t total_entries_ = 0;
+  std::vector<ManifestBlock> index_;
+
+  std::uint64_t loaded_offset_ = 0;  // block currently decoded
+  std::uint64_t next_offset_ = 0;    // block after the loaded one
+  std::string payload_;
+  const char* cursor_ = nullptr;
+  std::uint32_t left_ = 0;
+  std::string prev_path_;
+  std::int64_t prev_mtime_ = 0;
+};
+
+}  // namespace dms
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <sys/stat.h>
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "dms/blocking_queue.h"
+#include "dms/rate_limit.h"
+
+namespace dms {
+
+// Attributes to give a destination entry once its data has landed.
+struct MetadataFixup {
+  // Source of the entry; stat()ed for the owner and read for xattrs,
+  // relative to a handle to its directory.
+  std::string src;
+  std::string dst;
+  // st_mode-style type and permission bits. The type decides how the
+  // entry is treated; permissions are not set on symlinks, nor when 0.
+  std::uint32_t mode = 0;
+  // Modification time; left alone when kKeepTime.
+  std::int64_t mtime_ns = kKeepTime;
+
+  static constexpr std::int64_t kKeepTime = INT64_MIN;
+};
+
+struct MetadataOptions {
+  // Worker threads applying batches; 0 means std::thread::hardware_concurrency().
+  // Setting attributes on a parallel file system is a round trip to a
+  // metadata server each, so more threads than cores pay off.
+  unsigned threads = 0;
+  // Entries of one directory applied together against one handle to it.
+  std::size_t batch_size = 256;
+  // Also copy the owner (needs privileges) and the extended attributes.
+  bool owner = false;
+  bool xattrs = false;
+  // One metadata op is acquired per entry; null means unthrottled.
+  std::shared_ptr<Throttle> throttle;
+};
+
+struct MetadataStats {
+  std::uint64_t files = 0;  // non-directories
+  std::uint64_t dirs = 0;
+  std::uint64_t batches = 0;
+  // The first few failures, formatted as "path: reason".
+  std::vector<std::string> errors;
+  std::uint64_t error_count = 0;
+};
+
+// Applies mode, owner, xattrs and times to copied entries off the data
+// path. Setting them one file at a time, each as a path walk from the
+// root, costs as much as the copy itself on Lustre. Instead, add() sorts
+// fixups into per-directory buckets; a full bucket goes to a pool of
+// metadata workers as one batch, which opens its directory once and
+// applies every entry relative to that handle with the *at() calls.
+//
+// Directories are held back until finish(): creating entries in a
+// directory moves its mtime, and a read-only mode would lock out the
+// entries still to come. finish() applies them in one bottom-up pass,
+// deepest first, with the directories of each depth spread over the pool.
+class MetadataBatcher {
+ public:
+  explicit MetadataBatcher(MetadataOptions options = {});
+  ~MetadataBatcher();
+
+  MetadataBatcher(const MetadataBatcher&) = delete;
+  MetadataBatcher& operator=(const MetadataBatcher&) = delete;
+
+  // Thread-safe. May block while the workers are behind.
+  void add(MetadataFixup fixup);
+
+  // Applies everything still pending, then the directories, and stops the
+  // workers. Call once, after the last add().
+  MetadataStats finish();
+
+ private:
+  struct Batch {
+    std::string dir;
+    std::vector<MetadataFixup> entries;
+  };
+
+  void worker_loop();
+  void apply(const Batch& batch);
+  // `src_dirfd` is a handle to the directory of fixup.src, or -1 when
+  // neither the owner nor the xattrs are copied.
+  void apply_entry(int dirfd, int src_dirfd, const MetadataFixup& fixup);
+  void submit(Batch batch);
+  // Submits every bucket and waits until all batches are applied.
+  void drain();
+  void record_error(const std::string& path, const std::string& reason);
+
+  MetadataOptions options_;
+  BlockingQueue<Batch> queue_;
+  std::vector<std::thread> workers_;
+
+  std::mutex mu_;
+  std::condition_variable idle_;
+  std::unordered_map<std::string, std::vector<MetadataFixup>> buckets_;
+  std::size_t pending_ = 0;   // entries in buckets_
+  std::size_t in_flight_ = 0;  // batches submitted and not yet applied
+  std::vector<MetadataFixup> dirs_;
+  MetadataStats stats_;
+  bool finished_ = false;
+};
+
+}  // namespace dms
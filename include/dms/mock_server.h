@@ -0,0 +1,75 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "dms/file.h"
+
+namespace dms {
+
+// In-process stand-in for the DMS server's job-submission endpoint, for
+// testing and benchmarking clients offline.
+//
+// Speaks the protocol of rpc.h: every kSubmit frame is answered with a
+// kReceipts frame that accepts each job under a fresh id, or rejects it if
+// its source or destination is empty. `latency` delays each reply by that
+// much from the arrival of its frame, standing in for the network round
+// trip and server-side work; replies still overlap, as pipelined ones do
+// on a real connection.
+class MockDmsServer {
+ public:
+  struct Options {
+    std::string address = "127.0.0.1:0";
+    std::chrono::microseconds latency{0};
+  };
+
+  // Starts listening and serving. Throws std::system_error.
+  MockDmsServer();
+  explicit MockDmsServer(Options options);
+  // Calls stop().
+  ~MockDmsServer();
+
+  MockDmsServer(const MockDmsServer&) = delete;
+  MockDmsServer& operator=(const MockDmsServer&) = delete;
+
+  // "host:port" to connect to; the real port when listening on port 0.
+  const std::string& address() const { return address_; }
+
+  // Stops accepting and drops every open connection.
+  void stop();
+
+  std::uint64_t connections() const { return connections_.load(); }
+  std::uint64_t frames() const { return frames_.load(); }
+  std::uint64_t jobs() const { return jobs_.load(); }
+
+ private:
+  struct Connection;
+
+  void accept_loop();
+  void serve(Connection& conn);
+  // Called by each of a connection's threads as it ends.
+  void finish(Connection& conn);
+
+  Options options_;
+  UniqueFd listen_fd_;
+  std::string address_;
+  std::thread acceptor_;
+
+  // Running connections, and finished ones not joined yet.
+  std::mutex mu_;
+  std::list<std::unique_ptr<Connection>> conns_;
+  bool stopped_ = false;
+
+  std::atomic<std::uint64_t> next_job_id_{1};
+  std::atomic<std::uint64_t> connections_{0};
+  std::atomic<std::uint64_t> frames_{0};
+  std::atomic<std::uint64_t> jobs_{0};
+};
+
+}  // namespace dms
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "dms/file.h"
+
+namespace dms {
+
+// Receiving end of the data streams of data_stream.h: a minimal data mover
+// that writes what it receives below a root directory, for loopback tests
+// and benchmarks and as the reference for the protocol.
+//
+// Every connection is served by its own thread, and its socket is closed
+// as soon as it ends. Files are shared by the connections of a session, so
+// a file's chunks may arrive over any of them; kOpen may be repeated on
+// each and only the first one creates the file. A file is closed once all
+// of its bytes have arrived and been written; a chunk sent again counts
+// once. A kRef is filled from the referenced file below the root after
+// checking the chunk's fingerprint; with no root, every reference is
+// reported missing.
+class MoverServer {
+ public:
+  struct Options {
+    std::string address = "127.0.0.1:0";
+    // Destination root; empty discards the data, which measures the sender
+    // and the network alone.
+    std::string root;
+    // Cap on each connection's receive rate in bytes/s, 0 for none. Makes
+    // loopback behave like a long-haul path on which a single stream is
+    // limited by its window, for testing striped pushes.
+    std::uint64_t stream_rate = 0;
+  };
+
+  // Starts listening and serving. Throws std::system_error.
+  MoverServer();
+  explicit MoverServer(Options options);
+  // Calls stop().
+  ~MoverServer();
+
+  MoverServer(const MoverServer&) = delete;
+  MoverServer& operator=(const MoverServer&) = delete;
+
+  const std::string& address() const { return address_; }
+
+  // Stops accepting and drops every open connection.
+  void stop();
+
+  std::uint64_t connections() const { return connections_.load(); }
+  std::uint64_t files() const { return files_.load(); }
+  std::uint64_t bytes() const { return bytes_.load(); }
+  // Connections dropped for a protocol or I/O error.
+  std::uint64_t errors() const { return errors_.load(); }
+  // kRef chunks copied from a file already held, and those not found.
+  std::uint64_t refs_copied() const { return refs_copied_.load(); }
+  std::uint64_t refs_missed() const { return refs_missed_.load(); }
+
+ private:
+  struct Session;
+  struct Connection;
+
+  void accept_loop();
+  void serve(Connection& conn);
+  std::shared_ptr<Session> join_session(std::uint64_t id);
+
+  Options options_;
+  UniqueFd listen_fd_;
+  std::string address_;
+  std::thread acceptor_;
+
+  std::mutex mu_;
+  // Running connections, and finished ones not joined yet.
+  std::list<std::unique_ptr<Connection>> conns_;
+  std::map<std::uint64_t, std::weak_ptr<Session>> sessions_;
+  bool stopped_ = false;
+
+  std::atomic<std::uint64_t> connections_{0};
+  std::atomic<std::uint64_t> files_{0};
+  std::atomic<std::uint64_t> bytes_{0};
+  std::atomic<std::uint64_t> errors_{0};
+  std::atomic<std::uint64_t> refs_copied_{0};
+  std::atomic<std::uint64_t> refs_missed_{0};
+};
+
+}  // namespace dms
@@ -0,0 +1,286 @@
+#pragma once
+
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <optional>
+#include <thread>
+#include <utility>
+
+namespace dms {
+
+// Bounded multi-producer/multi-consumer queue without a lock, for stages
+// that hand many small items between many threads, where BlockingQueue
+// would serialize every push and pop on its mutex.
+//
+// The items live in a ring of slots, each with a sequence number that
+// says whether the slot is free or full for the current lap around the
+// ring (Dmitry Vyukov's bounded queue). A producer claims slots by moving
+// the tail forward with a compare-and-swap, moves its items in and
+// publishes each by advancing the slot's sequence; consumers do the same
+// from the head. The batch calls claim a run of consecutive slots with
+// that one compare-and-swap, so the contended counters are touched once
+// per batch instead of once per item.
+//
+// push() and pop() give the back-pressure of BlockingQueue: they spin for
+// a moment when the queue is full (empty) and then sleep on a futex until
+// a consumer makes room (a producer adds an item) or the queue is closed.
+// Waking costs nothing while no thread sleeps.
+template <typename T>
+class MpmcQueue {
+ public:
+  // The capacity is rounded up to a power of two.
+  explicit MpmcQueue(std::size_t capacity)
+      : mask_(round_up(capacity) - 1), slots_(new Slot[mask_ + 1]) {
+    for (std::size_t i = 0; i <= mask_; ++i) slots_[i].seq.store(i, std::memory_order_relaxed);
+  }
+
+  ~MpmcQueue() {
+    const std::size_t tail = tail_.load(std::memory_order_relaxed);
+    for (std::size_t pos = head_.load(std::memory_order_relaxed); pos != tail; ++pos) {
+      slots_[pos & mask_].item()->~T();
+    }
+  }
+
+  MpmcQueue(const MpmcQueue&) = delete;
+  MpmcQueue& operator=(const MpmcQueue&) = delete;
+
+  std::size_t capacity() const { return mask_ + 1; }
+
+  // Items queued or being queued; only a hint while other threads work.
+  std::size_t size_approx() const {
+    const std::size_t head = head_.load(std::memory_order_relaxed);
+    const std::size_t tail = tail_.load(std::memory_order_relaxed);
+    return tail > head ? tail - head : 0;
+  }
+
+  // Non-blocking; `item` is moved from only if it was queued.
+  bool try_push(T&& item) { return try_push_batch(&item, 1) == 1; }
+
+  // Queues as many of the first `count` items as there is room for right
+  // now, in order, and returns how many; those are moved from.
+  std::size_t try_push_batch(T* items, std::size_t count) {
+    std::size_t pos;
+    const std::size_t n = claim(tail_, 0, count, pos);
+    for (std::size_t i = 0; i < n; ++i) {
+      Slot& slot = slots_[(pos + i) & mask_];
+      new (slot.storage) T(std::move(items[i]));
+      slot.seq.store(pos + i + 1, std::memory_order_release);
+    }
+    if (n) not_empty_.notify(n);
+    return n;
+  }
+
+  // Returns false if the queue was closed before the item could be queued.
+  bool push(T item) { return push_batch(&item, 1) == 1; }
+
+  // Queues all `count` items, blocking while the queue is full, and returns
+  // `count`, or how many were queued before the queue was closed.
+  std::size_t push_batch(T* items, std::size_t count) {
+    std::size_t done = 0;
+    while (done < count) {
+      const std::size_t n = wait(not_full_, [&] {
+        return closed_.load(std::memory_order_acquire)
+                   ? kClosed
+                   : try_push_batch(items + done, count - done);
+      });
+      if (n == kClosed) break;
+      done += n;
+    }
+    return done;
+  }
+
+  // Non-blocking pop; returns std::nullopt if no item is ready right now.
+  std::optional<T> try_pop() {
+    std::size_t pos;
+    if (claim(head_, 1, 1, pos) == 0) return std::nullopt;
+    std::optional<T> item(take(pos));
+    not_full_.notify(1);
+    return item;
+  }
+
+  // Moves up to `max` ready items to `out`, in order, and returns how many.
+  std::size_t try_pop_batch(T* out, std::size_t max) {
+    std::size_t pos;
+    const std::size_t n = claim(head_, 1, max, pos);
+    for (std::size_t i = 0; i < n; ++i) out[i] = take(pos + i);
+    if (n) not_full_.notify(n);
+    return n;
+  }
+
+  // Returns std::nullopt once the queue is closed and empty.
+  std::optional<T> pop() {
+    std::optional<T> item;
+    wait(not_empty_, [&]() -> std::size_t {
+      item = try_pop();
+      return item ? 1 : drained() ? kClosed : 0;
+    });
+    return item;
+  }
+
+  // Blocks until at least one item is ready, then moves up to `max` of them
+  // to `out` and returns how many; 0 once the queue is closed and empty.
+  std::size_t pop_batch(T* out, std::size_t max) {
+    const std::size_t n = wait(not_empty_, [&]() -> std::size_t {
+      const std::size_t popped = try_pop_batch(out, max);
+      return popped ? popped : drained() ? kClosed : 0;
+    });
+    return n == kClosed ? 0 : n;
+  }
+
+  // Wakes every waiter; items queued before the call can still be popped.
+  void close() {
+    closed_.store(true, std::memory_order_release);
+    not_full_.notify(INT_MAX);
+    not_empty_.notify(INT_MAX);
+  }
+
+ private:
+  static constexpr std::size_t kClosed = ~std::size_t{0};
+  static constexpr int kSpins = 64;
+
+  struct Slot {
+    std::atomic<std::size_t> seq;
+    alignas(T) unsigned char storage[sizeof(T)];
+
+    T* item() { return std::launder(reinterpret_cast<T*>(storage)); }
+  };
+
+  // Threads sleeping until the other side makes progress. A sleeper
+  // registers, rechecks the queue and sleeps only if the epoch has not
+  // moved since it registered; a waker that finds sleepers moves the epoch
+  // and wakes some of them. The fences on both sides order the queue
+  // update against the count of sleepers, so no wakeup is lost. The waker
+  // unregisters the threads it woke, so the pushes (pops) made before they
+  // get to run do not wake them again.
+  class Waiters {
+   public:
+    std::uint32_t prepare() {
+      sleepers_.fetch_add(1, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      return epoch_.load(std::memory_order_relaxed);
+    }
+
+    void sleep(std::uint32_t epoch) {
+      // 0 only when woken by notify(), which unregistered this thread.
+      if (futex(FUTEX_WAIT_PRIVATE, epoch) != 0) cancel();
+    }
+
+    void cancel() { sleepers_.fetch_sub(1, std::memory_order_relaxed); }
+
+    void notify(std::size_t count) {
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if (sleepers_.load(std::memory_order_relaxed) == 0) return;
+      epoch_.fetch_add(1, std::memory_order_relaxed);
+      const long woken = futex(FUTEX_WAKE_PRIVATE, std::min<std::size_t>(count, INT_MAX));
+      if (woken > 0) sleepers_.fetch_sub(static_cast<std::uint32_t>(woken));
+    }
+
+   private:
+    long futex(int op, std::size_t value) {
+      return ::syscall(SYS_futex, reinterpret_cast<std::uint32_t*>(&epoch_), op,
+                       static_cast<std::uint32_t>(value), nullptr, nullptr, 0);
+    }
+
+    std::atomic<std::uint32_t> epoch_{0};
+    std::atomic<std::uint32_t> sleepers_{0};
+  };
+
+  static std::size_t round_up(std::size_t n) {
+    std::size_t p = 2;
+    while (p < n) p <<= 1;
+    return p;
+  }
+
+  // Claims up to `count` consecutive slots from `end` (the tail for
+  // producers, lag 0: a slot is free when its sequence equals its position;
+  // the head for consumers, lag 1: full when it is one past). Returns how
+  // many, the first at `pos`; 0 when the next slot is not ready.
+  std::size_t claim(std::atomic<std::size_t>& end, std::size_t lag, std::size_t count,
+                    std::size_t& pos) {
+    if (count == 0) return 0;
+    pos = end.load(std::memory_order_relaxed);
+    for (;;) {
+      // Nobody else can claim these slots without moving `end` first,
+      // which makes the compare-and-swap below fail.
+      std::size_t n = 0;
+      while (n < count &&
+             slots_[(pos + n) & mask_].seq.load(std::memory_order_acquire) == pos + n + lag) {
+        ++n;
+      }
+      if (n == 0) {
+        const std::size_t seq = slots_[pos & mask_].seq.load(std::memory_order_acquire);
+        // Still a lap behind: full (producers) or empty (consumers).
+        if (static_cast<std::ptrdiff_t>(seq - (pos + lag)) < 0) return 0;
+        pos = end.load(std::memory_order_relaxed);
+        continue;
+      }
+      if (end.compare_exchange_weak(pos, pos + n, std::memory_order_relaxed)) return n;
+    }
+  }
+
+  // Moves the item out of a claimed full slot and frees the slot.
+  T take(std::size_t pos) {
+    Slot& slot = slots_[pos & mask_];
+    T item(std::move(*slot.item()));
+    slot.item()->~T();
+    slot.seq.store(pos + mask_ + 1, std::memory_order_release);
+    return item;
+  }
+
+  // Closed, and no producer is still filling a slot it claimed.
+  bool drained() const {
+    return closed_.load(std::memory_order_acquire) &&
+           head_.load(std::memory_order_acquire) == tail_.load(std::memory_order_acquire);
+  }
+
+  // Retries `attempt` until it returns non-zero, spinning briefly and then
+  // sleeping on `waiters`.
+  template <typename F>
+  std::size_t wait(Waiters& waiters, F attempt) {
+    for (int spin = 0;; ++spin) {
+      if (const std::size_t n = attempt()) return n;
+      if (spin < kSpins) {
+        cpu_relax();
+        continue;
+      }
+      if (closed_.load(std::memory_order_acquire)) {
+        // A producer is still publishing a slot it claimed before close().
+        std::this_thread::yield();
+        continue;
+      }
+      const std::uint32_t epoch = waiters.prepare();
+      if (const std::size_t n = attempt()) {
+        waiters.cancel();
+        return n;
+      }
+      waiters.sleep(epoch);
+    }
+  }
+
+  static void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#endif
+  }
+
+  const std::size_t mask_;
+  std::unique_ptr<Slot[]> slots_;
+  alignas(64) std::atomic<std::size_t> tail_{0};
+  alignas(64) std::atomic<std::size_t> head_{0};
+  alignas(64) std::atomic<bool> closed_{false};
+  Waiters not_empty_;
+  Waiters not_full_;
+};
+
+}  // namespace dms
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace dms {
+
+// Where copy workers run and where their buffers live on multi-socket
+// hosts. A chunk is read into, checksummed in and written from the buffers
+// of the worker that took it, so placing each worker's buffers on the
+// worker's own node keeps every copy of the data off the socket
+// interconnect. Topology comes from sysfs and placement from the
+// sched_setaffinity and mbind syscalls, so no libnuma is needed.
+enum class NumaPolicy {
+  kNone,        // leave threads and memory to the kernel (first touch)
+  kLocal,       // pin worker i to node i % nodes, its buffers on that node
+  kInterleave,  // unpinned workers, buffers spread page by page over nodes
+};
+
+const char* to_string(NumaPolicy policy);
+// Parses "none", "local" or "interleave"; throws std::invalid_argument.
+NumaPolicy parse_numa_policy(const std::string& text);
+
+// For memory placement: no node, or every node interleaved.
+constexpr int kAnyNode = -1;
+constexpr int kAllNodes = -2;
+
+// The online NUMA nodes with CPUs, in id order; {0} on hosts without
+// NUMA or without sysfs.
+const std::vector<int>& numa_nodes();
+
+// CPUs of `node` that this process may run on; empty if none.
+std::vector<int> numa_node_cpus(int node);
+
+// The node of the CPU the calling thread is running on.
+int current_numa_node();
+
+// Restricts the calling thread to the CPUs of `node`. Returns false, and
+// leaves the thread as it was, if the node has no CPU available to it.
+bool pin_thread_to_node(int node);
+
+// Places the pages of [addr, addr + length), which must be page-aligned
+// and not yet touched, on `node` (preferred, so allocation falls back to
+// other nodes when it is full) or, for kAllNodes, interleaved over all
+// nodes. kAnyNode is a no-op. Returns false if the kernel refused.
+bool place_memory(void* addr, std::size_t length, int node);
+
+}  // namespace dms
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+namespace dms {
+
+// Copies that leave the data to the kernel or the storage instead of
+// moving it through the client's buffers. On a file system with shared
+// extents (XFS, Btrfs, OCFS2) a reflink clones a whole file by reference
+// in one call; copy_file_range() copies a range inside the kernel, and on
+// NFS 4.2 or SMB3 as a server-side copy that never crosses the network.
+enum class OffloadMode {
+  kAuto,       // reflink, else copy_file_range, else read and write
+  kReflink,    // reflink, else read and write
+  kCopyRange,  // copy_file_range, else read and write
+  kNone,       // always read and write
+};
+
+const char* to_string(OffloadMode mode);
+// Parses "auto", "reflink", "copy-range" or "none"; throws
+// std::invalid_argument.
+OffloadMode parse_offload_mode(const std::string& text);
+
+// How the data of a copied file got to its destination.
+enum class CopyPath {
+  kReadWrite,  // through the workers' buffers
+  kReflink,
+  kCopyRange,
+  kPacked,     // through a packed transfer unit (see pack.h)
+};
+
+const char* to_string(CopyPath path);
+
+// Makes the open `dst_fd` share the extents of the whole of `src_fd`
+// (ioctl FICLONE). Returns 0 or an errno.
+int reflink(int src_fd, int dst_fd);
+
+// Copies [offset, offset + length) of `src_fd` to the same range of
+// `dst_fd` with copy_file_range(), calling it again after short copies.
+// Returns 0 or an errno; ENODATA if the source ends before the range does.
+int copy_range(int src_fd, int dst_fd, std::uint64_t offset, std::uint64_t length);
+
+// Whether an errno from reflink() or copy_range() means the file systems
+// cannot offload this copy (different file systems, no support for the
+// call), so the caller should read and write instead, rather than an I/O
+// error.
+bool offload_unsupported(int err);
+
+}  // namespace dms
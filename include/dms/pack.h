@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace dms {
+
+// A packed transfer unit carries many small files as one contiguous blob:
+//
+//   header  (32 bytes)  magic "DMSPACK1", u32 version, u32 entry count,
+//                       u64 data size, u64 index size
+//   data                file contents, back to back
+//   index               per file: u16 path length, path, u32 mode,
+//                       u64 mtime (ns since the epoch), u64 offset, u64 size
+//
+// All integers are little-endian; offsets are relative to the data region.
+// The index trails the data so a sender can stream file contents into the
+// unit before it knows the final index size.
+
+struct PackEntry {
+  std::string path;
+  std::uint32_t mode = 0;
+  std::int64_t mtime_ns = 0;
+  std::uint64_t offset = 0;
+  std::uint64_t size = 0;
+};
+
+// Builds packed units. The unit buffer is reused across reset() calls, so a
+// worker that packs continuously stops allocating once it has warmed up.
+class PackWriter {
+ public:
+  PackWriter() { reset(); }
+
+  void reset();
+
+  // Appends the contents of `src` under the name `path`. Throws
+  // std::system_error if the file cannot be read.
+  void add_file(const std::string& src, const std::string& path);
+
+  std::size_t entries() const { return entries_.size(); }
+  // The i-th file added, with the mode and mtime read from its source.
+  const PackEntry& entry(std::size_t i) const { return entries_[i]; }
+  // Contents of the file added last; valid until the next add or reset().
+  std::string_view last_data() const;
+  std::uint64_t data_size() const;
+
+  // Appends the index, fills in the header and returns the finished unit.
+  // The view stays valid until the next reset().
+  std::string_view finish();
+
+ private:
+  std::string unit_;
+  std::vector<PackEntry> entries_;
+};
+
+// Parses the index of a unit; throws std::runtime_error if it is malformed.
+std::vector<PackEntry> read_pack_index(std::string_view unit);
+
+struct UnpackResult {
+  std::uint64_t files = 0;
+  std::uint64_t bytes = 0;
+  // (path, reason) for every entry that could not be created.
+  std::vector<std::pair<std::string, std::string>> failures;
+};
+
+// Recreates every file of `unit` below `dst_root` (or at its own path when
+// dst_root is empty), restoring mode and mtime. Entries are grouped by
+// parent directory and created with openat() against one directory handle
+// per group, so each directory is resolved once per unit rather than once
+// per file. With sync_files, each file is fdatasync()ed before it counts as
+// created. Throws std::runtime_error if the unit is malformed.
+UnpackResult unpack(std::string_view unit, const std::string& dst_root, bool sync_files = false);
+
+}  // namespace dms
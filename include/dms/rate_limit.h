@@ -0,0 +1,140 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+namespace dms {
+
+// Limits of one level of the hierarchy; 0 means unlimited.
+struct RateLimits {
+  std::uint64_t bytes_per_sec = 0;
+  // Metadata operations (stats, opens, creates) per second.
+  std::uint64_t ops_per_sec = 0;
+};
+
+// Token bucket in its "theoretical arrival time" form: the whole state is
+// the time at which every token handed out so far is paid for, so taking
+// tokens is a single compare-and-swap and no lock is involved. A bucket
+// that has been idle holds up to `burst` worth of tokens, so a job that
+// runs for T overshoots its rate by up to burst / T; short jobs want a
+// short burst. The rate may be changed at any time; tokens already owed
+// are rescaled to the new rate.
+class TokenBucket {
+ public:
+  static constexpr std::chrono::milliseconds kDefaultBurst{100};
+
+  explicit TokenBucket(std::uint64_t rate = 0, std::chrono::nanoseconds burst = kDefaultBurst)
+      : burst_(burst), rate_(rate) {}
+
+  TokenBucket(const TokenBucket&) = delete;
+  TokenBucket& operator=(const TokenBucket&) = delete;
+
+  // Tokens per second; 0 means unlimited.
+  std::uint64_t rate() const { return rate_.load(std::memory_order_relaxed); }
+  void set_rate(std::uint64_t rate);
+
+  // Takes n tokens at `rate` (as read by the caller) and returns how long
+  // to wait before using them. Never fails: the tokens are owed instead.
+  std::chrono::nanoseconds reserve(std::uint64_t n, std::uint64_t rate);
+
+ private:
+  const std::chrono::nanoseconds burst_;
+  std::atomic<std::uint64_t> rate_;
+  // steady_clock nanoseconds; 0 for a full bucket.
+  std::atomic<std::int64_t> paid_until_{0};
+};
+
+class RateLimiter;
+
+// The limits a job runs under: its own, its tenant's and the global ones.
+// Workers call acquire_bytes() before moving data and acquire_ops() before
+// metadata operations; each blocks until every level has room. When no
+// level limits the resource, acquiring it costs three relaxed loads.
+class Throttle {
+ public:
+  // A stand-alone throttle with only job-level limits.
+  explicit Throttle(RateLimits limits = {},
+                    std::chrono::nanoseconds burst = TokenBucket::kDefaultBurst);
+
+  Throttle(const Throttle&) = delete;
+  Throttle& operator=(const Throttle&) = delete;
+
+  RateLimits limits() const { return {job_.bytes.rate(), job_.ops.rate()}; }
+  // Takes effect for waits already in progress within a few milliseconds.
+  void set_limits(RateLimits limits);
+
+  void acquire_bytes(std::uint64_t n) { acquire(&Level::bytes, n); }
+  void acquire_ops(std::uint64_t n = 1) { acquire(&Level::ops, n); }
+
+  // Time spent blocked, summed over the calling threads.
+  double waited_seconds() const;
+
+ private:
+  friend class RateLimiter;
+
+  struct Level {
+    explicit Level(std::chrono::nanoseconds burst) : bytes(0, burst), ops(0, burst) {}
+
+    TokenBucket bytes;
+    TokenBucket ops;
+  };
+
+  Throttle(RateLimits limits, std::chrono::nanoseconds burst, std::shared_ptr<Level> tenant,
+           std::shared_ptr<Level> global);
+
+  void acquire(TokenBucket Level::*bucket, std::uint64_t n);
+
+  Level job_;
+  std::shared_ptr<Level> tenant_;
+  std::shared_ptr<Level> global_;
+  std::atomic<std::int64_t> waited_ns_{0};
+};
+
+// The global and per-tenant levels above the jobs' throttles. Every level
+// can be changed while jobs run; a tenant is created, unlimited, the first
+// time it is named. Every bucket of every level gets the same burst.
+class RateLimiter {
+ public:
+  explicit RateLimiter(std::chrono::nanoseconds burst = TokenBucket::kDefaultBurst);
+
+  RateLimiter(const RateLimiter&) = delete;
+  RateLimiter& operator=(const RateLimiter&) = delete;
+
+  RateLimits global_limits() const;
+  void set_global_limits(RateLimits limits);
+  RateLimits tenant_limits(const std::string& tenant);
+  void set_tenant_limits(const std::string& tenant, RateLimits limits);
+
+  // Creates the throttle of a job of `tenant`. A named job can be adjusted
+  // later through apply() for as long as the throttle lives.
+  std::shared_ptr<Throttle> make_throttle(const std::string& tenant, RateLimits limits = {},
+                                          const std::string& job = "");
+
+  // Applies limits given as text, one level per line:
+  //
+  //   global BYTES_PER_SEC OPS_PER_SEC
+  //   tenant NAME BYTES_PER_SEC OPS_PER_SEC
+  //   job NAME BYTES_PER_SEC OPS_PER_SEC
+  //
+  // Rates take parse_size() suffixes ("500M"); 0 or "-" means unlimited.
+  // Blank lines and '#' comments are ignored, as are unknown jobs. The
+  // whole text is parsed before anything changes; throws
+  // std::invalid_argument on a malformed line.
+  void apply(const std::string& text);
+
+ private:
+  std::shared_ptr<Throttle::Level> tenant_level(const std::string& tenant);
+
+  const std::chrono::nanoseconds burst_;
+  std::shared_ptr<Throttle::Level> global_;
+  std::mutex mu_;
+  std::map<std::string, std::shared_ptr<Throttle::Level>> tenants_;
+  std::map<std::string, std::weak_ptr<Throttle>> jobs_;
+};
+
+}  // namespace dms
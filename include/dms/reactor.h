@@ -0,0 +1,204 @@
+#pragma once
+
+#include <sys/stat.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "dms/io_backend.h"
+#include "dms/task.h"
+
+namespace dms {
+
+namespace detail {
+class ReactorLoop;
+}
+
+// A file operation awaited by a coroutine on a reactor thread, e.g.
+// `std::int64_t n = co_await async_read(fd, buf, len, off);`. The result
+// is what the system call returns, or -errno. Created by the async_*
+// functions below and awaited at once; it lives in the awaiting frame, so
+// an operation in flight costs no allocation.
+class IoOperation {
+ public:
+  enum class Kind : std::uint8_t { kNop, kRead, kWrite, kOpenat, kClose, kStatx, kFdatasync };
+
+  explicit IoOperation(Kind kind) : kind_(kind) {}
+
+  // On the psync backend the operation runs here, on the reactor thread.
+  bool await_ready() noexcept;
+  void await_suspend(std::coroutine_handle<> awaiting) noexcept;
+  std::int64_t await_resume() const noexcept { return result_; }
+
+ private:
+  friend class detail::ReactorLoop;
+  friend IoOperation async_read(int, void*, std::size_t, std::uint64_t);
+  friend IoOperation async_write(int, const void*, std::size_t, std::uint64_t);
+  friend IoOperation async_openat(int, const char*, int, mode_t);
+  friend IoOperation async_close(int);
+  friend IoOperation async_statx(int, const char*, int, unsigned, struct statx*);
+  friend IoOperation async_fdatasync(int);
+
+  std::int64_t run_blocking() const;
+
+  Kind kind_;
+  int fd_ = -1;
+  int flags_ = 0;
+  unsigned mode_ = 0;
+  const char* path_ = nullptr;
+  void* buf_ = nullptr;
+  std::size_t length_ = 0;
+  std::uint64_t offset_ = 0;
+  std::coroutine_handle<> awaiting_;
+  IoOperation* next_ = nullptr;  // in the reactor thread's backlog
+  std::int64_t result_ = 0;
+};
+
+// Positional read and write; short transfers are returned as they are.
+IoOperation async_read(int fd, void* buf, std::size_t length, std::uint64_t offset);
+IoOperation async_write(int fd, const void* buf, std::size_t length, std::uint64_t offset);
+// openat(2); the result is the new descriptor. `path` must stay valid
+// until the operation completes.
+IoOperation async_openat(int dirfd, const char* path, int flags, mode_t mode = 0);
+IoOperation async_close(int fd);
+// statx(2) into `out`; with AT_EMPTY_PATH and an empty path, of `fd`.
+IoOperation async_statx(int fd, const char* path, int flags, unsigned mask, struct statx* out);
+IoOperation async_fdatasync(int fd);
+// A round trip through the reactor thread's event loop, letting the
+// thread's other coroutines run.
+IoOperation async_yield();
+
+// Event loops running coroutines, for work made of many small I/O-bound
+// tasks (e.g. one per small file) where a thread per task, or a pool of
+// threads each blocked on one, runs into context-switch and memory limits.
+// Each of a few reactor threads owns an io_uring instance (see
+// uring_backend.h): a coroutine awaiting an operation queues an SQE and
+// is suspended, and the thread resumes it when the completion is reaped,
+// so one thread keeps a ring's worth of operations in the kernel. An
+// operation beyond that waits in a per-thread backlog linked through the
+// operations themselves. Without io_uring, the psync backend runs each
+// operation on the reactor thread as it is awaited.
+//
+// A spawned task stays on the reactor thread that first runs it, so state
+// shared only by the tasks of one thread (see AsyncSemaphore) needs no
+// locking.
+class Reactor {
+ public:
+  struct Options {
+    unsigned threads = 2;
+    // Operations each thread keeps in its ring; more wait in its backlog.
+    unsigned queue_depth = 256;
+    IoBackendKind backend = IoBackendKind::kAuto;
+    // spawn() blocks while this many spawned tasks are unfinished; 0 means
+    // no limit. An unstarted or suspended task costs only its frame.
+    std::size_t max_in_flight = 0;
+  };
+
+  // Starts the threads. Throws std::system_error if kUring is requested
+  // and unavailable.
+  explicit Reactor(Options options);
+  // Waits for every spawned task, then stops the threads.
+  ~Reactor();
+
+  Reactor(const Reactor&) = delete;
+  Reactor& operator=(const Reactor&) = delete;
+
+  // "uring" or "psync".
+  const char* backend_name() const { return backend_name_; }
+  unsigned threads() const { return static_cast<unsigned>(loops_.size()); }
+
+  // Hands `task` to the next reactor thread, round robin. Thread-safe.
+  void spawn(Task<void> task);
+
+  // Blocks until every task spawned so far has finished, and rethrows the
+  // first exception one of them let escape.
+  void wait();
+
+  std::size_t in_flight() const { return in_flight_.load(std::memory_order_relaxed); }
+  std::size_t peak_in_flight() const { return peak_in_flight_.load(std::memory_order_relaxed); }
+
+ private:
+  friend class detail::ReactorLoop;
+
+  void task_done(std::exception_ptr error);
+
+  Options options_;
+  const char* backend_name_ = "psync";
+  std::vector<std::unique_ptr<detail::ReactorLoop>> loops_;
+  std::atomic<std::size_t> next_loop_{0};
+
+  std::atomic<std::size_t> in_flight_{0};
+  std::atomic<std::size_t> peak_in_flight_{0};
+  std::atomic<unsigned> waiters_{0};
+  std::mutex mu_;
+  std::condition_variable changed_;
+  std::exception_ptr error_;
+};
+
+// The index of the calling reactor thread, or -1 on other threads.
+int reactor_thread_index();
+
+// Queues a coroutine of the calling reactor thread to be resumed by that
+// thread once the running coroutine suspends.
+void resume_later(std::coroutine_handle<> handle);
+
+// A counting semaphore for the coroutines of one reactor thread, e.g. to
+// bound the files they have open at once. Waiters are resumed in order.
+// Not thread-safe: every coroutine using it must run on the same thread.
+class AsyncSemaphore {
+ public:
+  class Awaiter {
+   public:
+    explicit Awaiter(AsyncSemaphore& sem) : sem_(sem) {}
+
+    bool await_ready() const noexcept {
+      if (sem_.count_ == 0) return false;
+      --sem_.count_;
+      return true;
+    }
+    void await_suspend(std::coroutine_handle<> awaiting) noexcept {
+      awaiting_ = awaiting;
+      (sem_.tail_ ? sem_.tail_->next_ : sem_.head_) = this;
+      sem_.tail_ = this;
+    }
+    void await_resume() const noexcept {}
+
+   private:
+    friend class AsyncSemaphore;
+
+    AsyncSemaphore& sem_;
+    Awaiter* next_ = nullptr;
+    std::coroutine_handle<> awaiting_;
+  };
+
+  explicit AsyncSemaphore(std::size_t count) : count_(count) {}
+
+  Awaiter acquire() noexcept { return Awaiter(*this); }
+
+  void release() {
+    if (!head_) {
+      ++count_;
+      return;
+    }
+    // The unit passes straight to the first waiter.
+    Awaiter* waiter = head_;
+    head_ = waiter->next_;
+    if (!head_) tail_ = nullptr;
+    resume_later(waiter->awaiting_);
+  }
+
+ private:
+  std::size_t count_;
+  Awaiter* head_ = nullptr;
+  Awaiter* tail_ = nullptr;
+};
+
+}  // namespace dms
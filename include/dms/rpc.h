@@ -0,0 +1,89 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "dms/file.h"
+
+namespace dms {
+
+// Wire protocol between the client and the DMS server.
+//
+// A connection carries frames in both directions:
+//
+//   header   "DMSR", u16 type, u16 reserved, u32 count, u32 payload size,
+//            u64 sequence
+//   payload  `count` records
+//
+// The client sends kSubmit frames of job records (varint priority, varint
+// source length, source, varint destination length, destination) without
+// waiting for replies. The server answers every kSubmit frame, in order,
+// with a kReceipts frame of the same sequence number holding one receipt
+// per job (varint job id, u8 status, varint message length, message).
+// Integers without "varint" are little-endian fixed width.
+
+struct JobSpec {
+  std::string src;
+  std::string dst;
+  std::uint32_t priority = 0;
+};
+
+enum class JobStatus : std::uint8_t {
+  kAccepted = 0,
+  kRejected = 1,
+};
+
+const char* to_string(JobStatus status);
+
+struct JobReceipt {
+  std::uint64_t job_id = 0;  // assigned by the server; 0 if rejected
+  JobStatus status = JobStatus::kAccepted;
+  std::string message;  // reason for a rejection
+};
+
+enum class FrameType : std::uint16_t {
+  kSubmit = 1,
+  kReceipts = 2,
+};
+
+constexpr std::size_t kFrameHeaderSize = 24;
+constexpr std::uint32_t kMaxFramePayload = 64 << 20;
+
+struct Frame {
+  FrameType type = FrameType::kSubmit;
+  std::uint32_t count = 0;
+  std::uint64_t sequence = 0;
+  std::string payload;
+};
+
+void append_job(std::string& payload, const JobSpec& job);
+void append_receipt(std::string& payload, const JobReceipt& receipt);
+
+// Decode the records of a frame; return false if the payload is malformed
+// or does not hold exactly frame.count records.
+bool parse_jobs(const Frame& frame, std::vector<JobSpec>& jobs);
+bool parse_receipts(const Frame& frame, std::vector<JobReceipt>& receipts);
+
+// Writes a frame to a socket. Throws std::system_error.
+void write_frame(int fd, FrameType type, std::uint32_t count, std::uint64_t sequence,
+                 const std::string& payload);
+
+// Reads the next frame. Returns false on a clean end of stream between
+// frames. Throws std::system_error on I/O errors and std::runtime_error on
+// a malformed header or an end of stream inside a frame.
+bool read_frame(int fd, Frame& frame);
+
+// TCP helpers for "host:port" addresses, e.g. "dms.example.org:7300" or
+// "127.0.0.1:0" (listen on a free port). Sockets get TCP_NODELAY: frames
+// are already batched and must not wait for Nagle's algorithm. Throw
+// std::system_error, or std::invalid_argument for a bad address.
+UniqueFd connect_tcp(const std::string& address);
+UniqueFd listen_tcp(const std::string& address);
+// Waits for a connection on a listen_tcp() socket. Fails with EINVAL once
+// the listener has been shut down, which is how a server stops accepting.
+UniqueFd accept_tcp(int listen_fd);
+// "host:port" the socket is bound to.
+std::string local_address(int fd);
+
+}  // namespace dms
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "dms/units.h"
+
+namespace dms {
+
+struct ScanEntry {
+  // Path relative to the scan root, '/'-separated, never empty.
+  std::string path;
+  // st_mode-style type and permission bits.
+  std::uint32_t mode = 0;
+  std::uint64_t size = 0;
+  std::int64_t mtime_ns = 0;
+};
+
+struct ScanOptions {
+  // Walker threads; 0 means std::thread::hardware_concurrency(). Walks of
+  // remote or parallel file systems are latency bound and benefit from more
+  // threads than cores.
+  unsigned threads = 0;
+  // Per-thread getdents64 buffer. Large buffers cut the number of directory
+  // reads for big directories to a handful.
+  std::size_t getdents_buffer = 1 * MiB;
+  // Entries handed to the sink per call.
+  std::size_t batch_size = 256;
+  // Let the number of walking threads follow the measured statx latency
+  // and entry rate (see concurrency.h); `threads` is then the most used.
+  bool adaptive = false;
+};
+
+struct ScanStats {
+  std::uint64_t dirs = 0;
+  std::uint64_t files = 0;
+  std::uint64_t others = 0;
+  std::uint64_t bytes = 0;
+  std::uint64_t steals = 0;
+  // Walking threads at the end and at most; both equal `threads` unless
+  // the walk was adaptive.
+  unsigned final_threads = 0;
+  unsigned peak_threads = 0;
+  double seconds = 0;
+  // The first few errors, formatted as "path: reason".
+  std::vector<std::string> errors;
+  std::uint64_t error_count = 0;
+
+  double entries_per_second() const {
+    return seconds > 0 ? static_cast<double>(dirs + files + others) / seconds : 0;
+  }
+};
+
+// Parallel directory-tree walker. Each thread keeps a deque of directories
+// still to read: it pops its own work depth-first from the back and, when it
+// runs dry, steals from the front of another thread's deque, where the
+// shallow and therefore largest subtrees sit. Directories are read with
+// getdents64 and every entry is described with a single statx() call asking
+// only for type, mode, size and mtime. Every name is resolved relative to
+// a handle to its directory: a subdirectory is opened from its parent's
+// handle, which its queued siblings share, and described through its own,
+// so the walk never looks up a path of more than one component.
+class Scanner {
+ public:
+  // Receives entries in batches while the walk is still running. Called
+  // concurrently from walker threads. Batches of different threads
+  // interleave, so the contents of a directory may be reported before the
+  // directory itself; consumers recreating the tree must create missing
+  // parents on demand.
+  using Sink = std::function<void(std::vector<ScanEntry>&& batch)>;
+
+  explicit Scanner(ScanOptions options = {});
+
+  // Walks the tree below `root` (the root itself is not reported). Throws
+  // std::system_error if the root cannot be opened; errors below the root
+  // are counted in the returned stats.
+  ScanStats scan(const std::string& root, const Sink& sink);
+
+ private:
+  class Walk;
+
+  ScanOptions options_;
+};
+
+}  // namespace dms
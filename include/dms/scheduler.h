@@ -0,0 +1,189 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "dms/rate_limit.h"
+
+namespace dms {
+
+// Priority classes of the jobs sharing a Scheduler, highest first.
+enum class Priority : std::uint8_t { kUrgent, kNormal, kBulk };
+
+constexpr std::size_t kPriorityClasses = 3;
+
+const char* to_string(Priority priority);
+// "urgent", "normal" or "bulk"; throws std::invalid_argument otherwise.
+Priority parse_priority(const std::string& text);
+
+struct SchedulerStats {
+  std::uint64_t grants = 0;
+  // Grants that had to wait for a slot.
+  std::uint64_t queued_grants = 0;
+  // Slots given up by a job and granted to a waiting job of a higher class,
+  // i.e. the lower class preempted at a chunk boundary.
+  std::uint64_t preemptions = 0;
+  std::size_t jobs = 0;
+  // Most jobs waiting for a slot at once.
+  std::size_t peak_waiting_jobs = 0;
+};
+
+class Scheduler;
+
+// One job's share of a Scheduler. The job's threads take a slot with
+// acquire() before each unit of work, a batch of chunks, and give it back
+// with release() after it, so a job is preempted only between batches.
+// Must not be destroyed while it holds or waits for a slot.
+class SchedulerJob {
+ public:
+  // A queued claim on a slot, granted after the job's earlier claims.
+  // Granting either wakes the thread blocked in wait() or, if set, calls
+  // on_grant under the scheduler's lock; on_grant must not call back into
+  // the scheduler. Stays where it is until granted.
+  class Request {
+   public:
+    explicit Request(std::function<void()> on_grant = {}) : on_grant_(std::move(on_grant)) {}
+
+    Request(const Request&) = delete;
+    Request& operator=(const Request&) = delete;
+
+    // Blocks until the slot is granted and, under a byte rate, until its
+    // bytes are paid for.
+    void wait();
+
+   private:
+    friend class Scheduler;
+
+    std::function<void()> on_grant_;
+    Scheduler* scheduler_ = nullptr;
+    Request* next_ = nullptr;
+    std::uint64_t bytes_ = 0;
+    std::chrono::steady_clock::time_point queued_;
+    std::chrono::nanoseconds pace_{0};
+    bool granted_ = false;
+    std::condition_variable granted_cv_;
+  };
+
+  ~SchedulerJob();
+
+  SchedulerJob(const SchedulerJob&) = delete;
+  SchedulerJob& operator=(const SchedulerJob&) = delete;
+
+  Priority priority() const { return priority_; }
+  unsigned weight() const { return weight_; }
+
+  // Queues `request` for a slot to move `bytes`; does not block.
+  void request(Request& request, std::uint64_t bytes);
+
+  // Blocks until the job may move `bytes`.
+  void acquire(std::uint64_t bytes) {
+    Request r;
+    request(r, bytes);
+    r.wait();
+  }
+
+  void release();
+
+  // Time spent waiting in wait() for slots and rate, summed over threads.
+  double waited_seconds() const {
+    return static_cast<double>(waited_ns_.load(std::memory_order_relaxed)) / 1e9;
+  }
+
+ private:
+  friend class Scheduler;
+
+  SchedulerJob(Scheduler& scheduler, Priority priority, unsigned weight)
+      : scheduler_(scheduler), priority_(priority), weight_(weight) {}
+
+  Scheduler& scheduler_;
+  const Priority priority_;
+  const unsigned weight_;
+  // Guarded by the scheduler's lock: the job's waiting requests, and its
+  // virtual time, the start tag of its next grant.
+  Request* head_ = nullptr;
+  Request* tail_ = nullptr;
+  double vtime_ = 0;
+  std::atomic<std::int64_t> waited_ns_{0};
+};
+
+// Shares the worker slots, and optionally a byte rate, of the client
+// among concurrent jobs. At most `slots` units of work run at once. A
+// freed slot goes to the waiting job of the highest priority class; within
+// a class, jobs are served by start-time fair queuing: every grant advances
+// the job's virtual time by bytes / weight, the job with the lowest
+// virtual time goes next, and a job that was idle rejoins at the class's
+// current virtual time rather than with credit saved up. Over time each
+// waiting job of a class gets slots in proportion to its weight, counted
+// in bytes. With a byte rate, grants are paced in the same order, so the
+// rate is shared the same way.
+//
+// Waiting jobs sit in one heap per class keyed by virtual time, so a grant
+// costs O(log jobs) under one lock and wakes only the thread it goes to.
+class Scheduler {
+ public:
+  struct Options {
+    // Units of work running at once across all jobs; 0 means
+    // std::thread::hardware_concurrency().
+    unsigned slots = 0;
+    // Bytes per second across all jobs; 0 means unlimited.
+    std::uint64_t bytes_per_sec = 0;
+  };
+
+  Scheduler();
+  explicit Scheduler(Options options);
+
+  Scheduler(const Scheduler&) = delete;
+  Scheduler& operator=(const Scheduler&) = delete;
+
+  unsigned slots() const { return slots_; }
+  std::uint64_t bytes_per_sec() const { return bucket_.rate(); }
+  // Takes effect for grants made from now on.
+  void set_bytes_per_sec(std::uint64_t rate) { bucket_.set_rate(rate); }
+
+  // Registers a job; the scheduler must outlive it. A weight of 0 counts
+  // as 1.
+  std::unique_ptr<SchedulerJob> add_job(Priority priority, unsigned weight = 1);
+
+  SchedulerStats stats() const;
+
+ private:
+  friend class SchedulerJob;
+
+  struct Waiting {
+    double vtime;
+    std::uint64_t sequence;  // FIFO among equal virtual times
+    SchedulerJob* job;
+  };
+
+  // Heap order: lowest virtual time on top, then the earliest queued.
+  static bool later(const Waiting& a, const Waiting& b);
+
+  void enqueue(SchedulerJob& job, SchedulerJob::Request& request, std::uint64_t bytes);
+  void release(SchedulerJob& job);
+  void remove(SchedulerJob& job);
+  // Grants free slots to waiting jobs, best first.
+  void dispatch();
+
+  const unsigned slots_;
+  TokenBucket bucket_;
+
+  mutable std::mutex mu_;
+  unsigned free_;
+  std::vector<Waiting> waiting_[kPriorityClasses];
+  double class_vtime_[kPriorityClasses] = {};
+  std::uint64_t next_sequence_ = 0;
+  // The class of the job whose release() is being dispatched, for
+  // counting preemptions; kPriorityClasses outside release().
+  std::size_t releasing_class_ = kPriorityClasses;
+  SchedulerStats stats_;
+};
+
+}  // namespace dms
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <sys/stat.h>
+
+#include <cstdint>
+#include <vector>
+
+namespace dms {
+
+// A byte range of a file that holds data; everything between extents is a
+// hole, which reads as zeros and takes no space.
+struct Extent {
+  std::uint64_t offset = 0;
+  std::uint64_t length = 0;
+
+  std::uint64_t end() const { return offset + length; }
+};
+
+// Whether the file has fewer blocks allocated than its size needs, which
+// is the case for every file with holes. Costs nothing beyond the stat.
+bool may_be_sparse(const struct stat& st);
+
+// The data extents of the first `size` bytes of an open file, in order and
+// clipped to `size`. Found with lseek(SEEK_DATA/SEEK_HOLE), or with the
+// FIEMAP ioctl on file systems without them, where extents that are
+// allocated but unwritten count as holes. One extent covering the whole
+// file if neither works.
+std::vector<Extent> data_extents(int fd, std::uint64_t size);
+
+// Deallocates [offset, offset + length) of an open file, keeping its size,
+// so the range reads as zeros. Returns 0 or an errno (EOPNOTSUPP where the
+// file system cannot punch holes).
+int punch_hole(int fd, std::uint64_t offset, std::uint64_t length);
+
+}  // namespace dms
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+namespace dms {
+
+constexpr std::uint64_t KiB = 1024;
+constexpr std::uint64_t MiB = 1024 * KiB;
+constexpr std::uint64_t GiB = 1024 * MiB;
+
+// Parses "4096", "64K", "8M", "1G" (binary multiples, case-insensitive,
+// optional trailing "B" / "iB"). Throws std::invalid_argument on bad input.
+std::uint64_t parse_size(const std::string& text);
+
+// Formats a byte count as e.g. "1.50 GiB".
+std::string format_bytes(double bytes);
+
+// Formats a rate as e.g. "812.3 MiB/s".
+std::string format_rate(double bytes_per_sec);
+
+}  // namespace dms
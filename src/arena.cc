@@ -0,0 +1,167 @@
+#include "dms/arena.h"
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iterator>
+#include <new>
+#include <string>
+
+#include "dms/buffer_pool.h"
+
+namespace dms {
+namespace {
+
+constexpr std::size_t kHugePage = 2 * MiB;
+// Stripes of per-thread free lists; threads beyond this share them.
+constexpr unsigned kCaches = 64;
+// Buffers a thread keeps for itself; the rest go to the shared list.
+constexpr std::size_t kCacheLimit = 8;
+
+unsigned thread_index() {
+  static std::atomic<unsigned> next{0};
+  thread_local const unsigned index = next.fetch_add(1, std::memory_order_relaxed);
+  return index;
+}
+
+// Whether madvise(MADV_HUGEPAGE) can give the mapping huge pages.
+bool thp_enabled() {
+  std::ifstream in("/sys/kernel/mm/transparent_hugepage/enabled");
+  std::string mode((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+  return !mode.empty() && mode.find("[never]") == std::string::npos;
+}
+
+}  // namespace
+
+BufferArena::BufferArena(Options options)
+    : buffer_size_(align_up(std::max<std::size_t>(options.buffer_size, 1), kDirectIoAlignment)),
+      count_(std::max<std::size_t>(options.count, 1)),
+      node_(options.node),
+      caches_(new Cache[kCaches]) {
+  mapped_ = align_up(buffer_size_ * count_, kHugePage);
+  void* p = MAP_FAILED;
+  if (options.huge_pages) {
+    // Fails unless enough pages are reserved in vm.nr_hugepages.
+    p = ::mmap(nullptr, mapped_, PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (p != MAP_FAILED) page_kind_ = "hugetlb";
+  }
+  if (p == MAP_FAILED) {
+    // Transparent huge pages only back 2 MiB-aligned ranges, so map one
+    // page more than needed and trim the ends.
+    const std::size_t extra = options.huge_pages ? kHugePage : 0;
+    p = ::mmap(nullptr, mapped_ + extra, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+               -1, 0);
+    if (p == MAP_FAILED) throw std::bad_alloc();
+    if (extra) {
+      char* raw = static_cast<char*>(p);
+      char* aligned = reinterpret_cast<char*>(
+          align_up(reinterpret_cast<std::uintptr_t>(raw), kHugePage));
+      if (aligned > raw) ::munmap(raw, aligned - raw);
+      if (raw + extra > aligned) ::munmap(aligned + mapped_, raw + extra - aligned);
+      p = aligned;
+      if (thp_enabled() && ::madvise(p, mapped_, MADV_HUGEPAGE) == 0) page_kind_ = "thp";
+    }
+  }
+  base_ = static_cast<char*>(p);
+  place_memory(base_, mapped_, node_);  // best effort: unplaced memory still works
+  if (options.prefault) {
+    for (std::size_t i = 0; i < count_; ++i) prefault(base_ + i * buffer_size_);
+  }
+
+  // Reserved up front, so releasing a buffer never allocates.
+  shared_.reserve(count_);
+  for (std::size_t i = count_; i-- > 0;) shared_.push_back(base_ + i * buffer_size_);
+  for (unsigned i = 0; i < kCaches; ++i) caches_[i].buffers.reserve(kCacheLimit);
+}
+
+BufferArena::~BufferArena() { ::munmap(base_, mapped_); }
+
+BufferArena::Cache& BufferArena::local_cache() { return caches_[thread_index() % kCaches]; }
+
+char* BufferArena::try_acquire() {
+  Cache& cache = local_cache();
+  {
+    std::lock_guard<std::mutex> lock(cache.mu);
+    if (!cache.buffers.empty()) {
+      char* buffer = cache.buffers.back();
+      cache.buffers.pop_back();
+      return buffer;
+    }
+  }
+  {
+    std::lock_guard<std::mutex> lock(mu_);
+    if (!shared_.empty()) {
+      char* buffer = shared_.back();
+      shared_.pop_back();
+      return buffer;
+    }
+  }
+  return steal();
+}
+
+char* BufferArena::acquire() {
+  if (char* buffer = try_acquire()) return buffer;
+  waiters_.fetch_add(1);
+  std::unique_lock<std::mutex> lock(mu_);
+  for (;;) {
+    if (!shared_.empty()) {
+      char* buffer = shared_.back();
+      shared_.pop_back();
+      waiters_.fetch_sub(1);
+      return buffer;
+    }
+    // A buffer released to a thread's own list just before this thread
+    // registered as a waiter is only found here, hence the timed wait.
+    lock.unlock();
+    char* buffer = steal();
+    lock.lock();
+    if (buffer) {
+      waiters_.fetch_sub(1);
+      return buffer;
+    }
+    released_.wait_for(lock, std::chrono::milliseconds(1));
+  }
+}
+
+void BufferArena::release(char* buffer) {
+  if (waiters_.load() == 0) {
+    Cache& cache = local_cache();
+    std::lock_guard<std::mutex> lock(cache.mu);
+    if (cache.buffers.size() < kCacheLimit) {
+      cache.buffers.push_back(buffer);
+      return;
+    }
+  }
+  {
+    std::lock_guard<std::mutex> lock(mu_);
+    shared_.push_back(buffer);
+  }
+  released_.notify_one();
+}
+
+void BufferArena::prefault(char* buffer) const {
+  static const auto page = static_cast<std::size_t>(::sysconf(_SC_PAGESIZE));
+  // Free buffers hold nothing, so writing to them is harmless.
+  for (std::size_t off = 0; off < buffer_size_; off += page) buffer[off] = 0;
+}
+
+char* BufferArena::steal() {
+  const unsigned self = thread_index() % kCaches;
+  for (unsigned i = 1; i < kCaches; ++i) {
+    Cache& cache = caches_[(self + i) % kCaches];
+    std::lock_guard<std::mutex> lock(cache.mu);
+    if (!cache.buffers.empty()) {
+      char* buffer = cache.buffers.back();
+      cache.buffers.pop_back();
+      return buffer;
+    }
+  }
+  return nullptr;
+}
+
+}  // namespace dms
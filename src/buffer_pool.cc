@@ -0,0 +1,26 @@
+#include "dms/buffer_pool.h"
+
+namespace dms {
+
+BufferPool::BufferPool(BufferArena& arena, std::size_t count) : arena_(arena) {
+  buffers_.reserve(count);
+  for (std::size_t i = 0; i < count; ++i) {
+    buffers_.push_back(arena_.acquire());
+    arena_.prefault(buffers_.back());
+  }
+}
+
+BufferPool::~BufferPool() {
+  for (char* buffer : buffers_) arena_.release(buffer);
+}
+
+std::vector<iovec> BufferPool::iovecs() const {
+  std::vector<iovec> out(buffers_.size());
+  for (std::size_t i = 0; i < buffers_.size(); ++i) {
+    out[i].iov_base = buffers_[i];
+    out[i].iov_len = arena_.buffer_size();
+  }
+  return out;
+}
+
+}  // namespace dms
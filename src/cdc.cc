@@ -0,0 +1,231 @@
+// Content-defined chunking: the gear-hash candidate scan, with scalar and
+// AVX-512 kernels picked at runtime, and the size rules that pick
+// boundaries among the candidates.
+//
+// Both kernels find the same candidates: the vector one splits the range
+// into one stretch per lane, and every lane first rolls the 64 bytes in
+// front of its stretch through the hash, which is all the state a
+// sequential scan would have carried in.
+
+#include <immintrin.h>
+
+#include <algorithm>
+
+#include "dms/dedup.h"
+
+namespace dms {
+namespace {
+
+constexpr std::size_t kWindow = 64;
+
+struct Candidate {
+  std::size_t end;  // the chunk would end after this byte
+  bool strict;      // the hash also passes the strict mask
+};
+
+// The gear table, one 64-bit value per byte value: the XOR of a value
+// picked by the byte's low nibble and one picked by its high nibble, from
+// two sets of 16 fixed pseudo-random values. Built that way, a lookup is
+// two 16-entry permutes held in registers instead of a memory gather. The
+// values decide where chunks end, so changing them would stop an index
+// from matching chunks cut before the change.
+struct Gear {
+  std::uint64_t low[16];
+  std::uint64_t high[16];
+  std::uint64_t table[256];
+};
+
+const Gear& gear() {
+  static const Gear g = [] {
+    Gear g;
+    std::uint64_t x = 0x646d732d63646331ULL;  // "dms-cdc1"
+    auto next = [&x] {
+      // splitmix64
+      x += 0x9e3779b97f4a7c15ULL;
+      std::uint64_t z = x;
+      z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+      z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+      return z ^ (z >> 31);
+    };
+    for (auto& v : g.low) v = next();
+    for (auto& v : g.high) v = next();
+    for (unsigned b = 0; b < 256; ++b) g.table[b] = g.low[b & 15] ^ g.high[b >> 4];
+    return g;
+  }();
+  return g;
+}
+
+// Each kernel appends the candidates at positions [begin, end) in order;
+// begin >= kWindow.
+using ScanFn = void (*)(const unsigned char*, std::size_t, std::size_t, std::uint64_t,
+                        std::uint64_t, std::vector<Candidate>&);
+
+void scan_scalar(const unsigned char* data, std::size_t begin, std::size_t end,
+                 std::uint64_t loose, std::uint64_t strict, std::vector<Candidate>& out) {
+  const std::uint64_t* g = gear().table;
+  std::uint64_t h = 0;
+  for (std::size_t i = begin - kWindow; i < begin; ++i) h = (h << 1) + g[data[i]];
+  for (std::size_t i = begin; i < end; ++i) {
+    h = (h << 1) + g[data[i]];
+    if ((h & loose) == 0) out.push_back({i + 1, (h & strict) == 0});
+  }
+}
+
+// The hash after byte `pos`, from the window ending there.
+std::uint64_t window_hash(const unsigned char* data, std::size_t pos) {
+  const std::uint64_t* g = gear().table;
+  std::uint64_t h = 0;
+  for (std::size_t i = pos + 1 - kWindow; i <= pos; ++i) h = (h << 1) + g[data[i]];
+  return h;
+}
+
+// Rolls byte K of each lane's 8-byte word through the lanes' hashes and
+// returns the lanes whose hash passes `mask`.
+template <int K>
+__attribute__((target("avx512f"))) inline __m512i roll(__m512i h, __m512i words, __m512i low0,
+                                                      __m512i low1, __m512i high0,
+                                                      __m512i high1) {
+  // The permutes use the low 4 bits of each index: the byte's nibbles.
+  // The shifts use the zero-masking forms with every lane selected, the
+  // same instructions; GCC 12's plain forms start from an uninitialized
+  // vector and trip -Wuninitialized.
+  const __m512i lo = _mm512_maskz_srli_epi64(0xff, words, 8 * K);
+  const __m512i hi = _mm512_maskz_srli_epi64(0xff, words, 8 * K + 4);
+  const __m512i value = _mm512_xor_si512(_mm512_permutex2var_epi64(low0, lo, low1),
+                                         _mm512_permutex2var_epi64(high0, hi, high1));
+  return _mm512_add_epi64(_mm512_maskz_slli_epi64(0xff, h, 1), value);
+}
+
+// Eight lanes, each scanning a stretch of `stride` bytes (a multiple of
+// 8). Every step gathers the next 8 bytes of each stretch, rolls them
+// through the lanes' hashes and collects the loose-mask tests of all 64
+// hashes, so only the rare hits branch; their strict test recomputes the
+// hash from the window.
+__attribute__((target("avx512f"))) void scan_avx512(const unsigned char* data,
+                                                   std::size_t begin, std::size_t end,
+                                                   std::uint64_t loose, std::uint64_t strict,
+                                                   std::vector<Candidate>& out) {
+  constexpr unsigned kLanes = 8;
+  const std::size_t stride = ((end - begin) / kLanes) & ~std::size_t{7};
+  if (stride < kWindow) return scan_scalar(data, begin, end, loose, strict, out);
+  const Gear& g = gear();
+  const __m512i low0 = _mm512_loadu_si512(g.low);
+  const __m512i low1 = _mm512_loadu_si512(g.low + 8);
+  const __m512i high0 = _mm512_loadu_si512(g.high);
+  const __m512i high1 = _mm512_loadu_si512(g.high + 8);
+  const auto s = static_cast<long long>(stride);
+  const auto b = static_cast<long long>(begin - kWindow);
+  __m512i offsets = _mm512_setr_epi64(b, b + s, b + 2 * s, b + 3 * s, b + 4 * s, b + 5 * s,
+                                      b + 6 * s, b + 7 * s);
+  const __m512i step = _mm512_set1_epi64(8);
+  const __m512i loose_v = _mm512_set1_epi64(static_cast<long long>(loose));
+  __m512i h = _mm512_setzero_si512();
+  std::vector<Candidate> lanes[kLanes];
+  for (std::size_t t = 0; t < stride + kWindow; t += 8) {
+    // Masked gather for the same reason as the shifts in roll().
+    const __m512i words =
+        _mm512_mask_i64gather_epi64(_mm512_setzero_si512(), 0xff, offsets, data, 1);
+    offsets = _mm512_add_epi64(offsets, step);
+    // Bit 8k + j of `hits`: lane j's hash after byte k passed the mask.
+    std::uint64_t hits = 0;
+#define DMS_ROLL(K)                                \
+  h = roll<K>(h, words, low0, low1, high0, high1); \
+  hits |= std::uint64_t{_mm512_testn_epi64_mask(h, loose_v)} << (8 * K)
+    DMS_ROLL(0);
+    DMS_ROLL(1);
+    DMS_ROLL(2);
+    DMS_ROLL(3);
+    DMS_ROLL(4);
+    DMS_ROLL(5);
+    DMS_ROLL(6);
+    DMS_ROLL(7);
+#undef DMS_ROLL
+    if (hits == 0 || t < kWindow) continue;
+    for (; hits != 0; hits &= hits - 1) {
+      const int bit = __builtin_ctzll(hits);
+      const std::size_t lane = bit & 7;
+      const std::size_t pos = begin + lane * stride + t + (bit >> 3) - kWindow;
+      lanes[lane].push_back({pos + 1, (window_hash(data, pos) & strict) == 0});
+    }
+  }
+  for (const auto& lane : lanes) out.insert(out.end(), lane.begin(), lane.end());
+  scan_scalar(data, begin + kLanes * stride, end, loose, strict, out);
+}
+
+struct Kernel {
+  ScanFn scan;
+  const char* name;
+};
+
+const Kernel& kernel() {
+  static const Kernel k = []() -> Kernel {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) return {scan_avx512, "avx512"};
+    return {scan_scalar, "scalar"};
+  }();
+  return k;
+}
+
+// The top `bits` bits, which depend on the most bytes of the window.
+std::uint64_t top_bits(unsigned bits) { return ~std::uint64_t{0} << (64 - bits); }
+
+Chunker::Options sanitized(Chunker::Options options) {
+  options.min_size = std::max(options.min_size, kWindow);
+  std::size_t avg = 256;
+  while (avg < options.avg_size && avg < (std::size_t{1} << 40)) avg <<= 1;
+  if (avg > 256 && avg - options.avg_size > options.avg_size - avg / 2) avg >>= 1;
+  options.avg_size = std::max(avg, options.min_size);
+  options.max_size = std::max(options.max_size, options.avg_size);
+  return options;
+}
+
+}  // namespace
+
+const char* cdc_implementation() { return kernel().name; }
+
+Chunker::Chunker() : Chunker(Options{}) {}
+
+Chunker::Chunker(Options options) : options_(sanitized(options)) {
+  unsigned bits = 0;
+  while ((std::size_t{1} << (bits + 1)) <= options_.avg_size) ++bits;
+  strict_mask_ = top_bits(bits + 2);
+  loose_mask_ = top_bits(bits - 2);
+}
+
+std::size_t Chunker::split(const char* data, std::size_t size, bool last,
+                           std::vector<std::size_t>& ends) const {
+  std::vector<Candidate> candidates;
+  if (size > kWindow) {
+    kernel().scan(reinterpret_cast<const unsigned char*>(data), kWindow, size, loose_mask_,
+                  strict_mask_, candidates);
+  }
+  const Options& o = options_;
+  std::size_t start = 0;
+  std::size_t next = 0;
+  while (start < size) {
+    while (next < candidates.size() && candidates[next].end < start + o.min_size) ++next;
+    std::size_t cut = 0;
+    for (std::size_t i = next; i < candidates.size(); ++i) {
+      const Candidate& c = candidates[i];
+      if (c.end > start + o.max_size) break;
+      if (c.strict || c.end > start + o.avg_size) {
+        cut = c.end;
+        break;
+      }
+    }
+    if (cut == 0) {
+      if (size - start >= o.max_size) {
+        cut = start + o.max_size;
+      } else if (last) {
+        cut = size;
+      } else {
+        break;
+      }
+    }
+    ends.push_back(cut);
+    start = cut;
+  }
+  return start;
+}
+
+}  // namespace dms
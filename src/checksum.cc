@@ -0,0 +1,136 @@
+#include "dms/checksum.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cinttypes>
+#include <cstdio>
+#include <memory>
+#include <stdexcept>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include "dms/encoding.h"
+#include "dms/error.h"
+#include "dms/file.h"
+
+namespace dms {
+
+const char* to_string(ChecksumKind kind) {
+  switch (kind) {
+    case ChecksumKind::kNone:
+      return "none";
+    case ChecksumKind::kCrc32c:
+      return "crc32c";
+    case ChecksumKind::kXxh3:
+      return "xxh3";
+  }
+  return "?";
+}
+
+ChecksumKind parse_checksum(const std::string& text) {
+  if (text == "none") return ChecksumKind::kNone;
+  if (text == "crc32c") return ChecksumKind::kCrc32c;
+  if (text == "xxh3") return ChecksumKind::kXxh3;
+  throw std::invalid_argument("unknown checksum: '" + text + "'");
+}
+
+std::uint64_t chunk_digest(ChecksumKind kind, const void* data, std::size_t length) {
+  switch (kind) {
+    case ChecksumKind::kNone:
+      return 0;
+    case ChecksumKind::kCrc32c:
+      return crc32c(data, length);
+    case ChecksumKind::kXxh3:
+      return xxh3_64(data, length);
+  }
+  return 0;
+}
+
+void FileDigest::add(std::uint64_t chunk_digest, std::uint64_t chunk_length) {
+  if (kind_ == ChecksumKind::kCrc32c) {
+    crc_ = chunks_ == 0 ? static_cast<std::uint32_t>(chunk_digest)
+                        : crc32c_combine(crc_, static_cast<std::uint32_t>(chunk_digest),
+                                         chunk_length);
+  } else if (kind_ == ChecksumKind::kXxh3) {
+    put_u64(digests_, chunk_digest);
+  }
+  ++chunks_;
+}
+
+std::uint64_t FileDigest::value() const {
+  switch (kind_) {
+    case ChecksumKind::kNone:
+      return 0;
+    case ChecksumKind::kCrc32c:
+      return crc_;
+    case ChecksumKind::kXxh3:
+      if (chunks_ == 0) return xxh3_64(nullptr, 0);
+      if (chunks_ == 1) return load_u64(digests_.data());
+      return xxh3_64(digests_.data(), digests_.size());
+  }
+  return 0;
+}
+
+std::uint64_t checksum_file(const std::string& path, ChecksumKind kind, std::size_t chunk_size,
+                            unsigned threads) {
+  UniqueFd fd = open_or_throw(path, O_RDONLY);
+  struct stat st;
+  if (::fstat(fd.get(), &st) != 0) throw_errno("fstat " + path);
+  const auto size = static_cast<std::uint64_t>(st.st_size);
+  chunk_size = std::max<std::size_t>(chunk_size, 1);
+  const std::uint64_t nchunks = (size + chunk_size - 1) / chunk_size;
+  if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+  threads = static_cast<unsigned>(
+      std::min<std::uint64_t>(threads, std::max<std::uint64_t>(nchunks, 1)));
+
+  // Chunks are handed out in order from a shared counter; each digest lands
+  // in its own slot and the slots are folded once every thread is done.
+  std::vector<std::uint64_t> digests(nchunks);
+  std::atomic<std::uint64_t> next{0};
+  std::atomic<int> error{0};
+  auto worker = [&] {
+    std::unique_ptr<char[]> buf(new char[chunk_size]);
+    for (std::uint64_t i; (i = next.fetch_add(1)) < nchunks && error.load() == 0;) {
+      const std::uint64_t offset = i * chunk_size;
+      const auto want =
+          static_cast<std::size_t>(std::min<std::uint64_t>(chunk_size, size - offset));
+      try {
+        if (pread_full(fd.get(), buf.get(), want, static_cast<off_t>(offset)) != want) {
+          throw std::system_error(EIO, std::generic_category(), "short read");
+        }
+      } catch (const std::system_error& e) {
+        int expected = 0;
+        error.compare_exchange_strong(expected, e.code().value());
+        return;
+      }
+      digests[i] = chunk_digest(kind, buf.get(), want);
+    }
+  };
+  std::vector<std::thread> pool;
+  for (unsigned t = 1; t < threads; ++t) pool.emplace_back(worker);
+  worker();
+  for (auto& t : pool) t.join();
+  if (error.load() != 0) throw_errno(error.load(), "read " + path);
+
+  FileDigest digest(kind);
+  for (std::uint64_t i = 0; i < nchunks; ++i) {
+    digest.add(digests[i], std::min<std::uint64_t>(chunk_size, size - i * chunk_size));
+  }
+  return digest.value();
+}
+
+std::string format_digest(ChecksumKind kind, std::uint64_t digest) {
+  char buf[17];
+  if (kind == ChecksumKind::kCrc32c) {
+    std::snprintf(buf, sizeof(buf), "%08" PRIx32, static_cast<std::uint32_t>(digest));
+  } else {
+    std::snprintf(buf, sizeof(buf), "%016" PRIx64, digest);
+  }
+  return buf;
+}
+
+}  // namespace dms
@@ -0,0 +1,185 @@
+#include "dms/compress.h"
+
+#include <dlfcn.h>
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace dms {
+namespace {
+
+constexpr std::size_t kSampleSize = 4096;
+constexpr std::size_t kLz4MaxInput = 0x7E000000;
+// Above this sampled ratio a chunk is sent raw.
+constexpr double kIncompressible = 0.9;
+// At or below it, kAuto spends the extra CPU on zstd.
+constexpr double kWellCompressible = 0.6;
+
+// The few entry points used, with their stable C ABI signatures.
+struct Lz4 {
+  int (*compress_fast)(const char*, char*, int, int, int) = nullptr;
+  int (*decompress_safe)(const char*, char*, int, int) = nullptr;
+  int (*compress_bound)(int) = nullptr;
+};
+
+struct Zstd {
+  std::size_t (*compress)(void*, std::size_t, const void*, std::size_t, int) = nullptr;
+  std::size_t (*decompress)(void*, std::size_t, const void*, std::size_t) = nullptr;
+  std::size_t (*compress_bound)(std::size_t) = nullptr;
+  unsigned (*is_error)(std::size_t) = nullptr;
+  const char* (*error_name)(std::size_t) = nullptr;
+};
+
+template <typename F>
+bool bind(void* lib, const char* name, F& fn) {
+  fn = reinterpret_cast<F>(::dlsym(lib, name));
+  return fn != nullptr;
+}
+
+const Lz4* lz4() {
+  static const Lz4* lib = []() -> const Lz4* {
+    void* handle = ::dlopen("liblz4.so.1", RTLD_NOW | RTLD_LOCAL);
+    if (!handle) return nullptr;
+    static Lz4 fns;
+    if (!bind(handle, "LZ4_compress_fast", fns.compress_fast) ||
+        !bind(handle, "LZ4_decompress_safe", fns.decompress_safe) ||
+        !bind(handle, "LZ4_compressBound", fns.compress_bound)) {
+      return nullptr;
+    }
+    return &fns;
+  }();
+  return lib;
+}
+
+const Zstd* zstd() {
+  static const Zstd* lib = []() -> const Zstd* {
+    void* handle = ::dlopen("libzstd.so.1", RTLD_NOW | RTLD_LOCAL);
+    if (!handle) return nullptr;
+    static Zstd fns;
+    if (!bind(handle, "ZSTD_compress", fns.compress) ||
+        !bind(handle, "ZSTD_decompress", fns.decompress) ||
+        !bind(handle, "ZSTD_compressBound", fns.compress_bound) ||
+        !bind(handle, "ZSTD_isError", fns.is_error) ||
+        !bind(handle, "ZSTD_getErrorName", fns.error_name)) {
+      return nullptr;
+    }
+    return &fns;
+  }();
+  return lib;
+}
+
+[[noreturn]] void throw_unavailable(Codec codec) {
+  throw std::runtime_error(std::string("compression codec not available: ") + to_string(codec));
+}
+
+[[noreturn]] void throw_zstd(std::size_t code) {
+  throw std::runtime_error(std::string("zstd: ") + zstd()->error_name(code));
+}
+
+}  // namespace
+
+const char* to_string(Codec codec) {
+  switch (codec) {
+    case Codec::kNone:
+      return "none";
+    case Codec::kLz4:
+      return "lz4";
+    case Codec::kZstd:
+      return "zstd";
+    case Codec::kAuto:
+      return "auto";
+  }
+  return "?";
+}
+
+Codec parse_codec(const std::string& text) {
+  if (text == "none") return Codec::kNone;
+  if (text == "lz4") return Codec::kLz4;
+  if (text == "zstd") return Codec::kZstd;
+  if (text == "auto") return Codec::kAuto;
+  throw std::invalid_argument("unknown compression codec: '" + text + "'");
+}
+
+bool codec_available(Codec codec) {
+  switch (codec) {
+    case Codec::kNone:
+      return true;
+    case Codec::kLz4:
+      return lz4() != nullptr;
+    case Codec::kZstd:
+      return zstd() != nullptr;
+    case Codec::kAuto:
+      return lz4() != nullptr || zstd() != nullptr;
+  }
+  return false;
+}
+
+std::size_t compress_bound(Codec codec, std::size_t size) {
+  if (codec == Codec::kLz4 && lz4() && size <= kLz4MaxInput) {
+    return static_cast<std::size_t>(lz4()->compress_bound(static_cast<int>(size)));
+  }
+  if (codec == Codec::kZstd && zstd()) return zstd()->compress_bound(size);
+  if (codec == Codec::kNone) return size;
+  throw_unavailable(codec);
+}
+
+std::size_t compress(Codec codec, const char* data, std::size_t size, char* out,
+                     std::size_t capacity, int level) {
+  if (codec == Codec::kLz4 && lz4()) {
+    if (size > kLz4MaxInput) throw std::runtime_error("lz4: input too large");
+    const int n = lz4()->compress_fast(data, out, static_cast<int>(size),
+                                       static_cast<int>(std::min<std::size_t>(capacity, INT32_MAX)),
+                                       std::max(1, level));
+    if (n <= 0) throw std::runtime_error("lz4: compression failed");
+    return static_cast<std::size_t>(n);
+  }
+  if (codec == Codec::kZstd && zstd()) {
+    const std::size_t n = zstd()->compress(out, capacity, data, size, level == 0 ? 1 : level);
+    if (zstd()->is_error(n)) throw_zstd(n);
+    return n;
+  }
+  throw_unavailable(codec);
+}
+
+void decompress(Codec codec, const char* data, std::size_t size, char* out,
+                std::size_t raw_size) {
+  std::size_t n = 0;
+  if (codec == Codec::kLz4 && lz4()) {
+    if (size > INT32_MAX || raw_size > INT32_MAX) throw std::runtime_error("lz4: frame too large");
+    const int r = lz4()->decompress_safe(data, out, static_cast<int>(size),
+                                         static_cast<int>(raw_size));
+    if (r < 0) throw std::runtime_error("lz4: corrupt data");
+    n = static_cast<std::size_t>(r);
+  } else if (codec == Codec::kZstd && zstd()) {
+    n = zstd()->decompress(out, raw_size, data, size);
+    if (zstd()->is_error(n)) throw_zstd(n);
+  } else {
+    throw_unavailable(codec);
+  }
+  if (n != raw_size) throw std::runtime_error("decompressed size mismatch");
+}
+
+double sample_ratio(const char* data, std::size_t size) {
+  const Codec codec = lz4() ? Codec::kLz4 : zstd() ? Codec::kZstd : Codec::kNone;
+  if (codec == Codec::kNone || size == 0) return 1;
+  char out[kSampleSize + kSampleSize / 8 + 64];
+  std::size_t raw = 0;
+  std::size_t packed = 0;
+  const std::size_t len = std::min(size, kSampleSize);
+  const std::size_t starts[] = {0, (size - len) / 2, size - len};
+  const int samples = size > 3 * kSampleSize ? 3 : 1;
+  for (int i = 0; i < samples; ++i) {
+    packed += compress(codec, data + starts[i], len, out, sizeof(out));
+    raw += len;
+  }
+  return static_cast<double>(packed) / static_cast<double>(raw);
+}
+
+Codec choose_codec(Codec requested, double ratio) {
+  if (requested == Codec::kNone || ratio > kIncompressible) return Codec::kNone;
+  if (requested != Codec::kAuto) return requested;
+  if (ratio <= kWellCompressible && zstd()) return Codec::kZstd;
+  return lz4() ? Codec::kLz4 : Codec::kZstd;
+}
+
+}  // namespace dms
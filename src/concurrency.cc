@@ -0,0 +1,111 @@
+#include "dms/concurrency.h"
+
+#include <algorithm>
+
+namespace dms {
+namespace {
+
+constexpr double kDecrease = 0.7;
+constexpr double kMinGain = 1.05;
+
+std::int64_t now_ns() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+AdaptiveLimit::Options sanitized(AdaptiveLimit::Options options) {
+  options.min_limit = std::max(1u, options.min_limit);
+  options.max_limit = std::max(options.min_limit, options.max_limit);
+  options.initial_limit = std::clamp(options.initial_limit, options.min_limit, options.max_limit);
+  return options;
+}
+
+}  // namespace
+
+AdaptiveLimit::AdaptiveLimit() : AdaptiveLimit(Options{}) {}
+
+AdaptiveLimit::AdaptiveLimit(Options options)
+    : options_(sanitized(options)),
+      limit_(options_.initial_limit),
+      peak_(options_.initial_limit),
+      interval_start_(now_ns()) {}
+
+void AdaptiveLimit::wait_admitted(unsigned slot) {
+  std::unique_lock<std::mutex> lock(gate_mu_);
+  gate_cv_.wait(lock, [&] { return closed_ || slot < limit_.load(std::memory_order_acquire); });
+}
+
+void AdaptiveLimit::close() {
+  {
+    std::lock_guard<std::mutex> lock(gate_mu_);
+    closed_ = true;
+  }
+  gate_cv_.notify_all();
+}
+
+void AdaptiveLimit::record(std::chrono::nanoseconds latency, std::uint64_t ops,
+                           std::uint64_t work) {
+  latency_ns_.fetch_add(latency.count() * static_cast<std::int64_t>(ops),
+                        std::memory_order_relaxed);
+  ops_.fetch_add(ops, std::memory_order_relaxed);
+  work_.fetch_add(work, std::memory_order_relaxed);
+  const std::int64_t now = now_ns();
+  const std::int64_t start = interval_start_.load(std::memory_order_relaxed);
+  const std::int64_t interval = std::chrono::nanoseconds(options_.interval).count();
+  if (now - start < interval) return;
+  std::unique_lock<std::mutex> lock(update_mu_, std::try_to_lock);
+  if (!lock.owns_lock() || interval_start_.load(std::memory_order_relaxed) != start) return;
+  interval_start_.store(now, std::memory_order_relaxed);
+  update(static_cast<double>(now - start) * 1e-9);
+}
+
+void AdaptiveLimit::update(double seconds) {
+  const std::uint64_t ops = ops_.exchange(0, std::memory_order_relaxed);
+  const std::int64_t latency_ns = latency_ns_.exchange(0, std::memory_order_relaxed);
+  const std::uint64_t work = work_.exchange(0, std::memory_order_relaxed);
+  if (ops == 0) return;
+  const double latency = static_cast<double>(latency_ns) / static_cast<double>(ops);
+  const double throughput = static_cast<double>(work) / seconds;
+  if (base_latency_ == 0 || latency < base_latency_) base_latency_ = latency;
+
+  const unsigned limit = limit_.load(std::memory_order_relaxed);
+  if (latency > options_.tolerance * base_latency_) {
+    if (limit == options_.min_limit) {
+      base_latency_ = latency;
+    } else {
+      set_limit(std::max(options_.min_limit, static_cast<unsigned>(limit * kDecrease)));
+    }
+    slow_start_ = false;
+    last_step_ = 0;
+    hold_ = options_.hold_intervals;
+  } else if (last_step_ > 0 && throughput < last_throughput_ * kMinGain) {
+    set_limit(limit - last_step_);
+    slow_start_ = false;
+    last_step_ = 0;
+    hold_ = options_.hold_intervals;
+  } else if (hold_ > 0) {
+    --hold_;
+  } else {
+    const unsigned next = std::min(options_.max_limit, slow_start_ ? 2 * limit : limit + 1);
+    last_step_ = next - limit;
+    set_limit(next);
+  }
+  last_throughput_ = throughput;
+}
+
+void AdaptiveLimit::set_limit(unsigned limit) {
+  const unsigned old = limit_.load(std::memory_order_relaxed);
+  if (limit == old) return;
+  {
+    std::lock_guard<std::mutex> lock(gate_mu_);
+    limit_.store(limit, std::memory_order_release);
+  }
+  changes_.fetch_add(1, std::memory_order_relaxed);
+  if (limit > peak_.load(std::memory_order_relaxed)) {
+    peak_.store(limit, std::memory_order_relaxed);
+  }
+  if (limit > old) gate_cv_.notify_all();
+}
+
+}  // namespace dms
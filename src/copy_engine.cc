@@ -0,0 +1,1282 @@
+#include "dms/copy_engine.h"
+
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <system_error>
+#include <thread>
+#include <unordered_set>
+
+#include "dms/blocking_queue.h"
+#include "dms/buffer_pool.h"
+#include "dms/concurrency.h"
+#include "dms/error.h"
+#include "dms/file.h"
+#include "dms/journal.h"
+#include "dms/manifest.h"
+#include "dms/metadata.h"
+#include "dms/mpmc_queue.h"
+#include "dms/offload.h"
+#include "dms/pack.h"
+#include "dms/reactor.h"
+#include "dms/scanner.h"
+#include "dms/sparse.h"
+
+namespace dms {
+namespace {
+
+constexpr std::size_t kMaxRecordedErrors = 16;
+// Caps the entries of one packed unit so runs of empty files still split.
+constexpr std::size_t kMaxPackEntries = 4096;
+// Operations each reactor thread keeps in its ring, and files its
+// coroutines have open at once (fewer if RLIMIT_NOFILE is low).
+constexpr unsigned kReactorQueueDepth = 256;
+constexpr std::size_t kReactorOpenFiles = 512;
+
+std::string parent_of(const std::string& path) { return path.substr(0, path.rfind('/')); }
+
+std::int64_t mtime_ns(const struct stat& st) {
+  return static_cast<std::int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+}
+
+// Per-file state shared by all chunks of that file. The last chunk to
+// finish closes the destination and settles the file's outcome.
+struct OpenFile {
+  std::string src;
+  std::string dst;
+  UniqueFd src_fd;
+  UniqueFd dst_fd;
+  // Unique within a job; lets I/O backends cache the file in a fixed slot.
+  // Requests use 2 * id for the source and 2 * id + 1 for the destination.
+  std::uint64_t id = 0;
+  // Journal key of the file; only meaningful when the job has a journal.
+  std::uint64_t journal_key = 0;
+  // Per-chunk digests, indexed by chunk number, when checksumming. Each
+  // slot is written by the one worker that copies the chunk.
+  std::vector<std::uint64_t> digests;
+  std::uint64_t size = 0;
+  std::uint32_t mode = 0;
+  std::int64_t mtime_ns = 0;
+  // Sync mode: bytes the destination already held. Chunks below this are
+  // compared with the destination before being written.
+  std::uint64_t compare_size = 0;
+  // Whether each side was opened with O_DIRECT. Direct reads of the tail are
+  // rounded up to the alignment; direct writes of the tail are zero-padded
+  // and the destination is truncated back to `size` once all chunks land.
+  bool src_direct = false;
+  bool dst_direct = false;
+  // Whether the source has holes, and its data extents if so. Chunks
+  // without data are not queued, and the others only move their data.
+  bool sparse = false;
+  std::vector<Extent> extents;
+  // Copy offload: whether the file was reflinked, and whether its chunks go
+  // to copy_file_range(), which is turned off for the rest of the file once
+  // the kernel refuses. `offloaded` and `buffered` record whether any chunk
+  // went either way, for the path reported for the file.
+  bool reflinked = false;
+  std::atomic<bool> copy_range{false};
+  std::atomic<bool> offloaded{false};
+  std::atomic<bool> buffered{false};
+  std::atomic<std::uint64_t> chunks_left{0};
+  std::atomic<bool> failed{false};
+};
+
+// Switches an open descriptor to O_DIRECT. Returns false, leaving the
+// descriptor buffered, on file systems that reject it (e.g. tmpfs).
+bool enable_direct_io(int fd) {
+  int flags = ::fcntl(fd, F_GETFL);
+  return flags >= 0 && ::fcntl(fd, F_SETFL, flags | O_DIRECT) == 0;
+}
+
+struct ChunkTask {
+  std::shared_ptr<OpenFile> file;
+  std::uint64_t offset = 0;
+  std::size_t length = 0;
+};
+
+// Small files that one worker reads into a packed unit and unpacks at the
+// destination. Their sources are only opened by the worker, keeping the
+// per-file open/stat/close cost off the planner thread.
+struct PackTask {
+  std::vector<FileTask> files;
+  std::vector<std::uint64_t> journal_keys;  // parallel to files, if journaling
+  std::uint64_t bytes = 0;
+};
+
+// What the planner hands to the workers: a chunk, or a pack when `pack` is set.
+struct WorkItem {
+  ChunkTask chunk;
+  std::unique_ptr<PackTask> pack;
+};
+
+}  // namespace
+
+class CopyEngine::Job {
+ public:
+  explicit Job(CopyEngine& engine)
+      : engine_(engine),
+        options_(engine.options_),
+        queue_(options_.queue_depth ? options_.queue_depth : 4 * options_.threads) {
+    // Backends are created here rather than in the workers so that an
+    // explicitly requested but unavailable backend fails the job up front.
+    std::vector<std::unique_ptr<IoBackend>> backends;
+    for (unsigned i = 0; i < options_.threads; ++i) {
+      backends.push_back(make_io_backend(options_.io_backend, 2 * options_.io_batch));
+    }
+    io_backend_name_ = backends.front()->name();
+    if (!options_.journal.empty()) {
+      // Syncing records whose chunks are not synced buys nothing.
+      Journal::Options journal;
+      journal.durable = options_.journal_sync_data;
+      journal_ = std::make_unique<Journal>(options_.journal, journal);
+    }
+    if (options_.adaptive_concurrency) {
+      AdaptiveLimit::Options limit;
+      limit.max_limit = options_.threads;
+      limit_ = std::make_unique<AdaptiveLimit>(limit);
+    }
+    MetadataOptions metadata;
+    metadata.threads = options_.metadata_threads ? options_.metadata_threads : options_.threads;
+    metadata.batch_size = options_.metadata_batch;
+    metadata.owner = options_.preserve_owner;
+    metadata.xattrs = options_.preserve_xattrs;
+    metadata.throttle = options_.throttle;
+    metadata_ = std::make_unique<MetadataBatcher>(metadata);
+    if (options_.coroutines) {
+      Reactor::Options reactor;
+      reactor.threads = options_.reactor_threads;
+      reactor.queue_depth = kReactorQueueDepth;
+      reactor.backend = options_.io_backend;
+      reactor.max_in_flight = options_.max_in_flight;
+      reactor_ = std::make_unique<Reactor>(reactor);
+      // A quarter of the descriptors for the coroutines, a few per worker.
+      rlimit files;
+      std::size_t open_files = kReactorOpenFiles;
+      if (::getrlimit(RLIMIT_NOFILE, &files) == 0 && files.rlim_cur != RLIM_INFINITY) {
+        open_files = std::clamp<std::size_t>(files.rlim_cur / 4 / reactor_->threads(), 1,
+                                             open_files);
+      }
+      for (unsigned i = 0; i < reactor_->threads(); ++i) {
+        file_slots_.push_back(std::make_unique<AsyncSemaphore>(open_files));
+      }
+    }
+    // Every worker takes its buffers from the arena of its NUMA node.
+    for (unsigned i = 0; i < options_.threads; ++i) {
+      int node = kAnyNode;
+      if (options_.numa == NumaPolicy::kLocal) {
+        node = numa_nodes()[i % numa_nodes().size()];
+      } else if (options_.numa == NumaPolicy::kInterleave) {
+        node = kAllNodes;
+      }
+      worker_nodes_.push_back(node);
+    }
+    for (unsigned i = 0; i < options_.threads; ++i) {
+      const int node = worker_nodes_[i];
+      if (arena(node)) continue;
+      const auto workers = std::count(worker_nodes_.begin(), worker_nodes_.end(), node);
+      arenas_.push_back(engine_.take_arena(node, static_cast<std::size_t>(workers) * pool_size()));
+    }
+    if (options_.scheduler) {
+      schedule_ = options_.scheduler->add_job(options_.priority, options_.weight);
+    }
+    start_ = std::chrono::steady_clock::now();
+    if (options_.throttle) throttle_start_ = options_.throttle->waited_seconds();
+    workers_.reserve(options_.threads);
+    for (unsigned i = 0; i < options_.threads; ++i) {
+      workers_.emplace_back([this, i, b = std::move(backends[i])] { worker_loop(i, *b); });
+    }
+  }
+
+  ~Job() {
+    // Its coroutines use everything below.
+    reactor_.reset();
+    queue_.close();
+    if (limit_) limit_->close();
+    for (auto& t : workers_) {
+      if (t.joinable()) t.join();
+    }
+    for (auto& a : arenas_) engine_.return_arena(std::move(a));
+  }
+
+  // Queues a file whose size is not known yet.
+  void add_file(const FileTask& task) {
+    if (options_.small_file_max == 0 && !options_.sync) {
+      add_chunked_file(task);
+      return;
+    }
+    acquire_ops(1);
+    struct stat st;
+    if (::stat(task.src.c_str(), &st) != 0) {
+      record_failure(task.src, std::system_category().message(errno));
+      return;
+    }
+    add_file(task, static_cast<std::uint64_t>(st.st_size), mtime_ns(st));
+  }
+
+  // Queues a file whose size and mtime the caller already knows (e.g. from
+  // a directory walk). Small files are batched into packs; the rest are
+  // chunked. Blocks when the queue is full, so planning never runs more
+  // than queue_depth work items ahead.
+  void add_file(const FileTask& task, std::uint64_t size, std::int64_t mtime) {
+    if (options_.sync) acquire_ops(1);
+    if (options_.sync && unchanged(task.dst, size, mtime)) {
+      unchanged_files_.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+    if (options_.small_file_max == 0 || size > options_.small_file_max) {
+      add_chunked_file(task);
+      return;
+    }
+    std::uint64_t key = 0;
+    if (journal_) {
+      // A packed file is journaled as a single chunk at offset 0.
+      key = Journal::file_key(task.dst, size, mtime, 0, checksum_id());
+      if (journal_->is_done(key, 0)) {
+        skip_chunk(size);
+        report_digest(task, journal_->digest(key, 0));
+        files_.fetch_add(1, std::memory_order_relaxed);
+        return;
+      }
+    }
+    if (reactor_) {
+      acquire_ops(1);
+      acquire_bytes(size);
+      reactor_->spawn(copy_small_file(task, key));
+      return;
+    }
+    if (!pending_pack_.files.empty() &&
+        (pending_pack_.bytes + size > options_.pack_size ||
+         pending_pack_.files.size() >= kMaxPackEntries)) {
+      flush_pack();
+    }
+    pending_pack_.files.push_back(task);
+    if (journal_) pending_pack_.journal_keys.push_back(key);
+    pending_pack_.bytes += size;
+  }
+
+  // Opens src, creates dst and queues its chunks.
+  void add_chunked_file(const FileTask& task) {
+    auto file = std::make_shared<OpenFile>();
+    file->id = next_file_id_++;
+    file->src = task.src;
+    file->dst = task.dst;
+    bool resuming = false;
+    acquire_ops(1);
+    try {
+      file->src_fd = open_or_throw(task.src, O_RDONLY);
+      struct stat st;
+      if (::fstat(file->src_fd.get(), &st) != 0) throw_errno("fstat " + task.src);
+      file->size = static_cast<std::uint64_t>(st.st_size);
+      file->mode = st.st_mode;
+      file->mtime_ns = mtime_ns(st);
+      const bool direct = options_.direct_io && file->size >= options_.direct_io_min_size;
+      if (journal_) {
+        file->journal_key = Journal::file_key(task.dst, file->size, mtime_ns(st),
+                                              options_.chunk_size, checksum_id());
+        resuming = journal_->has_file(file->journal_key);
+      }
+      const bool keep = resuming || options_.sync;
+      file->dst_fd = open_or_throw(
+          task.dst, (options_.sync ? O_RDWR : O_WRONLY) | O_CREAT | (keep ? 0 : O_TRUNC),
+          st.st_mode & 07777);
+      if (keep) {
+        struct stat dst_st;
+        if (::fstat(file->dst_fd.get(), &dst_st) != 0) throw_errno("fstat " + task.dst);
+        const auto dst_size = static_cast<std::uint64_t>(dst_st.st_size);
+        // Journaled chunks are only trusted if the destination still has
+        // the size this job gave it; otherwise start the file over.
+        if (resuming && dst_size != file->size) {
+          resuming = false;
+          if (!options_.sync && ::ftruncate(file->dst_fd.get(), 0) != 0) {
+            throw_errno("ftruncate " + task.dst);
+          }
+        }
+        if (options_.sync) file->compare_size = std::min(dst_size, file->size);
+      }
+      // Sizing the destination up front lets chunks be written in any order
+      // without the file system serialising on EOF extension. A kept
+      // destination may also need cutting down to the source size.
+      if ((file->size > 0 || keep) &&
+          ::ftruncate(file->dst_fd.get(), static_cast<off_t>(file->size)) != 0) {
+        throw_errno("ftruncate " + task.dst);
+      }
+      if (offload_allowed(OffloadMode::kReflink) && file->size > 0 && try_reflink(*file)) {
+        finish_file(*file);
+        return;
+      }
+      if (options_.sparse && may_be_sparse(st)) plan_sparse(*file, keep);
+      // Data extents need not be aligned, so sparse files stay buffered. A
+      // file due for O_DIRECT skips copy_file_range() unless that mode was
+      // asked for by name: were the kernel to refuse it, the workers' reads
+      // and writes would go through the page cache after all.
+      const bool direct_file = direct && !file->sparse;
+      file->copy_range.store(offload_allowed(OffloadMode::kCopyRange) &&
+                                 !(direct_file && options_.offload == OffloadMode::kAuto),
+                             std::memory_order_relaxed);
+      if (direct_file && !file->copy_range.load(std::memory_order_relaxed)) {
+        file->src_direct = enable_direct_io(file->src_fd.get());
+        file->dst_direct = enable_direct_io(file->dst_fd.get());
+        if (file->src_direct || file->dst_direct) direct_files_.fetch_add(1);
+      }
+    } catch (const std::system_error& e) {
+      record_failure(task.src, e.what());
+      return;
+    }
+
+    const std::uint64_t chunk = options_.chunk_size;
+    const std::uint64_t nchunks = file->size == 0 ? 0 : (file->size + chunk - 1) / chunk;
+    if (options_.checksum != ChecksumKind::kNone) file->digests.assign(nchunks, 0);
+    std::vector<std::uint64_t> todo;
+    todo.reserve(nchunks);
+    for (std::uint64_t i = 0; i < nchunks; ++i) {
+      const std::uint64_t offset = i * chunk;
+      const std::uint64_t length = std::min(chunk, file->size - offset);
+      if (file->sparse && !has_data(*file, offset, offset + length)) {
+        hole_bytes_.fetch_add(length, std::memory_order_relaxed);
+        if (!file->digests.empty()) file->digests[i] = zero_digest(length);
+        continue;
+      }
+      if (resuming && journal_->is_done(file->journal_key, offset)) {
+        skip_chunk(std::min(chunk, file->size - offset));
+        if (!file->digests.empty()) file->digests[i] = journal_->digest(file->journal_key, offset);
+      } else {
+        todo.push_back(offset);
+      }
+    }
+    if (todo.empty()) {
+      finish_file(*file);
+      return;
+    }
+    // Set before the first push: workers may finish chunks while we queue.
+    file->chunks_left.store(todo.size(), std::memory_order_relaxed);
+    std::vector<WorkItem> items(todo.size());
+    for (std::size_t i = 0; i < todo.size(); ++i) {
+      items[i].chunk.file = file;
+      items[i].chunk.offset = todo[i];
+      items[i].chunk.length = static_cast<std::size_t>(std::min(chunk, file->size - todo[i]));
+    }
+    queue_.push_batch(items.data(), items.size());
+  }
+
+  // Whether the job may offload copies with `mode`'s call. Checksums need
+  // the data in the workers' buffers.
+  bool offload_allowed(OffloadMode mode) const {
+    return (options_.offload == OffloadMode::kAuto || options_.offload == mode) &&
+           options_.checksum == ChecksumKind::kNone;
+  }
+
+  // Clones the source into the destination, replacing whatever a kept
+  // destination held. Returns false if the file systems cannot clone it.
+  bool try_reflink(OpenFile& file) {
+    const int err = reflink(file.src_fd.get(), file.dst_fd.get());
+    if (err != 0) {
+      if (offload_unsupported(err)) return false;
+      throw std::system_error(err, std::generic_category(), "reflink " + file.dst);
+    }
+    file.reflinked = true;
+    reflinked_files_.fetch_add(1, std::memory_order_relaxed);
+    reflinked_bytes_.fetch_add(file.size, std::memory_order_relaxed);
+    return true;
+  }
+
+  // Finds the data extents of a source with fewer blocks than its size.
+  // The destination was sized with ftruncate(), which leaves it one hole,
+  // but a kept destination may hold data where the source has holes, so
+  // those are punched. Where that fails the file is copied dense.
+  void plan_sparse(OpenFile& file, bool keep) {
+    file.extents = data_extents(file.src_fd.get(), file.size);
+    std::uint64_t data = 0;
+    for (const Extent& e : file.extents) data += e.length;
+    if (data == file.size) {
+      file.extents.clear();
+      return;
+    }
+    if (keep) {
+      std::uint64_t pos = 0;
+      for (const Extent& e : file.extents) {
+        if (punch_hole(file.dst_fd.get(), pos, e.offset - pos) != 0) {
+          file.extents.clear();
+          return;
+        }
+        pos = e.end();
+      }
+      if (punch_hole(file.dst_fd.get(), pos, file.size - pos) != 0) {
+        file.extents.clear();
+        return;
+      }
+    }
+    file.sparse = true;
+    sparse_files_.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  static bool has_data(const OpenFile& file, std::uint64_t begin, std::uint64_t end) {
+    bool found = false;
+    for_each_data(file, begin, end, [&](std::uint64_t, std::uint64_t) { found = true; });
+    return found;
+  }
+
+  // Digest of `length` zero bytes, for chunks that are all hole; the
+  // chunk-sized one is computed once per job.
+  std::uint64_t zero_digest(std::size_t length) {
+    if (zeros_.size() < length) zeros_.assign(options_.chunk_size, 0);
+    if (length != options_.chunk_size) {
+      return chunk_digest(options_.checksum, zeros_.data(), length);
+    }
+    if (!zero_chunk_digest_) {
+      zero_chunk_digest_ = chunk_digest(options_.checksum, zeros_.data(), length);
+    }
+    return *zero_chunk_digest_;
+  }
+
+  // Plans one walked or manifest entry, given relative to both roots.
+  // Entries may arrive before their parent directory's own entry, so
+  // parents are created on demand.
+  void plan_entry(const ScanEntry& entry, const std::string& src_root,
+                  const std::string& dst_root) {
+    namespace fs = std::filesystem;
+    const std::string src = src_root + "/" + entry.path;
+    const std::string dst = dst_root + "/" + entry.path;
+    if (S_ISDIR(entry.mode)) {
+      if (ensure_dir(dst)) metadata_->add({src, dst, entry.mode, entry.mtime_ns});
+    } else if (S_ISLNK(entry.mode)) {
+      if (!ensure_dir(parent_of(dst))) return;
+      acquire_ops(1);
+      std::error_code ec;
+      const fs::path target = fs::read_symlink(src, ec);
+      if (!ec && options_.sync) {
+        std::error_code dst_ec;
+        if (fs::read_symlink(dst, dst_ec) == target && !dst_ec) {
+          unchanged_files_.fetch_add(1, std::memory_order_relaxed);
+          return;
+        }
+      }
+      if (!ec) fs::remove(dst, ec);
+      if (!ec) fs::create_symlink(target, dst, ec);
+      if (ec) {
+        record_failure(dst, ec.message());
+        return;
+      }
+      metadata_->add({src, dst, entry.mode, entry.mtime_ns});
+    } else if (S_ISREG(entry.mode)) {
+      if (ensure_dir(parent_of(dst))) add_file({src, dst}, entry.size, entry.mtime_ns);
+    }
+  }
+
+  // Creates the destination root and gives it the attributes of the source
+  // root, which the walk does not report.
+  bool plan_root(const std::string& src_root, const std::string& dst_root) {
+    if (!ensure_dir(dst_root)) return false;
+    struct stat st;
+    if (::stat(src_root.c_str(), &st) == 0 && S_ISDIR(st.st_mode)) {
+      metadata_->add({src_root, dst_root, st.st_mode, mtime_ns(st)});
+    }
+    return true;
+  }
+
+  // Creates `dir` and its parents unless this job already has. Known
+  // directories cost one hash lookup rather than a stat() per file.
+  bool ensure_dir(const std::string& dir) {
+    if (known_dirs_.count(dir)) return true;
+    acquire_ops(1);
+    std::error_code ec;
+    std::filesystem::create_directories(dir, ec);
+    if (ec) {
+      record_failure(dir, ec.message());
+      return false;
+    }
+    known_dirs_.insert(dir);
+    return true;
+  }
+
+  void record_failure(const std::string& path, const std::string& reason) {
+    failed_files_.fetch_add(1, std::memory_order_relaxed);
+    std::lock_guard<std::mutex> lock(errors_mu_);
+    if (errors_.size() < kMaxRecordedErrors) errors_.push_back(path + ": " + reason);
+  }
+
+  JobStats finish() {
+    flush_pack();
+    if (reactor_) reactor_->wait();
+    queue_.close();
+    if (limit_) limit_->close();
+    for (auto& t : workers_) t.join();
+    workers_.clear();
+    const MetadataStats metadata = metadata_->finish();
+    failed_files_.fetch_add(metadata.error_count, std::memory_order_relaxed);
+    {
+      std::lock_guard<std::mutex> lock(errors_mu_);
+      for (const auto& err : metadata.errors) {
+        if (errors_.size() < kMaxRecordedErrors) errors_.push_back(err);
+      }
+    }
+    if (journal_) {
+      try {
+        journal_->sync();
+      } catch (const std::system_error& e) {
+        record_failure(options_.journal, e.what());
+      }
+    }
+
+    JobStats stats;
+    stats.files = files_.load();
+    stats.failed_files = failed_files_.load();
+    stats.direct_files = direct_files_.load();
+    stats.bytes = bytes_.load();
+    stats.chunks = chunks_.load();
+    stats.packs = packs_.load();
+    stats.packed_files = packed_files_.load();
+    stats.skipped_chunks = skipped_chunks_.load();
+    stats.skipped_bytes = skipped_bytes_.load();
+    stats.unchanged_files = unchanged_files_.load();
+    stats.matched_chunks = matched_chunks_.load();
+    stats.matched_bytes = matched_bytes_.load();
+    stats.sparse_files = sparse_files_.load();
+    stats.hole_bytes = hole_bytes_.load();
+    stats.reflinked_files = reflinked_files_.load();
+    stats.reflinked_bytes = reflinked_bytes_.load();
+    stats.copy_range_files = copy_range_files_.load();
+    stats.copy_range_bytes = copy_range_bytes_.load();
+    stats.metadata_files = metadata.files;
+    stats.metadata_dirs = metadata.dirs;
+    stats.metadata_batches = metadata.batches;
+    stats.coroutine_files = coroutine_files_.load();
+    stats.reactor = "none";
+    if (reactor_) {
+      stats.peak_in_flight = reactor_->peak_in_flight();
+      stats.reactor = std::to_string(reactor_->threads()) +
+                      (reactor_->threads() == 1 ? " thread (" : " threads (") +
+                      reactor_->backend_name() + ")";
+    }
+    stats.io_backend = io_backend_name_;
+    stats.checksum = to_string(options_.checksum);
+    if (options_.checksum == ChecksumKind::kCrc32c) {
+      stats.checksum += std::string(" (") + crc32c_implementation() + ")";
+    } else if (options_.checksum == ChecksumKind::kXxh3) {
+      stats.checksum += std::string(" (") + xxh3_implementation() + ")";
+    }
+    std::size_t buffers = 0;
+    for (const auto& a : arenas_) buffers += a->count();
+    stats.buffers = std::to_string(buffers) + " x " + format_bytes(arenas_.front()->buffer_size()) +
+                    " (" + arenas_.front()->page_kind() + ")";
+    stats.numa = to_string(options_.numa);
+    if (options_.numa != NumaPolicy::kNone) {
+      const std::size_t nodes = numa_nodes().size();
+      stats.numa += " (" + std::to_string(nodes) + (nodes == 1 ? " node)" : " nodes)");
+    }
+    stats.final_threads = limit_ ? limit_->limit() : options_.threads;
+    stats.peak_threads = limit_ ? limit_->peak() : options_.threads;
+    if (options_.throttle) {
+      stats.throttled_seconds = options_.throttle->waited_seconds() - throttle_start_;
+    }
+    if (schedule_) stats.scheduled_seconds = schedule_->waited_seconds();
+    stats.seconds =
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - start_).count();
+    std::lock_guard<std::mutex> lock(errors_mu_);
+    stats.errors = errors_;
+    return stats;
+  }
+
+ private:
+  void worker_loop(unsigned slot, IoBackend& backend) {
+    const std::size_t batch = std::max(1u, options_.io_batch);
+    const int node = worker_nodes_[slot];
+    // Every chunk this worker takes is read into, and written from, its own
+    // buffers, so with both on one node the data stays there.
+    if (options_.numa == NumaPolicy::kLocal) pin_thread_to_node(node);
+    BufferPool pool(*arena(node), pool_size());
+    const std::vector<iovec> buffers = pool.iovecs();
+    const bool registered = backend.register_buffers(buffers);
+
+    PackWriter packer;
+    std::vector<ChunkTask> tasks;
+    std::vector<IoRequest> requests;
+    std::vector<std::size_t> owner;  // requests[r] belongs to tasks[owner[r]]
+    std::vector<std::size_t> compare;
+    std::vector<WorkItem> items(batch);
+    for (;;) {
+      if (limit_) limit_->admit(slot);
+      std::size_t n = queue_.try_pop_batch(items.data(), batch);
+      if (n == 0) {
+        // About to idle: let go of finished files before blocking.
+        backend.release_files();
+        n = queue_.pop_batch(items.data(), batch);
+        if (n == 0) break;
+      }
+      // Preemption point: other jobs may take the slot between batches.
+      if (schedule_) schedule_->acquire(batch_bytes(items.data(), n));
+      tasks.clear();
+      for (std::size_t i = 0; i < n; ++i) {
+        if (items[i].pack) continue;
+        if (offload_chunk(items[i].chunk)) {
+          items[i].chunk.file.reset();
+        } else {
+          tasks.push_back(std::move(items[i].chunk));
+        }
+      }
+      if (!tasks.empty()) copy_batch(backend, tasks, buffers, registered, requests, owner, compare);
+      for (std::size_t i = 0; i < n; ++i) {
+        if (!items[i].pack) continue;
+        copy_pack(*items[i].pack, packer);
+        items[i].pack.reset();
+      }
+      if (schedule_) schedule_->release();
+    }
+  }
+
+  static std::uint64_t batch_bytes(const WorkItem* items, std::size_t n) {
+    std::uint64_t bytes = 0;
+    for (std::size_t i = 0; i < n; ++i) {
+      bytes += items[i].pack ? items[i].pack->bytes : items[i].chunk.length;
+    }
+    return bytes;
+  }
+
+  // Buffers per worker; sync mode reads the destination side of a chunk
+  // into a second one.
+  std::size_t pool_size() const {
+    return (options_.sync ? 2 : 1) * std::max<std::size_t>(1, options_.io_batch);
+  }
+
+  BufferArena* arena(int node) const {
+    for (const auto& a : arenas_) {
+      if (a->node() == node) return a.get();
+    }
+    return nullptr;
+  }
+
+  // Moves a chunk with copy_file_range() if its file is offloaded. Returns
+  // false, leaving the chunk to copy_batch(), if it is not, if sync mode
+  // compares the chunk, or if the kernel refuses, which turns offloading
+  // off for the rest of the file. Only the data of sparse files is copied.
+  bool offload_chunk(const ChunkTask& task) {
+    OpenFile& file = *task.file;
+    if (!file.copy_range.load(std::memory_order_relaxed) || task.offset < file.compare_size) {
+      return false;
+    }
+    if (!file.failed.load(std::memory_order_relaxed)) {
+      const auto start = std::chrono::steady_clock::now();
+      int err = 0;
+      std::uint64_t bytes = 0;
+      auto copy = [&](std::uint64_t offset, std::uint64_t length) {
+        if (err == 0) err = copy_range(file.src_fd.get(), file.dst_fd.get(), offset, length);
+        bytes += length;
+      };
+      if (file.sparse) {
+        for_each_data(file, task.offset, task.offset + task.length, copy);
+      } else {
+        copy(task.offset, task.length);
+      }
+      if (err != 0 && offload_unsupported(err)) {
+        file.copy_range.store(false, std::memory_order_relaxed);
+        return false;
+      }
+      // Charged only now, so a refused chunk is not charged again by
+      // copy_batch().
+      acquire_bytes(task.length);
+      if (err == ENODATA) {
+        fail(file, std::system_error(EIO, std::generic_category(), "source shrank during copy"));
+      } else if (err != 0) {
+        fail(file, std::system_error(err, std::generic_category(), "copy_file_range"));
+      } else {
+        file.offloaded.store(true, std::memory_order_relaxed);
+        bytes_.fetch_add(bytes, std::memory_order_relaxed);
+        copy_range_bytes_.fetch_add(bytes, std::memory_order_relaxed);
+        chunks_.fetch_add(1, std::memory_order_relaxed);
+        if (limit_) limit_->record(std::chrono::steady_clock::now() - start, 1, bytes);
+        if (journal_) {
+          if (options_.journal_sync_data && ::fdatasync(file.dst_fd.get()) != 0) {
+            fail(file, std::system_error(errno, std::generic_category(), "fdatasync"));
+          } else {
+            journal_->record(file.journal_key, task.offset,
+                             static_cast<std::uint32_t>(task.length), 0);
+          }
+        }
+      }
+    }
+    if (file.chunks_left.fetch_sub(1, std::memory_order_acq_rel) == 1) finish_file(file);
+    return true;
+  }
+
+  // Copies one small file on a reactor thread. Only a bounded number of
+  // each thread's files are open, and buffered, at once; the rest wait
+  // here as bare frames. The slot is given back even if the transfer
+  // throws, which Reactor::wait() rethrows.
+  Task<void> copy_small_file(FileTask task, std::uint64_t journal_key) {
+    AsyncSemaphore& slots = *file_slots_[reactor_thread_index()];
+    co_await slots.acquire();
+    try {
+      co_await transfer_small_file(task, journal_key);
+    } catch (...) {
+      slots.release();
+      throw;
+    }
+    slots.release();
+  }
+
+  Task<void> transfer_small_file(const FileTask& task, std::uint64_t journal_key) {
+    auto failed = [&](const std::string& path, const char* what, std::int64_t rc) {
+      record_failure(path, std::system_error(static_cast<int>(-rc), std::generic_category(), what)
+                               .what());
+    };
+    std::int64_t fd = co_await async_openat(AT_FDCWD, task.src.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+      failed(task.src, "open", fd);
+      co_return;
+    }
+    auto st = std::make_unique<struct statx>();
+    std::int64_t rc = co_await async_statx(static_cast<int>(fd), "", AT_EMPTY_PATH,
+                                           STATX_MODE | STATX_SIZE | STATX_MTIME, st.get());
+    const std::uint64_t size = rc == 0 ? st->stx_size : 0;
+    std::unique_ptr<char[]> data(new char[std::max<std::uint64_t>(size, 1)]);
+    if (rc < 0) {
+      failed(task.src, "statx", rc);
+    } else {
+      rc = co_await read_full(static_cast<int>(fd), data.get(), size);
+      if (rc < 0) failed(task.src, "read", rc);
+    }
+    co_await async_close(static_cast<int>(fd));
+    if (rc < 0) co_return;
+
+    std::uint64_t digest = 0;
+    if (options_.checksum != ChecksumKind::kNone) {
+      digest = chunk_digest(options_.checksum, data.get(), size);
+    }
+    fd = co_await async_openat(AT_FDCWD, task.dst.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                               st->stx_mode & 07777);
+    if (fd < 0) {
+      failed(task.dst, "open", fd);
+      co_return;
+    }
+    rc = co_await write_full(static_cast<int>(fd), data.get(), size);
+    if (rc < 0) {
+      failed(task.dst, "write", rc);
+    } else if (options_.journal_sync_data) {
+      rc = co_await async_fdatasync(static_cast<int>(fd));
+      if (rc < 0) failed(task.dst, "fdatasync", rc);
+    }
+    const std::int64_t closed = co_await async_close(static_cast<int>(fd));
+    if (rc < 0) co_return;
+    if (closed < 0) {
+      failed(task.dst, "close", closed);
+      co_return;
+    }
+    if (journal_) journal_->record(journal_key, 0, 0, digest);
+    report_digest(task, digest);
+    report_path(task, CopyPath::kReadWrite);
+    metadata_->add({task.src, task.dst, st->stx_mode,
+                    static_cast<std::int64_t>(st->stx_mtime.tv_sec) * 1000000000 +
+                        st->stx_mtime.tv_nsec});
+    files_.fetch_add(1, std::memory_order_relaxed);
+    bytes_.fetch_add(size, std::memory_order_relaxed);
+    coroutine_files_.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  // Reads `size` bytes from offset 0; returns 0 or -errno.
+  static Task<std::int64_t> read_full(int fd, char* data, std::uint64_t size) {
+    for (std::uint64_t done = 0; done < size;) {
+      const std::int64_t n = co_await async_read(fd, data + done, size - done, done);
+      if (n < 0) co_return n;
+      // The file shrank since it was stat()ed.
+      if (n == 0) co_return -EIO;
+      done += static_cast<std::uint64_t>(n);
+    }
+    co_return 0;
+  }
+
+  // Writes `size` bytes at offset 0; returns 0 or -errno.
+  static Task<std::int64_t> write_full(int fd, const char* data, std::uint64_t size) {
+    for (std::uint64_t done = 0; done < size;) {
+      const std::int64_t n = co_await async_write(fd, data + done, size - done, done);
+      if (n < 0) co_return n;
+      if (n == 0) co_return -EIO;
+      done += static_cast<std::uint64_t>(n);
+    }
+    co_return 0;
+  }
+
+  // Reads the pack's sources into one unit and recreates them from it with
+  // batched creates at the destination.
+  void copy_pack(const PackTask& pack, PackWriter& packer) {
+    acquire_ops(pack.files.size());
+    acquire_bytes(pack.bytes);
+    const auto start = std::chrono::steady_clock::now();
+    packer.reset();
+    std::vector<bool> packed(pack.files.size());
+    std::vector<std::uint64_t> digests(pack.files.size());
+    for (std::size_t i = 0; i < pack.files.size(); ++i) {
+      const FileTask& f = pack.files[i];
+      try {
+        packer.add_file(f.src, f.dst);
+        packed[i] = true;
+        if (options_.checksum != ChecksumKind::kNone) {
+          const std::string_view data = packer.last_data();
+          digests[i] = chunk_digest(options_.checksum, data.data(), data.size());
+        }
+      } catch (const std::system_error& e) {
+        record_failure(f.src, e.what());
+      }
+    }
+    if (packer.entries() == 0) return;
+    UnpackResult result = unpack(packer.finish(), "", options_.journal_sync_data);
+    for (const auto& [path, reason] : result.failures) record_failure(path, reason);
+    // Unpacking set mode and mtime; owner and xattrs are left to the pool,
+    // which sets mode and mtime again after them, since chown clears
+    // set-user-ID bits.
+    const bool fixups = options_.preserve_owner || options_.preserve_xattrs;
+    if (journal_ || options_.digest_sink || options_.path_sink || fixups) {
+      std::unordered_set<std::string> failed;
+      for (const auto& f : result.failures) failed.insert(f.first);
+      for (std::size_t i = 0, entry = 0; i < pack.files.size(); ++i) {
+        if (!packed[i]) continue;
+        const PackEntry& packed_entry = packer.entry(entry++);
+        if (failed.count(pack.files[i].dst)) continue;
+        if (journal_) journal_->record(pack.journal_keys[i], 0, 0, digests[i]);
+        report_digest(pack.files[i], digests[i]);
+        report_path(pack.files[i], CopyPath::kPacked);
+        if (fixups) {
+          metadata_->add({pack.files[i].src, pack.files[i].dst, packed_entry.mode,
+                          packed_entry.mtime_ns});
+        }
+      }
+    }
+    files_.fetch_add(result.files, std::memory_order_relaxed);
+    bytes_.fetch_add(result.bytes, std::memory_order_relaxed);
+    packed_files_.fetch_add(result.files, std::memory_order_relaxed);
+    packs_.fetch_add(1, std::memory_order_relaxed);
+    if (limit_) limit_->record(std::chrono::steady_clock::now() - start, 1, pack.bytes);
+  }
+
+  // Reads every chunk of the batch in one submission, then writes the ones
+  // that read cleanly in a second submission. In sync mode the first
+  // submission also reads the destination side of chunks the destination
+  // already covers; chunks whose sides match are not written. A chunk of a
+  // sparse file takes one read and one write per data extent in it.
+  void copy_batch(IoBackend& backend, std::vector<ChunkTask>& tasks,
+                  const std::vector<iovec>& buffers, bool registered,
+                  std::vector<IoRequest>& requests, std::vector<std::size_t>& owner,
+                  std::vector<std::size_t>& compare) {
+    requests.clear();
+    owner.clear();
+    std::uint64_t batch_bytes = 0;
+    for (std::size_t i = 0; i < tasks.size(); ++i) {
+      OpenFile& file = *tasks[i].file;
+      if (file.failed.load(std::memory_order_relaxed)) continue;
+      file.buffered.store(true, std::memory_order_relaxed);
+      IoRequest req;
+      req.op = IoOp::kRead;
+      req.fd = file.src_fd.get();
+      req.file_id = 2 * file.id;
+      req.buf = buffers[i].iov_base;
+      req.buf_index = registered ? static_cast<int>(i) : -1;
+      req.length = file.src_direct ? align_up(tasks[i].length, kDirectIoAlignment)
+                                   : tasks[i].length;
+      req.offset = tasks[i].offset;
+      if (!file.sparse) {
+        requests.push_back(req);
+        owner.push_back(i);
+        batch_bytes += tasks[i].length;
+        continue;
+      }
+      // Only the data is read. The holes are zeroed in the buffer, where
+      // the digest and the sync comparison see the chunk whole.
+      char* const buf = static_cast<char*>(buffers[i].iov_base);
+      const std::uint64_t end = tasks[i].offset + tasks[i].length;
+      std::uint64_t pos = tasks[i].offset;
+      for_each_data(file, pos, end, [&](std::uint64_t offset, std::uint64_t length) {
+        std::memset(buf + (pos - tasks[i].offset), 0, offset - pos);
+        req.buf = buf + (offset - tasks[i].offset);
+        req.offset = offset;
+        req.length = length;
+        requests.push_back(req);
+        owner.push_back(i);
+        batch_bytes += length;
+        pos = offset + length;
+      });
+      std::memset(buf + (pos - tasks[i].offset), 0, end - pos);
+    }
+    const std::size_t live = requests.size();
+    // Bytes request r must transfer; direct requests of a file's tail ask
+    // for more.
+    auto expected = [&](std::size_t r) {
+      const ChunkTask& task = tasks[owner[r]];
+      return static_cast<std::size_t>(std::min<std::uint64_t>(
+          requests[r].length, task.offset + task.length - requests[r].offset));
+    };
+    acquire_bytes(batch_bytes);
+    // The batch's latency, as the concurrency controller sees it, starts
+    // after any throttling.
+    const auto start = std::chrono::steady_clock::now();
+    // compare[i]: index of the destination read of tasks[i], or kNoCompare.
+    // Those requests sit after the source reads, so compacting the writes
+    // into the front of `requests` below never overwrites one unread.
+    constexpr std::size_t kNoCompare = SIZE_MAX;
+    compare.assign(tasks.size(), kNoCompare);
+    for (std::size_t r = 0; r < live; ++r) {
+      const std::size_t i = owner[r];
+      OpenFile& file = *tasks[i].file;
+      if ((r > 0 && owner[r - 1] == i) || tasks[i].offset >= file.compare_size) continue;
+      IoRequest req;
+      req.op = IoOp::kRead;
+      req.fd = file.dst_fd.get();
+      req.file_id = 2 * file.id + 1;
+      const std::size_t slot = buffers.size() / 2 + i;
+      req.buf = buffers[slot].iov_base;
+      req.buf_index = registered ? static_cast<int>(slot) : -1;
+      req.length = file.dst_direct ? align_up(tasks[i].length, kDirectIoAlignment)
+                                   : tasks[i].length;
+      req.offset = tasks[i].offset;
+      compare[i] = requests.size();
+      requests.push_back(req);
+    }
+    backend.submit(requests.data(), requests.size());
+
+    // The reads of a chunk are adjacent, and its writes take their places.
+    std::size_t writes = 0;
+    for (std::size_t r = 0, next = 0; r < live; r = next) {
+      const std::size_t i = owner[r];
+      const ChunkTask& task = tasks[i];
+      bool read = true;
+      for (next = r; next < live && owner[next] == i; ++next) {
+        if (!read) continue;
+        if (requests[next].result < 0) {
+          fail(*task.file, std::system_error(static_cast<int>(-requests[next].result),
+                                             std::generic_category(), "read"));
+          read = false;
+        } else if (static_cast<std::size_t>(requests[next].result) < expected(next)) {
+          fail(*task.file, std::system_error(EIO, std::generic_category(),
+                                             "source shrank during copy"));
+          read = false;
+        }
+      }
+      if (!read) continue;
+      const void* data = buffers[i].iov_base;
+      const std::size_t c = compare[i];
+      if (c != kNoCompare && same_chunk(task, data, requests[c])) {
+        matched_chunks_.fetch_add(1, std::memory_order_relaxed);
+        matched_bytes_.fetch_add(task.length, std::memory_order_relaxed);
+        if (!task.file->digests.empty()) {
+          task.file->digests[task.offset / options_.chunk_size] =
+              chunk_digest(options_.checksum, data, task.length);
+        }
+        if (journal_) {
+          journal_->record(task.file->journal_key, task.offset,
+                           static_cast<std::uint32_t>(task.length),
+                           task.file->digests.empty()
+                               ? 0
+                               : task.file->digests[task.offset / options_.chunk_size]);
+        }
+        continue;
+      }
+      // The chunk is hot in the worker's buffer: digest it before the write.
+      if (!task.file->digests.empty()) {
+        task.file->digests[task.offset / options_.chunk_size] =
+            chunk_digest(options_.checksum, data, task.length);
+      }
+      for (std::size_t q = r; q < next; ++q) {
+        IoRequest req = requests[q];
+        req.op = IoOp::kWrite;
+        req.fd = task.file->dst_fd.get();
+        req.file_id = 2 * task.file->id + 1;
+        req.length = expected(q);
+        if (task.file->dst_direct && req.length % kDirectIoAlignment != 0) {
+          const std::size_t length = req.length;
+          req.length = align_up(length, kDirectIoAlignment);
+          std::memset(static_cast<char*>(req.buf) + length, 0, req.length - length);
+        }
+        owner[writes] = i;
+        requests[writes++] = req;
+      }
+    }
+    backend.submit(requests.data(), writes);
+
+    int synced_fd = -1;
+    for (std::size_t w = 0, next = 0; w < writes; w = next) {
+      const ChunkTask& task = tasks[owner[w]];
+      bool written = true;
+      std::uint64_t bytes = 0;
+      for (next = w; next < writes && owner[next] == owner[w]; ++next) {
+        if (!written) continue;
+        if (requests[next].result < 0) {
+          fail(*task.file, std::system_error(static_cast<int>(-requests[next].result),
+                                             std::generic_category(), "write"));
+          written = false;
+        }
+        bytes += std::min<std::uint64_t>(requests[next].length,
+                                         task.offset + task.length - requests[next].offset);
+      }
+      if (!written) continue;
+      bytes_.fetch_add(bytes, std::memory_order_relaxed);
+      chunks_.fetch_add(1, std::memory_order_relaxed);
+      if (!journal_) continue;
+      // Chunks of one file are usually adjacent in a batch; sync each
+      // destination once before journaling its chunks.
+      if (options_.journal_sync_data && requests[w].fd != synced_fd) {
+        if (::fdatasync(requests[w].fd) != 0) {
+          fail(*task.file, std::system_error(errno, std::generic_category(), "fdatasync"));
+          continue;
+        }
+        synced_fd = requests[w].fd;
+      }
+      journal_->record(task.file->journal_key, task.offset,
+                       static_cast<std::uint32_t>(task.length),
+                       task.file->digests.empty()
+                           ? 0
+                           : task.file->digests[task.offset / options_.chunk_size]);
+    }
+    if (limit_ && live > 0) {
+      limit_->record((std::chrono::steady_clock::now() - start) / live, live, batch_bytes);
+    }
+    for (auto& task : tasks) {
+      OpenFile& file = *task.file;
+      if (file.chunks_left.fetch_sub(1, std::memory_order_acq_rel) == 1) finish_file(file);
+    }
+  }
+
+  // Whether the destination read of a chunk returned the same bytes as its
+  // source side, judged by XXH3 digests of both.
+  static bool same_chunk(const ChunkTask& task, const void* src, const IoRequest& dst) {
+    if (dst.result < 0 || static_cast<std::size_t>(dst.result) < task.length) return false;
+    return xxh3_64(src, task.length) == xxh3_64(dst.buf, task.length);
+  }
+
+  // Calls f(offset, length) for each piece of a sparse file's data in
+  // [begin, end), in order.
+  template <typename F>
+  static void for_each_data(const OpenFile& file, std::uint64_t begin, std::uint64_t end, F f) {
+    auto it = std::partition_point(file.extents.begin(), file.extents.end(),
+                                   [&](const Extent& e) { return e.end() <= begin; });
+    for (; it != file.extents.end() && it->offset < end; ++it) {
+      const std::uint64_t from = std::max(it->offset, begin);
+      f(from, std::min(it->end(), end) - from);
+    }
+  }
+
+  void flush_pack() {
+    if (pending_pack_.files.empty()) return;
+    WorkItem item;
+    item.pack = std::make_unique<PackTask>(std::move(pending_pack_));
+    pending_pack_ = PackTask{};
+    queue_.push(std::move(item));
+  }
+
+  // Sync mode: whether `dst` is a regular file with the given size and mtime.
+  static bool unchanged(const std::string& dst, std::uint64_t size, std::int64_t mtime) {
+    struct stat st;
+    return ::lstat(dst.c_str(), &st) == 0 && S_ISREG(st.st_mode) &&
+           static_cast<std::uint64_t>(st.st_size) == size && mtime_ns(st) == mtime;
+  }
+
+  void acquire_bytes(std::uint64_t n) {
+    if (options_.throttle) options_.throttle->acquire_bytes(n);
+  }
+
+  void acquire_ops(std::uint64_t n) {
+    if (options_.throttle) options_.throttle->acquire_ops(n);
+  }
+
+  std::uint32_t checksum_id() const { return static_cast<std::uint32_t>(options_.checksum); }
+
+  void report_digest(const FileTask& task, std::uint64_t digest) {
+    if (options_.checksum != ChecksumKind::kNone && options_.digest_sink) {
+      options_.digest_sink(task, digest);
+    }
+  }
+
+  void report_path(const FileTask& task, CopyPath path) {
+    if (options_.path_sink) options_.path_sink(task, path);
+  }
+
+  void skip_chunk(std::uint64_t bytes) {
+    skipped_chunks_.fetch_add(1, std::memory_order_relaxed);
+    skipped_bytes_.fetch_add(bytes, std::memory_order_relaxed);
+  }
+
+  void fail(OpenFile& file, const std::system_error& e) {
+    if (!file.failed.exchange(true)) record_failure(file.src, e.what());
+  }
+
+  void finish_file(OpenFile& file) {
+    file.src_fd.reset();
+    if (file.dst_direct && file.size % kDirectIoAlignment != 0 && !file.failed.load() &&
+        ::ftruncate(file.dst_fd.get(), static_cast<off_t>(file.size)) != 0) {
+      fail(file, std::system_error(errno, std::generic_category(), "ftruncate"));
+    }
+    int err = file.dst_fd.close();
+    if (file.failed.load()) return;
+    if (err != 0) {
+      record_failure(file.dst, std::system_category().message(err));
+      return;
+    }
+    files_.fetch_add(1, std::memory_order_relaxed);
+    CopyPath path = CopyPath::kReadWrite;
+    if (file.reflinked) {
+      path = CopyPath::kReflink;
+    } else if (file.offloaded.load() && !file.buffered.load()) {
+      path = CopyPath::kCopyRange;
+      copy_range_files_.fetch_add(1, std::memory_order_relaxed);
+    }
+    report_path({file.src, file.dst}, path);
+    // The source mode and mtime, the latter as unpacked small files keep
+    // it, so a later sync can skip the file on metadata alone.
+    metadata_->add({file.src, file.dst, file.mode, file.mtime_ns});
+    if (options_.checksum != ChecksumKind::kNone && options_.digest_sink) {
+      FileDigest digest(options_.checksum);
+      for (std::size_t i = 0; i < file.digests.size(); ++i) {
+        digest.add(file.digests[i], std::min<std::uint64_t>(options_.chunk_size,
+                                                            file.size - i * options_.chunk_size));
+      }
+      report_digest({file.src, file.dst}, digest.value());
+    }
+  }
+
+  CopyEngine& engine_;
+  const CopyOptions& options_;
+  MpmcQueue<WorkItem> queue_;
+  std::vector<int> worker_nodes_;
+  std::vector<std::unique_ptr<BufferArena>> arenas_;
+  PackTask pending_pack_;
+  std::unordered_set<std::string> known_dirs_;
+  std::unique_ptr<MetadataBatcher> metadata_;
+  std::unique_ptr<Reactor> reactor_;
+  // Per reactor thread; see copy_small_file().
+  std::vector<std::unique_ptr<AsyncSemaphore>> file_slots_;
+  std::vector<char> zeros_;  // planner only
+  std::optional<std::uint64_t> zero_chunk_digest_;
+  std::vector<std::thread> workers_;
+  std::string io_backend_name_;
+  std::unique_ptr<Journal> journal_;
+  std::unique_ptr<AdaptiveLimit> limit_;
+  std::unique_ptr<SchedulerJob> schedule_;
+  std::uint64_t next_file_id_ = 1;
+  std::chrono::steady_clock::time_point start_;
+  double throttle_start_ = 0;
+
+  std::atomic<std::uint64_t> files_{0};
+  std::atomic<std::uint64_t> sparse_files_{0};
+  std::atomic<std::uint64_t> hole_bytes_{0};
+  std::atomic<std::uint64_t> coroutine_files_{0};
+  std::atomic<std::uint64_t> reflinked_files_{0};
+  std::atomic<std::uint64_t> reflinked_bytes_{0};
+  std::atomic<std::uint64_t> copy_range_files_{0};
+  std::atomic<std::uint64_t> copy_range_bytes_{0};
+  std::atomic<std::uint64_t> failed_files_{0};
+  std::atomic<std::uint64_t> direct_files_{0};
+  std::atomic<std::uint64_t> bytes_{0};
+  std::atomic<std::uint64_t> chunks_{0};
+  std::atomic<std::uint64_t> packs_{0};
+  std::atomic<std::uint64_t> packed_files_{0};
+  std::atomic<std::uint64_t> skipped_chunks_{0};
+  std::atomic<std::uint64_t> skipped_bytes_{0};
+  std::atomic<std::uint64_t> unchanged_files_{0};
+  std::atomic<std::uint64_t> matched_chunks_{0};
+  std::atomic<std::uint64_t> matched_bytes_{0};
+  std::mutex errors_mu_;
+  std::vector<std::string> errors_;
+};
+
+std::unique_ptr<BufferArena> CopyEngine::take_arena(int node, std::size_t count) {
+  {
+    std::lock_guard<std::mutex> lock(arenas_mu_);
+    for (auto it = arenas_.begin(); it != arenas_.end(); ++it) {
+      if ((*it)->node() != node || (*it)->count() < count) continue;
+      std::unique_ptr<BufferArena> arena = std::move(*it);
+      arenas_.erase(it);
+      return arena;
+    }
+  }
+  BufferArena::Options options;
+  options.buffer_size = options_.chunk_size;
+  options.count = count;
+  options.huge_pages = options_.huge_pages;
+  options.node = node;
+  // Each worker faults in its own buffers, all at once.
+  options.prefault = false;
+  return std::make_unique<BufferArena>(options);
+}
+
+void CopyEngine::return_arena(std::unique_ptr<BufferArena> arena) {
+  std::lock_guard<std::mutex> lock(arenas_mu_);
+  arenas_.push_back(std::move(arena));
+}
+
+CopyEngine::CopyEngine(CopyOptions options) : options_(std::move(options)) {
+  if (options_.chunk_size == 0) options_.chunk_size = 8 * MiB;
+  if (options_.threads == 0) options_.threads = std::max(1u, std::thread::hardware_concurrency());
+  if (options_.direct_io) options_.chunk_size = align_up(options_.chunk_size, kDirectIoAlignment);
+}
+
+JobStats CopyEngine::copy_files(const std::vector<FileTask>& files) {
+  Job job(*this);
+  for (const auto& f : files) job.add_file(f);
+  return job.finish();
+}
+
+JobStats CopyEngine::copy_tree(const std::string& src_root, const std::string& dst_root) {
+  Job job(*this);
+  if (!job.plan_root(src_root, dst_root)) return job.finish();
+
+  // The walker streams batches to this thread, which plans them while the
+  // walk continues. The bounded queue keeps a fast walker from running
+  // arbitrarily far ahead of planning.
+  BlockingQueue<std::vector<ScanEntry>> batches(64);
+  ScanOptions scan_options;
+  scan_options.threads = options_.scan_threads ? options_.scan_threads : options_.threads;
+  scan_options.adaptive = options_.adaptive_concurrency;
+  Scanner scanner(scan_options);
+  ScanStats scan_stats;
+  std::string scan_error;
+  std::thread walker([&] {
+    try {
+      scan_stats = scanner.scan(
+          src_root, [&](std::vector<ScanEntry>&& batch) { batches.push(std::move(batch)); });
+    } catch (const std::system_error& e) {
+      scan_error = e.what();
+    }
+    batches.close();
+  });
+
+  while (auto batch = batches.pop()) {
+    for (const ScanEntry& entry : *batch) job.plan_entry(entry, src_root, dst_root);
+  }
+  walker.join();
+  if (!scan_error.empty()) job.record_failure(src_root, scan_error);
+  for (const auto& err : scan_stats.errors) job.record_failure("scan " + src_root, err);
+  return job.finish();
+}
+
+JobStats CopyEngine::copy_manifest(const std::string& manifest, const std::string& src_root,
+                                   const std::string& dst_root, std::uint64_t start_offset) {
+  ManifestReader reader(manifest);
+  if (start_offset != 0) reader.seek_offset(start_offset);
+  // Every entry before the block the next one comes from has been planned.
+  std::uint64_t planned_to = reader.block_offset();
+  Job job(*this);
+  if (job.plan_root(src_root, dst_root)) {
+    ScanEntry entry;
+    try {
+      while (!(options_.stop_planning &&
+               options_.stop_planning->load(std::memory_order_relaxed)) &&
+             reader.next(entry)) {
+        job.plan_entry(entry, src_root, dst_root);
+        planned_to = reader.block_offset();
+      }
+    } catch (const std::runtime_error& e) {
+      job.record_failure(manifest, e.what());
+    }
+  }
+  JobStats stats = job.finish();
+  stats.manifest_offset = planned_to;
+  return stats;
+}
+
+}  // namespace dms
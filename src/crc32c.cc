@@ -0,0 +1,278 @@
+// CRC-32C kernels and runtime dispatch.
+//
+// Three implementations share the reflected polynomial 0x82F63B78 and work
+// on the raw register (the CRC before the final inversion):
+//
+//   scalar  slicing-by-8 tables.
+//   sse4.2  the crc32 instruction over three interleaved streams, so its
+//           3-cycle latency is hidden, with the streams merged by shifting
+//           their registers through a carry-less multiply.
+//   avx512  VPCLMULQDQ folding of four 512-bit accumulators (256 bytes per
+//           step), reduced to 128 bits and finished with the crc32
+//           instruction.
+//
+// Polynomials are handled in the reflected 32-bit form used by zlib: bit j
+// holds the coefficient of x^(31-j), so x^0 is 0x80000000.
+
+#include <immintrin.h>
+
+#include <array>
+#include <cstring>
+
+#include "dms/checksum.h"
+
+namespace dms {
+namespace {
+
+constexpr std::uint32_t kPoly = 0x82F63B78;
+
+std::uint64_t load64(const unsigned char* p) {
+  std::uint64_t v;
+  std::memcpy(&v, p, 8);
+  return v;
+}
+
+// a * b mod P.
+std::uint32_t multmodp(std::uint32_t a, std::uint32_t b) {
+  std::uint32_t m = 1u << 31;
+  std::uint32_t p = 0;
+  for (;;) {
+    if (a & m) {
+      p ^= b;
+      if ((a & (m - 1)) == 0) break;
+    }
+    m >>= 1;
+    b = b & 1 ? (b >> 1) ^ kPoly : b >> 1;
+  }
+  return p;
+}
+
+// x^(2^k) mod P for k < 64.
+const std::array<std::uint32_t, 64>& x2n_table() {
+  static const std::array<std::uint32_t, 64> table = [] {
+    std::array<std::uint32_t, 64> t{};
+    std::uint32_t p = 1u << 30;  // x^1
+    for (auto& e : t) {
+      e = p;
+      p = multmodp(p, p);
+    }
+    return t;
+  }();
+  return table;
+}
+
+// x^n mod P.
+std::uint32_t xpow(std::uint64_t n) {
+  const auto& table = x2n_table();
+  std::uint32_t p = 1u << 31;
+  for (unsigned k = 0; n != 0; n >>= 1, ++k) {
+    if (n & 1) p = multmodp(table[k], p);
+  }
+  return p;
+}
+
+using Table = std::array<std::array<std::uint32_t, 256>, 8>;
+
+const Table& slicing_table() {
+  static const Table table = [] {
+    Table t{};
+    for (std::uint32_t i = 0; i < 256; ++i) {
+      std::uint32_t c = i;
+      for (int k = 0; k < 8; ++k) c = c & 1 ? (c >> 1) ^ kPoly : c >> 1;
+      t[0][i] = c;
+    }
+    for (std::size_t k = 1; k < 8; ++k) {
+      for (std::size_t i = 0; i < 256; ++i) {
+        t[k][i] = (t[k - 1][i] >> 8) ^ t[0][t[k - 1][i] & 0xff];
+      }
+    }
+    return t;
+  }();
+  return table;
+}
+
+std::uint32_t crc_scalar(std::uint32_t reg, const unsigned char* p, std::size_t n) {
+  const Table& t = slicing_table();
+  for (; n >= 8; n -= 8, p += 8) {
+    const std::uint64_t v = load64(p) ^ reg;
+    reg = t[7][v & 0xff] ^ t[6][(v >> 8) & 0xff] ^ t[5][(v >> 16) & 0xff] ^
+          t[4][(v >> 24) & 0xff] ^ t[3][(v >> 32) & 0xff] ^ t[2][(v >> 40) & 0xff] ^
+          t[1][(v >> 48) & 0xff] ^ t[0][v >> 56];
+  }
+  for (; n > 0; --n) reg = (reg >> 8) ^ t[0][(reg ^ *p++) & 0xff];
+  return reg;
+}
+
+// Stream lengths of the interleaved sse4.2 kernel.
+constexpr std::size_t kLongBlock = 4096;
+constexpr std::size_t kShortBlock = 256;
+
+// Carry-less multiply constants: shift_k(n) advances a register over n
+// zero bytes; fold_k(f) moves a 128-bit lane f bytes down the message.
+// Both absorb the one-bit offset of reflected carry-less products and the
+// 32-bit shift of the crc32 instruction used for the final reduction.
+std::uint64_t shift_k(std::size_t bytes) { return xpow(8 * bytes - 33); }
+
+struct FoldK {
+  std::uint64_t lo;  // multiplies the first 8 bytes of a lane
+  std::uint64_t hi;  // multiplies the last 8
+};
+
+FoldK fold_k(std::size_t bytes) { return {xpow(8 * bytes + 31), xpow(8 * bytes - 33)}; }
+
+struct Constants {
+  std::uint64_t long1 = shift_k(kLongBlock);
+  std::uint64_t long2 = shift_k(2 * kLongBlock);
+  std::uint64_t short1 = shift_k(kShortBlock);
+  std::uint64_t short2 = shift_k(2 * kShortBlock);
+  FoldK f256 = fold_k(256);
+  FoldK f64 = fold_k(64);
+  FoldK f48 = fold_k(48);
+  FoldK f32 = fold_k(32);
+  FoldK f16 = fold_k(16);
+};
+
+const Constants& constants() {
+  static const Constants c;
+  return c;
+}
+
+__attribute__((target("sse4.2,pclmul"))) std::uint32_t shift_reg(std::uint32_t reg,
+                                                                   std::uint64_t k) {
+  const __m128i product = _mm_clmulepi64_si128(_mm_cvtsi32_si128(static_cast<int>(reg)),
+                                                _mm_cvtsi64_si128(static_cast<long long>(k)), 0);
+  return static_cast<std::uint32_t>(
+      _mm_crc32_u64(0, static_cast<std::uint64_t>(_mm_cvtsi128_si64(product))));
+}
+
+// Runs the interleaved loop over as many 3 * block byte spans as fit.
+__attribute__((target("sse4.2,pclmul"))) std::uint32_t three_way(
+    std::uint32_t reg, const unsigned char*& p, std::size_t& n, std::size_t block,
+    std::uint64_t k1, std::uint64_t k2) {
+  while (n >= 3 * block) {
+    std::uint64_t c0 = reg, c1 = 0, c2 = 0;
+    for (std::size_t i = 0; i < block; i += 8) {
+      c0 = _mm_crc32_u64(c0, load64(p + i));
+      c1 = _mm_crc32_u64(c1, load64(p + block + i));
+      c2 = _mm_crc32_u64(c2, load64(p + 2 * block + i));
+    }
+    reg = shift_reg(static_cast<std::uint32_t>(c0), k2) ^
+          shift_reg(static_cast<std::uint32_t>(c1), k1) ^ static_cast<std::uint32_t>(c2);
+    p += 3 * block;
+    n -= 3 * block;
+  }
+  return reg;
+}
+
+__attribute__((target("sse4.2,pclmul"))) std::uint32_t crc_sse42(std::uint32_t reg,
+                                                                   const unsigned char* p,
+                                                                   std::size_t n) {
+  for (; n > 0 && reinterpret_cast<std::uintptr_t>(p) & 7; --n) reg = _mm_crc32_u8(reg, *p++);
+  const Constants& c = constants();
+  reg = three_way(reg, p, n, kLongBlock, c.long1, c.long2);
+  reg = three_way(reg, p, n, kShortBlock, c.short1, c.short2);
+  std::uint64_t r = reg;
+  for (; n >= 8; n -= 8, p += 8) r = _mm_crc32_u64(r, load64(p));
+  reg = static_cast<std::uint32_t>(r);
+  for (; n > 0; --n) reg = _mm_crc32_u8(reg, *p++);
+  return reg;
+}
+
+#define DMS_AVX512_TARGET \
+  __attribute__((target("avx512f,avx512bw,avx512vl,vpclmulqdq,pclmul,sse4.2")))
+
+DMS_AVX512_TARGET __m512i fold512(__m512i x, __m512i k, __m512i data) {
+  return _mm512_ternarylogic_epi64(_mm512_clmulepi64_epi128(x, k, 0x00),
+                                   _mm512_clmulepi64_epi128(x, k, 0x11), data, 0x96);
+}
+
+DMS_AVX512_TARGET __m128i fold128(__m128i x, FoldK k, __m128i data) {
+  const __m128i kv = _mm_set_epi64x(static_cast<long long>(k.hi), static_cast<long long>(k.lo));
+  return _mm_ternarylogic_epi64(_mm_clmulepi64_si128(x, kv, 0x00),
+                                _mm_clmulepi64_si128(x, kv, 0x11), data, 0x96);
+}
+
+DMS_AVX512_TARGET __m512i broadcast(FoldK k) {
+  const auto lo = static_cast<long long>(k.lo);
+  const auto hi = static_cast<long long>(k.hi);
+  return _mm512_set_epi64(hi, lo, hi, lo, hi, lo, hi, lo);
+}
+
+DMS_AVX512_TARGET std::uint32_t crc_avx512(std::uint32_t reg, const unsigned char* p,
+                                           std::size_t n) {
+  if (n < 512) return crc_sse42(reg, p, n);
+  const Constants& c = constants();
+  // XORing the register into the first four bytes turns the rest of the
+  // computation into a CRC with a zero initial register.
+  __m512i x0 = _mm512_xor_si512(
+      _mm512_loadu_si512(p),
+      _mm512_inserti32x4(_mm512_setzero_si512(), _mm_cvtsi32_si128(static_cast<int>(reg)), 0));
+  __m512i x1 = _mm512_loadu_si512(p + 64);
+  __m512i x2 = _mm512_loadu_si512(p + 128);
+  __m512i x3 = _mm512_loadu_si512(p + 192);
+  p += 256;
+  n -= 256;
+  const __m512i k256 = broadcast(c.f256);
+  for (; n >= 256; n -= 256, p += 256) {
+    x0 = fold512(x0, k256, _mm512_loadu_si512(p));
+    x1 = fold512(x1, k256, _mm512_loadu_si512(p + 64));
+    x2 = fold512(x2, k256, _mm512_loadu_si512(p + 128));
+    x3 = fold512(x3, k256, _mm512_loadu_si512(p + 192));
+  }
+  const __m512i k64 = broadcast(c.f64);
+  x1 = fold512(x0, k64, x1);
+  x2 = fold512(x1, k64, x2);
+  x3 = fold512(x2, k64, x3);
+  for (; n >= 64; n -= 64, p += 64) x3 = fold512(x3, k64, _mm512_loadu_si512(p));
+
+  // Lane extraction goes through memory: it runs once per call, and GCC 12
+  // warns about the undefined pass-through operand of the extract builtins.
+  alignas(64) __m128i lanes[4];
+  _mm512_store_si512(lanes, x3);
+  __m128i r = fold128(lanes[0], c.f48, lanes[3]);
+  r = fold128(lanes[1], c.f32, r);
+  r = fold128(lanes[2], c.f16, r);
+  for (; n >= 16; n -= 16, p += 16) {
+    r = fold128(r, c.f16, _mm_loadu_si128(reinterpret_cast<const __m128i*>(p)));
+  }
+  std::uint64_t crc = _mm_crc32_u64(0, static_cast<std::uint64_t>(_mm_cvtsi128_si64(r)));
+  crc = _mm_crc32_u64(crc, static_cast<std::uint64_t>(_mm_extract_epi64(r, 1)));
+  reg = static_cast<std::uint32_t>(crc);
+  for (; n > 0; --n) reg = _mm_crc32_u8(reg, *p++);
+  return reg;
+}
+
+#undef DMS_AVX512_TARGET
+
+struct Kernel {
+  std::uint32_t (*fn)(std::uint32_t, const unsigned char*, std::size_t);
+  const char* name;
+};
+
+const Kernel& kernel() {
+  static const Kernel k = []() -> Kernel {
+    __builtin_cpu_init();
+    const bool sse42 = __builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("pclmul");
+    if (sse42 && __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw") &&
+        __builtin_cpu_supports("avx512vl") && __builtin_cpu_supports("vpclmulqdq")) {
+      return {crc_avx512, "avx512"};
+    }
+    if (sse42) return {crc_sse42, "sse4.2"};
+    return {crc_scalar, "scalar"};
+  }();
+  return k;
+}
+
+}  // namespace
+
+const char* crc32c_implementation() { return kernel().name; }
+
+std::uint32_t crc32c(const void* data, std::size_t length, std::uint32_t crc) {
+  return ~kernel().fn(~crc, static_cast<const unsigned char*>(data), length);
+}
+
+std::uint32_t crc32c_combine(std::uint32_t crc_a, std::uint32_t crc_b, std::uint64_t length_b) {
+  return multmodp(xpow(8 * length_b), crc_a) ^ crc_b;
+}
+
+}  // namespace dms
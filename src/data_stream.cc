@@ -0,0 +1,693 @@
+#include "dms/data_stream.h"
+
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <stdexcept>
+#include <system_error>
+#include <thread>
+
+#include "dms/arena.h"
+#include "dms/encoding.h"
+#include "dms/error.h"
+#include "dms/file.h"
+#include "dms/mpmc_queue.h"
+#include "dms/rpc.h"
+
+namespace dms {
+namespace {
+
+constexpr char kMagic[4] = {'D', 'M', 'S', 'D'};
+constexpr std::size_t kMaxErrors = 16;
+// References a stream sends between kSyncs, which bounds what it keeps to
+// resend missed chunks.
+constexpr std::size_t kSyncRefs = 1024;
+// Room in a chunk's buffer for its kRef frames; references beyond it are
+// sent as data.
+constexpr std::size_t kRefFrameSpace = 64 * KiB;
+
+void send_header(FileSender& sender, const StreamHeader& header, bool more) {
+  char buf[kStreamHeaderSize];
+  encode_stream_header(header, buf);
+  sender.send_bytes(buf, sizeof(buf), more);
+}
+
+// Reads the mover's answer to kSync or kEnd: any kMiss frames, then the
+// kAck.
+void read_ack(int fd, std::vector<StreamHeader>& misses, StreamHeader& ack) {
+  for (;;) {
+    char buf[kStreamHeaderSize];
+    std::size_t done = 0;
+    while (done < sizeof(buf)) {
+      ssize_t n = ::recv(fd, buf + done, sizeof(buf) - done, 0);
+      if (n < 0) {
+        if (errno == EINTR) continue;
+        throw_errno("recv");
+      }
+      if (n == 0) throw std::runtime_error("mover closed the connection without an ack");
+      done += static_cast<std::size_t>(n);
+    }
+    if (!decode_stream_header(buf, ack) ||
+        (ack.type != StreamFrame::kAck && ack.type != StreamFrame::kMiss)) {
+      throw std::runtime_error("mover sent a bad ack");
+    }
+    if (ack.type == StreamFrame::kAck) return;
+    misses.push_back(ack);
+  }
+}
+
+}  // namespace
+
+void encode_stream_header(const StreamHeader& header, char* out) {
+  std::memcpy(out, kMagic, 4);
+  const auto type = static_cast<std::uint16_t>(header.type);
+  out[4] = static_cast<char>(type);
+  out[5] = static_cast<char>(type >> 8);
+  const auto codec = static_cast<std::uint16_t>(header.codec);
+  out[6] = static_cast<char>(codec);
+  out[7] = static_cast<char>(codec >> 8);
+  store_u32(out + 8, header.file_id);
+  store_u32(out + 12, header.length);
+  store_u64(out + 16, header.offset);
+}
+
+bool decode_stream_header(const char* in, StreamHeader& header) {
+  if (std::memcmp(in, kMagic, 4) != 0) return false;
+  const std::uint16_t type = load_u16(in + 4);
+  if (type < static_cast<std::uint16_t>(StreamFrame::kHello) ||
+      type > static_cast<std::uint16_t>(StreamFrame::kSync)) {
+    return false;
+  }
+  header.type = static_cast<StreamFrame>(type);
+  header.codec = static_cast<Codec>(load_u16(in + 6));
+  header.file_id = load_u32(in + 8);
+  header.length = load_u32(in + 12);
+  header.offset = load_u64(in + 16);
+  return true;
+}
+
+void encode_ref_header(const RefHeader& ref, char* out) {
+  store_u32(out, ref.length);
+  store_u64(out + 4, ref.source_offset);
+  store_u64(out + 12, ref.digest.low);
+  store_u64(out + 20, ref.digest.high);
+}
+
+void decode_ref_header(const char* in, RefHeader& ref) {
+  ref.length = load_u32(in);
+  ref.source_offset = load_u64(in + 4);
+  ref.digest = {load_u64(in + 12), load_u64(in + 20)};
+}
+
+namespace {
+
+// One file being cut into chunks. Shared by the streams sending its
+// chunks; the descriptor closes with the last of them.
+struct Source {
+  UniqueFd fd;
+  std::uint32_t id = 0;
+  std::uint64_t size = 0;
+  const std::string* dst = nullptr;
+};
+
+struct Chunk {
+  std::shared_ptr<Source> source;
+  std::uint64_t offset = 0;
+  std::uint32_t length = 0;
+};
+
+// One frame of a chunk the compress pool prepared.
+struct Part {
+  StreamFrame type = StreamFrame::kData;  // kData, kZData or kRef
+  std::uint64_t offset = 0;
+  std::uint32_t length = 0;  // file bytes covered
+  Codec codec = Codec::kNone;
+  // The kZData or kRef payload, at `frame` in the payload's buffer; kData
+  // is sent from the chunk's data.
+  std::size_t frame = 0;
+  std::uint32_t frame_size = 0;
+  Hash128 digest;  // kRef
+};
+
+// A chunk ready for a stream. Without compression or dedup it is sent
+// from the file; otherwise the compress pool has read it into the start
+// of `buffer`, split it into `parts` and put their frames after the data,
+// from `frames` on.
+struct Payload {
+  Chunk chunk;
+  ArenaBuffer buffer;
+  std::vector<Part> parts;
+  std::size_t frames = 0;  // end of the frames written so far
+
+  // Room for a frame of `size` bytes, or nullptr.
+  char* frame(std::size_t size, std::size_t capacity) {
+    return capacity - frames >= size ? buffer.data() + frames : nullptr;
+  }
+};
+
+// A kRef a stream sent, kept until the mover has confirmed it.
+struct SentRef {
+  std::shared_ptr<Source> source;
+  std::uint64_t offset = 0;
+  std::uint32_t length = 0;
+  Hash128 digest;
+};
+
+class Push {
+ public:
+  Push(const std::string& address, const std::vector<FileTask>& files,
+       const PushOptions& options)
+      : address_(address),
+        files_(files),
+        options_(options),
+        prepare_(options.compression != Codec::kNone || options.dedup_index),
+        chunker_(options.dedup_chunking) {
+    chunk_size_ = std::min<std::size_t>(std::max<std::size_t>(options.chunk_size, 1),
+                                        prepare_ ? kMaxBufferedChunk : UINT32_MAX);
+    options_.max_streams = std::max(options_.max_streams, 1u);
+    options_.streams = std::min(std::max(options_.streams, 1u), options_.max_streams);
+    session_ = std::random_device{}() ^
+               static_cast<std::uint64_t>(
+                   std::chrono::steady_clock::now().time_since_epoch().count());
+  }
+
+  PushStats run();
+
+ private:
+  struct Stream {
+    std::thread thread;
+    std::atomic<bool> retire{false};
+    int fd = -1;  // while connected; guarded by mu_
+    bool running = true;
+  };
+
+  bool next_chunk(Chunk& chunk);
+  bool next_payload(Payload& payload);
+  void compress_loop();
+  // Appends the data between `from` and `to` (offsets into the chunk) as
+  // a kData part, or kZData if it compresses.
+  void add_literal(Payload& payload, std::size_t from, std::size_t to);
+  // Sends kSync and then, as data, the referenced chunks the mover missed.
+  void sync(FileSender& sender, int socket, std::vector<SentRef>& refs);
+  void add_stream();
+  void retire_stream();
+  void stream_loop(Stream& stream);
+  void adapt(double seconds);
+  // Mean smoothed RTT of the connected streams, in microseconds.
+  double mean_rtt();
+
+  const std::string& address_;
+  const std::vector<FileTask>& files_;
+  PushOptions options_;
+  const bool prepare_;  // chunks go through the compress pool
+  const Chunker chunker_;
+  std::size_t chunk_size_;
+  std::uint64_t session_;
+
+  // Work cursor, handed out under plan_mu_.
+  std::mutex plan_mu_;
+  std::size_t next_file_ = 0;
+  std::shared_ptr<Source> current_;
+  std::uint64_t next_offset_ = 0;
+  bool exhausted_ = false;
+
+  std::mutex mu_;
+  std::condition_variable changed_;
+  std::list<std::unique_ptr<Stream>> streams_;
+  unsigned active_ = 0;  // streams not retired or finished
+  std::exception_ptr error_;
+  std::atomic<bool> abort_{false};
+  PushStats stats_;
+  std::uint64_t acked_bytes_ = 0;
+  std::uint64_t acked_files_ = 0;
+
+  std::atomic<std::uint64_t> sent_{0};
+  std::atomic<std::uint64_t> wire_bytes_{0};
+
+  // Compression stage: chunks ready to send, the threads filling it and
+  // the buffers the chunks are read into, recycled once sent.
+  std::unique_ptr<BufferArena> buffers_;
+  std::unique_ptr<MpmcQueue<Payload>> ready_;
+  std::vector<std::thread> compressors_;
+  unsigned compressors_left_ = 0;  // guarded by mu_
+  std::atomic<std::uint64_t> compressed_chunks_{0};
+  std::atomic<std::uint64_t> raw_chunks_{0};
+  std::atomic<std::uint64_t> dedup_chunks_{0};
+  std::atomic<std::uint64_t> dedup_hits_{0};
+  std::atomic<std::uint64_t> dedup_bytes_{0};
+  std::atomic<std::uint64_t> dedup_misses_{0};
+
+  // Controller state.
+  std::uint64_t last_sent_ = 0;
+  double base_rtt_ = 0;
+  double before_ = 0;   // throughput before the last addition
+  unsigned added_ = 0;  // streams added by it, while it is being judged
+  unsigned settle_ = 0;
+  unsigned hold_ = 0;
+};
+
+bool Push::next_chunk(Chunk& chunk) {
+  std::lock_guard<std::mutex> lock(plan_mu_);
+  for (;;) {
+    if (current_ && (next_offset_ < current_->size || (current_->size == 0 && next_offset_ == 0))) {
+      chunk.source = current_;
+      chunk.offset = next_offset_;
+      chunk.length = static_cast<std::uint32_t>(
+          std::min<std::uint64_t>(chunk_size_, current_->size - next_offset_));
+      // An empty file is handed out once, as a chunk of no data.
+      next_offset_ += std::max<std::uint64_t>(chunk.length, 1);
+      return true;
+    }
+    current_.reset();
+    if (next_file_ == files_.size()) {
+      if (!exhausted_) {
+        exhausted_ = true;
+        std::lock_guard<std::mutex> stats_lock(mu_);
+        stats_.final_streams = active_;
+      }
+      return false;
+    }
+    const FileTask& task = files_[next_file_++];
+    auto source = std::make_shared<Source>();
+    struct stat st;
+    try {
+      source->fd = open_or_throw(task.src, O_RDONLY);
+      if (::fstat(source->fd.get(), &st) != 0) throw_errno("fstat " + task.src);
+    } catch (const std::system_error& e) {
+      std::lock_guard<std::mutex> stats_lock(mu_);
+      ++stats_.failed_files;
+      if (stats_.errors.size() < kMaxErrors) stats_.errors.push_back(task.src + ": " + e.what());
+      continue;
+    }
+    source->id = static_cast<std::uint32_t>(next_file_);
+    source->size = static_cast<std::uint64_t>(st.st_size);
+    source->dst = &task.dst;
+    current_ = std::move(source);
+    next_offset_ = 0;
+    std::lock_guard<std::mutex> stats_lock(mu_);
+    ++stats_.files;
+    stats_.bytes += current_->size;
+  }
+}
+
+bool Push::next_payload(Payload& payload) {
+  if (!ready_) return next_chunk(payload.chunk);
+  auto next = ready_->pop();
+  if (!next) return false;
+  payload = std::move(*next);
+  return true;
+}
+
+void Push::add_literal(Payload& payload, std::size_t from, std::size_t to) {
+  if (to == from) return;
+  Part part;
+  part.offset = payload.chunk.offset + from;
+  part.length = static_cast<std::uint32_t>(to - from);
+  if (options_.compression != Codec::kNone) {
+    const char* raw = payload.buffer.data() + from;
+    const Codec codec = choose_codec(options_.compression, sample_ratio(raw, part.length));
+    // Sent raw when the buffer is out of room, which only a chunk cut
+    // into many pieces by dedup can cause.
+    const std::size_t bound = codec != Codec::kNone ? 4 + compress_bound(codec, part.length) : 0;
+    char* out = bound ? payload.frame(bound, buffers_->buffer_size()) : nullptr;
+    if (out) {
+      const std::size_t n = compress(codec, raw, part.length, out + 4, bound - 4,
+                                     options_.compression_level);
+      if (n + 4 < part.length) {
+        store_u32(out, part.length);
+        part.type = StreamFrame::kZData;
+        part.codec = codec;
+        part.frame = payload.frames;
+        part.frame_size = static_cast<std::uint32_t>(4 + n);
+        payload.frames += part.frame_size;
+      }
+    }
+    (part.type == StreamFrame::kZData ? compressed_chunks_ : raw_chunks_).fetch_add(1);
+  }
+  payload.parts.push_back(std::move(part));
+}
+
+// Reads chunks ahead of the streams: looks up their content-defined chunks
+// in the dedup index, turning those found into references, and compresses
+// the rest where worth it. The last thread to run out of chunks closes the
+// queue.
+void Push::compress_loop() {
+  const double cpu_start = thread_cpu_seconds();
+  try {
+    Chunk chunk;
+    std::vector<std::size_t> ends;
+    while (!abort_.load() && next_chunk(chunk)) {
+      Payload payload;
+      payload.chunk = std::move(chunk);
+      const Chunk& c = payload.chunk;
+      payload.buffer = ArenaBuffer(buffers_.get(), buffers_->acquire());
+      payload.frames = c.length;
+      if (c.length > 0) {
+        if (pread_full(c.source->fd.get(), payload.buffer.data(), c.length,
+                       static_cast<off_t>(c.offset)) != c.length) {
+          throw_errno(EIO, "file ended before the range to send");
+        }
+      }
+      std::size_t literal = 0;  // start of the data not yet in a part
+      if (options_.dedup_index && c.length > 0) {
+        ChunkIndex& index = *options_.dedup_index;
+        const std::string& dst = *c.source->dst;
+        ends.clear();
+        chunker_.split(payload.buffer.data(), c.length, true, ends);
+        std::size_t start = 0;
+        for (const std::size_t end : ends) {
+          const auto n = static_cast<std::uint32_t>(end - start);
+          const std::uint64_t offset = c.offset + start;
+          const std::size_t from = start;
+          start = end;
+          // A chunk cut short by the end of the unit is not worth an entry.
+          if (n < chunker_.options().min_size) continue;
+          dedup_chunks_.fetch_add(1);
+          const Hash128 digest = xxh3_128(payload.buffer.data() + from, n);
+          ChunkIndex::Location at;
+          if (!index.find(digest, at) || at.length != n ||
+              (at.path == dst && at.offset == offset)) {
+            index.insert(digest, dst, offset, n);
+            continue;
+          }
+          // Parts keep the order of the data. Without room for its frame,
+          // the reference is sent as data.
+          add_literal(payload, literal, from);
+          literal = from;
+          const std::size_t size = kRefHeaderSize + at.path.size();
+          char* out = payload.frame(size, buffers_->buffer_size());
+          if (!out) continue;
+          literal = end;
+          Part ref;
+          ref.type = StreamFrame::kRef;
+          ref.offset = offset;
+          ref.length = n;
+          ref.digest = digest;
+          ref.frame = payload.frames;
+          ref.frame_size = static_cast<std::uint32_t>(size);
+          encode_ref_header({n, at.offset, digest}, out);
+          std::memcpy(out + kRefHeaderSize, at.path.data(), at.path.size());
+          payload.frames += size;
+          payload.parts.push_back(std::move(ref));
+        }
+      }
+      add_literal(payload, literal, c.length);
+      if (!ready_->push(std::move(payload))) break;
+    }
+  } catch (...) {
+    std::lock_guard<std::mutex> lock(mu_);
+    if (!error_) error_ = std::current_exception();
+    abort_.store(true);
+    ready_->close();
+  }
+  std::lock_guard<std::mutex> lock(mu_);
+  stats_.cpu_seconds += thread_cpu_seconds() - cpu_start;
+  if (--compressors_left_ == 0) ready_->close();
+  changed_.notify_all();
+}
+
+void Push::sync(FileSender& sender, int socket, std::vector<SentRef>& refs) {
+  send_header(sender, {StreamFrame::kSync, 0, 0, 0}, false);
+  std::vector<StreamHeader> misses;
+  StreamHeader ack;
+  read_ack(socket, misses, ack);
+  for (const StreamHeader& miss : misses) {
+    auto it = std::find_if(refs.begin(), refs.end(), [&](const SentRef& ref) {
+      return ref.source->id == miss.file_id && ref.offset == miss.offset;
+    });
+    if (it == refs.end() || it->length != miss.length) {
+      throw std::runtime_error("mover missed a chunk that was not referenced");
+    }
+    if (options_.throttle) options_.throttle->acquire_bytes(it->length);
+    send_header(sender, {StreamFrame::kData, miss.file_id, it->length, it->offset}, true);
+    sender.send_file(it->source->fd.get(), it->offset, it->length);
+    wire_bytes_.fetch_add(it->length);
+    dedup_bytes_.fetch_sub(it->length);
+    dedup_misses_.fetch_add(1);
+    // The chunk now has a copy at the place it was sent to.
+    options_.dedup_index->insert(it->digest, *it->source->dst, it->offset, it->length);
+  }
+  refs.clear();
+}
+
+// Called with mu_ held.
+void Push::add_stream() {
+  streams_.push_back(std::make_unique<Stream>());
+  Stream& stream = *streams_.back();
+  stream.thread = std::thread([this, &stream] { stream_loop(stream); });
+  ++active_;
+  stats_.peak_streams = std::max(stats_.peak_streams, active_);
+}
+
+// Called with mu_ held. Retires the newest stream; it leaves after its
+// current chunk.
+void Push::retire_stream() {
+  for (auto it = streams_.rbegin(); it != streams_.rend(); ++it) {
+    Stream& stream = **it;
+    if (stream.running && !stream.retire.load()) {
+      stream.retire.store(true);
+      --active_;
+      return;
+    }
+  }
+}
+
+void Push::stream_loop(Stream& stream) {
+  const double cpu_start = thread_cpu_seconds();
+  try {
+    UniqueFd socket = connect_tcp(address_);
+    {
+      std::lock_guard<std::mutex> lock(mu_);
+      stream.fd = socket.get();
+    }
+    FileSender sender(socket.get(), options_.send_method);
+    send_header(sender, {StreamFrame::kHello, 0, 0, session_}, false);
+    // Files arrive in id order on every stream, except from the compress
+    // pool; the mover ignores a repeated kOpen.
+    std::uint32_t opened = 0;
+    std::vector<SentRef> refs;
+    Payload payload;
+    while (!stream.retire.load() && !abort_.load() && next_payload(payload)) {
+      const Chunk& chunk = payload.chunk;
+      const Source& src = *chunk.source;
+      if (src.id != opened) {
+        const std::string& dst = *src.dst;
+        send_header(sender, {StreamFrame::kOpen, src.id, static_cast<std::uint32_t>(dst.size()),
+                             src.size}, true);
+        sender.send_bytes(dst.data(), dst.size(), chunk.length > 0);
+        opened = src.id;
+      }
+      if (chunk.length > 0 && payload.parts.empty()) {
+        if (options_.throttle) options_.throttle->acquire_bytes(chunk.length);
+        send_header(sender, {StreamFrame::kData, src.id, chunk.length, chunk.offset}, true);
+        sender.send_file(src.fd.get(), chunk.offset, chunk.length);
+        wire_bytes_.fetch_add(chunk.length);
+      }
+      for (const Part& part : payload.parts) {
+        const std::uint32_t wire = part.type == StreamFrame::kData ? part.length : part.frame_size;
+        if (options_.throttle) options_.throttle->acquire_bytes(wire);
+        send_header(sender, {part.type, src.id, wire, part.offset, part.codec}, true);
+        if (part.type == StreamFrame::kData) {
+          sender.send_bytes(payload.buffer.data() + (part.offset - chunk.offset), wire);
+        } else {
+          sender.send_bytes(payload.buffer.data() + part.frame, wire);
+        }
+        if (part.type == StreamFrame::kRef) {
+          refs.push_back({chunk.source, part.offset, part.length, part.digest});
+          dedup_hits_.fetch_add(1);
+          dedup_bytes_.fetch_add(part.length);
+        }
+        wire_bytes_.fetch_add(wire);
+      }
+      sent_.fetch_add(chunk.length);
+      payload = Payload{};
+      if (refs.size() >= kSyncRefs) sync(sender, socket.get(), refs);
+    }
+    if (!refs.empty()) sync(sender, socket.get(), refs);
+    send_header(sender, {StreamFrame::kEnd, 0, 0, 0}, false);
+    sender.finish();
+    std::vector<StreamHeader> misses;
+    StreamHeader ack;
+    read_ack(socket.get(), misses, ack);
+    if (!misses.empty()) throw std::runtime_error("mover missed a chunk that was not referenced");
+
+    std::lock_guard<std::mutex> lock(mu_);
+    stream.fd = -1;
+    acked_bytes_ += ack.offset;
+    acked_files_ += ack.file_id;
+    stats_.send_method = to_string(sender.method());
+    stats_.zerocopy_sends += sender.zerocopy_sends();
+    stats_.zerocopy_copied += sender.zerocopy_copied();
+  } catch (...) {
+    std::lock_guard<std::mutex> lock(mu_);
+    stream.fd = -1;
+    if (!error_) error_ = std::current_exception();
+    abort_.store(true);
+    if (ready_) ready_->close();
+  }
+  std::lock_guard<std::mutex> lock(mu_);
+  stats_.cpu_seconds += thread_cpu_seconds() - cpu_start;
+  stream.running = false;
+  if (!stream.retire.load()) --active_;
+  changed_.notify_all();
+}
+
+double Push::mean_rtt() {
+  double sum = 0;
+  unsigned n = 0;
+  for (const auto& stream : streams_) {
+    if (stream->fd < 0) continue;
+    tcp_info info{};
+    socklen_t len = sizeof(info);
+    if (::getsockopt(stream->fd, IPPROTO_TCP, TCP_INFO, &info, &len) == 0 && info.tcpi_rtt > 0) {
+      sum += info.tcpi_rtt;
+      ++n;
+    }
+  }
+  return n > 0 ? sum / n : 0;
+}
+
+// Called with mu_ held, once per adapt_interval while work remains.
+void Push::adapt(double seconds) {
+  const std::uint64_t sent = sent_.load();
+  const double throughput = static_cast<double>(sent - last_sent_) / seconds;
+  last_sent_ = sent;
+  const double rtt = mean_rtt();
+  if (rtt > 0 && (base_rtt_ == 0 || rtt < base_rtt_)) base_rtt_ = rtt;
+
+  // A change needs an interval to ramp up before it is judged.
+  if (settle_ > 0) {
+    --settle_;
+    return;
+  }
+  auto grow = [&](unsigned n) {
+    before_ = throughput;
+    added_ = n;
+    for (unsigned i = 0; i < n; ++i) add_stream();
+    settle_ = 1;
+  };
+  // Queueing delay well above the path's own RTT: the streams compete for
+  // a bottleneck instead of filling it.
+  const bool queueing = rtt > 1.5 * base_rtt_ && rtt - base_rtt_ > 1000;
+  if (queueing && active_ > 1) {
+    retire_stream();
+    added_ = 0;
+    hold_ = 4;
+    settle_ = 1;
+  } else if (added_ > 0) {
+    if (throughput > before_ * 1.05) {
+      // The last step paid off: double the streams, like slow start.
+      const unsigned n = std::min(active_, options_.max_streams - active_);
+      if (n == 0) {
+        added_ = 0;
+        return;
+      }
+      grow(n);
+    } else {
+      for (unsigned i = 0; i < added_; ++i) retire_stream();
+      added_ = 0;
+      hold_ = 8;
+      settle_ = 1;
+    }
+  } else if (hold_ > 0) {
+    --hold_;
+    return;
+  } else if (active_ < options_.max_streams) {
+    grow(1);
+  } else {
+    return;
+  }
+  ++stats_.stream_changes;
+}
+
+PushStats Push::run() {
+  const auto start = std::chrono::steady_clock::now();
+  stats_.compression = to_string(options_.compression);
+  if (!codec_available(options_.compression)) {
+    throw std::runtime_error(std::string("compression codec not available: ") +
+                             to_string(options_.compression));
+  }
+  if (prepare_) {
+    const unsigned threads = options_.compress_threads
+                                 ? options_.compress_threads
+                                 : std::max(1u, std::thread::hardware_concurrency());
+    const std::size_t depth = 2 * threads + options_.max_streams;
+    ready_ = std::make_unique<MpmcQueue<Payload>>(depth);
+    // A buffer for every chunk in the queue, being prepared or being sent,
+    // with room after the data for compressed and reference frames.
+    std::size_t frames = 0;
+    if (options_.compression != Codec::kNone) {
+      for (const Codec codec : {Codec::kLz4, Codec::kZstd}) {
+        if (codec_available(codec)) frames = std::max(frames, compress_bound(codec, chunk_size_));
+      }
+      frames += 64;
+    }
+    if (options_.dedup_index) frames += kRefFrameSpace;
+    BufferArena::Options arena;
+    arena.buffer_size = chunk_size_ + frames;
+    arena.count = ready_->capacity() + threads + options_.max_streams;
+    arena.huge_pages = options_.huge_pages;
+    // Faulted in as the pipeline first fills each buffer; most pushes never
+    // use all of them.
+    arena.prefault = false;
+    buffers_ = std::make_unique<BufferArena>(arena);
+    compressors_left_ = threads;
+    for (unsigned i = 0; i < threads; ++i) {
+      compressors_.emplace_back([this] { compress_loop(); });
+    }
+  }
+  {
+    std::unique_lock<std::mutex> lock(mu_);
+    for (unsigned i = 0; i < options_.streams; ++i) add_stream();
+    auto last = start;
+    while (active_ > 0 || std::any_of(streams_.begin(), streams_.end(),
+                                      [](const auto& s) { return s->running; })) {
+      changed_.wait_for(lock, options_.adapt_interval);
+      const auto now = std::chrono::steady_clock::now();
+      if (now - last < options_.adapt_interval) continue;
+      if (options_.adaptive && !abort_.load() && !exhausted_) {
+        adapt(std::chrono::duration<double>(now - last).count());
+      }
+      last = now;
+    }
+  }
+  for (auto& stream : streams_) stream->thread.join();
+  for (auto& t : compressors_) t.join();
+  if (error_) std::rethrow_exception(error_);
+  if (acked_bytes_ != stats_.bytes || acked_files_ != stats_.files) {
+    throw std::runtime_error("mover acknowledged " + std::to_string(acked_bytes_) + " of " +
+                             std::to_string(stats_.bytes) + " bytes");
+  }
+  stats_.compressed_chunks = compressed_chunks_.load();
+  stats_.raw_chunks = raw_chunks_.load();
+  stats_.wire_bytes = wire_bytes_.load();
+  stats_.dedup_chunks = dedup_chunks_.load();
+  stats_.dedup_hits = dedup_hits_.load();
+  stats_.dedup_bytes = dedup_bytes_.load();
+  stats_.dedup_misses = dedup_misses_.load();
+  stats_.seconds =
+      std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  return stats_;
+}
+
+}  // namespace
+
+PushStats push_files(const std::string& address, const std::vector<FileTask>& files,
+                     const PushOptions& options) {
+  return Push(address, files, options).run();
+}
+
+}  // namespace dms
@@ -0,0 +1,122 @@
+#include "dms/dedup.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <stdexcept>
+
+#include "dms/encoding.h"
+#include "dms/error.h"
+#include "dms/file.h"
+
+namespace dms {
+namespace {
+
+constexpr char kMagic[8] = {'D', 'M', 'S', 'C', 'H', 'I', 'X', '1'};
+constexpr std::size_t kEntrySize = 32;
+
+[[noreturn]] void throw_corrupt(const std::string& path) {
+  throw std::runtime_error("not a valid chunk index: " + path);
+}
+
+}  // namespace
+
+void ChunkIndex::load(const std::string& path) {
+  UniqueFd fd(::open(path.c_str(), O_RDONLY | O_CLOEXEC));
+  if (!fd) {
+    if (errno == ENOENT) return;
+    throw_errno("open " + path);
+  }
+  struct stat st;
+  if (::fstat(fd.get(), &st) != 0) throw_errno("fstat " + path);
+  std::string data(static_cast<std::size_t>(st.st_size), '\0');
+  if (pread_full(fd.get(), data.data(), data.size(), 0) != data.size()) {
+    throw_errno(EIO, "read " + path);
+  }
+  if (data.size() < sizeof(kMagic) + 4 + 8 + 8 ||
+      data.compare(0, sizeof(kMagic), kMagic, sizeof(kMagic)) != 0 ||
+      xxh3_64(data.data(), data.size() - 8) != load_u64(data.data() + data.size() - 8)) {
+    throw_corrupt(path);
+  }
+  const char* p = data.data() + sizeof(kMagic);
+  const char* const end = data.data() + data.size() - 8;
+  const std::uint32_t path_count = load_u32(p);
+  const std::uint64_t entry_count = load_u64(p + 4);
+  p += 12;
+
+  std::lock_guard<std::mutex> lock(mu_);
+  std::vector<std::uint32_t> ids;
+  ids.reserve(path_count);
+  for (std::uint32_t i = 0; i < path_count; ++i) {
+    if (end - p < 4 || static_cast<std::size_t>(end - p - 4) < load_u32(p)) throw_corrupt(path);
+    const std::uint32_t length = load_u32(p);
+    ids.push_back(path_id(std::string(p + 4, length)));
+    p += 4 + length;
+  }
+  if (static_cast<std::uint64_t>(end - p) != entry_count * kEntrySize) throw_corrupt(path);
+  for (; p < end; p += kEntrySize) {
+    const std::uint32_t index = load_u32(p + 28);
+    if (index >= ids.size()) throw_corrupt(path);
+    entries_[{load_u64(p), load_u64(p + 8)}] = {load_u64(p + 16), load_u32(p + 24), ids[index]};
+  }
+}
+
+void ChunkIndex::save(const std::string& path) const {
+  std::string out(kMagic, sizeof(kMagic));
+  {
+    std::lock_guard<std::mutex> lock(mu_);
+    put_u32(out, static_cast<std::uint32_t>(paths_.size()));
+    put_u64(out, entries_.size());
+    for (const std::string& p : paths_) {
+      put_u32(out, static_cast<std::uint32_t>(p.size()));
+      out += p;
+    }
+    out.reserve(out.size() + entries_.size() * kEntrySize + 8);
+    for (const auto& [digest, entry] : entries_) {
+      put_u64(out, digest.low);
+      put_u64(out, digest.high);
+      put_u64(out, entry.offset);
+      put_u32(out, entry.length);
+      put_u32(out, entry.path);
+    }
+  }
+  put_u64(out, xxh3_64(out.data(), out.size()));
+
+  const std::string tmp = path + ".tmp";
+  UniqueFd fd = open_or_throw(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  pwrite_full(fd.get(), out.data(), out.size(), 0);
+  if (::fsync(fd.get()) != 0) throw_errno("fsync " + tmp);
+  if (fd.close() != 0) throw_errno("close " + tmp);
+  if (::rename(tmp.c_str(), path.c_str()) != 0) throw_errno("rename " + tmp);
+}
+
+bool ChunkIndex::find(const Hash128& digest, Location& location) const {
+  std::lock_guard<std::mutex> lock(mu_);
+  auto it = entries_.find(digest);
+  if (it == entries_.end()) return false;
+  location.path = paths_[it->second.path];
+  location.offset = it->second.offset;
+  location.length = it->second.length;
+  return true;
+}
+
+void ChunkIndex::insert(const Hash128& digest, const std::string& path, std::uint64_t offset,
+                        std::uint32_t length) {
+  std::lock_guard<std::mutex> lock(mu_);
+  entries_[digest] = {offset, length, path_id(path)};
+}
+
+std::size_t ChunkIndex::size() const {
+  std::lock_guard<std::mutex> lock(mu_);
+  return entries_.size();
+}
+
+std::uint32_t ChunkIndex::path_id(const std::string& path) {
+  auto [it, added] = path_ids_.emplace(path, static_cast<std::uint32_t>(paths_.size()));
+  if (added) paths_.push_back(path);
+  return it->second;
+}
+
+}  // namespace dms
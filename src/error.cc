@@ -0,0 +1,14 @@
+#include "dms/error.h"
+
+#include <cerrno>
+#include <system_error>
+
+namespace dms {
+
+void throw_errno(const std::string& what) { throw_errno(errno, what); }
+
+void throw_errno(int err, const std::string& what) {
+  throw std::system_error(err, std::generic_category(), what);
+}
+
+}  // namespace dms
@@ -0,0 +1,68 @@
+#include "dms/file.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cerrno>
+
+#include "dms/error.h"
+
+namespace dms {
+
+void UniqueFd::reset(int fd) {
+  if (fd_ >= 0) ::close(fd_);
+  fd_ = fd;
+}
+
+int UniqueFd::close() {
+  if (fd_ < 0) return 0;
+  int rc = ::close(std::exchange(fd_, -1));
+  return rc == 0 ? 0 : errno;
+}
+
+UniqueFd open_or_throw(const std::string& path, int flags, mode_t mode) {
+  int fd = ::open(path.c_str(), flags | O_CLOEXEC, mode);
+  if (fd < 0) throw_errno("open " + path);
+  return UniqueFd(fd);
+}
+
+std::size_t pread_full(int fd, void* buf, std::size_t len, off_t offset) {
+  auto* p = static_cast<char*>(buf);
+  std::size_t done = 0;
+  while (done < len) {
+    ssize_t n = ::pread(fd, p + done, len - done, offset + static_cast<off_t>(done));
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      throw_errno("pread");
+    }
+    if (n == 0) break;
+    done += static_cast<std::size_t>(n);
+  }
+  return done;
+}
+
+void pwrite_full(int fd, const void* buf, std::size_t len, off_t offset) {
+  const auto* p = static_cast<const char*>(buf);
+  std::size_t done = 0;
+  while (done < len) {
+    ssize_t n = ::pwrite(fd, p + done, len - done, offset + static_cast<off_t>(done));
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      throw_errno("pwrite");
+    }
+    done += static_cast<std::size_t>(n);
+  }
+}
+
+struct timespec to_timespec(std::int64_t ns) {
+  struct timespec ts;
+  ts.tv_sec = static_cast<time_t>(ns / 1000000000);
+  ts.tv_nsec = static_cast<long>(ns % 1000000000);
+  if (ts.tv_nsec < 0) {
+    ts.tv_nsec += 1000000000;
+    --ts.tv_sec;
+  }
+  return ts;
+}
+
+}  // namespace dms
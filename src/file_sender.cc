@@ -0,0 +1,290 @@
+#include "dms/file_sender.h"
+
+#include <fcntl.h>
+#include <linux/errqueue.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <stdexcept>
+#include <system_error>
+
+#include "dms/error.h"
+
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60
+#endif
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY 0x4000000
+#endif
+
+namespace dms {
+namespace {
+
+constexpr std::size_t kCopyBuffer = 1 << 20;
+constexpr std::size_t kPipeSize = 1 << 20;
+// Largest single sendfile() transfer the kernel performs.
+constexpr std::size_t kMaxSendfile = 0x7ffff000;
+// Mapped ranges awaiting completion before send_file() waits for some.
+constexpr std::size_t kMaxMappings = 16;
+
+// Errors meaning "this method does not work here" rather than a failed
+// transfer.
+bool unsupported(int err) {
+  return err == EINVAL || err == ENOSYS || err == EOPNOTSUPP || err == ENOTSUP ||
+         err == ENOPROTOOPT || err == ENODEV;
+}
+
+[[noreturn]] void throw_short_file() {
+  throw_errno(EIO, "file ended before the range to send");
+}
+
+// Wrap-safe "a is at or past b" for the 32-bit zerocopy ids.
+bool id_reached(std::uint32_t a, std::uint32_t b) {
+  return static_cast<std::int32_t>(a - b) >= 0;
+}
+
+}  // namespace
+
+const char* to_string(SendMethod method) {
+  switch (method) {
+    case SendMethod::kAuto:
+      return "auto";
+    case SendMethod::kZerocopy:
+      return "zerocopy";
+    case SendMethod::kSendfile:
+      return "sendfile";
+    case SendMethod::kSplice:
+      return "splice";
+    case SendMethod::kCopy:
+      return "copy";
+  }
+  return "?";
+}
+
+SendMethod parse_send_method(const std::string& text) {
+  if (text == "auto") return SendMethod::kAuto;
+  if (text == "zerocopy") return SendMethod::kZerocopy;
+  if (text == "sendfile") return SendMethod::kSendfile;
+  if (text == "splice") return SendMethod::kSplice;
+  if (text == "copy") return SendMethod::kCopy;
+  throw std::invalid_argument("unknown send method: '" + text + "'");
+}
+
+FileSender::FileSender(int socket, SendMethod method)
+    : socket_(socket), method_(method == SendMethod::kAuto ? SendMethod::kSendfile : method) {
+  if (method_ == SendMethod::kZerocopy) {
+    const int one = 1;
+    if (::setsockopt(socket_, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) != 0) {
+      method_ = SendMethod::kSendfile;
+    }
+  }
+}
+
+FileSender::~FileSender() {
+  try {
+    finish();
+  } catch (const std::system_error&) {
+  }
+  // Left over only if finish() failed; the kernel may still read them, but
+  // the socket is broken by then.
+  for (const Mapping& m : mappings_) ::munmap(m.addr, m.length);
+}
+
+void FileSender::send_bytes(const void* data, std::size_t length, bool more) {
+  const auto* p = static_cast<const char*>(data);
+  const int flags = MSG_NOSIGNAL | (more ? MSG_MORE : 0);
+  while (length > 0) {
+    ssize_t n = ::send(socket_, p, length, flags);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      throw_errno("send");
+    }
+    p += n;
+    length -= static_cast<std::size_t>(n);
+  }
+}
+
+void FileSender::send_file(int fd, std::uint64_t offset, std::size_t length) {
+  if (method_ == SendMethod::kZerocopy && !send_zerocopy(fd, offset, length)) {
+    method_ = SendMethod::kSendfile;
+  }
+  if (method_ == SendMethod::kSendfile && !send_sendfile(fd, offset, length)) {
+    method_ = SendMethod::kSplice;
+  }
+  if (method_ == SendMethod::kSplice && !send_splice(fd, offset, length)) {
+    method_ = SendMethod::kCopy;
+  }
+  if (method_ == SendMethod::kCopy) send_copy(fd, offset, length);
+}
+
+void FileSender::finish() {
+  while (!mappings_.empty()) reap(true);
+}
+
+bool FileSender::send_zerocopy(int fd, std::uint64_t& offset, std::size_t& length) {
+  if (length == 0) return true;
+  static const auto page = static_cast<std::uint64_t>(::sysconf(_SC_PAGESIZE));
+  const std::uint64_t base = offset & ~(page - 1);
+  const std::size_t map_length = length + static_cast<std::size_t>(offset - base);
+  void* addr =
+      ::mmap(nullptr, map_length, PROT_READ, MAP_SHARED, fd, static_cast<off_t>(base));
+  if (addr == MAP_FAILED) {
+    if (unsupported(errno) || errno == EACCES) return false;
+    throw_errno("mmap");
+  }
+  const char* p = static_cast<const char*>(addr) + (offset - base);
+  bool first = true;
+  while (length > 0) {
+    ssize_t n = ::send(socket_, p, length, MSG_ZEROCOPY | MSG_NOSIGNAL);
+    if (n < 0) {
+      const int err = errno;
+      if (err == EINTR) continue;
+      if (err == ENOBUFS && zc_next_ != zc_done_) {
+        // Out of option memory for pinned pages: let earlier sends finish.
+        reap(true);
+        continue;
+      }
+      if (first && (unsupported(err) || err == ENOBUFS)) {
+        ::munmap(addr, map_length);
+        return false;
+      }
+      ::munmap(addr, map_length);
+      throw_errno(err, "send");
+    }
+    first = false;
+    ++zc_next_;
+    p += n;
+    offset += static_cast<std::uint64_t>(n);
+    length -= static_cast<std::size_t>(n);
+  }
+  mappings_.push_back({addr, map_length, zc_next_});
+  reap(false);
+  while (mappings_.size() > kMaxMappings) reap(true);
+  return true;
+}
+
+void FileSender::reap(bool wait) {
+  if (wait) {
+    pollfd pfd{socket_, 0, 0};  // POLLERR is always reported
+    while (::poll(&pfd, 1, -1) < 0) {
+      if (errno != EINTR) throw_errno("poll");
+    }
+  }
+  for (bool first = true;; first = false) {
+    char control[128];
+    msghdr msg{};
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    if (::recvmsg(socket_, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+      if ((errno == EAGAIN || errno == EWOULDBLOCK) && wait && first) {
+        // Woken by a socket error rather than a completion.
+        int err = 0;
+        socklen_t len = sizeof(err);
+        ::getsockopt(socket_, SOL_SOCKET, SO_ERROR, &err, &len);
+        throw_errno(err != 0 ? err : EPIPE, "send");
+      }
+      if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+      if (errno == EINTR) continue;
+      throw_errno("recvmsg MSG_ERRQUEUE");
+    }
+    for (cmsghdr* cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+      const bool recverr = (cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) ||
+                           (cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR);
+      if (!recverr) continue;
+      const auto* ee = reinterpret_cast<const sock_extended_err*>(CMSG_DATA(cm));
+      if (ee->ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+        if (ee->ee_errno != 0) throw_errno(static_cast<int>(ee->ee_errno), "send");
+        continue;
+      }
+      // ee_info..ee_data is an inclusive range of completed send ids.
+      if (ee->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) zc_copied_ += ee->ee_data - ee->ee_info + 1;
+      if (id_reached(ee->ee_data + 1, zc_done_)) zc_done_ = ee->ee_data + 1;
+    }
+  }
+  while (!mappings_.empty() && id_reached(zc_done_, mappings_.front().end_id)) {
+    ::munmap(mappings_.front().addr, mappings_.front().length);
+    mappings_.pop_front();
+  }
+}
+
+bool FileSender::send_sendfile(int fd, std::uint64_t& offset, std::size_t& length) {
+  bool first = true;
+  while (length > 0) {
+    auto off = static_cast<off_t>(offset);
+    ssize_t n = ::sendfile(socket_, fd, &off, std::min(length, kMaxSendfile));
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      if (first && unsupported(errno)) return false;
+      throw_errno("sendfile");
+    }
+    if (n == 0) throw_short_file();
+    first = false;
+    offset += static_cast<std::uint64_t>(n);
+    length -= static_cast<std::size_t>(n);
+  }
+  return true;
+}
+
+bool FileSender::send_splice(int fd, std::uint64_t& offset, std::size_t& length) {
+  if (!pipe_read_) {
+    int fds[2];
+    if (::pipe2(fds, O_CLOEXEC) != 0) throw_errno("pipe2");
+    pipe_read_.reset(fds[0]);
+    pipe_write_.reset(fds[1]);
+    const int size = ::fcntl(fds[1], F_SETPIPE_SZ, static_cast<int>(kPipeSize));
+    pipe_size_ = size > 0 ? static_cast<std::size_t>(size) : 65536;
+  }
+  bool first = true;
+  while (length > 0) {
+    auto off = static_cast<loff_t>(offset);
+    ssize_t in = ::splice(fd, &off, pipe_write_.get(), nullptr, std::min(length, pipe_size_),
+                          SPLICE_F_MOVE | SPLICE_F_MORE);
+    if (in < 0) {
+      if (errno == EINTR) continue;
+      if (first && unsupported(errno)) return false;
+      throw_errno("splice");
+    }
+    if (in == 0) throw_short_file();
+    first = false;
+    for (ssize_t left = in; left > 0;) {
+      ssize_t out = ::splice(pipe_read_.get(), nullptr, socket_, nullptr,
+                             static_cast<std::size_t>(left), SPLICE_F_MOVE | SPLICE_F_MORE);
+      if (out < 0) {
+        if (errno == EINTR) continue;
+        throw_errno("splice");
+      }
+      left -= out;
+    }
+    offset += static_cast<std::uint64_t>(in);
+    length -= static_cast<std::size_t>(in);
+  }
+  return true;
+}
+
+void FileSender::send_copy(int fd, std::uint64_t offset, std::size_t length) {
+  if (!buffer_) buffer_.reset(new char[kCopyBuffer]);
+  while (length > 0) {
+    const std::size_t want = std::min(length, kCopyBuffer);
+    if (pread_full(fd, buffer_.get(), want, static_cast<off_t>(offset)) != want) {
+      throw_short_file();
+    }
+    send_bytes(buffer_.get(), want);
+    offset += want;
+    length -= want;
+  }
+}
+
+double thread_cpu_seconds() {
+  timespec ts;
+  ::clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return static_cast<double>(ts.tv_sec) + static_cast<double>(ts.tv_nsec) * 1e-9;
+}
+
+}  // namespace dms
@@ -0,0 +1,72 @@
+#include "dms/io_backend.h"
+
+#include <cerrno>
+#include <stdexcept>
+#include <system_error>
+
+#include "dms/file.h"
+#include "uring_backend.h"
+
+namespace dms {
+namespace {
+
+class PsyncBackend final : public IoBackend {
+ public:
+  const char* name() const override { return "psync"; }
+
+  void submit(IoRequest* requests, std::size_t count) override {
+    for (std::size_t i = 0; i < count; ++i) {
+      IoRequest& req = requests[i];
+      try {
+        if (req.op == IoOp::kRead) {
+          req.result = static_cast<std::int64_t>(
+              pread_full(req.fd, req.buf, req.length, static_cast<off_t>(req.offset)));
+        } else {
+          pwrite_full(req.fd, req.buf, req.length, static_cast<off_t>(req.offset));
+          req.result = static_cast<std::int64_t>(req.length);
+        }
+      } catch (const std::system_error& e) {
+        req.result = -e.code().value();
+      }
+    }
+  }
+};
+
+}  // namespace
+
+const char* to_string(IoBackendKind kind) {
+  switch (kind) {
+    case IoBackendKind::kAuto: return "auto";
+    case IoBackendKind::kUring: return "uring";
+    case IoBackendKind::kPsync: return "psync";
+  }
+  return "unknown";
+}
+
+IoBackendKind parse_io_backend(const std::string& text) {
+  if (text == "auto") return IoBackendKind::kAuto;
+  if (text == "uring" || text == "io_uring") return IoBackendKind::kUring;
+  if (text == "psync") return IoBackendKind::kPsync;
+  throw std::invalid_argument("unknown I/O backend: '" + text + "'");
+}
+
+std::unique_ptr<IoBackend> make_io_backend(IoBackendKind kind, unsigned queue_depth) {
+  switch (kind) {
+    case IoBackendKind::kUring:
+      return make_uring_backend(queue_depth);
+    case IoBackendKind::kAuto:
+      if (uring_available()) {
+        try {
+          return make_uring_backend(queue_depth);
+        } catch (const std::system_error&) {
+          // e.g. RLIMIT_MEMLOCK exhausted by earlier rings; psync still works.
+        }
+      }
+      break;
+    case IoBackendKind::kPsync:
+      break;
+  }
+  return std::make_unique<PsyncBackend>();
+}
+
+}  // namespace dms
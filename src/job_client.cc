@@ -0,0 +1,174 @@
+#include "dms/job_client.h"
+
+#include <sys/socket.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <stdexcept>
+#include <system_error>
+
+namespace dms {
+
+JobClient::JobClient(const std::string& address) : JobClient(address, Options{}) {}
+
+JobClient::JobClient(const std::string& address, Options options)
+    : options_(options), fd_(connect_tcp(address)) {
+  options_.max_batch_jobs = std::max<std::size_t>(options_.max_batch_jobs, 1);
+  options_.max_inflight_frames = std::max<std::size_t>(options_.max_inflight_frames, 1);
+  options_.max_queued_jobs = std::max<std::size_t>(options_.max_queued_jobs, 1);
+  sender_ = std::thread([this] { send_loop(); });
+  receiver_ = std::thread([this] { receive_loop(); });
+}
+
+JobClient::~JobClient() { close(); }
+
+std::future<JobReceipt> JobClient::submit(JobSpec job) {
+  std::promise<JobReceipt> promise;
+  std::future<JobReceipt> future = promise.get_future();
+  std::unique_lock<std::mutex> lock(mu_);
+  done_cv_.wait(lock, [&] {
+    return error_ || closing_ || queued_.size() < options_.max_queued_jobs;
+  });
+  if (error_) {
+    promise.set_exception(error_);
+  } else if (closing_) {
+    promise.set_exception(
+        std::make_exception_ptr(std::logic_error("submit on a closed JobClient")));
+  } else {
+    queued_.push_back({std::move(job), std::move(promise)});
+    ++submitted_;
+    lock.unlock();
+    work_cv_.notify_one();
+  }
+  return future;
+}
+
+void JobClient::flush() {
+  std::unique_lock<std::mutex> lock(mu_);
+  const std::uint64_t target = submitted_;
+  done_cv_.wait(lock, [&] { return completed_ >= target; });
+}
+
+void JobClient::close() {
+  {
+    std::lock_guard<std::mutex> lock(mu_);
+    closing_ = true;
+  }
+  work_cv_.notify_all();
+  done_cv_.notify_all();
+  if (sender_.joinable()) sender_.join();
+  if (receiver_.joinable()) receiver_.join();
+  fd_.reset();
+}
+
+void JobClient::send_loop() {
+  std::vector<JobSpec> jobs;
+  std::string payload;
+  for (;;) {
+    std::unique_lock<std::mutex> lock(mu_);
+    work_cv_.wait(lock, [&] {
+      return error_ || (closing_ && queued_.empty()) ||
+             (!queued_.empty() && inflight_.size() < options_.max_inflight_frames);
+    });
+    if (error_) return;
+    if (queued_.empty()) break;  // closing with everything sent
+
+    InFlight batch{next_sequence_++, {}};
+    jobs.clear();
+    std::size_t bytes = 0;
+    while (!queued_.empty() && jobs.size() < options_.max_batch_jobs &&
+           (jobs.empty() || bytes < options_.max_batch_bytes)) {
+      Queued& q = queued_.front();
+      bytes += q.job.src.size() + q.job.dst.size() + 8;
+      jobs.push_back(std::move(q.job));
+      batch.promises.push_back(std::move(q.promise));
+      queued_.pop_front();
+    }
+    // Registered before the write, so the receipts cannot overtake it.
+    const std::uint64_t sequence = batch.sequence;
+    inflight_.push_back(std::move(batch));
+    lock.unlock();
+    done_cv_.notify_all();
+
+    payload.clear();
+    for (const JobSpec& job : jobs) append_job(payload, job);
+    try {
+      write_frame(fd_.get(), FrameType::kSubmit, static_cast<std::uint32_t>(jobs.size()),
+                  sequence, payload);
+    } catch (...) {
+      fail(std::current_exception());
+      return;
+    }
+    frames_sent_.fetch_add(1);
+    jobs_sent_.fetch_add(jobs.size());
+  }
+  // Tells the server no more frames follow; it closes the connection once
+  // the last receipts are out, which ends receive_loop().
+  ::shutdown(fd_.get(), SHUT_WR);
+}
+
+void JobClient::receive_loop() {
+  Frame frame;
+  std::vector<JobReceipt> receipts;
+  try {
+    while (read_frame(fd_.get(), frame)) {
+      if (frame.type != FrameType::kReceipts || !parse_receipts(frame, receipts)) {
+        throw std::runtime_error("malformed receipt frame");
+      }
+      InFlight batch;
+      {
+        std::lock_guard<std::mutex> lock(mu_);
+        if (inflight_.empty() || inflight_.front().sequence != frame.sequence ||
+            inflight_.front().promises.size() != receipts.size()) {
+          throw std::runtime_error("receipts do not match a submitted frame");
+        }
+        batch = std::move(inflight_.front());
+        inflight_.pop_front();
+      }
+      work_cv_.notify_one();
+      for (std::size_t i = 0; i < receipts.size(); ++i) {
+        batch.promises[i].set_value(std::move(receipts[i]));
+      }
+      {
+        std::lock_guard<std::mutex> lock(mu_);
+        completed_ += receipts.size();
+      }
+      done_cv_.notify_all();
+    }
+    std::lock_guard<std::mutex> lock(mu_);
+    if (!closing_ || !inflight_.empty() || !queued_.empty()) {
+      throw std::system_error(ECONNRESET, std::generic_category(),
+                              "connection closed by the server");
+    }
+  } catch (...) {
+    fail(std::current_exception());
+  }
+}
+
+void JobClient::fail(std::exception_ptr error) {
+  std::deque<Queued> queued;
+  std::deque<InFlight> inflight;
+  {
+    std::lock_guard<std::mutex> lock(mu_);
+    if (!error_) error_ = error;
+    error = error_;
+    queued.swap(queued_);
+    inflight.swap(inflight_);
+  }
+  // Wakes whichever of the two threads is still blocked on the socket.
+  ::shutdown(fd_.get(), SHUT_RDWR);
+  std::uint64_t failed = queued.size();
+  for (Queued& q : queued) q.promise.set_exception(error);
+  for (InFlight& batch : inflight) {
+    failed += batch.promises.size();
+    for (auto& promise : batch.promises) promise.set_exception(error);
+  }
+  {
+    std::lock_guard<std::mutex> lock(mu_);
+    completed_ += failed;
+  }
+  work_cv_.notify_all();
+  done_cv_.notify_all();
+}
+
+}  // namespace dms
@@ -0,0 +1,206 @@
+#include "dms/journal.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <memory>
+#include <system_error>
+
+#include "dms/encoding.h"
+#include "dms/error.h"
+
+namespace dms {
+namespace {
+
+constexpr std::size_t kRecordSize = 32;
+// The journal grows in zero-filled segments written ahead of the records.
+// Overwriting blocks that are already allocated and synced changes no
+// metadata, so fdatasync() of a batch is a data flush instead of a file
+// system journal commit; zeros fail the record check, so load() stops at
+// them like at any torn tail.
+constexpr std::uint64_t kSegmentSize = 1 << 20;
+
+std::uint64_t fnv1a64(const void* data, std::size_t len,
+                      std::uint64_t hash = 0xcbf29ce484222325ULL) {
+  const auto* p = static_cast<const unsigned char*>(data);
+  for (std::size_t i = 0; i < len; ++i) {
+    hash ^= p[i];
+    hash *= 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+std::uint32_t record_check(const char* record) {
+  std::uint64_t h = fnv1a64(record, kRecordSize - 4);
+  return static_cast<std::uint32_t>(h ^ (h >> 32));
+}
+
+}  // namespace
+
+Journal::Journal(const std::string& path) : Journal(path, Options{}) {}
+
+Journal::Journal(const std::string& path, Options options)
+    : options_(options), fd_(open_or_throw(path, O_RDWR | O_CREAT, 0644)) {
+  load();
+  flusher_ = std::thread([this] { flusher(); });
+}
+
+Journal::~Journal() {
+  {
+    std::lock_guard<std::mutex> lock(mu_);
+    stop_ = true;
+  }
+  wake_.notify_one();
+  flusher_.join();
+}
+
+std::uint64_t Journal::file_key(const std::string& dst, std::uint64_t size,
+                                std::int64_t mtime_ns, std::uint64_t chunk_size,
+                                std::uint32_t checksum_kind) {
+  std::uint64_t h = fnv1a64(dst.data(), dst.size());
+  h = fnv1a64(&size, sizeof(size), h);
+  h = fnv1a64(&mtime_ns, sizeof(mtime_ns), h);
+  h = fnv1a64(&chunk_size, sizeof(chunk_size), h);
+  return fnv1a64(&checksum_kind, sizeof(checksum_kind), h);
+}
+
+bool Journal::is_done(std::uint64_t key, std::uint64_t offset) const {
+  return done_.count({key, offset}) != 0;
+}
+
+std::uint64_t Journal::digest(std::uint64_t key, std::uint64_t offset) const {
+  auto it = done_.find({key, offset});
+  return it == done_.end() ? 0 : it->second;
+}
+
+void Journal::load() {
+  std::unique_ptr<char[]> buf(new char[kRecordSize * 4096]);
+  std::uint64_t offset = 0;
+  for (;;) {
+    std::size_t n =
+        pread_full(fd_.get(), buf.get(), kRecordSize * 4096, static_cast<off_t>(offset));
+    std::size_t used = 0;
+    for (; used + kRecordSize <= n; used += kRecordSize) {
+      const char* r = buf.get() + used;
+      if (load_u32(r + 28) != record_check(r)) break;
+      const std::uint64_t key = load_u64(r);
+      files_.insert(key);
+      done_[{key, load_u64(r + 8)}] = load_u64(r + 16);
+    }
+    offset += used;
+    if (used < n || n < kRecordSize * 4096) break;
+  }
+  end_ = offset;
+  allocated_ = end_;
+  struct stat st;
+  if (::fstat(fd_.get(), &st) != 0) throw_errno("fstat journal");
+  if (static_cast<std::uint64_t>(st.st_size) > end_ &&
+      ::ftruncate(fd_.get(), static_cast<off_t>(end_)) != 0) {
+    throw_errno("truncate journal tail");
+  }
+}
+
+void Journal::record(std::uint64_t key, std::uint64_t offset, std::uint32_t length,
+                     std::uint64_t digest) {
+  char r[kRecordSize];
+  store_u64(r, key);
+  store_u64(r + 8, offset);
+  store_u64(r + 16, digest);
+  store_u32(r + 24, length);
+  store_u32(r + 28, record_check(r));
+  bool wake;
+  {
+    std::lock_guard<std::mutex> lock(mu_);
+    pending_.append(r, kRecordSize);
+    ++appended_;
+    wake = ++pending_records_ == options_.sync_records;
+  }
+  if (wake) wake_.notify_one();
+}
+
+void Journal::flush_locked() {
+  std::string batch;
+  {
+    std::lock_guard<std::mutex> lock(mu_);
+    if (pending_.empty()) return;
+    batch.swap(pending_);
+    pending_records_ = 0;
+  }
+  int err = 0;
+  try {
+    if (options_.durable) preallocate_locked(end_ + batch.size());
+    pwrite_full(fd_.get(), batch.data(), batch.size(), static_cast<off_t>(end_));
+    end_ += batch.size();
+    if (options_.durable && ::fdatasync(fd_.get()) != 0) err = errno;
+  } catch (const std::system_error& e) {
+    err = e.code().value();
+  }
+  std::lock_guard<std::mutex> lock(mu_);
+  ++syncs_;
+  if (err != 0 && error_ == 0) error_ = err;
+}
+
+void Journal::preallocate_locked(std::uint64_t size) {
+  if (allocated_ >= size) return;
+  const std::string zeros(kSegmentSize, '\0');
+  while (allocated_ < size) {
+    pwrite_full(fd_.get(), zeros.data(), zeros.size(), static_cast<off_t>(allocated_));
+    allocated_ += zeros.size();
+  }
+}
+
+void Journal::sync() {
+  std::lock_guard<std::mutex> io(io_mu_);
+  flush_locked();
+  std::lock_guard<std::mutex> lock(mu_);
+  if (error_ != 0) throw_errno(error_, "journal");
+}
+
+void Journal::flusher() {
+  for (;;) {
+    {
+      // Keep half a segment ahead of the records so a batch rarely has to
+      // extend the file, and the sync at the end of a job never does.
+      std::lock_guard<std::mutex> io(io_mu_);
+      if (options_.durable && error_free() && allocated_ < end_ + kSegmentSize / 2) {
+        try {
+          preallocate_locked(end_ + kSegmentSize);
+          if (::fdatasync(fd_.get()) != 0) throw_errno("fdatasync journal");
+        } catch (const std::system_error& e) {
+          std::lock_guard<std::mutex> lock(mu_);
+          if (error_ == 0) error_ = e.code().value();
+        }
+      }
+    }
+    bool stopping;
+    {
+      std::unique_lock<std::mutex> lock(mu_);
+      wake_.wait_for(lock, options_.sync_interval, [&] {
+        return stop_ || pending_records_ >= options_.sync_records;
+      });
+      stopping = stop_;
+    }
+    std::lock_guard<std::mutex> io(io_mu_);
+    flush_locked();
+    if (stopping) return;
+  }
+}
+
+bool Journal::error_free() const {
+  std::lock_guard<std::mutex> lock(mu_);
+  return error_ == 0;
+}
+
+std::uint64_t Journal::records_written() const {
+  std::lock_guard<std::mutex> lock(mu_);
+  return appended_;
+}
+
+std::uint64_t Journal::syncs() const {
+  std::lock_guard<std::mutex> lock(mu_);
+  return syncs_;
+}
+
+}  // namespace dms
@@ -0,0 +1,220 @@
+#include "dms/manifest.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#include "dms/encoding.h"
+#include "dms/error.h"
+
+namespace dms {
+namespace {
+
+constexpr char kMagic[8] = {'D', 'M', 'S', 'M', 'A', 'N', 'I', '1'};
+constexpr char kEndMagic[8] = {'D', 'M', 'S', 'M', 'E', 'N', 'D', '1'};
+constexpr char kBlockMagic[4] = {'M', 'B', 'L', 'K'};
+constexpr std::uint32_t kVersion = 1;
+constexpr std::size_t kHeaderSize = 16;
+constexpr std::size_t kBlockHeaderSize = 12;
+constexpr std::size_t kIndexEntrySize = 20;
+constexpr std::size_t kTrailerSize = 32;
+// Rejects absurd payload sizes from corrupt headers before allocating.
+constexpr std::uint32_t kMaxPayload = 256u << 20;
+
+[[noreturn]] void corrupt(const char* what) {
+  throw std::runtime_error(std::string("corrupt manifest: ") + what);
+}
+
+std::size_t shared_prefix(const std::string& a, const std::string& b) {
+  const std::size_t n = std::min(a.size(), b.size());
+  std::size_t i = 0;
+  while (i < n && a[i] == b[i]) ++i;
+  return i;
+}
+
+}  // namespace
+
+ManifestWriter::ManifestWriter(const std::string& path, std::size_t block_entries)
+    : fd_(open_or_throw(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)),
+      block_entries_(std::max<std::size_t>(block_entries, 1)) {
+  std::string header(kMagic, sizeof(kMagic));
+  put_u32(header, kVersion);
+  put_u32(header, 0);
+  pwrite_full(fd_.get(), header.data(), header.size(), 0);
+  offset_ = header.size();
+}
+
+ManifestWriter::~ManifestWriter() {
+  if (closed_) return;
+  try {
+    close();
+  } catch (...) {
+  }
+}
+
+void ManifestWriter::add(const ScanEntry& entry) {
+  const std::size_t shared = shared_prefix(prev_path_, entry.path);
+  put_varint(block_, shared);
+  put_varint(block_, entry.path.size() - shared);
+  block_.append(entry.path, shared, std::string::npos);
+  put_varint(block_, entry.mode);
+  put_varint(block_, entry.size);
+  put_varint(block_, zigzag(entry.mtime_ns - prev_mtime_));
+  prev_path_ = entry.path;
+  prev_mtime_ = entry.mtime_ns;
+  ++entries_;
+  if (++block_count_ >= block_entries_) flush_block();
+}
+
+void ManifestWriter::flush_block() {
+  if (block_count_ == 0) return;
+  index_.push_back({offset_, entries_ - block_count_, block_count_});
+  std::string header(kBlockMagic, sizeof(kBlockMagic));
+  put_u32(header, block_count_);
+  put_u32(header, static_cast<std::uint32_t>(block_.size()));
+  pwrite_full(fd_.get(), header.data(), header.size(), static_cast<off_t>(offset_));
+  pwrite_full(fd_.get(), block_.data(), block_.size(),
+              static_cast<off_t>(offset_ + header.size()));
+  offset_ += header.size() + block_.size();
+  block_.clear();
+  block_count_ = 0;
+  prev_path_.clear();
+  prev_mtime_ = 0;
+}
+
+void ManifestWriter::close() {
+  if (closed_) return;
+  closed_ = true;
+  flush_block();
+  std::string tail;
+  for (const auto& b : index_) {
+    put_u64(tail, b.offset);
+    put_u64(tail, b.first_entry);
+    put_u32(tail, b.entries);
+  }
+  put_u64(tail, offset_);
+  put_u64(tail, index_.size());
+  put_u64(tail, entries_);
+  tail.append(kEndMagic, sizeof(kEndMagic));
+  pwrite_full(fd_.get(), tail.data(), tail.size(), static_cast<off_t>(offset_));
+  if (int err = fd_.close()) throw_errno(err, "close manifest");
+}
+
+ManifestReader::ManifestReader(const std::string& path)
+    : fd_(open_or_throw(path, O_RDONLY)) {
+  struct stat st;
+  if (::fstat(fd_.get(), &st) != 0) throw_errno("fstat " + path);
+  file_size_ = static_cast<std::uint64_t>(st.st_size);
+
+  char header[kHeaderSize];
+  if (pread_full(fd_.get(), header, kHeaderSize, 0) != kHeaderSize ||
+      std::memcmp(header, kMagic, sizeof(kMagic)) != 0) {
+    throw std::runtime_error(path + ": not a manifest");
+  }
+  if (load_u32(header + 8) != kVersion) throw std::runtime_error(path + ": unsupported version");
+  data_end_ = file_size_;
+  next_offset_ = kHeaderSize;
+
+  char trailer[kTrailerSize];
+  if (file_size_ >= kHeaderSize + kTrailerSize &&
+      pread_full(fd_.get(), trailer, kTrailerSize, static_cast<off_t>(file_size_ - kTrailerSize)) ==
+          kTrailerSize &&
+      std::memcmp(trailer + 24, kEndMagic, sizeof(kEndMagic)) == 0) {
+    const std::uint64_t index_offset = load_u64(trailer);
+    const std::uint64_t blocks = load_u64(trailer + 8);
+    if (index_offset < kHeaderSize ||
+        index_offset + blocks * kIndexEntrySize + kTrailerSize != file_size_) {
+      corrupt("bad trailer");
+    }
+    std::string raw(blocks * kIndexEntrySize, '\0');
+    if (pread_full(fd_.get(), &raw[0], raw.size(), static_cast<off_t>(index_offset)) !=
+        raw.size()) {
+      corrupt("short index");
+    }
+    index_.reserve(blocks);
+    for (std::uint64_t i = 0; i < blocks; ++i) {
+      const char* p = raw.data() + i * kIndexEntrySize;
+      index_.push_back({load_u64(p), load_u64(p + 8), load_u32(p + 16)});
+    }
+    total_entries_ = load_u64(trailer + 16);
+    data_end_ = index_offset;
+    complete_ = true;
+  }
+}
+
+void ManifestReader::seek_block(std::size_t block) {
+  if (block >= index_.size()) {
+    seek_offset(data_end_);
+    return;
+  }
+  seek_offset(index_[block].offset);
+}
+
+void ManifestReader::seek_offset(std::uint64_t offset) {
+  next_offset_ = std::max<std::uint64_t>(offset, kHeaderSize);
+  left_ = 0;
+  cursor_ = nullptr;
+}
+
+bool ManifestReader::load_block() {
+  if (next_offset_ + kBlockHeaderSize > data_end_) return false;
+  char header[kBlockHeaderSize];
+  if (pread_full(fd_.get(), header, kBlockHeaderSize, static_cast<off_t>(next_offset_)) !=
+      kBlockHeaderSize) {
+    return false;
+  }
+  if (std::memcmp(header, kBlockMagic, sizeof(kBlockMagic)) != 0) {
+    if (complete_) corrupt("bad block magic");
+    return false;  // torn tail of an unfinished manifest
+  }
+  const std::uint32_t count = load_u32(header + 4);
+  const std::uint32_t size = load_u32(header + 8);
+  if (size > kMaxPayload) corrupt("oversized block");
+  if (next_offset_ + kBlockHeaderSize + size > data_end_) {
+    if (complete_) corrupt("block overruns index");
+    return false;
+  }
+  payload_.resize(size);
+  if (pread_full(fd_.get(), &payload_[0], size,
+                 static_cast<off_t>(next_offset_ + kBlockHeaderSize)) != size) {
+    return false;
+  }
+  loaded_offset_ = next_offset_;
+  next_offset_ += kBlockHeaderSize + size;
+  cursor_ = payload_.data();
+  left_ = count;
+  prev_path_.clear();
+  prev_mtime_ = 0;
+  return true;
+}
+
+bool ManifestReader::next(ScanEntry& entry) {
+  while (left_ == 0) {
+    if (!load_block()) return false;
+  }
+  const char* end = payload_.data() + payload_.size();
+  std::uint64_t shared, suffix, mode, size, mtime;
+  if (!get_varint(cursor_, end, shared) || !get_varint(cursor_, end, suffix) ||
+      shared > prev_path_.size() || suffix > static_cast<std::uint64_t>(end - cursor_)) {
+    corrupt("bad path");
+  }
+  entry.path.assign(prev_path_, 0, shared);
+  entry.path.append(cursor_, suffix);
+  cursor_ += suffix;
+  if (!get_varint(cursor_, end, mode) || !get_varint(cursor_, end, size) ||
+      !get_varint(cursor_, end, mtime)) {
+    corrupt("bad entry");
+  }
+  entry.mode = static_cast<std::uint32_t>(mode);
+  entry.size = size;
+  entry.mtime_ns = prev_mtime_ + unzigzag(mtime);
+  prev_path_ = entry.path;
+  prev_mtime_ = entry.mtime_ns;
+  --left_;
+  return true;
+}
+
+}  // namespace dms
@@ -0,0 +1,284 @@
+#include "dms/metadata.h"
+
+#include <fcntl.h>
+#include <sys/xattr.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <system_error>
+#include <utility>
+
+#include "dms/file.h"
+
+namespace dms {
+namespace {
+
+constexpr std::size_t kMaxErrors = 16;
+// Full batches' worth of entries held in partial buckets before all of
+// them are submitted, so a walk over many sparse directories does not
+// pile them up.
+constexpr std::size_t kMaxPendingBatches = 64;
+
+std::pair<std::string, std::string> split_parent(const std::string& path) {
+  const std::size_t slash = path.rfind('/');
+  if (slash == std::string::npos) return {".", path};
+  return {slash == 0 ? "/" : path.substr(0, slash), path.substr(slash + 1)};
+}
+
+std::size_t depth(const std::string& path) {
+  return static_cast<std::size_t>(std::count(path.begin(), path.end(), '/'));
+}
+
+std::string error_text(int err) { return std::system_category().message(err); }
+
+// The *xattr() calls reach the file an O_PATH descriptor refers to
+// through this path; the f*xattr() ones do not accept such descriptors.
+std::string fd_path(int fd) { return "/proc/self/fd/" + std::to_string(fd); }
+
+// Reads a list or value into `out` with `get`, which, like listxattr and
+// getxattr, returns the size needed when passed no buffer. Returns 0 or an
+// errno.
+template <typename Get>
+int read_xattr(std::vector<char>& out, Get get) {
+  for (;;) {
+    const ssize_t size = get(nullptr, 0);
+    if (size < 0) return errno;
+    out.resize(static_cast<std::size_t>(size));
+    const ssize_t n = get(out.data(), out.size());
+    if (n >= 0) {
+      out.resize(static_cast<std::size_t>(n));
+      return 0;
+    }
+    // Grew in between.
+    if (errno != ERANGE) return errno;
+  }
+}
+
+// Copies every extended attribute of the file `src` refers to onto `dst`,
+// both O_PATH descriptors of files that are not symlinks. Returns 0 or an
+// errno.
+int copy_xattrs(int src, int dst) {
+  const std::string from = fd_path(src);
+  const std::string to = fd_path(dst);
+  std::vector<char> names;
+  int err = read_xattr(names, [&](char* buf, std::size_t size) {
+    return ::listxattr(from.c_str(), buf, size);
+  });
+  if (err == ENOTSUP) return 0;
+  if (err) return err;
+  std::vector<char> value;
+  for (std::size_t pos = 0; pos < names.size();) {
+    const char* name = names.data() + pos;
+    pos += std::char_traits<char>::length(name) + 1;
+    err = read_xattr(value, [&](char* buf, std::size_t size) {
+      return ::getxattr(from.c_str(), name, buf, size);
+    });
+    // Gone since the listing.
+    if (err == ENODATA) continue;
+    if (err) return err;
+    if (::setxattr(to.c_str(), name, value.data(), value.size(), 0) != 0 && errno != ENOTSUP) {
+      return errno;
+    }
+  }
+  return 0;
+}
+
+MetadataOptions normalized(MetadataOptions options) {
+  if (options.threads == 0) options.threads = std::max(1u, std::thread::hardware_concurrency());
+  options.batch_size = std::max<std::size_t>(options.batch_size, 1);
+  return options;
+}
+
+}  // namespace
+
+MetadataBatcher::MetadataBatcher(MetadataOptions options)
+    : options_(normalized(std::move(options))), queue_(2 * options_.threads) {
+  workers_.reserve(options_.threads);
+  for (unsigned i = 0; i < options_.threads; ++i) {
+    workers_.emplace_back([this] { worker_loop(); });
+  }
+}
+
+MetadataBatcher::~MetadataBatcher() {
+  queue_.close();
+  for (auto& t : workers_) t.join();
+}
+
+void MetadataBatcher::add(MetadataFixup fixup) {
+  std::vector<Batch> full;
+  {
+    std::lock_guard<std::mutex> lock(mu_);
+    if (S_ISDIR(fixup.mode)) {
+      dirs_.push_back(std::move(fixup));
+      return;
+    }
+    auto [dir, name] = split_parent(fixup.dst);
+    std::vector<MetadataFixup>& bucket = buckets_[dir];
+    bucket.push_back(std::move(fixup));
+    ++pending_;
+    if (bucket.size() >= options_.batch_size) {
+      pending_ -= bucket.size();
+      full.push_back({std::move(dir), std::move(bucket)});
+      buckets_.erase(full.back().dir);
+    } else if (pending_ >= kMaxPendingBatches * options_.batch_size) {
+      for (auto& [d, entries] : buckets_) full.push_back({d, std::move(entries)});
+      buckets_.clear();
+      pending_ = 0;
+    }
+    in_flight_ += full.size();
+  }
+  // Outside the lock: the queue blocks while the workers are behind.
+  for (Batch& batch : full) queue_.push(std::move(batch));
+}
+
+void MetadataBatcher::drain() {
+  std::vector<Batch> batches;
+  {
+    std::lock_guard<std::mutex> lock(mu_);
+    for (auto& [dir, entries] : buckets_) batches.push_back({dir, std::move(entries)});
+    buckets_.clear();
+    pending_ = 0;
+    in_flight_ += batches.size();
+  }
+  for (Batch& batch : batches) queue_.push(std::move(batch));
+  std::unique_lock<std::mutex> lock(mu_);
+  idle_.wait(lock, [&] { return in_flight_ == 0; });
+}
+
+MetadataStats MetadataBatcher::finish() {
+  drain();
+  std::vector<MetadataFixup> dirs;
+  {
+    std::lock_guard<std::mutex> lock(mu_);
+    dirs = std::move(dirs_);
+    dirs_.clear();
+  }
+  // Deepest first, and siblings next to each other so they share batches.
+  std::sort(dirs.begin(), dirs.end(), [](const MetadataFixup& a, const MetadataFixup& b) {
+    const std::size_t da = depth(a.dst);
+    const std::size_t db = depth(b.dst);
+    return da != db ? da > db : a.dst < b.dst;
+  });
+  dirs.erase(std::unique(dirs.begin(), dirs.end(),
+                         [](const MetadataFixup& a, const MetadataFixup& b) {
+                           return a.dst == b.dst;
+                         }),
+             dirs.end());
+  // The directories of one depth do not contain each other, so they go to
+  // the workers together; the next depth up waits for them.
+  for (std::size_t i = 0; i < dirs.size();) {
+    const std::size_t level = depth(dirs[i].dst);
+    for (; i < dirs.size() && depth(dirs[i].dst) == level; ++i) {
+      std::string parent = split_parent(dirs[i].dst).first;
+      {
+        std::lock_guard<std::mutex> lock(mu_);
+        std::vector<MetadataFixup>& bucket = buckets_[parent];
+        bucket.push_back(std::move(dirs[i]));
+        ++pending_;
+      }
+    }
+    drain();
+  }
+  queue_.close();
+  for (auto& t : workers_) t.join();
+  workers_.clear();
+  std::lock_guard<std::mutex> lock(mu_);
+  return stats_;
+}
+
+void MetadataBatcher::worker_loop() {
+  while (auto batch = queue_.pop()) {
+    apply(*batch);
+    std::lock_guard<std::mutex> lock(mu_);
+    ++stats_.batches;
+    if (--in_flight_ == 0) idle_.notify_all();
+  }
+}
+
+void MetadataBatcher::apply(const Batch& batch) {
+  if (options_.throttle) options_.throttle->acquire_ops(batch.entries.size());
+  const int dirfd = ::open(batch.dir.c_str(), O_PATH | O_DIRECTORY | O_CLOEXEC);
+  if (dirfd < 0) {
+    const std::string reason = error_text(errno);
+    for (const MetadataFixup& fixup : batch.entries) record_error(fixup.dst, reason);
+    return;
+  }
+  UniqueFd dir(dirfd);
+  // The owner and xattrs are read from the source through a handle to its
+  // directory as well, opened again only when the next entry's differs.
+  const bool read_source = options_.owner || options_.xattrs;
+  std::string src_dir;
+  UniqueFd src_dirfd;
+  int src_err = 0;
+  std::uint64_t files = 0;
+  std::uint64_t dirs = 0;
+  for (const MetadataFixup& fixup : batch.entries) {
+    ++(S_ISDIR(fixup.mode) ? dirs : files);
+    if (read_source) {
+      std::string parent = split_parent(fixup.src).first;
+      if (src_dir.empty() || parent != src_dir) {
+        src_dirfd.reset(::open(parent.c_str(), O_PATH | O_DIRECTORY | O_CLOEXEC));
+        src_err = src_dirfd ? 0 : errno;
+        src_dir = std::move(parent);
+      }
+      if (src_err != 0) {
+        record_error(fixup.dst, "source: " + error_text(src_err));
+        continue;
+      }
+    }
+    apply_entry(dir.get(), src_dirfd.get(), fixup);
+  }
+  std::lock_guard<std::mutex> lock(mu_);
+  stats_.files += files;
+  stats_.dirs += dirs;
+}
+
+// Owner first, since chown clears set-user-ID bits; the mode next and the
+// time last, which nothing after it may move.
+void MetadataBatcher::apply_entry(int dirfd, int src_dirfd, const MetadataFixup& fixup) {
+  const std::string name = split_parent(fixup.dst).second;
+  const std::string src_name = split_parent(fixup.src).second;
+  const bool symlink = S_ISLNK(fixup.mode);
+  if (options_.owner) {
+    struct stat st;
+    if (::fstatat(src_dirfd, src_name.c_str(), &st, AT_SYMLINK_NOFOLLOW) != 0 ||
+        ::fchownat(dirfd, name.c_str(), st.st_uid, st.st_gid, AT_SYMLINK_NOFOLLOW) != 0) {
+      record_error(fixup.dst, "owner: " + error_text(errno));
+      return;
+    }
+  }
+  // User attributes are not allowed on symlinks.
+  if (options_.xattrs && !symlink) {
+    UniqueFd src(::openat(src_dirfd, src_name.c_str(), O_PATH | O_NOFOLLOW | O_CLOEXEC));
+    UniqueFd dst;
+    if (src) dst.reset(::openat(dirfd, name.c_str(), O_PATH | O_NOFOLLOW | O_CLOEXEC));
+    const int err = !src || !dst ? errno : copy_xattrs(src.get(), dst.get());
+    if (err != 0) {
+      record_error(fixup.dst, "xattrs: " + error_text(err));
+      return;
+    }
+  }
+  if (!symlink && (fixup.mode & 07777) != 0 &&
+      ::fchmodat(dirfd, name.c_str(), fixup.mode & 07777, 0) != 0) {
+    record_error(fixup.dst, "mode: " + error_text(errno));
+    return;
+  }
+  if (fixup.mtime_ns != MetadataFixup::kKeepTime) {
+    struct timespec times[2];
+    times[0].tv_sec = 0;
+    times[0].tv_nsec = UTIME_OMIT;
+    times[1] = to_timespec(fixup.mtime_ns);
+    if (::utimensat(dirfd, name.c_str(), times, AT_SYMLINK_NOFOLLOW) != 0) {
+      record_error(fixup.dst, "times: " + error_text(errno));
+    }
+  }
+}
+
+void MetadataBatcher::record_error(const std::string& path, const std::string& reason) {
+  std::lock_guard<std::mutex> lock(mu_);
+  ++stats_.error_count;
+  if (stats_.errors.size() < kMaxErrors) stats_.errors.push_back(path + ": " + reason);
+}
+
+}  // namespace dms
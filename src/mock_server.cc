@@ -0,0 +1,158 @@
+#include "dms/mock_server.h"
+
+#include <sys/socket.h>
+
+#include <stdexcept>
+#include <system_error>
+#include <vector>
+
+#include "dms/blocking_queue.h"
+#include "dms/rpc.h"
+
+namespace dms {
+namespace {
+
+// Wait before accepting again after running out of descriptors.
+constexpr auto kAcceptBackoff = std::chrono::milliseconds(10);
+
+}  // namespace
+
+struct MockDmsServer::Connection {
+  struct Reply {
+    std::chrono::steady_clock::time_point due;
+    std::uint64_t sequence;
+    std::uint32_t count;
+    std::string payload;
+  };
+
+  explicit Connection(UniqueFd socket) : fd(std::move(socket)) {}
+
+  // Closed under mu_ once both threads are done; they are then joined by
+  // the acceptor or by stop().
+  UniqueFd fd;
+  int running = 2;
+  // Receipts waiting for their due time; bounds the frames a client can
+  // have outstanding before the reader stops reading.
+  BlockingQueue<Reply> replies{1024};
+  std::thread reader;
+  std::thread writer;
+};
+
+MockDmsServer::MockDmsServer() : MockDmsServer(Options{}) {}
+
+MockDmsServer::MockDmsServer(Options options)
+    : options_(options), listen_fd_(listen_tcp(options_.address)) {
+  address_ = local_address(listen_fd_.get());
+  acceptor_ = std::thread([this] { accept_loop(); });
+}
+
+MockDmsServer::~MockDmsServer() { stop(); }
+
+void MockDmsServer::stop() {
+  std::list<std::unique_ptr<Connection>> conns;
+  {
+    std::lock_guard<std::mutex> lock(mu_);
+    if (stopped_) return;
+    stopped_ = true;
+    conns.swap(conns_);
+    for (auto& conn : conns) ::shutdown(conn->fd.get(), SHUT_RDWR);
+  }
+  ::shutdown(listen_fd_.get(), SHUT_RDWR);
+  acceptor_.join();
+  for (auto& conn : conns) {
+    conn->replies.close();
+    conn->reader.join();
+    conn->writer.join();
+  }
+}
+
+void MockDmsServer::finish(Connection& conn) {
+  std::lock_guard<std::mutex> lock(mu_);
+  if (--conn.running == 0) conn.fd.reset();
+}
+
+void MockDmsServer::accept_loop() {
+  for (;;) {
+    UniqueFd fd;
+    try {
+      fd = accept_tcp(listen_fd_.get());
+    } catch (const std::system_error&) {
+      // Unless stop() shut the listener down, this passes, e.g. running out
+      // of descriptors until connections finish.
+      {
+        std::lock_guard<std::mutex> lock(mu_);
+        if (stopped_) return;
+      }
+      std::this_thread::sleep_for(kAcceptBackoff);
+      continue;
+    }
+    std::list<std::unique_ptr<Connection>> finished;
+    {
+      std::lock_guard<std::mutex> lock(mu_);
+      if (stopped_) return;
+      for (auto it = conns_.begin(); it != conns_.end();) {
+        auto next = std::next(it);
+        if ((*it)->running == 0) finished.splice(finished.end(), conns_, it);
+        it = next;
+      }
+      conns_.push_back(std::make_unique<Connection>(std::move(fd)));
+      Connection& conn = *conns_.back();
+      conn.reader = std::thread([this, &conn] {
+        serve(conn);
+        finish(conn);
+      });
+      conn.writer = std::thread([this, &conn] {
+        while (auto reply = conn.replies.pop()) {
+          std::this_thread::sleep_until(reply->due);
+          try {
+            write_frame(conn.fd.get(), FrameType::kReceipts, reply->count, reply->sequence,
+                        reply->payload);
+          } catch (const std::system_error&) {
+            ::shutdown(conn.fd.get(), SHUT_RDWR);
+            conn.replies.close();
+            finish(conn);
+            return;
+          }
+        }
+        // The client sent its last frame and has every receipt.
+        ::shutdown(conn.fd.get(), SHUT_WR);
+        finish(conn);
+      });
+      connections_.fetch_add(1);
+    }
+    for (auto& conn : finished) {
+      conn->reader.join();
+      conn->writer.join();
+    }
+  }
+}
+
+void MockDmsServer::serve(Connection& conn) {
+  Frame frame;
+  std::vector<JobSpec> jobs;
+  try {
+    while (read_frame(conn.fd.get(), frame)) {
+      const auto arrival = std::chrono::steady_clock::now();
+      if (frame.type != FrameType::kSubmit || !parse_jobs(frame, jobs)) break;
+      Connection::Reply reply{arrival + options_.latency, frame.sequence, frame.count, {}};
+      for (const JobSpec& job : jobs) {
+        JobReceipt receipt;
+        if (job.src.empty() || job.dst.empty()) {
+          receipt.status = JobStatus::kRejected;
+          receipt.message = "empty source or destination";
+        } else {
+          receipt.job_id = next_job_id_.fetch_add(1);
+        }
+        append_receipt(reply.payload, receipt);
+      }
+      frames_.fetch_add(1);
+      jobs_.fetch_add(jobs.size());
+      if (!conn.replies.push(std::move(reply))) break;
+    }
+  } catch (const std::exception&) {
+    // A broken or malformed stream ends the connection like an EOF.
+  }
+  conn.replies.close();
+}
+
+}  // namespace dms
@@ -0,0 +1,370 @@
+#include "dms/mover.h"
+
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <filesystem>
+#include <map>
+#include <stdexcept>
+#include <system_error>
+#include <unordered_map>
+#include <vector>
+
+#include "dms/checksum.h"
+#include "dms/compress.h"
+#include "dms/data_stream.h"
+#include "dms/encoding.h"
+#include "dms/error.h"
+#include "dms/rpc.h"
+
+namespace dms {
+namespace {
+
+constexpr std::size_t kReceiveBuffer = 1 << 20;
+constexpr std::uint32_t kMaxPath = 4096;
+// A kZData payload: the raw length and at worst slightly expanded data.
+constexpr std::uint32_t kMaxCompressedFrame = kMaxBufferedChunk + kMaxBufferedChunk / 8;
+// Wait before accepting again after running out of descriptors.
+constexpr auto kAcceptBackoff = std::chrono::milliseconds(10);
+
+// Reads exactly `len` bytes; returns false on end of stream before any.
+bool recv_exact(int fd, char* buf, std::size_t len) {
+  std::size_t done = 0;
+  while (done < len) {
+    ssize_t n = ::recv(fd, buf + done, len - done, 0);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      throw_errno("recv");
+    }
+    if (n == 0) {
+      if (done == 0) return false;
+      throw std::runtime_error("connection closed inside a frame");
+    }
+    done += static_cast<std::size_t>(n);
+  }
+  return true;
+}
+
+void send_all(int fd, const char* data, std::size_t len) {
+  while (len > 0) {
+    ssize_t n = ::send(fd, data, len, MSG_NOSIGNAL);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      throw_errno("send");
+    }
+    data += n;
+    len -= static_cast<std::size_t>(n);
+  }
+}
+
+// Relative, '/'-separated and without ".." components.
+bool safe_path(const std::string& path) {
+  if (path.empty() || path.front() == '/') return false;
+  std::size_t start = 0;
+  for (;;) {
+    const std::size_t end = path.find('/', start);
+    if (path.compare(start, end - start, "..") == 0) return false;
+    if (end == std::string::npos) return true;
+    start = end + 1;
+  }
+}
+
+// Adds [begin, end) to the disjoint ranges of `ranges` (begin -> end) and
+// returns how many of its bytes were not covered yet.
+std::uint64_t add_range(std::map<std::uint64_t, std::uint64_t>& ranges, std::uint64_t begin,
+                        std::uint64_t end) {
+  if (begin == end) return 0;
+  std::uint64_t added = end - begin;
+  std::uint64_t lo = begin;
+  std::uint64_t hi = end;
+  auto it = ranges.upper_bound(begin);
+  if (it != ranges.begin() && std::prev(it)->second >= begin) --it;
+  while (it != ranges.end() && it->first <= end) {
+    added -= std::min(it->second, end) - std::max(it->first, begin);
+    lo = std::min(lo, it->first);
+    hi = std::max(hi, it->second);
+    it = ranges.erase(it);
+  }
+  ranges.emplace(lo, hi);
+  return added;
+}
+
+}  // namespace
+
+struct MoverServer::Session {
+  struct File {
+    // Shared with the connections writing to the file, so that it is
+    // closed after the last write; null when discarding or complete.
+    std::shared_ptr<UniqueFd> fd;
+    std::uint64_t size = 0;
+    std::uint64_t received = 0;
+    // Byte ranges received so far, so that a resent chunk counts once.
+    std::map<std::uint64_t, std::uint64_t> ranges;
+  };
+
+  std::mutex mu;
+  std::unordered_map<std::uint32_t, File> files;
+};
+
+struct MoverServer::Connection {
+  explicit Connection(UniqueFd socket) : fd(std::move(socket)) {}
+
+  // Closed under mu_ once serve() returns; the thread is then joined by
+  // the acceptor or by stop().
+  UniqueFd fd;
+  std::thread thread;
+  bool done = false;
+};
+
+MoverServer::MoverServer() : MoverServer(Options{}) {}
+
+MoverServer::MoverServer(Options options)
+    : options_(std::move(options)), listen_fd_(listen_tcp(options_.address)) {
+  address_ = local_address(listen_fd_.get());
+  acceptor_ = std::thread([this] { accept_loop(); });
+}
+
+MoverServer::~MoverServer() { stop(); }
+
+void MoverServer::stop() {
+  std::list<std::unique_ptr<Connection>> conns;
+  {
+    std::lock_guard<std::mutex> lock(mu_);
+    if (stopped_) return;
+    stopped_ = true;
+    conns.swap(conns_);
+    for (auto& conn : conns) ::shutdown(conn->fd.get(), SHUT_RDWR);
+  }
+  ::shutdown(listen_fd_.get(), SHUT_RDWR);
+  acceptor_.join();
+  for (auto& conn : conns) conn->thread.join();
+}
+
+void MoverServer::accept_loop() {
+  for (;;) {
+    UniqueFd fd;
+    try {
+      fd = accept_tcp(listen_fd_.get());
+    } catch (const std::system_error&) {
+      // Unless stop() shut the listener down, this passes, e.g. running out
+      // of descriptors until connections finish.
+      {
+        std::lock_guard<std::mutex> lock(mu_);
+        if (stopped_) return;
+      }
+      std::this_thread::sleep_for(kAcceptBackoff);
+      continue;
+    }
+    std::list<std::unique_ptr<Connection>> finished;
+    {
+      std::lock_guard<std::mutex> lock(mu_);
+      if (stopped_) return;
+      for (auto it = conns_.begin(); it != conns_.end();) {
+        auto next = std::next(it);
+        if ((*it)->done) finished.splice(finished.end(), conns_, it);
+        it = next;
+      }
+      conns_.push_back(std::make_unique<Connection>(std::move(fd)));
+      Connection& conn = *conns_.back();
+      conn.thread = std::thread([this, &conn] {
+        serve(conn);
+        std::lock_guard<std::mutex> lock(mu_);
+        conn.fd.reset();
+        conn.done = true;
+      });
+      connections_.fetch_add(1);
+    }
+    for (auto& conn : finished) conn->thread.join();
+  }
+}
+
+std::shared_ptr<MoverServer::Session> MoverServer::join_session(std::uint64_t id) {
+  std::lock_guard<std::mutex> lock(mu_);
+  for (auto it = sessions_.begin(); it != sessions_.end();) {
+    it = it->second.expired() ? sessions_.erase(it) : std::next(it);
+  }
+  std::shared_ptr<Session> session = sessions_[id].lock();
+  if (!session) {
+    session = std::make_shared<Session>();
+    sessions_[id] = session;
+  }
+  return session;
+}
+
+void MoverServer::serve(Connection& conn) {
+  const int sock = conn.fd.get();
+  std::shared_ptr<Session> session;
+  std::vector<char> buffer(kReceiveBuffer);
+  std::vector<char> payload;
+  std::uint64_t received = 0;
+  std::uint32_t completed = 0;
+  // kRef chunks not found since the last kSync, as kMiss headers.
+  std::vector<StreamHeader> misses;
+  const auto start = std::chrono::steady_clock::now();
+  // Holds the connection to stream_rate, counting bytes as they are on
+  // the wire.
+  std::uint64_t wire = 0;
+  auto pace = [&](std::size_t n) {
+    wire += n;
+    if (options_.stream_rate == 0) return;
+    const double due = static_cast<double>(wire) / options_.stream_rate;
+    std::this_thread::sleep_until(start + std::chrono::duration<double>(due));
+  };
+  try {
+    char raw[kStreamHeaderSize];
+    StreamHeader header;
+    while (recv_exact(sock, raw, sizeof(raw))) {
+      if (!decode_stream_header(raw, header)) throw std::runtime_error("bad stream header");
+      if (header.type == StreamFrame::kHello) {
+        session = join_session(header.offset);
+        continue;
+      }
+      if (header.type == StreamFrame::kSync || header.type == StreamFrame::kEnd) {
+        misses.push_back({StreamFrame::kAck, completed, 0, received});
+        std::string reply(misses.size() * kStreamHeaderSize, '\0');
+        for (std::size_t i = 0; i < misses.size(); ++i) {
+          encode_stream_header(misses[i], reply.data() + i * kStreamHeaderSize);
+        }
+        send_all(sock, reply.data(), reply.size());
+        misses.clear();
+        if (header.type == StreamFrame::kEnd) return;
+        continue;
+      }
+      if (!session || header.type == StreamFrame::kAck || header.type == StreamFrame::kMiss) {
+        throw std::runtime_error("unexpected stream frame");
+      }
+
+      if (header.type == StreamFrame::kOpen) {
+        if (header.length > kMaxPath) throw std::runtime_error("path too long");
+        std::string path(header.length, '\0');
+        if (!recv_exact(sock, path.data(), path.size()) || !safe_path(path)) {
+          throw std::runtime_error("bad destination path");
+        }
+        std::lock_guard<std::mutex> lock(session->mu);
+        if (session->files.count(header.file_id) != 0) continue;
+        Session::File file;
+        file.size = header.offset;
+        if (!options_.root.empty()) {
+          const std::string dst = options_.root + "/" + path;
+          std::filesystem::create_directories(std::filesystem::path(dst).parent_path());
+          file.fd = std::make_shared<UniqueFd>(
+              open_or_throw(dst, O_WRONLY | O_CREAT | O_TRUNC, 0644));
+          if (::ftruncate(file.fd->get(), static_cast<off_t>(file.size)) != 0) {
+            throw_errno("ftruncate " + dst);
+          }
+        }
+        if (file.size == 0) {
+          ++completed;
+          files_.fetch_add(1);
+        }
+        session->files.emplace(header.file_id, std::move(file));
+        continue;
+      }
+
+      // kData, kZData or kRef. Compressed chunks and references arrive
+      // whole before the length of their data is known.
+      std::uint32_t length = header.length;
+      std::string source;
+      RefHeader ref;
+      if (header.type == StreamFrame::kRef) {
+        if (header.length <= kRefHeaderSize || header.length > kRefHeaderSize + kMaxPath) {
+          throw std::runtime_error("bad reference frame length");
+        }
+        payload.resize(header.length);
+        if (!recv_exact(sock, payload.data(), payload.size())) {
+          throw std::runtime_error("connection closed inside a frame");
+        }
+        pace(header.length);
+        decode_ref_header(payload.data(), ref);
+        length = ref.length;
+        source.assign(payload.data() + kRefHeaderSize, header.length - kRefHeaderSize);
+        if (length > kMaxBufferedChunk || !safe_path(source)) {
+          throw std::runtime_error("bad reference");
+        }
+      } else if (header.type == StreamFrame::kZData) {
+        if (header.length < 4 || header.length > kMaxCompressedFrame) {
+          throw std::runtime_error("bad compressed frame length");
+        }
+        payload.resize(header.length);
+        if (!recv_exact(sock, payload.data(), payload.size())) {
+          throw std::runtime_error("connection closed inside a frame");
+        }
+        pace(header.length);
+        length = load_u32(payload.data());
+        if (length > kMaxBufferedChunk) throw std::runtime_error("compressed chunk too large");
+      }
+      // Another connection may complete the file meanwhile; this one's
+      // reference keeps it open until the chunk is written.
+      std::shared_ptr<UniqueFd> file_fd;
+      {
+        std::lock_guard<std::mutex> lock(session->mu);
+        auto it = session->files.find(header.file_id);
+        if (it == session->files.end() || header.offset > it->second.size ||
+            length > it->second.size - header.offset) {
+          throw std::runtime_error("data for an unknown file or out of range");
+        }
+        file_fd = it->second.fd;
+      }
+      const int fd = file_fd ? file_fd->get() : -1;
+      if (header.type == StreamFrame::kRef) {
+        // Copied only if the source still holds the chunk; otherwise the
+        // client sends it after the next kSync.
+        buffer.resize(std::max<std::size_t>(buffer.size(), length));
+        bool found = false;
+        if (!options_.root.empty()) {
+          UniqueFd src(::open((options_.root + "/" + source).c_str(), O_RDONLY | O_CLOEXEC));
+          found = src && pread_full(src.get(), buffer.data(), length,
+                                    static_cast<off_t>(ref.source_offset)) == length &&
+                  xxh3_128(buffer.data(), length) == ref.digest;
+        }
+        if (!found) {
+          misses.push_back({StreamFrame::kMiss, header.file_id, length, header.offset});
+          refs_missed_.fetch_add(1);
+          continue;
+        }
+        if (fd >= 0) pwrite_full(fd, buffer.data(), length, static_cast<off_t>(header.offset));
+        refs_copied_.fetch_add(1);
+      } else if (header.type == StreamFrame::kZData) {
+        buffer.resize(std::max<std::size_t>(buffer.size(), length));
+        decompress(header.codec, payload.data() + 4, payload.size() - 4, buffer.data(),
+                   length);
+        if (fd >= 0) pwrite_full(fd, buffer.data(), length, static_cast<off_t>(header.offset));
+      } else {
+        for (std::uint32_t done = 0; done < length;) {
+          const auto want = std::min<std::size_t>(buffer.size(), length - done);
+          if (!recv_exact(sock, buffer.data(), want)) {
+            throw std::runtime_error("connection closed inside a frame");
+          }
+          if (fd >= 0) {
+            pwrite_full(fd, buffer.data(), want, static_cast<off_t>(header.offset + done));
+          }
+          done += static_cast<std::uint32_t>(want);
+          pace(want);
+        }
+      }
+      received += length;
+      bytes_.fetch_add(length);
+      file_fd.reset();
+      std::lock_guard<std::mutex> lock(session->mu);
+      Session::File& file = session->files.find(header.file_id)->second;
+      const std::uint64_t added =
+          add_range(file.ranges, header.offset, header.offset + length);
+      if (added != 0 && (file.received += added) == file.size) {
+        file.fd.reset();
+        file.ranges.clear();
+        ++completed;
+        files_.fetch_add(1);
+      }
+    }
+    throw std::runtime_error("connection closed before kEnd");
+  } catch (const std::exception&) {
+    errors_.fetch_add(1);
+    ::shutdown(sock, SHUT_RDWR);
+  }
+}
+
+}  // namespace dms
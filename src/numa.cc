@@ -0,0 +1,120 @@
+#include "dms/numa.h"
+
+#include <linux/mempolicy.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <stdexcept>
+
+namespace dms {
+namespace {
+
+constexpr int kMaxNodes = 1024;
+constexpr unsigned kMaskBits = 8 * sizeof(unsigned long);
+
+// Parses a sysfs list such as "0-3,8-11".
+std::vector<int> parse_list(const std::string& text) {
+  std::vector<int> out;
+  std::size_t pos = 0;
+  while (pos < text.size()) {
+    std::size_t end = text.find(',', pos);
+    if (end == std::string::npos) end = text.size();
+    const std::string item = text.substr(pos, end - pos);
+    pos = end + 1;
+    if (item.empty() || item[0] < '0' || item[0] > '9') continue;
+    const std::size_t dash = item.find('-');
+    const int first = std::stoi(item);
+    const int last = dash == std::string::npos ? first : std::stoi(item.substr(dash + 1));
+    for (int i = first; i <= last; ++i) out.push_back(i);
+  }
+  return out;
+}
+
+std::vector<int> read_list(const std::string& path) {
+  std::ifstream in(path);
+  std::string text;
+  if (!in || !std::getline(in, text)) return {};
+  return parse_list(text);
+}
+
+const std::string kNodeDir = "/sys/devices/system/node/";
+
+long mbind(void* addr, std::size_t length, int mode, const unsigned long* mask) {
+  return ::syscall(SYS_mbind, addr, length, mode, mask, mask ? kMaxNodes + 1 : 0, 0);
+}
+
+}  // namespace
+
+const char* to_string(NumaPolicy policy) {
+  switch (policy) {
+    case NumaPolicy::kNone:
+      return "none";
+    case NumaPolicy::kLocal:
+      return "local";
+    case NumaPolicy::kInterleave:
+      return "interleave";
+  }
+  return "?";
+}
+
+NumaPolicy parse_numa_policy(const std::string& text) {
+  if (text == "none") return NumaPolicy::kNone;
+  if (text == "local") return NumaPolicy::kLocal;
+  if (text == "interleave") return NumaPolicy::kInterleave;
+  throw std::invalid_argument("unknown NUMA policy: '" + text + "'");
+}
+
+const std::vector<int>& numa_nodes() {
+  static const std::vector<int> nodes = [] {
+    std::vector<int> out;
+    for (const int node : read_list(kNodeDir + "online")) {
+      if (node < kMaxNodes && !numa_node_cpus(node).empty()) out.push_back(node);
+    }
+    if (out.empty()) out.push_back(0);
+    return out;
+  }();
+  return nodes;
+}
+
+std::vector<int> numa_node_cpus(int node) {
+  cpu_set_t allowed;
+  CPU_ZERO(&allowed);
+  if (::sched_getaffinity(0, sizeof(allowed), &allowed) != 0) return {};
+  std::vector<int> cpus;
+  for (const int cpu : read_list(kNodeDir + "node" + std::to_string(node) + "/cpulist")) {
+    if (cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed)) cpus.push_back(cpu);
+  }
+  return cpus;
+}
+
+int current_numa_node() {
+  unsigned cpu = 0;
+  unsigned node = 0;
+  if (::syscall(SYS_getcpu, &cpu, &node, nullptr) != 0) return 0;
+  return static_cast<int>(node);
+}
+
+bool pin_thread_to_node(int node) {
+  const std::vector<int> cpus = numa_node_cpus(node);
+  if (cpus.empty()) return false;
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (const int cpu : cpus) CPU_SET(cpu, &set);
+  return ::sched_setaffinity(0, sizeof(set), &set) == 0;
+}
+
+bool place_memory(void* addr, std::size_t length, int node) {
+  if (node == kAnyNode || length == 0) return true;
+  unsigned long mask[kMaxNodes / kMaskBits] = {};
+  if (node == kAllNodes) {
+    for (const int n : numa_nodes()) mask[n / kMaskBits] |= 1UL << (n % kMaskBits);
+    return mbind(addr, length, MPOL_INTERLEAVE, mask) == 0;
+  }
+  if (node < 0 || node >= kMaxNodes) return false;
+  mask[node / kMaskBits] = 1UL << (node % kMaskBits);
+  return mbind(addr, length, MPOL_PREFERRED, mask) == 0;
+}
+
+}  // namespace dms
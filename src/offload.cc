@@ -0,0 +1,74 @@
+#include "dms/offload.h"
+
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <stdexcept>
+
+namespace dms {
+
+const char* to_string(OffloadMode mode) {
+  switch (mode) {
+    case OffloadMode::kAuto:
+      return "auto";
+    case OffloadMode::kReflink:
+      return "reflink";
+    case OffloadMode::kCopyRange:
+      return "copy-range";
+    case OffloadMode::kNone:
+      return "none";
+  }
+  return "?";
+}
+
+OffloadMode parse_offload_mode(const std::string& text) {
+  if (text == "auto") return OffloadMode::kAuto;
+  if (text == "reflink") return OffloadMode::kReflink;
+  if (text == "copy-range") return OffloadMode::kCopyRange;
+  if (text == "none") return OffloadMode::kNone;
+  throw std::invalid_argument("unknown offload mode: '" + text + "'");
+}
+
+const char* to_string(CopyPath path) {
+  switch (path) {
+    case CopyPath::kReadWrite:
+      return "read-write";
+    case CopyPath::kReflink:
+      return "reflink";
+    case CopyPath::kCopyRange:
+      return "copy-range";
+    case CopyPath::kPacked:
+      return "packed";
+  }
+  return "?";
+}
+
+int reflink(int src_fd, int dst_fd) {
+  return ::ioctl(dst_fd, FICLONE, src_fd) == 0 ? 0 : errno;
+}
+
+int copy_range(int src_fd, int dst_fd, std::uint64_t offset, std::uint64_t length) {
+  auto in = static_cast<loff_t>(offset);
+  auto out = static_cast<loff_t>(offset);
+  while (length > 0) {
+    const ssize_t n = ::copy_file_range(src_fd, &in, dst_fd, &out, length, 0);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return errno;
+    }
+    if (n == 0) return ENODATA;
+    length -= static_cast<std::uint64_t>(n);
+  }
+  return 0;
+}
+
+bool offload_unsupported(int err) {
+  // EXDEV: across file systems the kernel does not copy between. ENOTTY:
+  // the ioctl is unknown to the file system. EINVAL: the file system
+  // rejects the files or the range (e.g. unaligned for a clone).
+  return err == EXDEV || err == EOPNOTSUPP || err == ENOTTY || err == ENOSYS || err == EINVAL;
+}
+
+}  // namespace dms
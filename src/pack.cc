@@ -0,0 +1,212 @@
+#include "dms/pack.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <filesystem>
+#include <stdexcept>
+#include <system_error>
+
+#include "dms/encoding.h"
+#include "dms/error.h"
+#include "dms/file.h"
+
+namespace dms {
+namespace {
+
+constexpr char kMagic[8] = {'D', 'M', 'S', 'P', 'A', 'C', 'K', '1'};
+constexpr std::uint32_t kVersion = 1;
+constexpr std::size_t kHeaderSize = 32;
+
+[[noreturn]] void malformed(const char* what) {
+  throw std::runtime_error(std::string("malformed pack unit: ") + what);
+}
+
+std::pair<std::string, std::string> split_parent(const std::string& path) {
+  std::size_t slash = path.rfind('/');
+  if (slash == std::string::npos) return {".", path};
+  if (slash == 0) return {"/", path.substr(1)};
+  return {path.substr(0, slash), path.substr(slash + 1)};
+}
+
+UniqueFd open_directory(const std::string& dir) {
+  int fd = ::open(dir.c_str(), O_PATH | O_DIRECTORY | O_CLOEXEC);
+  if (fd < 0 && errno == ENOENT) {
+    std::error_code ec;
+    std::filesystem::create_directories(dir, ec);
+    fd = ::open(dir.c_str(), O_PATH | O_DIRECTORY | O_CLOEXEC);
+  }
+  if (fd < 0) throw_errno("open directory " + dir);
+  return UniqueFd(fd);
+}
+
+void create_entry(int dirfd, const std::string& name, const PackEntry& entry, const char* data,
+                  bool sync) {
+  int fd = ::openat(dirfd, name.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                    entry.mode & 07777);
+  if (fd < 0) throw_errno("create");
+  UniqueFd out(fd);
+  if (entry.size > 0) pwrite_full(out.get(), data + entry.offset, entry.size, 0);
+  // The create mode is masked by the umask and ignored for a file that
+  // already exists, so set it explicitly.
+  if (::fchmod(out.get(), entry.mode & 07777) != 0) throw_errno("fchmod");
+  struct timespec times[2];
+  times[0].tv_sec = 0;
+  times[0].tv_nsec = UTIME_OMIT;
+  times[1] = to_timespec(entry.mtime_ns);
+  if (::futimens(out.get(), times) != 0) throw_errno("futimens");
+  if (sync && ::fdatasync(out.get()) != 0) throw_errno("fdatasync");
+  if (int err = out.close()) throw std::system_error(err, std::generic_category(), "close");
+}
+
+}  // namespace
+
+void PackWriter::reset() {
+  unit_.assign(kHeaderSize, '\0');
+  entries_.clear();
+}
+
+std::uint64_t PackWriter::data_size() const { return unit_.size() - kHeaderSize; }
+
+std::string_view PackWriter::last_data() const {
+  if (entries_.empty()) return {};
+  const PackEntry& e = entries_.back();
+  return std::string_view(unit_).substr(kHeaderSize + e.offset, e.size);
+}
+
+void PackWriter::add_file(const std::string& src, const std::string& path) {
+  if (path.size() > 0xffff) {
+    throw std::system_error(ENAMETOOLONG, std::generic_category(), "pack " + src);
+  }
+  UniqueFd fd = open_or_throw(src, O_RDONLY);
+  struct stat st;
+  if (::fstat(fd.get(), &st) != 0) throw_errno("fstat " + src);
+
+  PackEntry entry;
+  entry.path = path;
+  entry.mode = st.st_mode;
+  entry.mtime_ns = static_cast<std::int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+  entry.offset = data_size();
+  const std::size_t start = unit_.size();
+  unit_.resize(start + static_cast<std::size_t>(st.st_size));
+  std::size_t n = 0;
+  try {
+    n = pread_full(fd.get(), &unit_[start], static_cast<std::size_t>(st.st_size), 0);
+  } catch (...) {
+    unit_.resize(start);
+    throw;
+  }
+  unit_.resize(start + n);
+  entry.size = n;
+  entries_.push_back(std::move(entry));
+}
+
+std::string_view PackWriter::finish() {
+  const std::uint64_t data = data_size();
+  const std::size_t index_start = unit_.size();
+  for (const auto& e : entries_) {
+    put_u16(unit_, static_cast<std::uint16_t>(e.path.size()));
+    unit_.append(e.path);
+    put_u32(unit_, e.mode);
+    put_u64(unit_, static_cast<std::uint64_t>(e.mtime_ns));
+    put_u64(unit_, e.offset);
+    put_u64(unit_, e.size);
+  }
+  char* header = &unit_[0];
+  std::copy(std::begin(kMagic), std::end(kMagic), header);
+  store_u32(header + 8, kVersion);
+  store_u32(header + 12, static_cast<std::uint32_t>(entries_.size()));
+  store_u64(header + 16, data);
+  store_u64(header + 24, unit_.size() - index_start);
+  return unit_;
+}
+
+std::vector<PackEntry> read_pack_index(std::string_view unit) {
+  if (unit.size() < kHeaderSize) malformed("short header");
+  if (!std::equal(std::begin(kMagic), std::end(kMagic), unit.data())) malformed("bad magic");
+  if (load_u32(unit.data() + 8) != kVersion) malformed("unsupported version");
+  const std::uint32_t count = load_u32(unit.data() + 12);
+  const std::uint64_t data_size = load_u64(unit.data() + 16);
+  const std::uint64_t index_size = load_u64(unit.data() + 24);
+  if (data_size > unit.size() - kHeaderSize ||
+      index_size != unit.size() - kHeaderSize - data_size) {
+    malformed("size mismatch");
+  }
+
+  std::vector<PackEntry> entries;
+  entries.reserve(count);
+  const char* p = unit.data() + kHeaderSize + data_size;
+  const char* end = unit.data() + unit.size();
+  for (std::uint32_t i = 0; i < count; ++i) {
+    if (end - p < 2) malformed("truncated index");
+    const std::uint16_t len = load_u16(p);
+    p += 2;
+    if (static_cast<std::size_t>(end - p) < len + 28u) malformed("truncated index");
+    PackEntry e;
+    e.path.assign(p, len);
+    p += len;
+    e.mode = load_u32(p);
+    e.mtime_ns = static_cast<std::int64_t>(load_u64(p + 4));
+    e.offset = load_u64(p + 12);
+    e.size = load_u64(p + 20);
+    p += 28;
+    if (e.offset > data_size || e.size > data_size - e.offset) malformed("entry out of range");
+    entries.push_back(std::move(e));
+  }
+  if (p != end) malformed("trailing bytes");
+  return entries;
+}
+
+UnpackResult unpack(std::string_view unit, const std::string& dst_root, bool sync_files) {
+  std::vector<PackEntry> entries = read_pack_index(unit);
+  const char* data = unit.data() + kHeaderSize;
+
+  struct Target {
+    std::string parent;
+    std::string name;
+    const PackEntry* entry;
+  };
+  std::vector<Target> targets;
+  targets.reserve(entries.size());
+  for (const auto& e : entries) {
+    auto [parent, name] = split_parent(dst_root.empty() ? e.path : dst_root + "/" + e.path);
+    targets.push_back({std::move(parent), std::move(name), &e});
+  }
+  std::stable_sort(targets.begin(), targets.end(),
+                   [](const Target& a, const Target& b) { return a.parent < b.parent; });
+
+  UnpackResult result;
+  UniqueFd dirfd;
+  const std::string* current = nullptr;
+  std::string dir_error;
+  for (const auto& t : targets) {
+    const std::string path = t.parent + "/" + t.name;
+    if (!current || t.parent != *current) {
+      current = &t.parent;
+      dir_error.clear();
+      try {
+        dirfd = open_directory(*current);
+      } catch (const std::system_error& e) {
+        dirfd.reset();
+        dir_error = e.what();
+      }
+    }
+    if (!dirfd) {
+      result.failures.emplace_back(path, dir_error);
+      continue;
+    }
+    try {
+      create_entry(dirfd.get(), t.name, *t.entry, data, sync_files);
+      ++result.files;
+      result.bytes += t.entry->size;
+    } catch (const std::system_error& e) {
+      result.failures.emplace_back(path, e.what());
+    }
+  }
+  return result;
+}
+
+}  // namespace dms
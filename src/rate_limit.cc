@@ -0,0 +1,237 @@
+#include "dms/rate_limit.h"
+
+#include <algorithm>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "dms/units.h"
+
+namespace dms {
+namespace {
+
+// Longest sleep between checks for a changed rate.
+constexpr std::chrono::milliseconds kMaxSleep{20};
+
+std::int64_t now_ns() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+// Time to produce n tokens at `rate` per second.
+std::int64_t cost_ns(std::uint64_t n, std::uint64_t rate) {
+  return static_cast<std::int64_t>(static_cast<double>(n) * 1e9 / static_cast<double>(rate));
+}
+
+std::uint64_t parse_rate(const std::string& text, bool bytes) {
+  if (text == "-") return 0;
+  if (bytes) return parse_size(text);
+  std::size_t end = 0;
+  unsigned long long value = 0;
+  try {
+    value = std::stoull(text, &end);
+  } catch (const std::exception&) {
+    end = 0;
+  }
+  if (end == 0 || end != text.size()) throw std::invalid_argument("bad rate: '" + text + "'");
+  return value;
+}
+
+}  // namespace
+
+void TokenBucket::set_rate(std::uint64_t rate) {
+  const std::uint64_t old = rate_.exchange(rate, std::memory_order_relaxed);
+  if (old == rate) return;
+  std::int64_t paid = paid_until_.load(std::memory_order_relaxed);
+  std::int64_t next;
+  do {
+    next = 0;
+    if (old != 0 && rate != 0) {
+      // Whatever is still owed is repaid at the new rate.
+      const std::int64_t now = now_ns();
+      const std::int64_t owed = paid - now;
+      next = owed > 0 ? now + static_cast<std::int64_t>(static_cast<double>(owed) *
+                                                        static_cast<double>(old) /
+                                                        static_cast<double>(rate))
+                      : paid;
+    }
+  } while (!paid_until_.compare_exchange_weak(paid, next, std::memory_order_relaxed));
+}
+
+std::chrono::nanoseconds TokenBucket::reserve(std::uint64_t n, std::uint64_t rate) {
+  const std::int64_t now = now_ns();
+  const std::int64_t burst = burst_.count();
+  const std::int64_t cost = cost_ns(n, rate);
+  std::int64_t paid = paid_until_.load(std::memory_order_relaxed);
+  std::int64_t next;
+  do {
+    next = std::max(paid, now) + cost;
+  } while (!paid_until_.compare_exchange_weak(paid, next, std::memory_order_relaxed));
+  return std::chrono::nanoseconds(std::max<std::int64_t>(0, next - now - burst));
+}
+
+Throttle::Throttle(RateLimits limits, std::chrono::nanoseconds burst)
+    : Throttle(limits, burst, std::make_shared<Level>(burst), std::make_shared<Level>(burst)) {}
+
+Throttle::Throttle(RateLimits limits, std::chrono::nanoseconds burst,
+                   std::shared_ptr<Level> tenant, std::shared_ptr<Level> global)
+    : job_(burst), tenant_(std::move(tenant)), global_(std::move(global)) {
+  set_limits(limits);
+}
+
+void Throttle::set_limits(RateLimits limits) {
+  job_.bytes.set_rate(limits.bytes_per_sec);
+  job_.ops.set_rate(limits.ops_per_sec);
+}
+
+double Throttle::waited_seconds() const {
+  return static_cast<double>(waited_ns_.load(std::memory_order_relaxed)) * 1e-9;
+}
+
+void Throttle::acquire(TokenBucket Level::*bucket, std::uint64_t n) {
+  TokenBucket* const levels[] = {&(job_.*bucket), &(*tenant_.*bucket), &(*global_.*bucket)};
+  std::uint64_t rates[3];
+  bool limited = false;
+  for (int i = 0; i < 3; ++i) {
+    rates[i] = levels[i]->rate();
+    limited |= rates[i] != 0;
+  }
+  if (!limited || n == 0) return;
+
+  // Reserve at every limited level and wait for the slowest. If that
+  // level's rate changes meanwhile, the rest of the wait is rescaled.
+  std::chrono::nanoseconds wait{0};
+  int slowest = -1;
+  for (int i = 0; i < 3; ++i) {
+    if (rates[i] == 0) continue;
+    const std::chrono::nanoseconds w = levels[i]->reserve(n, rates[i]);
+    if (w > wait) {
+      wait = w;
+      slowest = i;
+    }
+  }
+  if (slowest < 0) return;
+  const auto start = std::chrono::steady_clock::now();
+  auto deadline = start + wait;
+  std::uint64_t rate = rates[slowest];
+  for (;;) {
+    auto now = std::chrono::steady_clock::now();
+    if (now >= deadline) break;
+    std::this_thread::sleep_for(std::min<std::chrono::nanoseconds>(deadline - now, kMaxSleep));
+    const std::uint64_t current = levels[slowest]->rate();
+    if (current == rate) continue;
+    if (current == 0) break;
+    now = std::chrono::steady_clock::now();
+    if (now < deadline) {
+      deadline = now + std::chrono::nanoseconds(static_cast<std::int64_t>(
+                           static_cast<double>((deadline - now).count()) *
+                           static_cast<double>(rate) / static_cast<double>(current)));
+    }
+    rate = current;
+  }
+  waited_ns_.fetch_add(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() -
+                                                           start)
+          .count(),
+      std::memory_order_relaxed);
+}
+
+RateLimiter::RateLimiter(std::chrono::nanoseconds burst)
+    : burst_(burst), global_(std::make_shared<Throttle::Level>(burst)) {}
+
+RateLimits RateLimiter::global_limits() const {
+  return {global_->bytes.rate(), global_->ops.rate()};
+}
+
+void RateLimiter::set_global_limits(RateLimits limits) {
+  global_->bytes.set_rate(limits.bytes_per_sec);
+  global_->ops.set_rate(limits.ops_per_sec);
+}
+
+RateLimits RateLimiter::tenant_limits(const std::string& tenant) {
+  auto level = tenant_level(tenant);
+  return {level->bytes.rate(), level->ops.rate()};
+}
+
+void RateLimiter::set_tenant_limits(const std::string& tenant, RateLimits limits) {
+  auto level = tenant_level(tenant);
+  level->bytes.set_rate(limits.bytes_per_sec);
+  level->ops.set_rate(limits.ops_per_sec);
+}
+
+std::shared_ptr<Throttle> RateLimiter::make_throttle(const std::string& tenant,
+                                                     RateLimits limits,
+                                                     const std::string& job) {
+  std::shared_ptr<Throttle> throttle(
+      new Throttle(limits, burst_, tenant_level(tenant), global_));
+  if (!job.empty()) {
+    std::lock_guard<std::mutex> lock(mu_);
+    for (auto it = jobs_.begin(); it != jobs_.end();) {
+      it = it->second.expired() ? jobs_.erase(it) : std::next(it);
+    }
+    jobs_[job] = throttle;
+  }
+  return throttle;
+}
+
+std::shared_ptr<Throttle::Level> RateLimiter::tenant_level(const std::string& tenant) {
+  std::lock_guard<std::mutex> lock(mu_);
+  auto& level = tenants_[tenant];
+  if (!level) level = std::make_shared<Throttle::Level>(burst_);
+  return level;
+}
+
+void RateLimiter::apply(const std::string& text) {
+  struct Change {
+    std::string scope;
+    std::string name;
+    RateLimits limits;
+  };
+  std::vector<Change> changes;
+  std::istringstream lines(text);
+  std::string line;
+  for (int number = 1; std::getline(lines, line); ++number) {
+    line = line.substr(0, line.find('#'));
+    std::istringstream in(line);
+    std::vector<std::string> words;
+    for (std::string w; in >> w;) words.push_back(w);
+    if (words.empty()) continue;
+    const std::string where = "limits line " + std::to_string(number);
+    const bool global = words[0] == "global";
+    if (!(global ? words.size() == 3
+                 : (words[0] == "tenant" || words[0] == "job") && words.size() == 4)) {
+      throw std::invalid_argument(where + ": expected 'global BYTES OPS', 'tenant NAME BYTES "
+                                          "OPS' or 'job NAME BYTES OPS'");
+    }
+    Change change;
+    change.scope = words[0];
+    if (!global) change.name = words[1];
+    try {
+      change.limits.bytes_per_sec = parse_rate(words[words.size() - 2], true);
+      change.limits.ops_per_sec = parse_rate(words.back(), false);
+    } catch (const std::invalid_argument& e) {
+      throw std::invalid_argument(where + ": " + e.what());
+    }
+    changes.push_back(std::move(change));
+  }
+
+  for (const Change& change : changes) {
+    if (change.scope == "global") {
+      set_global_limits(change.limits);
+    } else if (change.scope == "tenant") {
+      set_tenant_limits(change.name, change.limits);
+    } else {
+      std::shared_ptr<Throttle> job;
+      {
+        std::lock_guard<std::mutex> lock(mu_);
+        auto it = jobs_.find(change.name);
+        if (it != jobs_.end()) job = it->second.lock();
+      }
+      if (job) job->set_limits(change.limits);
+    }
+  }
+}
+
+}  // namespace dms
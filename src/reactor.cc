@@ -0,0 +1,419 @@
+#include "dms/reactor.h"
+
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <thread>
+
+#include "dms/error.h"
+#include "dms/file.h"
+#include "uring_backend.h"
+
+namespace dms {
+namespace detail {
+
+// The root frame of a spawned task: started by the loop that takes it, it
+// awaits the task, tells the reactor, and frees itself on return.
+struct SpawnedTask {
+  struct promise_type {
+    SpawnedTask get_return_object() {
+      return {std::coroutine_handle<promise_type>::from_promise(*this)};
+    }
+    std::suspend_always initial_suspend() const noexcept { return {}; }
+    std::suspend_never final_suspend() const noexcept { return {}; }
+    void return_void() const noexcept {}
+    void unhandled_exception() const noexcept { std::terminate(); }
+  };
+
+  std::coroutine_handle<promise_type> handle;
+};
+
+class ReactorLoop {
+ public:
+  ReactorLoop(int index, unsigned queue_depth, bool uring) : index_(index) {
+    if (uring) {
+      ring_ = std::make_unique<UringRing>(queue_depth);
+      // One entry stays with the wakeup read.
+      capacity_ = ring_->entries() - 1;
+      const int fd = ::eventfd(0, EFD_CLOEXEC);
+      if (fd < 0) throw_errno("eventfd");
+      wakeup_fd_.reset(fd);
+    }
+  }
+
+  void start() {
+    thread_ = std::thread([this] { run(); });
+  }
+
+  void stop() {
+    {
+      std::lock_guard<std::mutex> lock(mu_);
+      stopping_ = true;
+    }
+    wake();
+    thread_.join();
+  }
+
+  // From any thread.
+  void post(std::coroutine_handle<> handle) {
+    {
+      std::lock_guard<std::mutex> lock(mu_);
+      inbox_.push_back(handle);
+    }
+    if (!ring_) {
+      wakeup_.notify_one();
+    } else if (sleeping_.exchange(false)) {
+      // Only a loop about to block in the kernel needs telling.
+      wake();
+    }
+  }
+
+  // From the loop's own thread.
+  void resume_later(std::coroutine_handle<> handle) { ready_.push_back(handle); }
+
+  int index() const { return index_; }
+  bool uring() const { return ring_ != nullptr; }
+
+  void submit(IoOperation& op) {
+    if (in_ring_ < capacity_) {
+      prepare(op);
+      return;
+    }
+    op.next_ = nullptr;
+    (backlog_tail_ ? backlog_tail_->next_ : backlog_head_) = &op;
+    backlog_tail_ = &op;
+  }
+
+  static SpawnedTask run_spawned(Reactor& reactor, Task<void> task) {
+    std::exception_ptr error;
+    try {
+      co_await std::move(task);
+    } catch (...) {
+      error = std::current_exception();
+    }
+    reactor.task_done(error);
+  }
+
+  static thread_local ReactorLoop* current;
+
+ private:
+  static constexpr std::uint64_t kWakeup = 0;
+
+  void run() {
+    current = this;
+    if (ring_) arm_wakeup();
+    std::vector<std::coroutine_handle<>> batch;
+    for (;;) {
+      bool stopping;
+      {
+        std::lock_guard<std::mutex> lock(mu_);
+        batch.swap(inbox_);
+        stopping = stopping_;
+      }
+      for (auto handle : batch) handle.resume();
+      batch.clear();
+      run_ready();
+      if (stopping && in_ring_ == 0 && !backlog_head_) break;
+      if (ring_) {
+        poll_ring();
+      } else {
+        std::unique_lock<std::mutex> lock(mu_);
+        wakeup_.wait(lock, [&] { return !inbox_.empty() || stopping_; });
+      }
+    }
+    current = nullptr;
+  }
+
+  // Resumes the coroutines whose operations completed; they may queue
+  // more before suspending again.
+  void run_ready() {
+    while (!ready_.empty()) {
+      resuming_.swap(ready_);
+      for (auto handle : resuming_) handle.resume();
+      resuming_.clear();
+    }
+  }
+
+  // Submits what the coroutines queued, blocks until something completes
+  // (or the loop is woken), and readies the coroutines that were waiting.
+  void poll_ring() {
+    while (backlog_head_ && in_ring_ < capacity_) {
+      IoOperation* op = backlog_head_;
+      backlog_head_ = op->next_;
+      if (!backlog_head_) backlog_tail_ = nullptr;
+      prepare(*op);
+    }
+    sleeping_.store(true);
+    bool posted;
+    {
+      std::lock_guard<std::mutex> lock(mu_);
+      posted = !inbox_.empty() || stopping_;
+    }
+    ring_->submit_and_wait(posted ? 0 : 1);
+    sleeping_.store(false);
+    ring_->reap([&](const io_uring_cqe& cqe) {
+      if (cqe.user_data == kWakeup) {
+        arm_wakeup();
+        return;
+      }
+      auto* op = reinterpret_cast<IoOperation*>(cqe.user_data);
+      op->result_ = cqe.res;
+      --in_ring_;
+      ready_.push_back(op->awaiting_);
+    });
+  }
+
+  void prepare(IoOperation& op) {
+    io_uring_sqe* sqe = ring_->next_sqe();
+    sqe->fd = op.fd_;
+    sqe->user_data = reinterpret_cast<std::uintptr_t>(&op);
+    switch (op.kind_) {
+      case IoOperation::Kind::kNop:
+        sqe->opcode = IORING_OP_NOP;
+        break;
+      case IoOperation::Kind::kRead:
+      case IoOperation::Kind::kWrite:
+        sqe->opcode = op.kind_ == IoOperation::Kind::kRead ? IORING_OP_READ : IORING_OP_WRITE;
+        sqe->addr = reinterpret_cast<std::uintptr_t>(op.buf_);
+        sqe->len = static_cast<unsigned>(op.length_);
+        sqe->off = op.offset_;
+        break;
+      case IoOperation::Kind::kOpenat:
+        sqe->opcode = IORING_OP_OPENAT;
+        sqe->addr = reinterpret_cast<std::uintptr_t>(op.path_);
+        sqe->len = op.mode_;
+        sqe->open_flags = static_cast<unsigned>(op.flags_);
+        break;
+      case IoOperation::Kind::kClose:
+        sqe->opcode = IORING_OP_CLOSE;
+        break;
+      case IoOperation::Kind::kStatx:
+        sqe->opcode = IORING_OP_STATX;
+        sqe->addr = reinterpret_cast<std::uintptr_t>(op.path_);
+        sqe->len = op.mode_;  // the statx mask
+        sqe->off = reinterpret_cast<std::uintptr_t>(op.buf_);
+        sqe->statx_flags = static_cast<unsigned>(op.flags_);
+        break;
+      case IoOperation::Kind::kFdatasync:
+        sqe->opcode = IORING_OP_FSYNC;
+        sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+        break;
+    }
+    ++in_ring_;
+  }
+
+  void arm_wakeup() {
+    io_uring_sqe* sqe = ring_->next_sqe();
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = wakeup_fd_.get();
+    sqe->addr = reinterpret_cast<std::uintptr_t>(&wakeup_count_);
+    sqe->len = sizeof(wakeup_count_);
+    sqe->user_data = kWakeup;
+  }
+
+  void wake() {
+    if (ring_) {
+      const std::uint64_t one = 1;
+      // Cannot fail short of a bad descriptor; an overflowing count
+      // (EAGAIN) still wakes the loop.
+      [[maybe_unused]] const ssize_t n = ::write(wakeup_fd_.get(), &one, sizeof(one));
+    } else {
+      std::lock_guard<std::mutex> lock(mu_);
+      wakeup_.notify_one();
+    }
+  }
+
+  const int index_;
+  // Declared before the ring, which may still write it while closing.
+  std::uint64_t wakeup_count_ = 0;
+  UniqueFd wakeup_fd_;
+  std::unique_ptr<UringRing> ring_;
+  unsigned capacity_ = 0;
+  unsigned in_ring_ = 0;
+  IoOperation* backlog_head_ = nullptr;
+  IoOperation* backlog_tail_ = nullptr;
+  std::vector<std::coroutine_handle<>> ready_;
+  std::vector<std::coroutine_handle<>> resuming_;
+  std::thread thread_;
+
+  std::mutex mu_;
+  std::condition_variable wakeup_;
+  std::vector<std::coroutine_handle<>> inbox_;
+  bool stopping_ = false;
+  std::atomic<bool> sleeping_{false};
+};
+
+thread_local ReactorLoop* ReactorLoop::current = nullptr;
+
+}  // namespace detail
+
+bool IoOperation::await_ready() noexcept {
+  if (detail::ReactorLoop::current->uring()) return false;
+  result_ = run_blocking();
+  return true;
+}
+
+void IoOperation::await_suspend(std::coroutine_handle<> awaiting) noexcept {
+  awaiting_ = awaiting;
+  detail::ReactorLoop::current->submit(*this);
+}
+
+std::int64_t IoOperation::run_blocking() const {
+  long rc = 0;
+  switch (kind_) {
+    case Kind::kNop:
+      return 0;
+    case Kind::kRead:
+      rc = ::pread(fd_, buf_, length_, static_cast<off_t>(offset_));
+      break;
+    case Kind::kWrite:
+      rc = ::pwrite(fd_, buf_, length_, static_cast<off_t>(offset_));
+      break;
+    case Kind::kOpenat:
+      rc = ::openat(fd_, path_, flags_, mode_);
+      break;
+    case Kind::kClose:
+      rc = ::close(fd_);
+      break;
+    case Kind::kStatx:
+      rc = ::statx(fd_, path_, flags_, mode_, static_cast<struct statx*>(buf_));
+      break;
+    case Kind::kFdatasync:
+      rc = ::fdatasync(fd_);
+      break;
+  }
+  return rc < 0 ? -errno : rc;
+}
+
+IoOperation async_read(int fd, void* buf, std::size_t length, std::uint64_t offset) {
+  IoOperation op(IoOperation::Kind::kRead);
+  op.fd_ = fd;
+  op.buf_ = buf;
+  op.length_ = length;
+  op.offset_ = offset;
+  return op;
+}
+
+IoOperation async_write(int fd, const void* buf, std::size_t length, std::uint64_t offset) {
+  IoOperation op(IoOperation::Kind::kWrite);
+  op.fd_ = fd;
+  op.buf_ = const_cast<void*>(buf);
+  op.length_ = length;
+  op.offset_ = offset;
+  return op;
+}
+
+IoOperation async_openat(int dirfd, const char* path, int flags, mode_t mode) {
+  IoOperation op(IoOperation::Kind::kOpenat);
+  op.fd_ = dirfd;
+  op.path_ = path;
+  op.flags_ = flags;
+  op.mode_ = mode;
+  return op;
+}
+
+IoOperation async_close(int fd) {
+  IoOperation op(IoOperation::Kind::kClose);
+  op.fd_ = fd;
+  return op;
+}
+
+IoOperation async_statx(int fd, const char* path, int flags, unsigned mask, struct statx* out) {
+  IoOperation op(IoOperation::Kind::kStatx);
+  op.fd_ = fd;
+  op.path_ = path;
+  op.flags_ = flags;
+  op.mode_ = mask;
+  op.buf_ = out;
+  return op;
+}
+
+IoOperation async_fdatasync(int fd) {
+  IoOperation op(IoOperation::Kind::kFdatasync);
+  op.fd_ = fd;
+  return op;
+}
+
+IoOperation async_yield() { return IoOperation(IoOperation::Kind::kNop); }
+
+Reactor::Reactor(Options options) : options_(options) {
+  bool uring = options_.backend == IoBackendKind::kUring ||
+               (options_.backend == IoBackendKind::kAuto && uring_available());
+  auto make_loops = [&] {
+    loops_.clear();
+    for (unsigned i = 0; i < std::max(1u, options_.threads); ++i) {
+      loops_.push_back(std::make_unique<detail::ReactorLoop>(
+          static_cast<int>(i), std::max(options_.queue_depth, 2u), uring));
+    }
+  };
+  try {
+    make_loops();
+  } catch (const std::system_error&) {
+    // A ring the probe allowed may still fail, e.g. on the memlock limit.
+    if (options_.backend == IoBackendKind::kUring) throw;
+    uring = false;
+    make_loops();
+  }
+  backend_name_ = uring ? "uring" : "psync";
+  for (auto& loop : loops_) loop->start();
+}
+
+Reactor::~Reactor() {
+  try {
+    wait();
+  } catch (...) {
+    // Reported to whoever called wait(); nothing to do with it here.
+  }
+  for (auto& loop : loops_) loop->stop();
+}
+
+void Reactor::spawn(Task<void> task) {
+  if (options_.max_in_flight != 0 && in_flight_.load() >= options_.max_in_flight) {
+    waiters_.fetch_add(1);
+    std::unique_lock<std::mutex> lock(mu_);
+    changed_.wait(lock, [&] { return in_flight_.load() < options_.max_in_flight; });
+    waiters_.fetch_sub(1);
+  }
+  const std::size_t n = in_flight_.fetch_add(1) + 1;
+  std::size_t peak = peak_in_flight_.load(std::memory_order_relaxed);
+  while (n > peak && !peak_in_flight_.compare_exchange_weak(peak, n)) {
+  }
+  detail::SpawnedTask root = detail::ReactorLoop::run_spawned(*this, std::move(task));
+  const std::size_t loop = next_loop_.fetch_add(1, std::memory_order_relaxed) % loops_.size();
+  loops_[loop]->post(root.handle);
+}
+
+void Reactor::wait() {
+  waiters_.fetch_add(1);
+  std::unique_lock<std::mutex> lock(mu_);
+  changed_.wait(lock, [&] { return in_flight_.load() == 0; });
+  waiters_.fetch_sub(1);
+  if (error_) std::rethrow_exception(std::exchange(error_, nullptr));
+}
+
+void Reactor::task_done(std::exception_ptr error) {
+  if (error) {
+    std::lock_guard<std::mutex> lock(mu_);
+    if (!error_) error_ = error;
+  }
+  in_flight_.fetch_sub(1);
+  // Lock-free unless someone is blocked on the count.
+  if (waiters_.load() != 0) {
+    std::lock_guard<std::mutex> lock(mu_);
+    changed_.notify_all();
+  }
+}
+
+int reactor_thread_index() {
+  return detail::ReactorLoop::current ? detail::ReactorLoop::current->index() : -1;
+}
+
+void resume_later(std::coroutine_handle<> handle) {
+  detail::ReactorLoop::current->resume_later(handle);
+}
+
+}  // namespace dms
@@ -0,0 +1,277 @@
+#include "dms/rpc.h"
+
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#include "dms/encoding.h"
+#include "dms/error.h"
+
+namespace dms {
+namespace {
+
+constexpr char kMagic[4] = {'D', 'M', 'S', 'R'};
+
+void put_string(std::string& out, const std::string& s) {
+  put_varint(out, s.size());
+  out.append(s);
+}
+
+bool get_string(const char*& p, const char* end, std::string& s) {
+  std::uint64_t len;
+  if (!get_varint(p, end, len) || len > static_cast<std::uint64_t>(end - p)) return false;
+  s.assign(p, len);
+  p += len;
+  return true;
+}
+
+// Reads exactly `len` bytes; returns the number read before end of stream.
+std::size_t recv_full(int fd, char* buf, std::size_t len) {
+  std::size_t done = 0;
+  while (done < len) {
+    ssize_t n = ::recv(fd, buf + done, len - done, 0);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      throw_errno("recv");
+    }
+    if (n == 0) break;
+    done += static_cast<std::size_t>(n);
+  }
+  return done;
+}
+
+// Splits "host:port" at the last colon; "[v6addr]:port" is unbracketed.
+void split_address(const std::string& address, std::string& host, std::string& port) {
+  const std::size_t colon = address.rfind(':');
+  if (colon == std::string::npos || colon + 1 == address.size()) {
+    throw std::invalid_argument("address must be host:port: '" + address + "'");
+  }
+  host = address.substr(0, colon);
+  port = address.substr(colon + 1);
+  if (host.size() >= 2 && host.front() == '[' && host.back() == ']') {
+    host = host.substr(1, host.size() - 2);
+  }
+}
+
+struct AddrInfo {
+  addrinfo* list = nullptr;
+  ~AddrInfo() {
+    if (list) ::freeaddrinfo(list);
+  }
+};
+
+void resolve(const std::string& address, int flags, AddrInfo& result) {
+  std::string host, port;
+  split_address(address, host, port);
+  addrinfo hints{};
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = flags;
+  const int rc =
+      ::getaddrinfo(host.empty() ? nullptr : host.c_str(), port.c_str(), &hints, &result.list);
+  if (rc != 0) {
+    throw std::invalid_argument("cannot resolve '" + address + "': " + ::gai_strerror(rc));
+  }
+}
+
+void set_nodelay(int fd) {
+  const int one = 1;
+  ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+}
+
+}  // namespace
+
+const char* to_string(JobStatus status) {
+  switch (status) {
+    case JobStatus::kAccepted:
+      return "accepted";
+    case JobStatus::kRejected:
+      return "rejected";
+  }
+  return "?";
+}
+
+void append_job(std::string& payload, const JobSpec& job) {
+  put_varint(payload, job.priority);
+  put_string(payload, job.src);
+  put_string(payload, job.dst);
+}
+
+void append_receipt(std::string& payload, const JobReceipt& receipt) {
+  put_varint(payload, receipt.job_id);
+  payload.push_back(static_cast<char>(receipt.status));
+  put_string(payload, receipt.message);
+}
+
+bool parse_jobs(const Frame& frame, std::vector<JobSpec>& jobs) {
+  jobs.clear();
+  const char* p = frame.payload.data();
+  const char* end = p + frame.payload.size();
+  for (std::uint32_t i = 0; i < frame.count; ++i) {
+    JobSpec job;
+    std::uint64_t priority;
+    if (!get_varint(p, end, priority) || priority > UINT32_MAX) return false;
+    job.priority = static_cast<std::uint32_t>(priority);
+    if (!get_string(p, end, job.src) || !get_string(p, end, job.dst)) return false;
+    jobs.push_back(std::move(job));
+  }
+  return p == end;
+}
+
+bool parse_receipts(const Frame& frame, std::vector<JobReceipt>& receipts) {
+  receipts.clear();
+  const char* p = frame.payload.data();
+  const char* end = p + frame.payload.size();
+  for (std::uint32_t i = 0; i < frame.count; ++i) {
+    JobReceipt receipt;
+    if (!get_varint(p, end, receipt.job_id) || p == end) return false;
+    const auto status = static_cast<std::uint8_t>(*p++);
+    if (status > static_cast<std::uint8_t>(JobStatus::kRejected)) return false;
+    receipt.status = static_cast<JobStatus>(status);
+    if (!get_string(p, end, receipt.message)) return false;
+    receipts.push_back(std::move(receipt));
+  }
+  return p == end;
+}
+
+void write_frame(int fd, FrameType type, std::uint32_t count, std::uint64_t sequence,
+                 const std::string& payload) {
+  char header[kFrameHeaderSize];
+  std::memcpy(header, kMagic, 4);
+  header[4] = static_cast<char>(static_cast<std::uint16_t>(type));
+  header[5] = static_cast<char>(static_cast<std::uint16_t>(type) >> 8);
+  header[6] = header[7] = 0;
+  store_u32(header + 8, count);
+  store_u32(header + 12, static_cast<std::uint32_t>(payload.size()));
+  store_u64(header + 16, sequence);
+
+  // One sendmsg() for header and payload; MSG_NOSIGNAL turns a closed peer
+  // into EPIPE instead of SIGPIPE.
+  iovec iov[2] = {{header, kFrameHeaderSize},
+                  {const_cast<char*>(payload.data()), payload.size()}};
+  msghdr msg{};
+  msg.msg_iov = iov;
+  msg.msg_iovlen = payload.empty() ? 1 : 2;
+  while (msg.msg_iovlen > 0) {
+    ssize_t n = ::sendmsg(fd, &msg, MSG_NOSIGNAL);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      throw_errno("send");
+    }
+    auto left = static_cast<std::size_t>(n);
+    while (msg.msg_iovlen > 0 && left >= msg.msg_iov->iov_len) {
+      left -= msg.msg_iov->iov_len;
+      ++msg.msg_iov;
+      --msg.msg_iovlen;
+    }
+    if (msg.msg_iovlen > 0) {
+      msg.msg_iov->iov_base = static_cast<char*>(msg.msg_iov->iov_base) + left;
+      msg.msg_iov->iov_len -= left;
+    }
+  }
+}
+
+bool read_frame(int fd, Frame& frame) {
+  char header[kFrameHeaderSize];
+  const std::size_t got = recv_full(fd, header, sizeof(header));
+  if (got == 0) return false;
+  if (got != sizeof(header)) throw std::runtime_error("connection closed inside a frame");
+  if (std::memcmp(header, kMagic, 4) != 0) throw std::runtime_error("bad frame magic");
+  const std::uint16_t type = load_u16(header + 4);
+  if (type != static_cast<std::uint16_t>(FrameType::kSubmit) &&
+      type != static_cast<std::uint16_t>(FrameType::kReceipts)) {
+    throw std::runtime_error("unknown frame type " + std::to_string(type));
+  }
+  const std::uint32_t size = load_u32(header + 12);
+  if (size > kMaxFramePayload) throw std::runtime_error("frame payload too large");
+  frame.type = static_cast<FrameType>(type);
+  frame.count = load_u32(header + 8);
+  frame.sequence = load_u64(header + 16);
+  frame.payload.resize(size);
+  if (recv_full(fd, frame.payload.data(), size) != size) {
+    throw std::runtime_error("connection closed inside a frame");
+  }
+  return true;
+}
+
+UniqueFd connect_tcp(const std::string& address) {
+  AddrInfo ai;
+  resolve(address, 0, ai);
+  int err = 0;
+  for (addrinfo* a = ai.list; a; a = a->ai_next) {
+    UniqueFd fd(::socket(a->ai_family, a->ai_socktype | SOCK_CLOEXEC, a->ai_protocol));
+    if (!fd) {
+      err = errno;
+      continue;
+    }
+    if (::connect(fd.get(), a->ai_addr, a->ai_addrlen) == 0) {
+      set_nodelay(fd.get());
+      return fd;
+    }
+    err = errno;
+  }
+  throw_errno(err, "connect " + address);
+}
+
+UniqueFd listen_tcp(const std::string& address) {
+  AddrInfo ai;
+  resolve(address, AI_PASSIVE, ai);
+  int err = 0;
+  for (addrinfo* a = ai.list; a; a = a->ai_next) {
+    UniqueFd fd(::socket(a->ai_family, a->ai_socktype | SOCK_CLOEXEC, a->ai_protocol));
+    if (!fd) {
+      err = errno;
+      continue;
+    }
+    const int one = 1;
+    ::setsockopt(fd.get(), SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (::bind(fd.get(), a->ai_addr, a->ai_addrlen) == 0 && ::listen(fd.get(), 128) == 0) {
+      return fd;
+    }
+    err = errno;
+  }
+  throw_errno(err, "listen " + address);
+}
+
+std::string local_address(int fd) {
+  sockaddr_storage ss{};
+  socklen_t len = sizeof(ss);
+  if (::getsockname(fd, reinterpret_cast<sockaddr*>(&ss), &len) != 0) throw_errno("getsockname");
+  char host[INET6_ADDRSTRLEN] = "";
+  unsigned port = 0;
+  std::string address;
+  if (ss.ss_family == AF_INET6) {
+    const auto* in6 = reinterpret_cast<const sockaddr_in6*>(&ss);
+    ::inet_ntop(AF_INET6, &in6->sin6_addr, host, sizeof(host));
+    port = ntohs(in6->sin6_port);
+    // Appended piecewise: GCC 12 warns (-Wrestrict) on "[" + std::string.
+    address.append("[").append(host).append("]");
+  } else {
+    const auto* in = reinterpret_cast<const sockaddr_in*>(&ss);
+    ::inet_ntop(AF_INET, &in->sin_addr, host, sizeof(host));
+    port = ntohs(in->sin_port);
+    address.append(host);
+  }
+  return address.append(":").append(std::to_string(port));
+}
+
+UniqueFd accept_tcp(int listen_fd) {
+  for (;;) {
+    const int fd = ::accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+    if (fd >= 0) {
+      set_nodelay(fd);
+      return UniqueFd(fd);
+    }
+    if (errno != EINTR && errno != ECONNABORTED) throw_errno("accept");
+  }
+}
+
+}  // namespace dms
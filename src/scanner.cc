@@ -0,0 +1,298 @@
+#include "dms/scanner.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <system_error>
+#include <thread>
+
+#include "dms/concurrency.h"
+#include "dms/file.h"
+
+namespace dms {
+namespace {
+
+constexpr std::size_t kMaxRecordedErrors = 16;
+
+// Layout of the records returned by getdents64(2).
+struct LinuxDirent64 {
+  std::uint64_t d_ino;
+  std::int64_t d_off;
+  unsigned short d_reclen;
+  unsigned char d_type;
+  char d_name[];
+};
+
+constexpr unsigned kStatxMask = STATX_TYPE | STATX_MODE | STATX_SIZE | STATX_MTIME;
+constexpr int kStatxFlags = AT_SYMLINK_NOFOLLOW | AT_NO_AUTOMOUNT | AT_STATX_DONT_SYNC;
+
+// Last component of a relative path.
+const char* base_name(const std::string& path) {
+  const std::size_t slash = path.rfind('/');
+  return path.c_str() + (slash == std::string::npos ? 0 : slash + 1);
+}
+
+}  // namespace
+
+class Scanner::Walk {
+ public:
+  Walk(const ScanOptions& options, int root_fd, const Sink& sink)
+      : options_(options), root_fd_(root_fd), sink_(sink) {
+    for (unsigned i = 0; i < options_.threads; ++i) deques_.push_back(std::make_unique<Deque>());
+    if (options_.adaptive) {
+      AdaptiveLimit::Options limit;
+      limit.max_limit = options_.threads;
+      limit_ = std::make_unique<AdaptiveLimit>(limit);
+    }
+  }
+
+  ScanStats run() {
+    const auto start = std::chrono::steady_clock::now();
+    pending_.store(1);
+    deques_[0]->dirs.emplace_back();  // the root
+
+    std::vector<std::thread> threads;
+    for (unsigned i = 0; i < options_.threads; ++i) threads.emplace_back([this, i] { worker(i); });
+    for (auto& t : threads) t.join();
+
+    stats_.final_threads = limit_ ? limit_->limit() : options_.threads;
+    stats_.peak_threads = limit_ ? limit_->peak() : options_.threads;
+    stats_.seconds =
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return std::move(stats_);
+  }
+
+ private:
+  // A directory still to read. It is opened relative to a handle to its
+  // parent, shared by the queued subdirectories of the parent, so opening
+  // it looks up one name rather than its whole path, and a symlink
+  // swapped in for any directory above it is never followed.
+  struct DirTask {
+    std::string path;  // relative to the root; empty for the root itself
+    std::shared_ptr<const UniqueFd> parent;  // null for the root
+  };
+
+  struct Deque {
+    std::mutex mu;
+    std::deque<DirTask> dirs;
+  };
+
+  struct LocalStats {
+    std::uint64_t dirs = 0;
+    std::uint64_t files = 0;
+    std::uint64_t others = 0;
+    std::uint64_t bytes = 0;
+    std::uint64_t steals = 0;
+  };
+
+  void worker(unsigned self) {
+    std::unique_ptr<char[]> buffer(new char[options_.getdents_buffer]);
+    std::vector<ScanEntry> batch;
+    batch.reserve(options_.batch_size);
+    LocalStats local;
+    DirTask dir;
+    unsigned idle_rounds = 0;
+    for (;;) {
+      // Parked threads leave their queued directories to be stolen.
+      if (limit_) limit_->admit(self);
+      if (take(self, dir, local)) {
+        const auto start = std::chrono::steady_clock::now();
+        const std::uint64_t entries = read_dir(self, dir, buffer.get(), batch, local);
+        if (limit_ && entries > 0) {
+          const auto elapsed = std::chrono::steady_clock::now() - start;
+          limit_->record(elapsed / entries, entries, entries);
+        }
+        pending_.fetch_sub(1, std::memory_order_acq_rel);
+        idle_rounds = 0;
+        continue;
+      }
+      // Out of work: hand over what we have so the consumer is not left
+      // waiting on a partial batch while other threads finish the walk.
+      flush(batch);
+      if (pending_.load(std::memory_order_acquire) == 0) break;
+      if (++idle_rounds < 64) {
+        std::this_thread::yield();
+      } else {
+        std::this_thread::sleep_for(std::chrono::microseconds(50));
+      }
+    }
+    flush(batch);
+    if (limit_) limit_->close();  // the walk is over: release parked threads
+
+    std::lock_guard<std::mutex> lock(stats_mu_);
+    stats_.dirs += local.dirs;
+    stats_.files += local.files;
+    stats_.others += local.others;
+    stats_.bytes += local.bytes;
+    stats_.steals += local.steals;
+  }
+
+  // Pops from the back of our own deque, else steals from the front of the
+  // next non-empty deque, scanning round-robin from our neighbour.
+  bool take(unsigned self, DirTask& out, LocalStats& local) {
+    {
+      Deque& own = *deques_[self];
+      std::lock_guard<std::mutex> lock(own.mu);
+      if (!own.dirs.empty()) {
+        out = std::move(own.dirs.back());
+        own.dirs.pop_back();
+        return true;
+      }
+    }
+    const unsigned n = static_cast<unsigned>(deques_.size());
+    for (unsigned k = 1; k < n; ++k) {
+      Deque& victim = *deques_[(self + k) % n];
+      std::lock_guard<std::mutex> lock(victim.mu);
+      if (!victim.dirs.empty()) {
+        out = std::move(victim.dirs.front());
+        victim.dirs.pop_front();
+        ++local.steals;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Reports the directory, unless it is the root, and visits its entries.
+  // Returns the number of entries visited.
+  std::uint64_t read_dir(unsigned self, DirTask& task, char* buffer,
+                         std::vector<ScanEntry>& batch, LocalStats& local) {
+    std::uint64_t entries = 0;
+    const std::string& rel = task.path;
+    const int parent_fd = task.parent ? task.parent->get() : root_fd_;
+    const char* name = task.parent ? base_name(rel) : ".";
+    auto dir = std::make_shared<const UniqueFd>(
+        ::openat(parent_fd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC));
+    struct statx stx;
+    if (!*dir) {
+      const int err = errno;
+      if (err == ENOENT && task.parent) return 0;  // removed mid-walk
+      record_error(rel, err);
+      // Reported all the same, as whatever is there now.
+      if (task.parent && ::statx(parent_fd, name, kStatxFlags, kStatxMask, &stx) == 0) {
+        report(rel, stx, batch, local);
+      }
+      return 0;
+    }
+    if (task.parent) {
+      // Described through the handle: no second lookup of the name.
+      if (::statx(dir->get(), "", kStatxFlags | AT_EMPTY_PATH, kStatxMask, &stx) != 0) {
+        record_error(rel, errno);
+        return 0;
+      }
+      report(rel, stx, batch, local);
+      task.parent.reset();
+    }
+    for (;;) {
+      long n = ::syscall(SYS_getdents64, dir->get(), buffer, options_.getdents_buffer);
+      if (n < 0) {
+        if (errno == EINTR) continue;
+        record_error(rel, errno);
+        return entries;
+      }
+      if (n == 0) return entries;
+      for (long off = 0; off < n;) {
+        const auto* d = reinterpret_cast<const LinuxDirent64*>(buffer + off);
+        off += d->d_reclen;
+        const char* child = d->d_name;
+        if (child[0] == '.' && (child[1] == '\0' || (child[1] == '.' && child[2] == '\0'))) {
+          continue;
+        }
+        visit(self, dir, rel, child, d->d_type, batch, local);
+        ++entries;
+      }
+    }
+  }
+
+  // Directories are queued, and reported once opened by read_dir(); where
+  // the file system fills in d_type they are queued without a statx().
+  void visit(unsigned self, const std::shared_ptr<const UniqueFd>& dir, const std::string& parent,
+             const char* name, unsigned char type, std::vector<ScanEntry>& batch,
+             LocalStats& local) {
+    std::string path = parent.empty() ? std::string(name) : parent + "/" + name;
+    struct statx stx;
+    if (type != DT_DIR) {
+      if (::statx(dir->get(), name, kStatxFlags, kStatxMask, &stx) != 0) {
+        if (errno != ENOENT) record_error(path, errno);  // ENOENT: removed mid-walk
+        return;
+      }
+      if (!S_ISDIR(stx.stx_mode)) {
+        report(std::move(path), stx, batch, local);
+        return;
+      }
+    }
+    pending_.fetch_add(1, std::memory_order_acq_rel);
+    Deque& own = *deques_[self];
+    std::lock_guard<std::mutex> lock(own.mu);
+    own.dirs.push_back({std::move(path), dir});
+  }
+
+  void report(std::string path, const struct statx& stx, std::vector<ScanEntry>& batch,
+              LocalStats& local) {
+    ScanEntry entry;
+    entry.path = std::move(path);
+    entry.mode = stx.stx_mode;
+    entry.size = stx.stx_size;
+    entry.mtime_ns = stx.stx_mtime.tv_sec * 1000000000LL + stx.stx_mtime.tv_nsec;
+    if (S_ISDIR(entry.mode)) {
+      ++local.dirs;
+    } else if (S_ISREG(entry.mode)) {
+      ++local.files;
+      local.bytes += entry.size;
+    } else {
+      ++local.others;
+    }
+    batch.push_back(std::move(entry));
+    if (batch.size() >= options_.batch_size) flush(batch);
+  }
+
+  void flush(std::vector<ScanEntry>& batch) {
+    if (batch.empty()) return;
+    sink_(std::move(batch));
+    batch.clear();
+    batch.reserve(options_.batch_size);
+  }
+
+  void record_error(const std::string& rel, int err) {
+    std::lock_guard<std::mutex> lock(stats_mu_);
+    ++stats_.error_count;
+    if (stats_.errors.size() < kMaxRecordedErrors) {
+      stats_.errors.push_back((rel.empty() ? "." : rel) + ": " +
+                             std::generic_category().message(err));
+    }
+  }
+
+  const ScanOptions& options_;
+  const int root_fd_;
+  const Sink& sink_;
+  std::vector<std::unique_ptr<Deque>> deques_;
+  std::unique_ptr<AdaptiveLimit> limit_;
+  // Directories queued or being read; the walk is over when it drops to 0.
+  std::atomic<std::uint64_t> pending_{0};
+  std::mutex stats_mu_;
+  ScanStats stats_;
+};
+
+Scanner::Scanner(ScanOptions options) : options_(std::move(options)) {
+  if (options_.threads == 0) options_.threads = std::max(1u, std::thread::hardware_concurrency());
+  options_.getdents_buffer = std::max<std::size_t>(options_.getdents_buffer, 64 * KiB);
+  options_.batch_size = std::max<std::size_t>(options_.batch_size, 1);
+}
+
+ScanStats Scanner::scan(const std::string& root, const Sink& sink) {
+  UniqueFd root_fd = open_or_throw(root, O_RDONLY | O_DIRECTORY);
+  Walk walk(options_, root_fd.get(), sink);
+  return walk.run();
+}
+
+}  // namespace dms
@@ -0,0 +1,156 @@
+#include "dms/scheduler.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <thread>
+
+namespace dms {
+
+const char* to_string(Priority priority) {
+  switch (priority) {
+    case Priority::kUrgent:
+      return "urgent";
+    case Priority::kNormal:
+      return "normal";
+    case Priority::kBulk:
+      return "bulk";
+  }
+  return "?";
+}
+
+Priority parse_priority(const std::string& text) {
+  if (text == "urgent") return Priority::kUrgent;
+  if (text == "normal") return Priority::kNormal;
+  if (text == "bulk") return Priority::kBulk;
+  throw std::invalid_argument("unknown priority: '" + text + "'");
+}
+
+void SchedulerJob::Request::wait() {
+  {
+    std::unique_lock<std::mutex> lock(scheduler_->mu_);
+    granted_cv_.wait(lock, [&] { return granted_; });
+  }
+  if (pace_.count() > 0) std::this_thread::sleep_for(pace_);
+}
+
+SchedulerJob::~SchedulerJob() { scheduler_.remove(*this); }
+
+void SchedulerJob::request(Request& request, std::uint64_t bytes) {
+  scheduler_.enqueue(*this, request, bytes);
+}
+
+void SchedulerJob::release() { scheduler_.release(*this); }
+
+Scheduler::Scheduler() : Scheduler(Options{}) {}
+
+Scheduler::Scheduler(Options options)
+    : slots_(options.slots ? options.slots : std::max(1u, std::thread::hardware_concurrency())),
+      bucket_(options.bytes_per_sec),
+      free_(slots_) {}
+
+std::unique_ptr<SchedulerJob> Scheduler::add_job(Priority priority, unsigned weight) {
+  std::unique_ptr<SchedulerJob> job(new SchedulerJob(*this, priority, std::max(1u, weight)));
+  std::lock_guard<std::mutex> lock(mu_);
+  ++stats_.jobs;
+  return job;
+}
+
+SchedulerStats Scheduler::stats() const {
+  std::lock_guard<std::mutex> lock(mu_);
+  return stats_;
+}
+
+bool Scheduler::later(const Waiting& a, const Waiting& b) {
+  return a.vtime != b.vtime ? a.vtime > b.vtime : a.sequence > b.sequence;
+}
+
+void Scheduler::enqueue(SchedulerJob& job, SchedulerJob::Request& request, std::uint64_t bytes) {
+  request.scheduler_ = this;
+  request.bytes_ = bytes;
+  request.next_ = nullptr;
+  request.granted_ = false;
+  request.queued_ = {};
+  request.pace_ = std::chrono::nanoseconds(0);
+  std::lock_guard<std::mutex> lock(mu_);
+  if (!job.head_) {
+    // The job becomes backlogged: it joins at the class's virtual time, so
+    // time spent idle earns it nothing.
+    const auto c = static_cast<std::size_t>(job.priority_);
+    job.vtime_ = std::max(job.vtime_, class_vtime_[c]);
+    auto& heap = waiting_[c];
+    heap.push_back({job.vtime_, next_sequence_++, &job});
+    std::push_heap(heap.begin(), heap.end(), later);
+    std::size_t jobs = 0;
+    for (const auto& h : waiting_) jobs += h.size();
+    stats_.peak_waiting_jobs = std::max(stats_.peak_waiting_jobs, jobs);
+    job.head_ = &request;
+  } else {
+    job.tail_->next_ = &request;
+  }
+  job.tail_ = &request;
+  // Slots are only free while nobody waits, so this grants at once or not
+  // at all.
+  if (free_ > 0) {
+    dispatch();
+  } else {
+    request.queued_ = std::chrono::steady_clock::now();
+    ++stats_.queued_grants;
+  }
+}
+
+void Scheduler::release(SchedulerJob& job) {
+  std::lock_guard<std::mutex> lock(mu_);
+  ++free_;
+  releasing_class_ = static_cast<std::size_t>(job.priority_);
+  dispatch();
+  releasing_class_ = kPriorityClasses;
+}
+
+void Scheduler::remove(SchedulerJob&) {
+  std::lock_guard<std::mutex> lock(mu_);
+  --stats_.jobs;
+}
+
+void Scheduler::dispatch() {
+  while (free_ > 0) {
+    std::size_t c = 0;
+    while (c < kPriorityClasses && waiting_[c].empty()) ++c;
+    if (c == kPriorityClasses) return;
+    auto& heap = waiting_[c];
+    std::pop_heap(heap.begin(), heap.end(), later);
+    SchedulerJob& job = *heap.back().job;
+    heap.pop_back();
+
+    SchedulerJob::Request& request = *job.head_;
+    job.head_ = request.next_;
+    if (!job.head_) job.tail_ = nullptr;
+    class_vtime_[c] = job.vtime_;
+    job.vtime_ += static_cast<double>(std::max<std::uint64_t>(request.bytes_, 1)) / job.weight_;
+    if (job.head_) {
+      heap.push_back({job.vtime_, next_sequence_++, &job});
+      std::push_heap(heap.begin(), heap.end(), later);
+    }
+
+    --free_;
+    ++stats_.grants;
+    if (c < releasing_class_ && releasing_class_ < kPriorityClasses) ++stats_.preemptions;
+    if (request.queued_ != std::chrono::steady_clock::time_point{}) {
+      job.waited_ns_.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                   std::chrono::steady_clock::now() - request.queued_)
+                                   .count(),
+                               std::memory_order_relaxed);
+    }
+    if (const std::uint64_t rate = bucket_.rate(); rate != 0) {
+      request.pace_ = bucket_.reserve(request.bytes_, rate);
+      job.waited_ns_.fetch_add(request.pace_.count(), std::memory_order_relaxed);
+    }
+    request.granted_ = true;
+    if (request.on_grant_) {
+      request.on_grant_();
+    } else {
+      request.granted_cv_.notify_one();
+    }
+  }
+}
+
+}  // namespace dms
@@ -0,0 +1,99 @@
+#include "dms/sparse.h"
+
+#include <fcntl.h>
+#include <linux/fiemap.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+
+namespace dms {
+namespace {
+
+constexpr unsigned kFiemapExtents = 256;
+
+// Appends [offset, end) to `out`, merging it with the previous extent when
+// they touch.
+void add_extent(std::vector<Extent>& out, std::uint64_t offset, std::uint64_t end) {
+  if (end <= offset) return;
+  if (!out.empty() && out.back().end() >= offset) {
+    out.back().length = std::max(out.back().end(), end) - out.back().offset;
+    return;
+  }
+  out.push_back({offset, end - offset});
+}
+
+bool seek_extents(int fd, std::uint64_t size, std::vector<Extent>& out) {
+  std::uint64_t pos = 0;
+  while (pos < size) {
+    const off_t data = ::lseek(fd, static_cast<off_t>(pos), SEEK_DATA);
+    if (data < 0) {
+      // No data past pos: the rest is a hole.
+      if (errno == ENXIO) return true;
+      return false;
+    }
+    if (static_cast<std::uint64_t>(data) >= size) return true;
+    off_t hole = ::lseek(fd, data, SEEK_HOLE);
+    if (hole < 0) return false;
+    const std::uint64_t end = std::min<std::uint64_t>(static_cast<std::uint64_t>(hole), size);
+    add_extent(out, static_cast<std::uint64_t>(data), end);
+    pos = end;
+  }
+  return true;
+}
+
+bool fiemap_extents(int fd, std::uint64_t size, std::vector<Extent>& out) {
+  std::vector<char> storage(sizeof(fiemap) + kFiemapExtents * sizeof(fiemap_extent));
+  auto* map = reinterpret_cast<fiemap*>(storage.data());
+  std::uint64_t pos = 0;
+  while (pos < size) {
+    std::fill(storage.begin(), storage.end(), 0);
+    map->fm_start = pos;
+    map->fm_length = size - pos;
+    map->fm_flags = FIEMAP_FLAG_SYNC;
+    map->fm_extent_count = kFiemapExtents;
+    if (::ioctl(fd, FS_IOC_FIEMAP, map) != 0) return false;
+    if (map->fm_mapped_extents == 0) return true;
+    bool last = false;
+    for (unsigned i = 0; i < map->fm_mapped_extents; ++i) {
+      const fiemap_extent& e = map->fm_extents[i];
+      if (!(e.fe_flags & FIEMAP_EXTENT_UNWRITTEN)) {
+        add_extent(out, std::max<std::uint64_t>(e.fe_logical, pos),
+                   std::min<std::uint64_t>(e.fe_logical + e.fe_length, size));
+      }
+      pos = std::max<std::uint64_t>(pos, e.fe_logical + e.fe_length);
+      last = last || (e.fe_flags & FIEMAP_EXTENT_LAST);
+    }
+    if (last) return true;
+  }
+  return true;
+}
+
+}  // namespace
+
+bool may_be_sparse(const struct stat& st) {
+  return st.st_size > 0 &&
+         static_cast<std::uint64_t>(st.st_blocks) * 512 < static_cast<std::uint64_t>(st.st_size);
+}
+
+std::vector<Extent> data_extents(int fd, std::uint64_t size) {
+  std::vector<Extent> out;
+  if (size == 0) return out;
+  if (seek_extents(fd, size, out)) return out;
+  out.clear();
+  if (fiemap_extents(fd, size, out)) return out;
+  return {{0, size}};
+}
+
+int punch_hole(int fd, std::uint64_t offset, std::uint64_t length) {
+  if (length == 0) return 0;
+  if (::fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, static_cast<off_t>(offset),
+                  static_cast<off_t>(length)) == 0) {
+    return 0;
+  }
+  return errno;
+}
+
+}  // namespace dms
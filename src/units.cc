@@ -0,0 +1,50 @@
+#include "dms/units.h"
+
+#include <cctype>
+#include <cstdio>
+#include <stdexcept>
+
+namespace dms {
+
+std::uint64_t parse_size(const std::string& text) {
+  std::size_t pos = 0;
+  unsigned long long value = 0;
+  try {
+    value = std::stoull(text, &pos);
+  } catch (const std::exception&) {
+    throw std::invalid_argument("invalid size: '" + text + "'");
+  }
+  std::string suffix;
+  for (; pos < text.size(); ++pos) {
+    suffix += static_cast<char>(std::toupper(static_cast<unsigned char>(text[pos])));
+  }
+  if (suffix == "B") suffix.clear();
+  if (suffix.size() == 3 && suffix.compare(1, 2, "IB") == 0) suffix.resize(1);
+  if (suffix.size() == 2 && suffix[1] == 'B') suffix.resize(1);
+
+  if (suffix.empty()) return value;
+  switch (suffix[0]) {
+    case 'K': if (suffix.size() == 1) return value * KiB; break;
+    case 'M': if (suffix.size() == 1) return value * MiB; break;
+    case 'G': if (suffix.size() == 1) return value * GiB; break;
+    case 'T': if (suffix.size() == 1) return value * GiB * 1024; break;
+    default: break;
+  }
+  throw std::invalid_argument("invalid size suffix: '" + text + "'");
+}
+
+std::string format_bytes(double bytes) {
+  static const char* const kUnits[] = {"B", "KiB", "MiB", "GiB", "TiB", "PiB"};
+  int unit = 0;
+  while (bytes >= 1024.0 && unit < 5) {
+    bytes /= 1024.0;
+    ++unit;
+  }
+  char buf[32];
+  std::snprintf(buf, sizeof(buf), unit == 0 ? "%.0f %s" : "%.2f %s", bytes, kUnits[unit]);
+  return buf;
+}
+
+std::string format_rate(double bytes_per_sec) { return format_bytes(bytes_per_sec) + "/s"; }
+
+}  // namespace dms
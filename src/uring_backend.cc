@@ -0,0 +1,289 @@
+// io_uring backend driven directly through the io_uring_setup/enter/register
+// syscalls, so the client has no liburing dependency.
+
+#include "uring_backend.h"
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <deque>
+#include <unordered_map>
+
+#include "dms/error.h"
+#include "dms/file.h"
+
+namespace dms {
+namespace {
+
+// Fixed-file slots per ring. A batch rarely touches more than a handful of
+// files because the planner queues chunks file by file.
+constexpr unsigned kFileSlots = 64;
+
+int sys_io_uring_setup(unsigned entries, io_uring_params* params) {
+  return static_cast<int>(::syscall(SYS_io_uring_setup, entries, params));
+}
+
+int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+  return static_cast<int>(
+      ::syscall(SYS_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0));
+}
+
+int sys_io_uring_register(int fd, unsigned opcode, const void* arg, unsigned nr_args) {
+  return static_cast<int>(::syscall(SYS_io_uring_register, fd, opcode, arg, nr_args));
+}
+
+class UringBackend final : public IoBackend {
+ public:
+  explicit UringBackend(unsigned queue_depth) : ring_(std::max(queue_depth, 2u)) {
+    int sparse[kFileSlots];
+    std::fill(std::begin(sparse), std::end(sparse), -1);
+    fixed_files_ =
+        sys_io_uring_register(ring_.fd(), IORING_REGISTER_FILES, sparse, kFileSlots) == 0;
+    std::fill(std::begin(slot_owner_), std::end(slot_owner_), 0);
+  }
+
+  const char* name() const override { return "uring"; }
+
+  bool register_buffers(const std::vector<iovec>& buffers) override {
+    if (buffers_registered_) {
+      sys_io_uring_register(ring_.fd(), IORING_UNREGISTER_BUFFERS, nullptr, 0);
+      buffers_registered_ = false;
+    }
+    if (buffers.empty()) return false;
+    buffers_registered_ =
+        sys_io_uring_register(ring_.fd(), IORING_REGISTER_BUFFERS, buffers.data(),
+                              static_cast<unsigned>(buffers.size())) == 0;
+    return buffers_registered_;
+  }
+
+  void submit(IoRequest* requests, std::size_t count) override {
+    if (count == 0) return;
+    install_files(requests, count);
+
+    // Requests still needing I/O, by index; short transfers are requeued.
+    std::deque<std::size_t> pending;
+    for (std::size_t i = 0; i < count; ++i) {
+      requests[i].result = 0;
+      pending.push_back(i);
+    }
+    unsigned in_flight = 0;
+    while (!pending.empty() || in_flight > 0) {
+      while (!pending.empty() && in_flight < ring_.entries()) {
+        prepare(requests[pending.front()], pending.front());
+        pending.pop_front();
+        ++in_flight;
+      }
+      ring_.submit_and_wait(1);
+      in_flight -= ring_.reap([&](const io_uring_cqe& cqe) {
+        std::size_t i = static_cast<std::size_t>(cqe.user_data);
+        IoRequest& req = requests[i];
+        if (cqe.res == -EAGAIN || cqe.res == -EINTR) {
+          pending.push_back(i);
+        } else if (cqe.res < 0) {
+          req.result = cqe.res;
+        } else if (cqe.res == 0) {
+          // EOF on read; a zero-length write would otherwise spin forever.
+          if (req.op == IoOp::kWrite) req.result = -EIO;
+        } else {
+          req.result += cqe.res;
+          if (static_cast<std::size_t>(req.result) < req.length) pending.push_back(i);
+        }
+      });
+    }
+  }
+
+  void release_files() override {
+    if (!fixed_files_) return;
+    int fds[kFileSlots];
+    bool any = false;
+    for (unsigned s = 0; s < kFileSlots; ++s) {
+      fds[s] = slot_owner_[s] ? -1 : IORING_REGISTER_FILES_SKIP;
+      any |= slot_owner_[s] != 0;
+      slot_owner_[s] = 0;
+    }
+    slot_of_.clear();
+    if (any) update_files(fds);
+  }
+
+ private:
+  // Points fixed-file slots at the files of this batch in one register call.
+  // Slots holding files outside the batch are cleared, so a ring never pins
+  // a finished file beyond the batch that last used it.
+  void install_files(const IoRequest* requests, std::size_t count) {
+    if (!fixed_files_) return;
+    std::unordered_map<std::uint64_t, int> wanted;
+    for (std::size_t i = 0; i < count; ++i) {
+      if (requests[i].file_id != 0) wanted.emplace(requests[i].file_id, requests[i].fd);
+    }
+    bool changed = false;
+    for (auto& [id, fd] : wanted) {
+      (void)fd;
+      if (!slot_of_.count(id)) changed = true;
+    }
+    for (auto& [id, slot] : slot_of_) {
+      (void)slot;
+      if (!wanted.count(id)) changed = true;
+    }
+    if (!changed) return;
+
+    int fds[kFileSlots];
+    std::fill(std::begin(fds), std::end(fds), IORING_REGISTER_FILES_SKIP);
+    for (auto it = slot_of_.begin(); it != slot_of_.end();) {
+      if (wanted.count(it->first)) {
+        ++it;
+        continue;
+      }
+      fds[it->second] = -1;
+      slot_owner_[it->second] = 0;
+      it = slot_of_.erase(it);
+    }
+    unsigned next_free = 0;
+    for (auto& [id, fd] : wanted) {
+      if (slot_of_.count(id)) continue;
+      while (next_free < kFileSlots && slot_owner_[next_free] != 0) ++next_free;
+      if (next_free == kFileSlots) break;  // remaining files use plain fds
+      fds[next_free] = fd;
+      slot_owner_[next_free] = id;
+      slot_of_[id] = static_cast<int>(next_free);
+    }
+    if (!update_files(fds)) {
+      fixed_files_ = false;
+      slot_of_.clear();
+    }
+  }
+
+  bool update_files(int* fds) {
+    io_uring_files_update update;
+    std::memset(&update, 0, sizeof(update));
+    update.offset = 0;
+    update.fds = reinterpret_cast<std::uintptr_t>(fds);
+    return sys_io_uring_register(ring_.fd(), IORING_REGISTER_FILES_UPDATE, &update,
+                                 kFileSlots) >= 0;
+  }
+
+  void prepare(const IoRequest& req, std::size_t index) {
+    io_uring_sqe* sqe = ring_.next_sqe();
+    const auto done = static_cast<std::size_t>(req.result);
+    const bool fixed_buf = buffers_registered_ && req.buf_index >= 0;
+    if (req.op == IoOp::kRead) {
+      sqe->opcode = fixed_buf ? IORING_OP_READ_FIXED : IORING_OP_READ;
+    } else {
+      sqe->opcode = fixed_buf ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+    }
+    auto slot = fixed_files_ && req.file_id ? slot_of_.find(req.file_id) : slot_of_.end();
+    if (slot != slot_of_.end()) {
+      sqe->fd = slot->second;
+      sqe->flags |= IOSQE_FIXED_FILE;
+    } else {
+      sqe->fd = req.fd;
+    }
+    sqe->addr = reinterpret_cast<std::uintptr_t>(static_cast<char*>(req.buf) + done);
+    sqe->len = static_cast<unsigned>(req.length - done);
+    sqe->off = req.offset + done;
+    if (fixed_buf) sqe->buf_index = static_cast<std::uint16_t>(req.buf_index);
+    sqe->user_data = index;
+  }
+
+  UringRing ring_;
+  bool buffers_registered_ = false;
+  bool fixed_files_ = false;
+  std::unordered_map<std::uint64_t, int> slot_of_;
+  std::uint64_t slot_owner_[kFileSlots];
+};
+
+}  // namespace
+
+UringRing::UringRing(unsigned entries) {
+  io_uring_params params;
+  std::memset(&params, 0, sizeof(params));
+  params.flags = IORING_SETUP_CLAMP;
+  int fd = sys_io_uring_setup(entries, &params);
+  if (fd < 0) throw_errno("io_uring_setup");
+  fd_.reset(fd);
+
+  sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  cq_ring_size_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+  single_mmap_ = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+  if (single_mmap_) sq_ring_size_ = cq_ring_size_ = std::max(sq_ring_size_, cq_ring_size_);
+
+  sq_ring_ = map(sq_ring_size_, IORING_OFF_SQ_RING);
+  cq_ring_ = single_mmap_ ? sq_ring_ : map(cq_ring_size_, IORING_OFF_CQ_RING);
+  sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+  sqes_ = static_cast<io_uring_sqe*>(map(sqes_size_, IORING_OFF_SQES));
+
+  auto* sq = static_cast<char*>(sq_ring_);
+  sq_head_ = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+  sq_tail_ = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+  sq_mask_ = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+  sq_array_ = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+  auto* cq = static_cast<char*>(cq_ring_);
+  cq_head_ = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+  cq_tail_ = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+  cq_mask_ = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+  cqes_ = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+  sq_entries_ = params.sq_entries;
+}
+
+UringRing::~UringRing() {
+  if (sqes_) ::munmap(sqes_, sqes_size_);
+  if (cq_ring_ && !single_mmap_) ::munmap(cq_ring_, cq_ring_size_);
+  if (sq_ring_) ::munmap(sq_ring_, sq_ring_size_);
+}
+
+io_uring_sqe* UringRing::next_sqe() {
+  unsigned tail = sq_local_tail_++;
+  io_uring_sqe* sqe = &sqes_[tail & sq_mask_];
+  std::memset(sqe, 0, sizeof(*sqe));
+  sq_array_[tail & sq_mask_] = tail & sq_mask_;
+  return sqe;
+}
+
+void UringRing::submit_and_wait(unsigned wait_for) {
+  unsigned to_submit = sq_local_tail_ - __atomic_load_n(sq_tail_, __ATOMIC_ACQUIRE);
+  __atomic_store_n(sq_tail_, sq_local_tail_, __ATOMIC_RELEASE);
+  unsigned pending = to_submit + unsubmitted_;
+  for (;;) {
+    int rc = sys_io_uring_enter(fd(), pending, wait_for, wait_for ? IORING_ENTER_GETEVENTS : 0);
+    if (rc >= 0) {
+      unsubmitted_ = pending - std::min<unsigned>(pending, static_cast<unsigned>(rc));
+      return;
+    }
+    if (errno == EINTR) continue;
+    // EAGAIN/EBUSY: the CQ ring is full; the caller reaps and retries.
+    if ((errno == EAGAIN || errno == EBUSY) && cq_ready() > 0) {
+      unsubmitted_ = pending;
+      return;
+    }
+    throw_errno("io_uring_enter");
+  }
+}
+
+void* UringRing::map(std::size_t size, off_t offset) {
+  void* p =
+      ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd(), offset);
+  if (p == MAP_FAILED) throw_errno("mmap io_uring");
+  return p;
+}
+
+std::unique_ptr<IoBackend> make_uring_backend(unsigned queue_depth) {
+  return std::make_unique<UringBackend>(queue_depth);
+}
+
+bool uring_available() {
+  static const bool available = [] {
+    io_uring_params params;
+    std::memset(&params, 0, sizeof(params));
+    int fd = sys_io_uring_setup(2, &params);
+    if (fd < 0) return false;
+    ::close(fd);
+    return true;
+  }();
+  return available;
+}
+
+}  // namespace dms
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <linux/io_uring.h>
+#include <sys/types.h>
+
+#include <cstddef>
+#include <memory>
+
+#include "dms/file.h"
+#include "dms/io_backend.h"
+
+namespace dms {
+
+// Creates an io_uring backend; throws std::system_error if the ring cannot
+// be set up.
+std::unique_ptr<IoBackend> make_uring_backend(unsigned queue_depth);
+
+// Minimal single-threaded view of an io_uring instance, driven directly
+// through the io_uring_setup/enter syscalls. Shared by the backend and the
+// reactor (see reactor.h).
+class UringRing {
+ public:
+  // Throws std::system_error if the ring cannot be set up.
+  explicit UringRing(unsigned entries);
+  ~UringRing();
+
+  UringRing(const UringRing&) = delete;
+  UringRing& operator=(const UringRing&) = delete;
+
+  int fd() const { return fd_.get(); }
+  unsigned entries() const { return sq_entries_; }
+
+  // Returns a zeroed SQE; the caller must not exceed entries() in flight.
+  io_uring_sqe* next_sqe();
+
+  // Publishes queued SQEs and waits for at least `wait_for` completions.
+  void submit_and_wait(unsigned wait_for);
+
+  unsigned cq_ready() const { return __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE) - *cq_head_; }
+
+  // Invokes fn(cqe) for every available completion and consumes them.
+  template <typename Fn>
+  unsigned reap(Fn&& fn) {
+    unsigned head = *cq_head_;
+    unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+    unsigned n = 0;
+    for (; head != tail; ++head, ++n) fn(cqes_[head & cq_mask_]);
+    __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+    return n;
+  }
+
+ private:
+  void* map(std::size_t size, off_t offset);
+
+  UniqueFd fd_;
+  bool single_mmap_ = false;
+  void* sq_ring_ = nullptr;
+  void* cq_ring_ = nullptr;
+  std::size_t sq_ring_size_ = 0;
+  std::size_t cq_ring_size_ = 0;
+  io_uring_sqe* sqes_ = nullptr;
+  std::size_t sqes_size_ = 0;
+  unsigned* sq_head_ = nullptr;
+  unsigned* sq_tail_ = nullptr;
+  unsigned* sq_array_ = nullptr;
+  unsigned sq_mask_ = 0;
+  unsigned* cq_head_ = nullptr;
+  unsigned* cq_tail_ = nullptr;
+  unsigned cq_mask_ = 0;
+  io_uring_cqe* cqes_ = nullptr;
+  unsigned sq_entries_ = 0;
+  unsigned sq_local_tail_ = 0;
+  unsigned unsubmitted_ = 0;
+};
+
+}  // namespace dms
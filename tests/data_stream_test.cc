@@ -0,0 +1,127 @@
+// Data streams: the frame header codec, and pushes to a loopback mover
+// that stripe files over several connections and land byte for byte.
+
+#include "dms/data_stream.h"
+
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <string>
+
+#include "dms/mover.h"
+#include "test.h"
+
+namespace {
+
+using dms::StreamFrame;
+using dms::StreamHeader;
+using dms::test::TempDir;
+
+std::string contents(const std::string& path) {
+  std::ifstream in(path, std::ios::binary);
+  return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+}
+
+// Bytes that do not repeat with any short period.
+std::string pattern(std::size_t size, std::uint64_t seed) {
+  std::string data(size, '\0');
+  for (char& c : data) {
+    seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+    c = static_cast<char>(seed >> 56);
+  }
+  return data;
+}
+
+void header_codec() {
+  StreamHeader header;
+  header.type = StreamFrame::kZData;
+  header.file_id = 0x01020304;
+  header.length = 0xa0b0c0d0;
+  header.offset = 0x1122334455667788;
+  header.codec = dms::Codec::kLz4;
+  char buf[dms::kStreamHeaderSize];
+  dms::encode_stream_header(header, buf);
+  StreamHeader decoded;
+  CHECK(dms::decode_stream_header(buf, decoded));
+  CHECK(decoded.type == header.type);
+  CHECK_EQ(decoded.file_id, header.file_id);
+  CHECK_EQ(decoded.length, header.length);
+  CHECK_EQ(decoded.offset, header.offset);
+  CHECK(decoded.codec == header.codec);
+
+  char bad[dms::kStreamHeaderSize];
+  std::copy(buf, buf + sizeof(buf), bad);
+  bad[0] = 'X';
+  CHECK(!dms::decode_stream_header(bad, decoded));
+  header.type = static_cast<StreamFrame>(0);
+  dms::encode_stream_header(header, bad);
+  CHECK(!dms::decode_stream_header(bad, decoded));
+  header.type = static_cast<StreamFrame>(static_cast<int>(StreamFrame::kSync) + 1);
+  dms::encode_stream_header(header, bad);
+  CHECK(!dms::decode_stream_header(bad, decoded));
+}
+
+void push_round_trip() {
+  TempDir dir;
+  std::filesystem::create_directories(dir / "src");
+  std::filesystem::create_directories(dir / "root");
+  const std::string big = pattern(3 * dms::MiB + 123, 1);
+  const std::string small = pattern(1000, 2);
+  std::ofstream(dir / "src/big", std::ios::binary) << big;
+  std::ofstream(dir / "src/small", std::ios::binary) << small;
+  std::ofstream(dir / "src/empty", std::ios::binary);
+
+  dms::MoverServer::Options mover_options;
+  mover_options.root = dir / "root";
+  dms::MoverServer mover(mover_options);
+  dms::PushOptions options;
+  options.chunk_size = 256 * dms::KiB;
+  options.streams = 3;
+  options.adaptive = false;
+  const dms::PushStats stats = dms::push_files(mover.address(),
+                                               {{dir / "src/big", "out/big"},
+                                                {dir / "src/small", "out/small"},
+                                                {dir / "src/empty", "out/empty"}},
+                                               options);
+  CHECK_EQ(stats.files, 3u);
+  CHECK_EQ(stats.failed_files, 0u);
+  CHECK_EQ(stats.bytes, big.size() + small.size());
+  CHECK_EQ(stats.final_streams, 3u);
+  CHECK(contents(dir / "root/out/big") == big);
+  CHECK(contents(dir / "root/out/small") == small);
+  CHECK(std::filesystem::exists(dir / "root/out/empty"));
+  CHECK_EQ(std::filesystem::file_size(dir / "root/out/empty"), 0u);
+  CHECK_EQ(mover.files(), 3u);
+  CHECK_EQ(mover.errors(), 0u);
+}
+
+void compressed_push() {
+  if (!dms::codec_available(dms::Codec::kLz4)) return;
+  TempDir dir;
+  std::filesystem::create_directories(dir / "root");
+  // Half compressible, half not.
+  const std::string data = std::string(dms::MiB, 'a') + pattern(dms::MiB, 3);
+  std::ofstream(dir / "src", std::ios::binary) << data;
+  dms::MoverServer::Options mover_options;
+  mover_options.root = dir / "root";
+  dms::MoverServer mover(mover_options);
+  dms::PushOptions options;
+  options.chunk_size = 256 * dms::KiB;
+  options.compression = dms::Codec::kLz4;
+  const dms::PushStats stats = dms::push_files(mover.address(), {{dir / "src", "f"}}, options);
+  CHECK_EQ(stats.failed_files, 0u);
+  CHECK(stats.compressed_chunks > 0);
+  CHECK(stats.raw_chunks > 0);
+  CHECK(stats.wire_bytes < data.size());
+  CHECK(contents(dir / "root/f") == data);
+}
+
+}  // namespace
+
+int main() {
+  return dms::test::run_tests({
+      {"header_codec", header_codec},
+      {"push_round_trip", push_round_trip},
+      {"compressed_push", compressed_push},
+  });
+}
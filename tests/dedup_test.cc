@@ -0,0 +1,206 @@
+// Deduplication: content-defined chunk boundaries, the chunk index, and
+// the kRef/kMiss path between a push and a loopback mover.
+
+#include "dms/dedup.h"
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "dms/data_stream.h"
+#include "dms/mover.h"
+#include "test.h"
+
+namespace {
+
+using dms::Chunker;
+using dms::test::TempDir;
+
+std::string contents(const std::string& path) {
+  std::ifstream in(path, std::ios::binary);
+  return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+}
+
+std::string pattern(std::size_t size, std::uint64_t seed) {
+  std::string data(size, '\0');
+  for (char& c : data) {
+    seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+    c = static_cast<char>(seed >> 56);
+  }
+  return data;
+}
+
+Chunker::Options small_chunks() {
+  Chunker::Options options;
+  options.min_size = 2 * dms::KiB;
+  options.avg_size = 8 * dms::KiB;
+  options.max_size = 32 * dms::KiB;
+  return options;
+}
+
+std::vector<std::size_t> chunk_ends(const Chunker& chunker, const std::string& data) {
+  std::vector<std::size_t> ends;
+  chunker.split(data.data(), data.size(), true, ends);
+  return ends;
+}
+
+void chunk_sizes() {
+  const Chunker chunker(small_chunks());
+  const std::string data = pattern(2 * dms::MiB, 1);
+  const std::vector<std::size_t> ends = chunk_ends(chunker, data);
+  CHECK(!ends.empty());
+  CHECK_EQ(ends.back(), data.size());
+  std::size_t start = 0;
+  for (std::size_t i = 0; i < ends.size(); ++i) {
+    const std::size_t size = ends[i] - start;
+    CHECK(size <= 32 * dms::KiB);
+    if (i + 1 < ends.size()) CHECK(size >= 2 * dms::KiB);
+    start = ends[i];
+  }
+  // Around avg_size on random data.
+  const double mean = static_cast<double>(data.size()) / static_cast<double>(ends.size());
+  CHECK(mean > 4 * dms::KiB && mean < 16 * dms::KiB);
+}
+
+void split_in_pieces() {
+  // Splitting as the data arrives finds the boundaries of one split.
+  const Chunker chunker(small_chunks());
+  const std::string data = pattern(dms::MiB, 2);
+  const std::vector<std::size_t> whole = chunk_ends(chunker, data);
+  std::vector<std::size_t> pieces;
+  std::size_t start = 0;
+  for (std::size_t arrived = 100 * dms::KiB;; arrived += 100 * dms::KiB) {
+    const bool last = arrived >= data.size();
+    arrived = std::min(arrived, data.size());
+    std::vector<std::size_t> ends;
+    const std::size_t end = chunker.split(data.data() + start, arrived - start, last, ends);
+    for (std::size_t e : ends) pieces.push_back(start + e);
+    start += end;
+    if (last) break;
+  }
+  CHECK(pieces == whole);
+}
+
+void boundaries_after_insert() {
+  const Chunker chunker(small_chunks());
+  const std::string data = pattern(dms::MiB, 3);
+  const std::size_t at = 300 * dms::KiB + 17;
+  const std::string edited = data.substr(0, at) + "inserted text" + data.substr(at);
+  const std::vector<std::size_t> before = chunk_ends(chunker, data);
+  const std::vector<std::size_t> after = chunk_ends(chunker, edited);
+  // Ends before the insertion stay; those a chunk past it come back shifted.
+  std::set<std::size_t> shifted;
+  for (std::size_t e : after) shifted.insert(e >= at ? e - 13 : e);
+  std::size_t moved = 0;
+  for (std::size_t e : before) {
+    if (e < at) {
+      CHECK(shifted.count(e) == 1);
+    } else if (e > at + 64 * dms::KiB) {
+      CHECK(shifted.count(e) == 1);
+    } else if (shifted.count(e) == 0) {
+      ++moved;
+    }
+  }
+  CHECK(moved <= 2);
+}
+
+void index_save_load() {
+  TempDir dir;
+  dms::ChunkIndex index;
+  index.insert({1, 2}, "a", 0, 100);
+  index.insert({3, 4}, "b/c", 4096, 200);
+  index.insert({1, 2}, "d", 8, 100);  // replaces
+  index.save(dir / "idx");
+  dms::ChunkIndex loaded;
+  loaded.load(dir / "idx");
+  loaded.load(dir / "missing");
+  CHECK_EQ(loaded.size(), 2u);
+  dms::ChunkIndex::Location at;
+  CHECK(loaded.find({1, 2}, at));
+  CHECK_EQ(at.path, "d");
+  CHECK_EQ(at.offset, 8u);
+  CHECK(loaded.find({3, 4}, at));
+  CHECK_EQ(at.path, "b/c");
+  CHECK_EQ(at.length, 200u);
+  CHECK(!loaded.find({5, 6}, at));
+}
+
+void ref_header_codec() {
+  dms::RefHeader ref;
+  ref.length = 0x01020304;
+  ref.source_offset = 0x1122334455667788;
+  ref.digest = {0xaaaabbbbccccdddd, 0x0123456789abcdef};
+  char buf[dms::kRefHeaderSize];
+  dms::encode_ref_header(ref, buf);
+  dms::RefHeader decoded;
+  dms::decode_ref_header(buf, decoded);
+  CHECK_EQ(decoded.length, ref.length);
+  CHECK_EQ(decoded.source_offset, ref.source_offset);
+  CHECK(decoded.digest == ref.digest);
+}
+
+// Pushes `src` to `dst` below the mover's root against `index`.
+dms::PushStats push(const dms::MoverServer& mover, const std::string& src, const std::string& dst,
+                    const std::shared_ptr<dms::ChunkIndex>& index) {
+  dms::PushOptions options;
+  options.chunk_size = 256 * dms::KiB;
+  options.streams = 2;
+  options.adaptive = false;
+  options.dedup_index = index;
+  options.dedup_chunking = small_chunks();
+  return dms::push_files(mover.address(), {{src, dst}}, options);
+}
+
+void refs_and_misses() {
+  TempDir dir;
+  std::filesystem::create_directories(dir / "root");
+  const std::string data = pattern(dms::MiB + 5000, 4);
+  std::ofstream(dir / "src", std::ios::binary) << data;
+  dms::MoverServer::Options mover_options;
+  mover_options.root = dir / "root";
+  dms::MoverServer mover(mover_options);
+  auto index = std::make_shared<dms::ChunkIndex>();
+
+  const dms::PushStats first = push(mover, dir / "src", "a", index);
+  CHECK_EQ(first.dedup_hits, 0u);
+  CHECK_EQ(index->size(), first.dedup_chunks);
+  CHECK(contents(dir / "root/a") == data);
+
+  // The same data again: every chunk is a reference the mover fills.
+  const dms::PushStats second = push(mover, dir / "src", "b", index);
+  CHECK_EQ(second.dedup_hits, second.dedup_chunks);
+  CHECK_EQ(second.dedup_misses, 0u);
+  CHECK_EQ(second.dedup_bytes, data.size());
+  CHECK(second.wire_bytes < data.size() / 10);
+  CHECK_EQ(mover.refs_copied(), second.dedup_hits);
+  CHECK(contents(dir / "root/b") == data);
+
+  // With the referenced copy gone, the mover answers kMiss and the chunks
+  // are sent again as data.
+  std::filesystem::remove(dir / "root/a");
+  const dms::PushStats third = push(mover, dir / "src", "c", index);
+  CHECK(third.dedup_hits > 0);
+  CHECK_EQ(third.dedup_misses, third.dedup_hits);
+  CHECK_EQ(mover.refs_missed(), third.dedup_misses);
+  CHECK_EQ(third.failed_files, 0u);
+  CHECK(contents(dir / "root/c") == data);
+  CHECK_EQ(mover.errors(), 0u);
+}
+
+}  // namespace
+
+int main() {
+  return dms::test::run_tests({
+      {"chunk_sizes", chunk_sizes},
+      {"split_in_pieces", split_in_pieces},
+      {"boundaries_after_insert", boundaries_after_insert},
+      {"index_save_load", index_save_load},
+      {"ref_header_codec", ref_header_codec},
+      {"refs_and_misses", refs_and_misses},
+  });
+}
@@ -0,0 +1,111 @@
+// Journal: records survive a reopen, and a torn or corrupt tail left by a
+// crash is cut off at the last good record.
+
+#include "dms/journal.h"
+
+#include <filesystem>
+#include <fstream>
+
+#include "test.h"
+
+namespace {
+
+using dms::Journal;
+using dms::test::TempDir;
+
+constexpr std::uint64_t kRecordSize = 32;
+
+std::uint64_t key(int n) { return Journal::file_key(std::to_string(n), 100, 7, 8, 0); }
+
+// Writes `records` chunks of one file at offsets 0, 8, 16, ...
+void write_records(const std::string& path, int records, Journal::Options options = {}) {
+  Journal journal(path, options);
+  for (int i = 0; i < records; ++i) journal.record(key(1), 8 * i, 8, 1000 + i);
+  journal.sync();
+}
+
+void round_trip() {
+  TempDir dir;
+  write_records(dir / "j", 3);
+  Journal journal(dir / "j");
+  CHECK_EQ(journal.loaded_records(), 3u);
+  CHECK(journal.has_file(key(1)));
+  CHECK(!journal.has_file(key(2)));
+  CHECK(journal.is_done(key(1), 16));
+  CHECK(!journal.is_done(key(1), 24));
+  CHECK_EQ(journal.digest(key(1), 8), 1001u);
+  CHECK_EQ(journal.digest(key(1), 24), 0u);
+  // A durable journal is zero-filled ahead; reopening trims it.
+  CHECK_EQ(std::filesystem::file_size(dir / "j"), 3 * kRecordSize);
+}
+
+void appends_after_reopen() {
+  TempDir dir;
+  write_records(dir / "j", 2, {std::chrono::milliseconds(1), 1, false});
+  {
+    Journal journal(dir / "j");
+    journal.record(key(2), 0, 8);
+  }
+  Journal journal(dir / "j");
+  CHECK_EQ(journal.loaded_records(), 3u);
+  CHECK(journal.is_done(key(1), 8));
+  CHECK(journal.is_done(key(2), 0));
+}
+
+void torn_tail() {
+  TempDir dir;
+  write_records(dir / "j", 3);
+  {
+    // Half a record, as a crash in the middle of a write leaves it.
+    std::ofstream out(dir / "j", std::ios::binary | std::ios::app);
+    out.write("\x01\x02\x03\x04\x05\x06\x07\x08\x09\x0a\x0b\x0c\x0d\x0e\x0f\x10", 16);
+  }
+  {
+    Journal journal(dir / "j");
+    CHECK_EQ(journal.loaded_records(), 3u);
+    CHECK_EQ(std::filesystem::file_size(dir / "j"), 3 * kRecordSize);
+    journal.record(key(1), 24, 8);
+  }
+  Journal journal(dir / "j");
+  CHECK_EQ(journal.loaded_records(), 4u);
+  CHECK(journal.is_done(key(1), 24));
+}
+
+void corrupt_record() {
+  TempDir dir;
+  write_records(dir / "j", 4);
+  {
+    // Flip a byte of the third record's offset.
+    std::fstream f(dir / "j", std::ios::binary | std::ios::in | std::ios::out);
+    f.seekp(2 * kRecordSize + 8);
+    f.put('\x55');
+  }
+  Journal journal(dir / "j");
+  CHECK_EQ(journal.loaded_records(), 2u);
+  CHECK(journal.is_done(key(1), 8));
+  CHECK(!journal.is_done(key(1), 16));
+  CHECK(!journal.is_done(key(1), 24));
+  CHECK_EQ(std::filesystem::file_size(dir / "j"), 2 * kRecordSize);
+}
+
+void key_covers_source() {
+  const std::uint64_t k = Journal::file_key("a", 100, 7, 8, 0);
+  CHECK_EQ(k, Journal::file_key("a", 100, 7, 8, 0));
+  CHECK(k != Journal::file_key("b", 100, 7, 8, 0));
+  CHECK(k != Journal::file_key("a", 101, 7, 8, 0));
+  CHECK(k != Journal::file_key("a", 100, 8, 8, 0));
+  CHECK(k != Journal::file_key("a", 100, 7, 16, 0));
+  CHECK(k != Journal::file_key("a", 100, 7, 8, 1));
+}
+
+}  // namespace
+
+int main() {
+  return dms::test::run_tests({
+      {"round_trip", round_trip},
+      {"appends_after_reopen", appends_after_reopen},
+      {"torn_tail", torn_tail},
+      {"corrupt_record", corrupt_record},
+      {"key_covers_source", key_covers_source},
+  });
+}
@@ -0,0 +1,177 @@
+// Manifest: entries round-trip through the block format, reading resumes
+// at a saved block offset, a manifest without a trailer reads up to its
+// last complete block, and a copy stopped while planning reports where to
+// resume.
+
+#include "dms/manifest.h"
+
+#include <sys/stat.h>
+
+#include <atomic>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "dms/copy_engine.h"
+#include "test.h"
+
+namespace {
+
+using dms::ManifestReader;
+using dms::ManifestWriter;
+using dms::ScanEntry;
+using dms::test::TempDir;
+
+bool same(const ScanEntry& a, const ScanEntry& b) {
+  return a.path == b.path && a.mode == b.mode && a.size == b.size && a.mtime_ns == b.mtime_ns;
+}
+
+// Ten entries with shared prefixes and mtimes that go back and forth,
+// including before 1970.
+std::vector<ScanEntry> sample_entries() {
+  std::vector<ScanEntry> entries;
+  const std::int64_t mtimes[] = {1700000000123456789, -5000000000, 1700000000000000000, 0,
+                                 42,                  -1,          1700000000999999999, 7,
+                                 1600000000000000000, 1};
+  for (int i = 0; i < 10; ++i) {
+    ScanEntry e;
+    e.path = i % 3 == 0 ? "dir" + std::to_string(i) : "dir/sub/file" + std::to_string(i);
+    e.mode = (i == 0 ? S_IFDIR | 0755 : S_IFREG | 0640);
+    e.size = static_cast<std::uint64_t>(i) << (i * 5);
+    e.mtime_ns = mtimes[i];
+    entries.push_back(e);
+  }
+  return entries;
+}
+
+// Writes the sample in blocks of 4 entries: 0-3, 4-7 and 8-9.
+void write_sample(const std::string& path) {
+  ManifestWriter writer(path, 4);
+  for (const ScanEntry& e : sample_entries()) writer.add(e);
+  writer.close();
+  CHECK_EQ(writer.entries(), 10u);
+  CHECK_EQ(writer.blocks(), 3u);
+}
+
+std::vector<ScanEntry> read_rest(ManifestReader& reader) {
+  std::vector<ScanEntry> entries;
+  for (ScanEntry e; reader.next(e);) entries.push_back(e);
+  return entries;
+}
+
+void round_trip() {
+  TempDir dir;
+  write_sample(dir / "m");
+  ManifestReader reader(dir / "m");
+  CHECK(reader.complete());
+  CHECK_EQ(reader.total_entries(), 10u);
+  CHECK_EQ(reader.blocks().size(), 3u);
+  CHECK_EQ(reader.blocks()[2].first_entry, 8u);
+  CHECK_EQ(reader.blocks()[2].entries, 2u);
+  const std::vector<ScanEntry> expected = sample_entries();
+  const std::vector<ScanEntry> read = read_rest(reader);
+  CHECK_EQ(read.size(), expected.size());
+  for (std::size_t i = 0; i < read.size() && i < expected.size(); ++i) {
+    CHECK(same(read[i], expected[i]));
+  }
+}
+
+void resume_offset() {
+  TempDir dir;
+  write_sample(dir / "m");
+  const std::vector<ScanEntry> expected = sample_entries();
+  std::vector<std::uint64_t> offsets;  // block_offset() after each entry
+  std::uint64_t end = 0;
+  {
+    ManifestReader reader(dir / "m");
+    CHECK_EQ(reader.block_offset(), reader.blocks()[0].offset);
+    for (ScanEntry e; reader.next(e);) offsets.push_back(reader.block_offset());
+    end = reader.block_offset();
+    CHECK_EQ(offsets[4], reader.blocks()[1].offset);
+    CHECK_EQ(offsets[7], reader.blocks()[2].offset);
+  }
+  // Mid-block, the block is read again from its start.
+  {
+    ManifestReader reader(dir / "m");
+    reader.seek_offset(offsets[4]);
+    const std::vector<ScanEntry> rest = read_rest(reader);
+    CHECK_EQ(rest.size(), 6u);
+    if (!rest.empty()) CHECK(same(rest.front(), expected[4]));
+  }
+  // After a block's last entry, reading goes on with the next block.
+  {
+    ManifestReader reader(dir / "m");
+    reader.seek_offset(offsets[7]);
+    const std::vector<ScanEntry> rest = read_rest(reader);
+    CHECK_EQ(rest.size(), 2u);
+    if (rest.size() == 2) CHECK(same(rest[1], expected[9]));
+  }
+  {
+    ManifestReader reader(dir / "m");
+    reader.seek_block(1);
+    CHECK_EQ(read_rest(reader).size(), 6u);
+    reader.seek_offset(end);
+    CHECK(read_rest(reader).empty());
+  }
+}
+
+void without_trailer() {
+  TempDir dir;
+  write_sample(dir / "m");
+  std::uint64_t cut = 0;
+  {
+    ManifestReader reader(dir / "m");
+    // In the middle of the last block: its entries are lost.
+    cut = reader.blocks()[2].offset + 5;
+  }
+  std::filesystem::resize_file(dir / "m", cut);
+  ManifestReader reader(dir / "m");
+  CHECK(!reader.complete());
+  const std::vector<ScanEntry> read = read_rest(reader);
+  CHECK_EQ(read.size(), 8u);
+  if (read.size() == 8) CHECK(same(read[7], sample_entries()[7]));
+}
+
+void copy_stopped_while_planning() {
+  TempDir dir;
+  std::filesystem::create_directory(dir / "src");
+  {
+    ManifestWriter writer(dir / "m", 2);
+    for (int i = 0; i < 5; ++i) {
+      const std::string name = std::string("f").append(std::to_string(i));
+      std::ofstream(dir / ("src/" + name)) << name;
+      struct stat st;
+      CHECK_EQ(::stat((dir / ("src/" + name)).c_str(), &st), 0);
+      writer.add({name, st.st_mode, static_cast<std::uint64_t>(st.st_size),
+                  st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec});
+    }
+    writer.close();
+  }
+  std::atomic<bool> stop{true};
+  dms::CopyOptions options;
+  options.threads = 1;
+  options.stop_planning = &stop;
+  dms::JobStats stopped = dms::CopyEngine(options).copy_manifest(dir / "m", dir / "src",
+                                                                 dir / "dst");
+  CHECK_EQ(stopped.files, 0u);
+  CHECK_EQ(stopped.manifest_offset, ManifestReader(dir / "m").blocks()[0].offset);
+
+  stop = false;
+  dms::JobStats resumed = dms::CopyEngine(options).copy_manifest(
+      dir / "m", dir / "src", dir / "dst", stopped.manifest_offset);
+  CHECK_EQ(resumed.files, 5u);
+  CHECK_EQ(resumed.failed_files, 0u);
+  CHECK_EQ(std::filesystem::file_size(dir / "dst/f4"), 2u);
+}
+
+}  // namespace
+
+int main() {
+  return dms::test::run_tests({
+      {"round_trip", round_trip},
+      {"resume_offset", resume_offset},
+      {"without_trailer", without_trailer},
+      {"copy_stopped_while_planning", copy_stopped_while_planning},
+  });
+}
@@ -0,0 +1,129 @@
+// MpmcQueue: order and capacity, close() with items left and with threads
+// blocked on either side, and many producers and consumers at once.
+
+#include "dms/mpmc_queue.h"
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <numeric>
+#include <thread>
+#include <vector>
+
+#include "test.h"
+
+namespace {
+
+using dms::MpmcQueue;
+
+void order_and_capacity() {
+  MpmcQueue<int> queue(5);
+  CHECK_EQ(queue.capacity(), 8u);
+  int pushed = 0;
+  while (queue.try_push(int(pushed))) ++pushed;
+  CHECK_EQ(pushed, 8);
+  CHECK_EQ(queue.size_approx(), 8u);
+  CHECK(!queue.try_push(99));
+  for (int i = 0; i < 3; ++i) CHECK_EQ(queue.try_pop().value_or(-1), i);
+  int batch[3] = {100, 101, 102};
+  CHECK_EQ(queue.try_push_batch(batch, 3), 3u);
+  int out[16];
+  CHECK_EQ(queue.try_pop_batch(out, 16), 8u);
+  for (int i = 0; i < 5; ++i) CHECK_EQ(out[i], i + 3);
+  CHECK_EQ(out[5], 100);
+  CHECK_EQ(out[7], 102);
+  CHECK(!queue.try_pop());
+}
+
+void close_drains() {
+  MpmcQueue<int> queue(8);
+  for (int i = 0; i < 5; ++i) CHECK(queue.push(i));
+  queue.close();
+  CHECK(!queue.push(5));
+  CHECK_EQ(queue.pop().value_or(-1), 0);
+  int out[8];
+  CHECK_EQ(queue.pop_batch(out, 8), 4u);
+  CHECK_EQ(out[3], 4);
+  CHECK(!queue.pop());
+  CHECK_EQ(queue.pop_batch(out, 8), 0u);
+}
+
+void close_wakes_waiters() {
+  MpmcQueue<int> empty(4);
+  MpmcQueue<int> full(4);
+  for (int i = 0; i < 4; ++i) full.push(i);
+  std::atomic<int> done{0};
+  std::thread consumer([&] {
+    CHECK(!empty.pop());
+    done.fetch_add(1);
+  });
+  std::thread producer([&] {
+    int items[2] = {7, 8};
+    CHECK_EQ(full.push_batch(items, 2), 0u);
+    done.fetch_add(1);
+  });
+  // Long enough for both to be asleep on the futex.
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  CHECK_EQ(done.load(), 0);
+  empty.close();
+  full.close();
+  consumer.join();
+  producer.join();
+  CHECK_EQ(done.load(), 2);
+  // The items queued before close() are still there.
+  CHECK_EQ(full.size_approx(), 4u);
+}
+
+void destroys_items_left() {
+  auto item = std::make_shared<int>(1);
+  {
+    MpmcQueue<std::shared_ptr<int>> queue(4);
+    queue.push(item);
+    queue.push(item);
+    queue.try_pop();
+    CHECK_EQ(item.use_count(), 2);
+  }
+  CHECK_EQ(item.use_count(), 1);
+}
+
+void many_threads() {
+  constexpr int kThreads = 4;
+  constexpr int kItems = 100000;
+  MpmcQueue<int> queue(64);
+  std::vector<std::thread> threads;
+  std::vector<long long> sums(kThreads, 0);
+  std::vector<int> counts(kThreads, 0);
+  for (int t = 0; t < kThreads; ++t) {
+    threads.emplace_back([&, t] {
+      int batch[16];
+      for (std::size_t n; (n = queue.pop_batch(batch, 16)) != 0;) {
+        for (std::size_t i = 0; i < n; ++i) sums[t] += batch[i];
+        counts[t] += static_cast<int>(n);
+      }
+    });
+  }
+  std::vector<std::thread> producers;
+  for (int t = 0; t < kThreads; ++t) {
+    producers.emplace_back([&, t] {
+      for (int i = 0; i < kItems; ++i) queue.push(t * kItems + i);
+    });
+  }
+  for (auto& p : producers) p.join();
+  queue.close();
+  for (auto& c : threads) c.join();
+  const long long n = static_cast<long long>(kThreads) * kItems;
+  CHECK_EQ(std::accumulate(counts.begin(), counts.end(), 0LL), n);
+  CHECK_EQ(std::accumulate(sums.begin(), sums.end(), 0LL), n * (n - 1) / 2);
+}
+
+}  // namespace
+
+int main() {
+  return dms::test::run_tests({
+      {"order_and_capacity", order_and_capacity},
+      {"close_drains", close_drains},
+      {"close_wakes_waiters", close_wakes_waiters},
+      {"destroys_items_left", destroys_items_left},
+      {"many_threads", many_threads},
+  });
+}
@@ -0,0 +1,151 @@
+// Packed units: contents, modes and mtimes survive pack and unpack, also
+// for pre-1970 mtimes and over existing files, and malformed units are
+// rejected.
+
+#include "dms/pack.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+
+#include "dms/file.h"
+#include "test.h"
+
+namespace {
+
+using dms::PackWriter;
+using dms::test::TempDir;
+
+std::string contents(const std::string& path) {
+  std::ifstream in(path, std::ios::binary);
+  return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+}
+
+void make_file(const std::string& path, const std::string& data, mode_t mode,
+               std::int64_t mtime_ns) {
+  std::ofstream(path, std::ios::binary) << data;
+  ::chmod(path.c_str(), mode);
+  struct timespec times[2];
+  times[0].tv_nsec = UTIME_OMIT;
+  times[1] = dms::to_timespec(mtime_ns);
+  ::utimensat(AT_FDCWD, path.c_str(), times, 0);
+}
+
+struct File {
+  const char* path;
+  std::string data;
+  mode_t mode;
+  std::int64_t mtime_ns;
+};
+
+const File kFiles[] = {
+    {"a", "first file", 0644, 1700000000123456789},
+    {"sub/dir/b", std::string(5000, 'x'), 0755, 1600000000000000001},
+    {"sub/empty", "", 0600, 0},
+    // Before 1970, and not on a second boundary.
+    {"sub/old", "old", 0444, -1500000000},
+};
+
+std::int64_t mtime_of(const struct stat& st) {
+  return static_cast<std::int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+}
+
+// Packs kFiles, whose sources are src/0, src/1, ...
+std::string pack_sample(const TempDir& dir, PackWriter& writer) {
+  std::filesystem::create_directory(dir / "src");
+  for (std::size_t i = 0; i < std::size(kFiles); ++i) {
+    const std::string src = dir / ("src/" + std::to_string(i));
+    make_file(src, kFiles[i].data, kFiles[i].mode, kFiles[i].mtime_ns);
+    writer.add_file(src, kFiles[i].path);
+  }
+  return std::string(writer.finish());
+}
+
+void round_trip() {
+  TempDir dir;
+  PackWriter writer;
+  const std::string unit = pack_sample(dir, writer);
+  CHECK_EQ(writer.entries(), 4u);
+  CHECK_EQ(writer.entry(3).mtime_ns, -1500000000);
+  CHECK_EQ(writer.entry(1).mode & 07777, 0755u);
+
+  const std::vector<dms::PackEntry> index = dms::read_pack_index(unit);
+  CHECK_EQ(index.size(), 4u);
+  std::uint64_t data = 0;
+  for (std::size_t i = 0; i < index.size() && i < std::size(kFiles); ++i) {
+    CHECK_EQ(index[i].path, kFiles[i].path);
+    CHECK_EQ(index[i].offset, data);
+    CHECK_EQ(index[i].size, kFiles[i].data.size());
+    data += index[i].size;
+  }
+
+  const dms::UnpackResult result = dms::unpack(unit, dir / "dst");
+  CHECK_EQ(result.files, 4u);
+  CHECK_EQ(result.bytes, data);
+  CHECK(result.failures.empty());
+  for (const File& f : kFiles) {
+    const std::string path = dir / ("dst/" + std::string(f.path));
+    CHECK_EQ(contents(path), f.data);
+    struct stat st;
+    CHECK_EQ(::stat(path.c_str(), &st), 0);
+    CHECK_EQ(st.st_mode & 07777, f.mode);
+    CHECK_EQ(mtime_of(st), f.mtime_ns);
+  }
+}
+
+void over_existing_files() {
+  TempDir dir;
+  PackWriter writer;
+  const std::string unit = pack_sample(dir, writer);
+  // Longer, with other modes, and created under a restrictive umask.
+  std::filesystem::create_directories(dir / "dst/sub/dir");
+  for (const File& f : kFiles) {
+    make_file(dir / ("dst/" + std::string(f.path)), std::string(8000, 'y'), 0600, 0);
+  }
+  const mode_t umask = ::umask(077);
+  const dms::UnpackResult result = dms::unpack(unit, dir / "dst");
+  ::umask(umask);
+  CHECK(result.failures.empty());
+  for (const File& f : kFiles) {
+    const std::string path = dir / ("dst/" + std::string(f.path));
+    CHECK_EQ(contents(path), f.data);
+    struct stat st;
+    CHECK_EQ(::stat(path.c_str(), &st), 0);
+    CHECK_EQ(st.st_mode & 07777, f.mode);
+  }
+}
+
+void malformed_units() {
+  TempDir dir;
+  PackWriter writer;
+  const std::string unit = pack_sample(dir, writer);
+  auto rejected = [](const std::string& bad) {
+    try {
+      dms::read_pack_index(bad);
+    } catch (const std::runtime_error&) {
+      return true;
+    }
+    return false;
+  };
+  CHECK(rejected(unit.substr(0, 16)));
+  CHECK(rejected(unit.substr(0, unit.size() - 1)));
+  std::string bad_magic = unit;
+  bad_magic[0] = 'X';
+  CHECK(rejected(bad_magic));
+  CHECK(!rejected(unit));
+}
+
+}  // namespace
+
+int main() {
+  return dms::test::run_tests({
+      {"round_trip", round_trip},
+      {"over_existing_files", over_existing_files},
+      {"malformed_units", malformed_units},
+  });
+}
@@ -0,0 +1,131 @@
+// Scheduler: a freed slot goes to the highest waiting class, and within a
+// class jobs get slots in proportion to their weights, without credit for
+// time spent idle.
+
+#include "dms/scheduler.h"
+
+#include <deque>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+#include "test.h"
+
+namespace {
+
+using dms::Priority;
+using dms::Scheduler;
+using dms::SchedulerJob;
+
+// Queues requests whose grants are recorded in order, so that a test can
+// release the slot of the job granted last and see who comes next.
+class GrantLog {
+ public:
+  void request(SchedulerJob& job, std::uint64_t bytes) {
+    requests_.emplace_back([this, &job] { granted_.push_back(&job); });
+    job.request(requests_.back(), bytes);
+  }
+
+  // Releases the slot of the latest grant; returns the job granted next.
+  SchedulerJob* release_last() {
+    const std::size_t before = granted_.size();
+    granted_.back()->release();
+    return granted_.size() > before ? granted_.back() : nullptr;
+  }
+
+  const std::vector<SchedulerJob*>& granted() const { return granted_; }
+
+ private:
+  std::deque<SchedulerJob::Request> requests_;
+  std::vector<SchedulerJob*> granted_;
+};
+
+void priority_order() {
+  Scheduler scheduler({1, 0});
+  auto holder = scheduler.add_job(Priority::kBulk);
+  auto bulk = scheduler.add_job(Priority::kBulk);
+  auto normal = scheduler.add_job(Priority::kNormal);
+  auto urgent = scheduler.add_job(Priority::kUrgent);
+  GrantLog log;
+  log.request(*holder, 1);
+  CHECK_EQ(log.granted().size(), 1u);
+  // Queued lowest class first; granted highest first.
+  log.request(*bulk, 1);
+  log.request(*normal, 1);
+  log.request(*urgent, 1);
+  CHECK_EQ(log.granted().size(), 1u);
+  CHECK(log.release_last() == urgent.get());
+  CHECK(log.release_last() == normal.get());
+  CHECK(log.release_last() == bulk.get());
+  CHECK(log.release_last() == nullptr);
+  const dms::SchedulerStats stats = scheduler.stats();
+  CHECK_EQ(stats.grants, 4u);
+  CHECK_EQ(stats.queued_grants, 3u);
+  // Only the bulk holder's slot went to a higher class.
+  CHECK_EQ(stats.preemptions, 1u);
+  CHECK_EQ(stats.peak_waiting_jobs, 3u);
+}
+
+void weighted_fair_queuing() {
+  Scheduler scheduler({1, 0});
+  auto holder = scheduler.add_job(Priority::kUrgent);
+  auto light = scheduler.add_job(Priority::kNormal, 1);
+  auto heavy = scheduler.add_job(Priority::kNormal, 3);
+  GrantLog log;
+  log.request(*holder, 1);
+  for (int i = 0; i < 40; ++i) {
+    log.request(*light, 1 << 20);
+    log.request(*heavy, 1 << 20);
+  }
+  int heavy_grants = 0;
+  for (int i = 0; i < 20; ++i) heavy_grants += log.release_last() == heavy.get();
+  CHECK(heavy_grants >= 14 && heavy_grants <= 16);
+
+  // A job that was idle joins at the class's virtual time: it gets its
+  // share from now on, not a burst for the time it missed.
+  auto late = scheduler.add_job(Priority::kNormal, 1);
+  for (int i = 0; i < 10; ++i) log.request(*late, 1 << 20);
+  int late_grants = 0;
+  for (int i = 0; i < 10; ++i) late_grants += log.release_last() == late.get();
+  CHECK(late_grants >= 1 && late_grants <= 3);
+  while (log.release_last()) {
+  }
+  CHECK_EQ(log.granted().size(), 1u + 80u + 10u);
+}
+
+void blocking_acquire() {
+  Scheduler scheduler({2, 0});
+  auto job = scheduler.add_job(Priority::kNormal);
+  job->acquire(100);
+  job->acquire(100);
+  job->release();
+  job->acquire(100);
+  job->release();
+  job->release();
+  CHECK_EQ(scheduler.stats().grants, 3u);
+  CHECK_EQ(scheduler.stats().queued_grants, 0u);
+}
+
+void priority_names() {
+  for (Priority p : {Priority::kUrgent, Priority::kNormal, Priority::kBulk}) {
+    CHECK(dms::parse_priority(dms::to_string(p)) == p);
+  }
+  bool threw = false;
+  try {
+    dms::parse_priority("high");
+  } catch (const std::invalid_argument&) {
+    threw = true;
+  }
+  CHECK(threw);
+}
+
+}  // namespace
+
+int main() {
+  return dms::test::run_tests({
+      {"priority_order", priority_order},
+      {"weighted_fair_queuing", weighted_fair_queuing},
+      {"blocking_acquire", blocking_acquire},
+      {"priority_names", priority_names},
+  });
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+// A minimal harness for the tests under tests/. Each test is an executable
+// whose main() passes its cases to run_tests(); CHECK() records a failure
+// and lets the case go on, an exception fails the rest of the case.
+
+#include <stdlib.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <exception>
+#include <filesystem>
+#include <string>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+namespace dms::test {
+
+inline int& failures() {
+  static int count = 0;
+  return count;
+}
+
+inline void fail(const char* file, int line, const char* what) {
+  std::fprintf(stderr, "%s:%d: check failed: %s\n", file, line, what);
+  ++failures();
+}
+
+// A fresh directory under /tmp, removed with everything in it.
+class TempDir {
+ public:
+  TempDir() {
+    char tmpl[] = "/tmp/dms-test-XXXXXX";
+    if (!::mkdtemp(tmpl)) throw std::system_error(errno, std::generic_category(), "mkdtemp");
+    path_ = tmpl;
+  }
+  ~TempDir() {
+    std::error_code ec;
+    std::filesystem::remove_all(path_, ec);
+  }
+
+  TempDir(const TempDir&) = delete;
+  TempDir& operator=(const TempDir&) = delete;
+
+  const std::string& path() const { return path_; }
+  std::string operator/(const std::string& name) const { return path_ + "/" + name; }
+
+ private:
+  std::string path_;
+};
+
+using Case = std::pair<const char*, void (*)()>;
+
+// Runs every case and returns the process exit status.
+inline int run_tests(const std::vector<Case>& cases) {
+  for (const auto& [name, body] : cases) {
+    const int before = failures();
+    try {
+      body();
+    } catch (const std::exception& e) {
+      std::fprintf(stderr, "%s: unexpected exception: %s\n", name, e.what());
+      ++failures();
+    }
+    std::printf("%s %s\n", failures() == before ? "ok  " : "FAIL", name);
+  }
+  return failures() == 0 ? 0 : 1;
+}
+
+}  // namespace dms::test
+
+#define CHECK(cond)                                                \
+  do {                                                             \
+    if (!(cond)) ::dms::test::fail(__FILE__, __LINE__, #cond);     \
+  } while (0)
+
+#define CHECK_EQ(a, b) CHECK((a) == (b))
@@ -0,0 +1,951 @@
+// dms-client: command-line front end for the DMS-Client transfer engine.
+
+#include <signal.h>
+#include <sys/stat.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <fstream>
+#include <future>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "dms/checksum.h"
+#include "dms/copy_engine.h"
+#include "dms/data_stream.h"
+#include "dms/dedup.h"
+#include "dms/error.h"
+#include "dms/job_client.h"
+#include "dms/manifest.h"
+#include "dms/mock_server.h"
+#include "dms/mover.h"
+#include "dms/rate_limit.h"
+#include "dms/scanner.h"
+#include "dms/scheduler.h"
+#include "dms/units.h"
+
+namespace {
+
+void usage(const char* argv0) {
+  std::fprintf(stderr,
+               "usage: %s copy [options] SRC DST\n"
+               "       %s copy --jobs LIST [options]\n"
+               "       %s sync [options] SRC DST   (copy --sync)\n"
+               "       %s scan [--threads N] [--adaptive] [--manifest FILE] ROOT\n"
+               "       %s checksum [--checksum KIND] [--chunk-size SIZE] [--threads N] FILE...\n"
+               "       %s checksum --check LIST [--checksum KIND] [--chunk-size SIZE]\n"
+               "       %s submit --server HOST:PORT [--batch N] [--window N] LIST\n"
+               "       %s mock-server [--listen HOST:PORT] [--latency-us N]\n"
+               "       %s push --mover HOST:PORT [push options] SRC DST\n"
+               "       %s mover [--listen HOST:PORT] [--root DIR] [--stream-rate SIZE]\n"
+               "\n"
+               "copy options:\n"
+               "  --chunk-size SIZE   chunk size (default 8M)\n"
+               "  --threads N         I/O worker threads (default: one per CPU)\n"
+               "  --adaptive          run as many workers and walker threads, up to\n"
+               "                      --threads, as keep raising throughput without\n"
+               "                      raising I/O latency\n"
+               "  --queue-depth N     chunks queued ahead of the workers\n"
+               "  --io-backend NAME   auto, uring or psync (default auto)\n"
+               "  --io-batch N        chunks per batched submission (default 4)\n"
+               "  --numa POLICY       none, local (pin workers to nodes, buffers on the\n"
+               "                      worker's node) or interleave (default none)\n"
+               "  --no-huge-pages     back chunk buffers with normal pages only\n"
+               "  --direct            use O_DIRECT for large files\n"
+               "  --no-sparse         copy holes as zeros instead of keeping them\n"
+               "  --offload MODE      auto (reflink, else copy_file_range), reflink,\n"
+               "                      copy-range or none (default auto); files fall back\n"
+               "                      to reads and writes where it is refused\n"
+               "  --paths-out FILE    write 'PATH  DST' lines telling how every copied\n"
+               "                      file was moved: reflink, copy-range, read-write\n"
+               "                      or packed\n"
+               "  --direct-min-size SIZE\n"
+               "                      smallest file copied with O_DIRECT (default 64M)\n"
+               "  --small-file-max SIZE\n"
+               "                      pack files up to this size (default 64K, 0 = off)\n"
+               "  --pack-size SIZE    target size of a packed unit (default 4M)\n"
+               "  --coroutines        copy small files as one coroutine each on reactor\n"
+               "                      threads driving io_uring, instead of in packs\n"
+               "  --reactor-threads N reactor threads for --coroutines (default 2)\n"
+               "  --max-in-flight N   small files started and unfinished at once\n"
+               "                      (default 1048576)\n"
+               "  --scan-threads N    directory-walker threads (default: --threads)\n"
+               "  --metadata-threads N\n"
+               "                      threads setting mode, times, owner and xattrs\n"
+               "                      (default: --threads)\n"
+               "  --metadata-batch N  entries of one directory set per batch (default 256)\n"
+               "  --preserve-owner    also copy the owner and group\n"
+               "  --xattrs            also copy extended attributes\n"
+               "  --manifest FILE     copy the entries of a manifest written by 'scan'\n"
+               "                      instead of walking SRC\n"
+               "  --resume-offset N   start planning at this manifest block offset, as\n"
+               "                      printed on the 'manifest:' line of an earlier run\n"
+               "  --journal FILE      log completed chunks to FILE and skip the chunks\n"
+               "                      an earlier run logged there\n"
+               "  --journal-sync-data fdatasync destinations before journaling chunks\n"
+               "  --checksum KIND     none, crc32c or xxh3, computed inline (default none)\n"
+               "  --checksum-out FILE write 'DIGEST  DST' lines for every copied file\n"
+               "                      (verify with 'checksum --check FILE')\n"
+               "  --sync              skip files whose destination has the same size and\n"
+               "                      mtime; compare the chunks of other existing files\n"
+               "                      and write only the ones that differ\n"
+               "  --jobs LIST         run the jobs of LIST (one 'PRIORITY<TAB>WEIGHT<TAB>\n"
+               "                      SRC<TAB>DST' per line) at once instead of SRC DST;\n"
+               "                      PRIORITY is urgent, normal or bulk\n"
+               "  --slots N           batches of chunks moved at once across the jobs,\n"
+               "                      granted by priority, then by weight (default: one\n"
+               "                      per CPU)\n"
+               "  --total-rate SIZE   limit all the jobs together to SIZE bytes/s, shared\n"
+               "                      the same way\n"
+               "\n"
+               "rate limits (copy and push):\n"
+               "  --max-rate SIZE     limit the job to SIZE bytes/s\n"
+               "  --max-ops N         limit the job to N metadata ops/s (copy only)\n"
+               "  --tenant NAME       tenant the job is accounted to (default 'default')\n"
+               "  --job NAME          name of the job in the limits file (default 'default')\n"
+               "  --limits FILE       'global BYTES OPS', 'tenant NAME BYTES OPS' and\n"
+               "                      'job NAME BYTES OPS' lines, 0 for unlimited; re-read\n"
+               "                      whenever FILE changes, so limits can be adjusted while\n"
+               "                      the job runs\n"
+               "  --burst-ms N        let each limit run up to N ms of its rate ahead after\n"
+               "                      an idle spell (default 100); a job of T ms overshoots\n"
+               "                      its limits by at most N/T\n"
+               "\n"
+               "submit sends the jobs of LIST (one 'SRC<TAB>DST' per line, '-' for stdin)\n"
+               "to a DMS server, pipelining batches of up to --batch jobs (default 4096)\n"
+               "with at most --window unanswered batches (default 64).\n"
+               "\n"
+               "push streams SRC (a file or a tree) to a data mover, which stores it as\n"
+               "DST below its root. --send-method is auto, zerocopy, sendfile, splice or\n"
+               "copy (default auto, which is sendfile); unusable methods fall back in\n"
+               "that order. The data is striped over --streams connections (default 1);\n"
+               "unless --fixed-streams is given, the count then adapts to the measured\n"
+               "throughput and RTT, up to --max-streams (default 16). --compress lz4|zstd|auto\n"
+               "compresses chunks on --compress-threads threads (default: one per CPU) at\n"
+               "--compress-level, sending chunks that do not compress as they are.\n"
+               "--dedup-index FILE keeps the fingerprints of the chunks sent to this mover\n"
+               "in FILE and sends chunks found there as references to the copy the mover\n"
+               "already holds; --dedup-chunk SIZE is the average content-defined chunk\n"
+               "(default 64K). Chunks read for either take buffers backed by huge pages\n"
+               "unless --no-huge-pages is given. mover without --root discards what it\n"
+               "receives; --stream-rate caps each connection at SIZE/s.\n",
+               argv0, argv0, argv0, argv0, argv0, argv0, argv0, argv0, argv0, argv0);
+}
+
+// Returns the value following option argv[i], advancing i.
+const char* option_value(int argc, char** argv, int& i) {
+  if (i + 1 >= argc) {
+    std::fprintf(stderr, "missing value for %s\n", argv[i]);
+    std::exit(2);
+  }
+  return argv[++i];
+}
+
+// Blocks SIGINT and SIGTERM for the calling thread and the threads it
+// starts afterwards, so that wait_for_signal() is their only receiver.
+sigset_t block_stop_signals() {
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGINT);
+  sigaddset(&signals, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+  return signals;
+}
+
+// Returns the signal received.
+int wait_for_signal(const sigset_t& signals) {
+  int sig;
+  sigwait(&signals, &sig);
+  return sig;
+}
+
+// The rate-limit options of copy and push. A limits file is applied when
+// the job starts and again each time its modification time changes.
+class ThrottleArgs {
+ public:
+  ThrottleArgs() = default;
+  ThrottleArgs(const ThrottleArgs&) = delete;
+  ThrottleArgs& operator=(const ThrottleArgs&) = delete;
+
+  ~ThrottleArgs() {
+    {
+      std::lock_guard<std::mutex> lock(mu_);
+      stop_ = true;
+    }
+    cv_.notify_all();
+    if (watcher_.joinable()) watcher_.join();
+  }
+
+  // Consumes argv[i], and its value, if it is a rate-limit option.
+  bool parse(int argc, char** argv, int& i) {
+    if (std::strcmp(argv[i], "--max-rate") == 0) {
+      limits_.bytes_per_sec = dms::parse_size(option_value(argc, argv, i));
+    } else if (std::strcmp(argv[i], "--max-ops") == 0) {
+      limits_.ops_per_sec = std::stoull(option_value(argc, argv, i));
+    } else if (std::strcmp(argv[i], "--tenant") == 0) {
+      tenant_ = option_value(argc, argv, i);
+    } else if (std::strcmp(argv[i], "--job") == 0) {
+      job_ = option_value(argc, argv, i);
+    } else if (std::strcmp(argv[i], "--limits") == 0) {
+      file_ = option_value(argc, argv, i);
+    } else if (std::strcmp(argv[i], "--burst-ms") == 0) {
+      burst_ = std::chrono::milliseconds(std::stoull(option_value(argc, argv, i)));
+    } else {
+      return false;
+    }
+    configured_ = true;
+    return true;
+  }
+
+  // The job's throttle, or null when no option was given. Throws if the
+  // limits file cannot be read or parsed.
+  std::shared_ptr<dms::Throttle> start() {
+    if (!configured_) return nullptr;
+    limiter_ = std::make_unique<dms::RateLimiter>(burst_);
+    auto throttle = limiter_->make_throttle(tenant_, limits_, job_);
+    if (!file_.empty()) {
+      modified_ = modified();
+      limiter_->apply(read_file());
+      watcher_ = std::thread([this] { watch(); });
+    }
+    return throttle;
+  }
+
+ private:
+  std::string read_file() const {
+    std::ifstream in(file_);
+    if (!in) throw std::runtime_error("cannot read " + file_);
+    return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+  }
+
+  std::int64_t modified() const {
+    struct stat st;
+    if (::stat(file_.c_str(), &st) != 0) return -1;
+    return static_cast<std::int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+  }
+
+  void watch() {
+    std::unique_lock<std::mutex> lock(mu_);
+    while (!cv_.wait_for(lock, std::chrono::milliseconds(500), [&] { return stop_; })) {
+      const std::int64_t mtime = modified();
+      if (mtime < 0 || mtime == modified_) continue;
+      modified_ = mtime;
+      try {
+        limiter_->apply(read_file());
+        std::fprintf(stderr, "limits: reloaded %s\n", file_.c_str());
+      } catch (const std::exception& e) {
+        std::fprintf(stderr, "limits: %s (keeping the previous limits)\n", e.what());
+      }
+    }
+  }
+
+  std::unique_ptr<dms::RateLimiter> limiter_;
+  dms::RateLimits limits_;
+  std::chrono::nanoseconds burst_ = dms::TokenBucket::kDefaultBurst;
+  std::string tenant_ = "default";
+  std::string job_ = "default";
+  std::string file_;
+  bool configured_ = false;
+
+  std::thread watcher_;
+  std::mutex mu_;
+  std::condition_variable cv_;
+  bool stop_ = false;
+  std::int64_t modified_ = -1;
+};
+
+void print_stats(const dms::JobStats& stats) {
+  std::printf("files:      %llu copied, %llu failed\n",
+              static_cast<unsigned long long>(stats.files),
+              static_cast<unsigned long long>(stats.failed_files));
+  std::printf("bytes:      %s in %llu chunks\n", dms::format_bytes(stats.bytes).c_str(),
+              static_cast<unsigned long long>(stats.chunks));
+  std::printf("packed:     %llu files in %llu units\n",
+              static_cast<unsigned long long>(stats.packed_files),
+              static_cast<unsigned long long>(stats.packs));
+  if (stats.reactor != "none") {
+    std::printf("coroutines: %llu files, %llu in flight at most, %s\n",
+                static_cast<unsigned long long>(stats.coroutine_files),
+                static_cast<unsigned long long>(stats.peak_in_flight), stats.reactor.c_str());
+  }
+  if (stats.unchanged_files > 0 || stats.matched_chunks > 0) {
+    std::printf("unchanged:  %llu files, %llu chunks (%s) matched\n",
+                static_cast<unsigned long long>(stats.unchanged_files),
+                static_cast<unsigned long long>(stats.matched_chunks),
+                dms::format_bytes(stats.matched_bytes).c_str());
+  }
+  if (stats.skipped_chunks > 0) {
+    std::printf("resumed:    %llu chunks (%s) already done\n",
+                static_cast<unsigned long long>(stats.skipped_chunks),
+                dms::format_bytes(stats.skipped_bytes).c_str());
+  }
+  if (stats.sparse_files > 0) {
+    std::printf("sparse:     %llu files, %s of holes skipped\n",
+                static_cast<unsigned long long>(stats.sparse_files),
+                dms::format_bytes(static_cast<double>(stats.hole_bytes)).c_str());
+  }
+  if (stats.reflinked_files > 0 || stats.copy_range_bytes > 0) {
+    std::printf("offload:    %llu files (%s) reflinked, %s by copy_file_range (%llu files)\n",
+                static_cast<unsigned long long>(stats.reflinked_files),
+                dms::format_bytes(static_cast<double>(stats.reflinked_bytes)).c_str(),
+                dms::format_bytes(static_cast<double>(stats.copy_range_bytes)).c_str(),
+                static_cast<unsigned long long>(stats.copy_range_files));
+  }
+  std::printf("metadata:   %llu files, %llu dirs in %llu batches\n",
+              static_cast<unsigned long long>(stats.metadata_files),
+              static_cast<unsigned long long>(stats.metadata_dirs),
+              static_cast<unsigned long long>(stats.metadata_batches));
+  std::printf("workers:    %u at the end, %u at most\n", stats.final_threads,
+              stats.peak_threads);
+  std::printf("io backend: %s (%llu files with O_DIRECT)\n", stats.io_backend.c_str(),
+              static_cast<unsigned long long>(stats.direct_files));
+  std::printf("checksum:   %s\n", stats.checksum.c_str());
+  std::printf("buffers:    %s\n", stats.buffers.c_str());
+  std::printf("numa:       %s\n", stats.numa.c_str());
+  if (stats.throttled_seconds > 0) {
+    std::printf("throttled:  %.3f s waited, summed over threads\n", stats.throttled_seconds);
+  }
+  std::printf("elapsed:    %.3f s\n", stats.seconds);
+  std::printf("throughput: %s\n", dms::format_rate(stats.throughput()).c_str());
+  for (const auto& err : stats.errors) std::fprintf(stderr, "error: %s\n", err.c_str());
+}
+
+struct ScheduledCopy {
+  dms::Priority priority = dms::Priority::kNormal;
+  unsigned weight = 1;
+  std::string src;
+  std::string dst;
+};
+
+// Reads 'PRIORITY<TAB>WEIGHT<TAB>SRC<TAB>DST' lines; blank lines and '#'
+// comments are skipped. Throws std::invalid_argument on a malformed line.
+std::vector<ScheduledCopy> read_jobs(const std::string& path) {
+  std::ifstream in(path);
+  if (!in) throw std::runtime_error("cannot read " + path);
+  std::vector<ScheduledCopy> jobs;
+  std::string line;
+  for (int number = 1; std::getline(in, line); ++number) {
+    if (line.empty() || line[0] == '#') continue;
+    std::vector<std::string> fields;
+    for (std::size_t pos = 0;;) {
+      const std::size_t tab = line.find('\t', pos);
+      fields.push_back(line.substr(pos, tab - pos));
+      if (tab == std::string::npos) break;
+      pos = tab + 1;
+    }
+    if (fields.size() != 4) {
+      throw std::invalid_argument(path + ":" + std::to_string(number) +
+                                  ": expected PRIORITY, WEIGHT, SRC and DST");
+    }
+    ScheduledCopy job;
+    job.priority = dms::parse_priority(fields[0]);
+    job.weight = static_cast<unsigned>(std::stoul(fields[1]));
+    job.src = fields[2];
+    job.dst = fields[3];
+    jobs.push_back(std::move(job));
+  }
+  return jobs;
+}
+
+// Runs every job of the list at once, each on its own engine, all sharing
+// one scheduler, and prints a line per job as it finishes.
+int run_jobs(const dms::CopyOptions& options, const std::string& list,
+             dms::Scheduler::Options scheduling) {
+  const std::vector<ScheduledCopy> jobs = read_jobs(list);
+  auto scheduler = std::make_shared<dms::Scheduler>(scheduling);
+  const auto start = std::chrono::steady_clock::now();
+  std::mutex print_mu;
+  std::uint64_t failed = 0;
+  std::uint64_t bytes = 0;
+  std::vector<std::thread> threads;
+  for (std::size_t i = 0; i < jobs.size(); ++i) {
+    threads.emplace_back([&, i] {
+      const ScheduledCopy& job = jobs[i];
+      dms::CopyOptions job_options = options;
+      job_options.scheduler = scheduler;
+      job_options.priority = job.priority;
+      job_options.weight = job.weight;
+      dms::JobStats stats;
+      try {
+        dms::CopyEngine engine(job_options);
+        struct stat st;
+        if (::stat(job.src.c_str(), &st) != 0) dms::throw_errno("stat " + job.src);
+        stats = S_ISDIR(st.st_mode) ? engine.copy_tree(job.src, job.dst)
+                                    : engine.copy_files({{job.src, job.dst}});
+      } catch (const std::exception& e) {
+        stats.failed_files = 1;
+        stats.errors.push_back(e.what());
+      }
+      std::lock_guard<std::mutex> lock(print_mu);
+      std::printf("job %-6zu  %s x%u: %llu files, %s in %.3f s (%s), %.3f s held back",
+                  i + 1, dms::to_string(job.priority), job.weight,
+                  static_cast<unsigned long long>(stats.files),
+                  dms::format_bytes(stats.bytes).c_str(), stats.seconds,
+                  dms::format_rate(stats.throughput()).c_str(), stats.scheduled_seconds);
+      if (stats.failed_files > 0) {
+        std::printf(", %llu failed", static_cast<unsigned long long>(stats.failed_files));
+      }
+      std::printf("\n");
+      for (const auto& err : stats.errors) std::fprintf(stderr, "error: %s\n", err.c_str());
+      failed += stats.failed_files;
+      bytes += stats.bytes;
+    });
+  }
+  for (auto& t : threads) t.join();
+  const double seconds =
+      std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  const dms::SchedulerStats stats = scheduler->stats();
+  std::printf("scheduler:  %u slots, %llu grants (%llu waited), %llu preemptions\n",
+              scheduler->slots(), static_cast<unsigned long long>(stats.grants),
+              static_cast<unsigned long long>(stats.queued_grants),
+              static_cast<unsigned long long>(stats.preemptions));
+  std::printf("elapsed:    %.3f s\n", seconds);
+  std::printf("throughput: %s\n",
+              dms::format_rate(seconds > 0 ? static_cast<double>(bytes) / seconds : 0).c_str());
+  return failed == 0 ? 0 : 1;
+}
+
+int run_copy(int argc, char** argv, bool sync) {
+  dms::CopyOptions options;
+  options.sync = sync;
+  std::string manifest;
+  std::string checksum_out;
+  std::string paths_out;
+  std::uint64_t resume_offset = 0;
+  std::string jobs;
+  dms::Scheduler::Options scheduling;
+  ThrottleArgs throttle;
+  std::vector<std::string> positional;
+  for (int i = 2; i < argc; ++i) {
+    const char* arg = argv[i];
+    if (throttle.parse(argc, argv, i)) continue;
+    if (std::strcmp(arg, "--chunk-size") == 0) {
+      options.chunk_size = dms::parse_size(option_value(argc, argv, i));
+    } else if (std::strcmp(arg, "--threads") == 0) {
+      options.threads = static_cast<unsigned>(std::stoul(option_value(argc, argv, i)));
+    } else if (std::strcmp(arg, "--adaptive") == 0) {
+      options.adaptive_concurrency = true;
+    } else if (std::strcmp(arg, "--queue-depth") == 0) {
+      options.queue_depth = std::stoul(option_value(argc, argv, i));
+    } else if (std::strcmp(arg, "--io-backend") == 0) {
+      options.io_backend = dms::parse_io_backend(option_value(argc, argv, i));
+    } else if (std::strcmp(arg, "--io-batch") == 0) {
+      options.io_batch = static_cast<unsigned>(std::stoul(option_value(argc, argv, i)));
+    } else if (std::strcmp(arg, "--numa") == 0) {
+      options.numa = dms::parse_numa_policy(option_value(argc, argv, i));
+    } else if (std::strcmp(arg, "--no-huge-pages") == 0) {
+      options.huge_pages = false;
+    } else if (std::strcmp(arg, "--no-sparse") == 0) {
+      options.sparse = false;
+    } else if (std::strcmp(arg, "--offload") == 0) {
+      options.offload = dms::parse_offload_mode(option_value(argc, argv, i));
+    } else if (std::strcmp(arg, "--paths-out") == 0) {
+      paths_out = option_value(argc, argv, i);
+    } else if (std::strcmp(arg, "--direct") == 0) {
+      options.direct_io = true;
+    } else if (std::strcmp(arg, "--direct-min-size") == 0) {
+      options.direct_io_min_size = dms::parse_size(option_value(argc, argv, i));
+    } else if (std::strcmp(arg, "--small-file-max") == 0) {
+      options.small_file_max = dms::parse_size(option_value(argc, argv, i));
+    } else if (std::strcmp(arg, "--pack-size") == 0) {
+      options.pack_size = dms::parse_size(option_value(argc, argv, i));
+    } else if (std::strcmp(arg, "--coroutines") == 0) {
+      options.coroutines = true;
+    } else if (std::strcmp(arg, "--reactor-threads") == 0) {
+      options.reactor_threads = static_cast<unsigned>(std::stoul(option_value(argc, argv, i)));
+    } else if (std::strcmp(arg, "--max-in-flight") == 0) {
+      options.max_in_flight = std::stoul(option_value(argc, argv, i));
+    } else if (std::strcmp(arg, "--scan-threads") == 0) {
+      options.scan_threads = static_cast<unsigned>(std::stoul(option_value(argc, argv, i)));
+    } else if (std::strcmp(arg, "--metadata-threads") == 0) {
+      options.metadata_threads = static_cast<unsigned>(std::stoul(option_value(argc, argv, i)));
+    } else if (std::strcmp(arg, "--metadata-batch") == 0) {
+      options.metadata_batch = std::stoul(option_value(argc, argv, i));
+    } else if (std::strcmp(arg, "--preserve-owner") == 0) {
+      options.preserve_owner = true;
+    } else if (std::strcmp(arg, "--xattrs") == 0) {
+      options.preserve_xattrs = true;
+    } else if (std::strcmp(arg, "--manifest") == 0) {
+      manifest = option_value(argc, argv, i);
+    } else if (std::strcmp(arg, "--resume-offset") == 0) {
+      resume_offset = std::stoull(option_value(argc, argv, i));
+    } else if (std::strcmp(arg, "--journal") == 0) {
+      options.journal = option_value(argc, argv, i);
+    } else if (std::strcmp(arg, "--journal-sync-data") == 0) {
+      options.journal_sync_data = true;
+    } else if (std::strcmp(arg, "--sync") == 0) {
+      options.sync = true;
+    } else if (std::strcmp(arg, "--checksum") == 0) {
+      options.checksum = dms::parse_checksum(option_value(argc, argv, i));
+    } else if (std::strcmp(arg, "--checksum-out") == 0) {
+      checksum_out = option_value(argc, argv, i);
+    } else if (std::strcmp(arg, "--jobs") == 0) {
+      jobs = option_value(argc, argv, i);
+    } else if (std::strcmp(arg, "--slots") == 0) {
+      scheduling.slots = static_cast<unsigned>(std::stoul(option_value(argc, argv, i)));
+    } else if (std::strcmp(arg, "--total-rate") == 0) {
+      scheduling.bytes_per_sec = dms::parse_size(option_value(argc, argv, i));
+    } else if (arg[0] == '-' && arg[1] == '-') {
+      std::fprintf(stderr, "unknown option: %s\n", arg);
+      usage(argv[0]);
+      return 2;
+    } else {
+      positional.emplace_back(arg);
+    }
+  }
+  if (positional.size() != (jobs.empty() ? 2 : 0) || (!jobs.empty() && !manifest.empty())) {
+    usage(argv[0]);
+    return 2;
+  }
+
+  std::unique_ptr<std::FILE, int (*)(std::FILE*)> digests(nullptr, std::fclose);
+  std::mutex digests_mu;
+  if (!checksum_out.empty()) {
+    if (options.checksum == dms::ChecksumKind::kNone) options.checksum = dms::ChecksumKind::kCrc32c;
+    digests.reset(std::fopen(checksum_out.c_str(), "w"));
+    if (!digests) {
+      std::perror(checksum_out.c_str());
+      return 1;
+    }
+    options.digest_sink = [&](const dms::FileTask& file, std::uint64_t digest) {
+      const std::string hex = dms::format_digest(options.checksum, digest);
+      std::lock_guard<std::mutex> lock(digests_mu);
+      std::fprintf(digests.get(), "%s  %s\n", hex.c_str(), file.dst.c_str());
+    };
+  }
+  std::unique_ptr<std::FILE, int (*)(std::FILE*)> paths(nullptr, std::fclose);
+  std::mutex paths_mu;
+  if (!paths_out.empty()) {
+    paths.reset(std::fopen(paths_out.c_str(), "w"));
+    if (!paths) {
+      std::perror(paths_out.c_str());
+      return 1;
+    }
+    options.path_sink = [&](const dms::FileTask& file, dms::CopyPath path) {
+      std::lock_guard<std::mutex> lock(paths_mu);
+      std::fprintf(paths.get(), "%s  %s\n", dms::to_string(path), file.dst.c_str());
+    };
+  }
+
+  // The first SIGINT or SIGTERM stops planning a manifest, so that the
+  // entries planned so far complete and the offset to resume at is printed;
+  // the second aborts. Static, as the detached waiter may outlive this call.
+  static std::atomic<bool> stop_planning{false};
+  if (!manifest.empty()) {
+    const sigset_t signals = block_stop_signals();
+    options.stop_planning = &stop_planning;
+    std::thread([signals] {
+      wait_for_signal(signals);
+      stop_planning.store(true, std::memory_order_relaxed);
+      std::fprintf(stderr,
+                   "dms-client: finishing the entries planned so far; interrupt again to "
+                   "abort\n");
+      std::_Exit(128 + wait_for_signal(signals));
+    }).detach();
+  }
+  options.throttle = throttle.start();
+  if (!jobs.empty()) return run_jobs(options, jobs, scheduling);
+  dms::CopyEngine engine(options);
+  if (!manifest.empty()) {
+    dms::JobStats stats =
+        engine.copy_manifest(manifest, positional[0], positional[1], resume_offset);
+    print_stats(stats);
+    std::printf("manifest:   planned up to offset %llu (--resume-offset continues there)\n",
+                static_cast<unsigned long long>(stats.manifest_offset));
+    return stats.failed_files == 0 ? 0 : 1;
+  }
+  struct stat st;
+  if (::stat(positional[0].c_str(), &st) != 0) {
+    std::perror(positional[0].c_str());
+    return 1;
+  }
+  dms::JobStats stats = S_ISDIR(st.st_mode)
+                            ? engine.copy_tree(positional[0], positional[1])
+                            : engine.copy_files({{positional[0], positional[1]}});
+  print_stats(stats);
+  return stats.failed_files == 0 ? 0 : 1;
+}
+
+int run_scan(int argc, char** argv) {
+  dms::ScanOptions options;
+  std::string manifest;
+  std::vector<std::string> positional;
+  for (int i = 2; i < argc; ++i) {
+    if (std::strcmp(argv[i], "--threads") == 0) {
+      options.threads = static_cast<unsigned>(std::stoul(option_value(argc, argv, i)));
+    } else if (std::strcmp(argv[i], "--adaptive") == 0) {
+      options.adaptive = true;
+    } else if (std::strcmp(argv[i], "--manifest") == 0) {
+      manifest = option_value(argc, argv, i);
+    } else {
+      positional.emplace_back(argv[i]);
+    }
+  }
+  if (positional.size() != 1) {
+    usage(argv[0]);
+    return 2;
+  }
+
+  std::unique_ptr<dms::ManifestWriter> writer;
+  if (!manifest.empty()) writer = std::make_unique<dms::ManifestWriter>(manifest);
+  std::mutex writer_mu;
+  dms::Scanner scanner(options);
+  dms::ScanStats stats =
+      scanner.scan(positional[0], [&](std::vector<dms::ScanEntry>&& batch) {
+        if (!writer) return;
+        std::lock_guard<std::mutex> lock(writer_mu);
+        for (const auto& entry : batch) writer->add(entry);
+      });
+  if (writer) {
+    writer->close();
+    std::printf("manifest:   %s (%llu entries, %zu blocks)\n", manifest.c_str(),
+                static_cast<unsigned long long>(writer->entries()), writer->blocks());
+  }
+  std::printf("dirs:       %llu\n", static_cast<unsigned long long>(stats.dirs));
+  std::printf("files:      %llu (%s)\n", static_cast<unsigned long long>(stats.files),
+              dms::format_bytes(stats.bytes).c_str());
+  std::printf("other:      %llu\n", static_cast<unsigned long long>(stats.others));
+  std::printf("threads:    %u at the end, %u at most\n", stats.final_threads,
+              stats.peak_threads);
+  std::printf("elapsed:    %.3f s\n", stats.seconds);
+  std::printf("rate:       %.0f entries/s (%llu steals)\n", stats.entries_per_second(),
+              static_cast<unsigned long long>(stats.steals));
+  for (const auto& err : stats.errors) std::fprintf(stderr, "error: %s\n", err.c_str());
+  return stats.error_count == 0 ? 0 : 1;
+}
+
+// Prints the digest of each file, or with --check verifies the files listed
+// in a --checksum-out file.
+int run_checksum(int argc, char** argv) {
+  dms::ChecksumKind kind = dms::ChecksumKind::kCrc32c;
+  std::size_t chunk_size = dms::CopyOptions{}.chunk_size;
+  unsigned threads = 0;
+  std::string check;
+  std::vector<std::string> positional;
+  for (int i = 2; i < argc; ++i) {
+    if (std::strcmp(argv[i], "--checksum") == 0) {
+      kind = dms::parse_checksum(option_value(argc, argv, i));
+    } else if (std::strcmp(argv[i], "--chunk-size") == 0) {
+      chunk_size = dms::parse_size(option_value(argc, argv, i));
+    } else if (std::strcmp(argv[i], "--threads") == 0) {
+      threads = static_cast<unsigned>(std::stoul(option_value(argc, argv, i)));
+    } else if (std::strcmp(argv[i], "--check") == 0) {
+      check = option_value(argc, argv, i);
+    } else {
+      positional.emplace_back(argv[i]);
+    }
+  }
+  if (kind == dms::ChecksumKind::kNone || check.empty() == positional.empty()) {
+    usage(argv[0]);
+    return 2;
+  }
+
+  if (check.empty()) {
+    int rc = 0;
+    for (const auto& path : positional) {
+      try {
+        const std::uint64_t digest = dms::checksum_file(path, kind, chunk_size, threads);
+        std::printf("%s  %s\n", dms::format_digest(kind, digest).c_str(), path.c_str());
+      } catch (const std::system_error& e) {
+        std::fprintf(stderr, "error: %s: %s\n", path.c_str(), e.what());
+        rc = 1;
+      }
+    }
+    return rc;
+  }
+
+  std::ifstream list(check);
+  if (!list) {
+    std::perror(check.c_str());
+    return 1;
+  }
+  std::uint64_t ok = 0, bad = 0;
+  std::string line;
+  while (std::getline(list, line)) {
+    const std::size_t sep = line.find("  ");
+    if (sep == std::string::npos) continue;
+    const std::string expected = line.substr(0, sep);
+    const std::string path = line.substr(sep + 2);
+    std::string actual;
+    try {
+      actual = dms::format_digest(kind, dms::checksum_file(path, kind, chunk_size, threads));
+    } catch (const std::system_error& e) {
+      actual = e.what();
+    }
+    if (actual == expected) {
+      ++ok;
+    } else {
+      ++bad;
+      std::printf("%s: FAILED (%s)\n", path.c_str(), actual.c_str());
+    }
+  }
+  std::printf("verified:   %llu ok, %llu failed\n", static_cast<unsigned long long>(ok),
+              static_cast<unsigned long long>(bad));
+  return bad == 0 ? 0 : 1;
+}
+
+// Submits every job of a list without waiting between them, then collects
+// the receipts.
+int run_submit(int argc, char** argv) {
+  std::string server;
+  dms::JobClient::Options options;
+  std::vector<std::string> positional;
+  for (int i = 2; i < argc; ++i) {
+    if (std::strcmp(argv[i], "--server") == 0) {
+      server = option_value(argc, argv, i);
+    } else if (std::strcmp(argv[i], "--batch") == 0) {
+      options.max_batch_jobs = std::stoul(option_value(argc, argv, i));
+    } else if (std::strcmp(argv[i], "--window") == 0) {
+      options.max_inflight_frames = std::stoul(option_value(argc, argv, i));
+    } else {
+      positional.emplace_back(argv[i]);
+    }
+  }
+  if (server.empty() || positional.size() != 1) {
+    usage(argv[0]);
+    return 2;
+  }
+  std::ifstream file;
+  if (positional[0] != "-") {
+    file.open(positional[0]);
+    if (!file) {
+      std::perror(positional[0].c_str());
+      return 1;
+    }
+  }
+  std::istream& list = positional[0] == "-" ? std::cin : file;
+
+  const auto start = std::chrono::steady_clock::now();
+  dms::JobClient client(server, options);
+  std::vector<std::future<dms::JobReceipt>> receipts;
+  std::vector<std::string> sources;
+  std::string line;
+  while (std::getline(list, line)) {
+    const std::size_t tab = line.find('\t');
+    if (tab == std::string::npos) continue;
+    dms::JobSpec job;
+    job.src = line.substr(0, tab);
+    job.dst = line.substr(tab + 1);
+    sources.push_back(job.src);
+    receipts.push_back(client.submit(std::move(job)));
+  }
+  std::uint64_t accepted = 0, rejected = 0;
+  for (std::size_t i = 0; i < receipts.size(); ++i) {
+    const dms::JobReceipt receipt = receipts[i].get();
+    if (receipt.status == dms::JobStatus::kAccepted) {
+      ++accepted;
+    } else {
+      ++rejected;
+      std::fprintf(stderr, "rejected: %s: %s\n", sources[i].c_str(), receipt.message.c_str());
+    }
+  }
+  client.close();
+  const double seconds =
+      std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  std::printf("jobs:       %llu accepted, %llu rejected\n",
+              static_cast<unsigned long long>(accepted), static_cast<unsigned long long>(rejected));
+  std::printf("frames:     %llu\n", static_cast<unsigned long long>(client.frames_sent()));
+  std::printf("elapsed:    %.3f s\n", seconds);
+  std::printf("rate:       %.0f jobs/s\n", seconds > 0 ? receipts.size() / seconds : 0.0);
+  return rejected == 0 ? 0 : 1;
+}
+
+// Serves the submission protocol until SIGINT or SIGTERM.
+int run_mock_server(int argc, char** argv) {
+  dms::MockDmsServer::Options options;
+  for (int i = 2; i < argc; ++i) {
+    if (std::strcmp(argv[i], "--listen") == 0) {
+      options.address = option_value(argc, argv, i);
+    } else if (std::strcmp(argv[i], "--latency-us") == 0) {
+      options.latency = std::chrono::microseconds(std::stoll(option_value(argc, argv, i)));
+    } else {
+      usage(argv[0]);
+      return 2;
+    }
+  }
+  const sigset_t signals = block_stop_signals();
+  dms::MockDmsServer server(options);
+  std::printf("listening on %s\n", server.address().c_str());
+  std::fflush(stdout);
+  wait_for_signal(signals);
+  server.stop();
+  std::printf("served %llu jobs in %llu frames over %llu connections\n",
+              static_cast<unsigned long long>(server.jobs()),
+              static_cast<unsigned long long>(server.frames()),
+              static_cast<unsigned long long>(server.connections()));
+  return 0;
+}
+
+// Streams a file or tree to a data mover.
+int run_push(int argc, char** argv) {
+  std::string mover;
+  std::string dedup_index;
+  dms::PushOptions options;
+  ThrottleArgs throttle;
+  std::vector<std::string> positional;
+  for (int i = 2; i < argc; ++i) {
+    if (throttle.parse(argc, argv, i)) continue;
+    if (std::strcmp(argv[i], "--mover") == 0) {
+      mover = option_value(argc, argv, i);
+    } else if (std::strcmp(argv[i], "--send-method") == 0) {
+      options.send_method = dms::parse_send_method(option_value(argc, argv, i));
+    } else if (std::strcmp(argv[i], "--chunk-size") == 0) {
+      options.chunk_size = dms::parse_size(option_value(argc, argv, i));
+    } else if (std::strcmp(argv[i], "--streams") == 0) {
+      options.streams = static_cast<unsigned>(std::stoul(option_value(argc, argv, i)));
+    } else if (std::strcmp(argv[i], "--max-streams") == 0) {
+      options.max_streams = static_cast<unsigned>(std::stoul(option_value(argc, argv, i)));
+    } else if (std::strcmp(argv[i], "--fixed-streams") == 0) {
+      options.adaptive = false;
+    } else if (std::strcmp(argv[i], "--compress") == 0) {
+      options.compression = dms::parse_codec(option_value(argc, argv, i));
+    } else if (std::strcmp(argv[i], "--compress-level") == 0) {
+      options.compression_level = std::stoi(option_value(argc, argv, i));
+    } else if (std::strcmp(argv[i], "--compress-threads") == 0) {
+      options.compress_threads = static_cast<unsigned>(std::stoul(option_value(argc, argv, i)));
+    } else if (std::strcmp(argv[i], "--dedup-index") == 0) {
+      dedup_index = option_value(argc, argv, i);
+    } else if (std::strcmp(argv[i], "--dedup-chunk") == 0) {
+      const std::size_t avg = dms::parse_size(option_value(argc, argv, i));
+      options.dedup_chunking = {avg / 4, avg, avg * 4};
+    } else if (std::strcmp(argv[i], "--no-huge-pages") == 0) {
+      options.huge_pages = false;
+    } else {
+      positional.emplace_back(argv[i]);
+    }
+  }
+  if (mover.empty() || positional.size() != 2) {
+    usage(argv[0]);
+    return 2;
+  }
+  const std::string& src = positional[0];
+  const std::string& dst = positional[1];
+  std::vector<dms::FileTask> files;
+  struct stat st;
+  if (::stat(src.c_str(), &st) != 0) {
+    std::perror(src.c_str());
+    return 1;
+  }
+  if (S_ISDIR(st.st_mode)) {
+    std::mutex mu;
+    dms::ScanStats scan = dms::Scanner().scan(src, [&](std::vector<dms::ScanEntry>&& batch) {
+      std::lock_guard<std::mutex> lock(mu);
+      for (const auto& entry : batch) {
+        if (S_ISREG(entry.mode)) files.push_back({src + "/" + entry.path, dst + "/" + entry.path});
+      }
+    });
+    for (const auto& err : scan.errors) std::fprintf(stderr, "error: %s\n", err.c_str());
+  } else {
+    files.push_back({src, dst});
+  }
+
+  options.throttle = throttle.start();
+  if (!dedup_index.empty()) {
+    options.dedup_index = std::make_shared<dms::ChunkIndex>();
+    options.dedup_index->load(dedup_index);
+  }
+  dms::PushStats stats = dms::push_files(mover, files, options);
+  if (options.dedup_index) options.dedup_index->save(dedup_index);
+  std::printf("files:      %llu sent, %llu failed\n", static_cast<unsigned long long>(stats.files),
+              static_cast<unsigned long long>(stats.failed_files));
+  std::printf("bytes:      %s\n", dms::format_bytes(static_cast<double>(stats.bytes)).c_str());
+  std::printf("elapsed:    %.3f s\n", stats.seconds);
+  std::printf("throughput: %s\n",
+              dms::format_rate(stats.seconds > 0 ? stats.bytes / stats.seconds : 0).c_str());
+  std::printf("send:       %s, %.3f CPU s/GiB\n", stats.send_method.c_str(),
+              stats.cpu_seconds_per_gib());
+  std::printf("streams:    %u at the end, %u at most, %u changes\n", stats.final_streams,
+              stats.peak_streams, stats.stream_changes);
+  if (stats.compressed_chunks + stats.raw_chunks > 0) {
+    std::printf("compress:   %s, %llu chunks compressed, %llu sent raw, %s on the wire (%.1f%%)\n",
+                stats.compression.c_str(),
+                static_cast<unsigned long long>(stats.compressed_chunks),
+                static_cast<unsigned long long>(stats.raw_chunks),
+                dms::format_bytes(static_cast<double>(stats.wire_bytes)).c_str(),
+                100 * stats.compression_ratio());
+  }
+  if (options.dedup_index) {
+    std::printf("dedup:      %llu of %llu chunks referenced (%s), %llu missed, %zu indexed\n",
+                static_cast<unsigned long long>(stats.dedup_hits),
+                static_cast<unsigned long long>(stats.dedup_chunks),
+                dms::format_bytes(static_cast<double>(stats.dedup_bytes)).c_str(),
+                static_cast<unsigned long long>(stats.dedup_misses),
+                options.dedup_index->size());
+  }
+  if (stats.zerocopy_sends > 0) {
+    std::printf("zerocopy:   %llu sends, %llu copied by the kernel\n",
+                static_cast<unsigned long long>(stats.zerocopy_sends),
+                static_cast<unsigned long long>(stats.zerocopy_copied));
+  }
+  for (const auto& err : stats.errors) std::fprintf(stderr, "error: %s\n", err.c_str());
+  return stats.failed_files == 0 ? 0 : 1;
+}
+
+// Receives pushed data until SIGINT or SIGTERM.
+int run_mover(int argc, char** argv) {
+  dms::MoverServer::Options options;
+  for (int i = 2; i < argc; ++i) {
+    if (std::strcmp(argv[i], "--listen") == 0) {
+      options.address = option_value(argc, argv, i);
+    } else if (std::strcmp(argv[i], "--root") == 0) {
+      options.root = option_value(argc, argv, i);
+    } else if (std::strcmp(argv[i], "--stream-rate") == 0) {
+      options.stream_rate = dms::parse_size(option_value(argc, argv, i));
+    } else {
+      usage(argv[0]);
+      return 2;
+    }
+  }
+  const sigset_t signals = block_stop_signals();
+  dms::MoverServer server(options);
+  std::printf("listening on %s\n", server.address().c_str());
+  std::fflush(stdout);
+  wait_for_signal(signals);
+  server.stop();
+  std::printf("received %llu files (%s) over %llu connections, %llu failed\n",
+              static_cast<unsigned long long>(server.files()),
+              dms::format_bytes(static_cast<double>(server.bytes())).c_str(),
+              static_cast<unsigned long long>(server.connections()),
+              static_cast<unsigned long long>(server.errors()));
+  if (server.refs_copied() + server.refs_missed() > 0) {
+    std::printf("references: %llu copied, %llu not found\n",
+                static_cast<unsigned long long>(server.refs_copied()),
+                static_cast<unsigned long long>(server.refs_missed()));
+  }
+  return 0;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  if (argc < 2) {
+    usage(argv[0]);
+    return 2;
+  }
+  try {
+    if (std::strcmp(argv[1], "copy") == 0) return run_copy(argc, argv, false);
+    if (std::strcmp(argv[1], "sync") == 0) return run_copy(argc, argv, true);
+    if (std::strcmp(argv[1], "scan") == 0) return run_scan(argc, argv);
+    if (std::strcmp(argv[1], "checksum") == 0) return run_checksum(argc, argv);
+    if (std::strcmp(argv[1], "submit") == 0) return run_submit(argc, argv);
+    if (std::strcmp(argv[1], "mock-server") == 0) return run_mock_server(argc, argv);
+    if (std::strcmp(argv[1], "push") == 0) return run_push(argc, argv);
+    if (std::strcmp(argv[1], "mover") == 0) return run_mover(argc, argv);
+  } catch (const std::exception& e) {
+    std::fprintf(stderr, "dms-client: %s\n", e.what());
+    return 1;
+  }
+  usage(argv[0]);
+  return 2;
+}